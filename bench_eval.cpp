@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/math_evaluator.h"
+#include "src/math_manager.h"
+#include "src/math_types.h"
+
+// Every allocation in the process goes through these, worker threads
+// included, so a case's count covers the whole calculation.
+static std::atomic<unsigned long long> g_allocations{0};
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size ? size : 1))
+        return block;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete[](void* block) noexcept { std::free(block); }
+void operator delete(void* block, size_t) noexcept { std::free(block); }
+void operator delete[](void* block, size_t) noexcept { std::free(block); }
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Batches are grown until one takes this long, then repeated and the
+    // fastest kept: interference only ever adds time.
+    constexpr double kTargetBatchSeconds = 0.05;
+    constexpr int kBatches = 5;
+    constexpr int kRetries = 2;
+    constexpr double kDefaultTolerance = 0.25;
+
+    volatile double g_sink = 0.0;
+
+    struct BenchCase
+    {
+        std::string name;
+        std::function<double()> run;  // one evaluation; returns something to keep
+    };
+
+    struct Measurement
+    {
+        double nsPerEval = 0.0;
+        double allocsPerEval = 0.0;
+    };
+
+    Measurement Measure(const BenchCase& bench)
+    {
+        g_sink = g_sink + bench.run();  // warm caches and the task pool
+
+        size_t iterations = 1;
+        for (;;)
+        {
+            const Clock::time_point start = Clock::now();
+            for (size_t index = 0; index < iterations; ++index)
+                g_sink = g_sink + bench.run();
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if (seconds >= kTargetBatchSeconds / 4 || iterations >= (size_t(1) << 30))
+            {
+                const double scale = kTargetBatchSeconds / (std::max)(seconds, 1e-9);
+                iterations = (std::max)(size_t(1), static_cast<size_t>(iterations * (std::min)(scale, 4.0)));
+                break;
+            }
+            iterations *= 8;
+        }
+
+        std::vector<double> samples;
+        unsigned long long allocations = 0;
+        for (int batch = 0; batch < kBatches; ++batch)
+        {
+            const unsigned long long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+            const Clock::time_point start = Clock::now();
+            for (size_t index = 0; index < iterations; ++index)
+                g_sink = g_sink + bench.run();
+            const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+            samples.push_back(ns / iterations);
+        }
+        Measurement measurement;
+        measurement.nsPerEval = *std::min_element(samples.begin(), samples.end());
+        measurement.allocsPerEval = static_cast<double>(allocations) / (static_cast<double>(iterations) * kBatches);
+        return measurement;
+    }
+
+    // Fixed scalar work that touches none of the code under test. Case times
+    // are gated relative to it, measured in the same run, so a baseline
+    // recorded on one machine still holds on one that is uniformly faster or
+    // slower.
+    const BenchCase kCalibration = {"calibration", [] {
+        double x = 0.5;
+        double sum = 0.0;
+        for (int index = 0; index < 2000; ++index)
+        {
+            x = 3.9 * x * (1.0 - x);
+            sum += std::sqrt(x + index);
+        }
+        return sum;
+    }};
+
+    MathObject MakeObject(MathType type, const std::wstring& upper, const std::wstring& lower, const std::wstring& body)
+    {
+        MathObject obj;
+        obj.type = type;
+        obj.SetParts(upper, lower, body);
+        return obj;
+    }
+
+    std::vector<BenchCase> BuildCorpus()
+    {
+        static const MathEvaluator eval;
+        std::vector<BenchCase> corpus;
+
+        corpus.push_back({"eval/arithmetic", [] {
+            return eval.Eval(L"2 + 3 * (4 - 1) / 7 - 2^5 + sqrt(16) * 1.5");
+        }});
+        corpus.push_back({"eval/functions", [] {
+            return eval.Eval(L"sin(0.5) * cos(0.25) + ln(10) - exp(0.1) / abs(-3)");
+        }});
+        corpus.push_back({"eval/variable", [] {
+            return eval.Eval(L"x^3 - 4x^2 + 3x - 1", L"x", 1.75);
+        }});
+
+        corpus.push_back({"eval_value/derived_units", [] {
+            return eval.EvalValue(L"5kg * 2m / s^2 + 3 N").baseValue;
+        }});
+        corpus.push_back({"eval_value/conversion", [] {
+            return eval.EvalValue(L"3m + 40cm - 12mm + 0.5km").baseValue;
+        }});
+        corpus.push_back({"eval_value/unit_exponents", [] {
+            return eval.EvalValue(L"sqrt(9m^2) * 4 m / (2 s)^2").baseValue;
+        }});
+
+        // One keystroke at a time, as the suggestion popup sees the prefix.
+        corpus.push_back({"units/suggest_typing", [] {
+            static UnitSymbolMatcher matcher;
+            size_t suggestions = 0;
+            for (const wchar_t* typed : { L"k", L"kP", L"kPa", L"kP", L"m", L"mi", L"min" })
+                suggestions += matcher.Match(typed).size();
+            return static_cast<double>(suggestions);
+        }});
+
+        corpus.push_back({"eval_rational/fractions", [] {
+            return eval.EvalRational(L"1/3 + 2/7 - 5/11 * (3/4)").toDouble();
+        }});
+        corpus.push_back({"eval_rational/powers", [] {
+            return eval.EvalRational(L"(2/3)^12 + (7/5)^9 - 1/1024").toDouble();
+        }});
+
+        corpus.push_back({"solve_rational/3x3", [] {
+            static const std::vector<std::wstring> equations = {
+                L"2x + y - z = 8", L"-3x - y + 2z = -11", L"-2x + y + 2z = -3" };
+            const LinearSystemSolution solution = eval.SolveLinearSystemRational(equations);
+            return solution.constants.empty() ? 0.0 : solution.constants[0].toDouble();
+        }});
+        corpus.push_back({"solve_rational/5x5", [] {
+            static const std::vector<std::wstring> equations = {
+                L"a + 2b - c + d - e = 3", L"2a - b + 3c + e = 7", L"a + b + c + d + e = 15",
+                L"3a - 2c + 4d - e = 10", L"b - c + 2d + 3e = 20" };
+            const LinearSystemSolution solution = eval.SolveLinearSystemRational(equations);
+            return solution.constants.empty() ? 0.0 : solution.constants[0].toDouble();
+        }});
+
+        static const MathObject largeSum = MakeObject(MathType::Summation, L"2000000", L"i=1", L"i");
+        static const MathObject trigSum = MakeObject(MathType::Summation, L"100000", L"i=1", L"sin(i)");
+        static const MathObject unitSum = MakeObject(MathType::Summation, L"10000", L"i=1", L"2 cm");
+        static const MathObject closedFormSum = MakeObject(MathType::Summation, L"1000000000000", L"i=1", L"i^2");
+        static const MathObject oscillatingIntegral = MakeObject(MathType::Integral, L"10", L"0", L"sin(x^2) dx");
+        static const MathObject unitIntegral = MakeObject(MathType::Integral, L"2", L"0", L"t m dt");
+
+        const auto formatted = [](const MathObject& obj) {
+            return [&obj] { return static_cast<double>(MathManager::Get().CalculateFormattedResult(obj).size()); };
+        };
+        corpus.push_back({"formatted/sum_2e6_terms", formatted(largeSum)});
+        corpus.push_back({"formatted/sum_sin_1e5_terms", formatted(trigSum)});
+        corpus.push_back({"formatted/sum_unit_term", formatted(unitSum)});
+        corpus.push_back({"formatted/sum_closed_form", formatted(closedFormSum)});
+        corpus.push_back({"formatted/integral_oscillating", formatted(oscillatingIntegral)});
+        corpus.push_back({"formatted/integral_units", formatted(unitIntegral)});
+
+        return corpus;
+    }
+
+    // Reads the flat file WriteBaseline produces; anything else is ignored.
+    // `calibrationNs` stays 0 in a file without one.
+    std::map<std::string, Measurement> ReadBaseline(const std::string& path, bool& found, double& calibrationNs)
+    {
+        std::map<std::string, Measurement> baseline;
+        std::ifstream file(path);
+        found = file.good();
+        if (!found)
+            return baseline;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        const std::string text = buffer.str();
+
+        const auto numberAfter = [&text](const char* key, size_t from, size_t to, double& out) {
+            const size_t at = text.find(key, from);
+            if (at == std::string::npos || at >= to)
+                return false;
+            const size_t colon = text.find(':', at);
+            if (colon == std::string::npos || colon >= to)
+                return false;
+            out = std::strtod(text.c_str() + colon + 1, nullptr);
+            return true;
+        };
+
+        numberAfter("\"calibration_ns\"", 0, text.size(), calibrationNs);
+        size_t position = 0;
+        while ((position = text.find("\"name\"", position)) != std::string::npos)
+        {
+            const size_t open = text.find('"', text.find(':', position) + 1);
+            const size_t close = open == std::string::npos ? open : text.find('"', open + 1);
+            if (close == std::string::npos)
+                break;
+            const std::string name = text.substr(open + 1, close - open - 1);
+            const size_t end = (std::min)(text.find('}', close), text.size());
+            Measurement measurement;
+            if (numberAfter("\"ns_per_eval\"", close, end, measurement.nsPerEval) &&
+                numberAfter("\"allocs_per_eval\"", close, end, measurement.allocsPerEval))
+                baseline[name] = measurement;
+            position = end;
+        }
+        return baseline;
+    }
+
+    bool WriteBaseline(const std::string& path, double calibrationNs, const std::vector<BenchCase>& corpus,
+        const std::vector<Measurement>& results)
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+        char header[64];
+        std::snprintf(header, sizeof(header), "{\n  \"calibration_ns\": %.1f,\n", calibrationNs);
+        file << header << "  \"cases\": [\n";
+        for (size_t index = 0; index < corpus.size(); ++index)
+        {
+            char line[256];
+            std::snprintf(line, sizeof(line), "    { \"name\": \"%s\", \"ns_per_eval\": %.1f, \"allocs_per_eval\": %.2f }%s\n",
+                corpus[index].name.c_str(), results[index].nsPerEval, results[index].allocsPerEval,
+                index + 1 < corpus.size() ? "," : "");
+            file << line;
+        }
+        file << "  ]\n}\n";
+        return static_cast<bool>(file);
+    }
+
+    void PrintUsage()
+    {
+        std::cout << "usage: bench_eval [--baseline FILE] [--update-baseline] [--tolerance FRACTION] [--filter TEXT]\n"
+                  << "  Compares against FILE (default bench_eval_baseline.json) and exits with 1 when a case\n"
+                  << "  is slower or allocates more than the baseline allows; --update-baseline rewrites FILE.\n"
+                  << "  Times are scaled by a calibration case run first, so the baseline carries across machines.\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string baselinePath = "bench_eval_baseline.json";
+    std::string filter;
+    double tolerance = kDefaultTolerance;
+    bool updateBaseline = false;
+
+    for (int index = 1; index < argc; ++index)
+    {
+        const std::string arg = argv[index];
+        if (arg == "--baseline" && index + 1 < argc)
+            baselinePath = argv[++index];
+        else if (arg == "--tolerance" && index + 1 < argc)
+            tolerance = std::atof(argv[++index]);
+        else if (arg == "--filter" && index + 1 < argc)
+            filter = argv[++index];
+        else if (arg == "--update-baseline")
+            updateBaseline = true;
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    std::vector<BenchCase> corpus = BuildCorpus();
+    if (!filter.empty())
+    {
+        corpus.erase(std::remove_if(corpus.begin(), corpus.end(),
+            [&filter](const BenchCase& bench) { return bench.name.find(filter) == std::string::npos; }), corpus.end());
+        if (updateBaseline)
+        {
+            std::cout << "--update-baseline needs the full corpus; drop --filter\n";
+            return 2;
+        }
+    }
+
+    bool baselineFound = false;
+    double baselineCalibrationNs = 0.0;
+    const std::map<std::string, Measurement> baseline = updateBaseline
+        ? std::map<std::string, Measurement>() : ReadBaseline(baselinePath, baselineFound, baselineCalibrationNs);
+    if (!updateBaseline && !baselineFound)
+        std::cout << "No baseline at " << baselinePath << "; reporting only.\n";
+
+    // How much slower this machine and build run than the baseline's. Without
+    // a calibration in the baseline only allocations are gated.
+    const double calibrationNs = Measure(kCalibration).nsPerEval;
+    const bool timeGated = baselineCalibrationNs > 0.0;
+    const double machineScale = timeGated ? calibrationNs / baselineCalibrationNs : 1.0;
+    std::printf("calibration %.1f ns", calibrationNs);
+    if (timeGated)
+        std::printf(", %.2fx the baseline machine\n", machineScale);
+    else if (baselineFound)
+        std::printf("; baseline has no calibration, time check skipped\n");
+    else
+        std::printf("\n");
+
+    std::printf("%-32s %12s %12s %14s %10s  %s\n", "case", "ns/eval", "allocs/eval", "evals/s", "vs base", "status");
+    std::vector<Measurement> results;
+    int regressions = 0;
+    for (const BenchCase& bench : corpus)
+    {
+        Measurement measurement = Measure(bench);
+        const auto reference = baseline.find(bench.name);
+        // A case that looks slow gets a second chance before it counts, since
+        // one unlucky run on a busy machine is not a regression.
+        for (int retry = 0; retry < kRetries && timeGated && reference != baseline.end() &&
+             measurement.nsPerEval > reference->second.nsPerEval * machineScale * (1.0 + tolerance); ++retry)
+            measurement.nsPerEval = (std::min)(measurement.nsPerEval, Measure(bench).nsPerEval);
+        results.push_back(measurement);
+
+        std::string status = "new";
+        char ratioText[32] = "-";
+        if (reference != baseline.end())
+        {
+            const double ratio = measurement.nsPerEval / (std::max)(reference->second.nsPerEval * machineScale, 1e-9);
+            if (timeGated)
+                std::snprintf(ratioText, sizeof(ratioText), "%.2fx", ratio);
+            // Allocation counts are deterministic up to thread scheduling, so
+            // half an allocation of slack is enough to absorb rounding.
+            const bool slower = timeGated && ratio > 1.0 + tolerance;
+            const bool allocates = measurement.allocsPerEval > reference->second.allocsPerEval * (1.0 + tolerance) + 0.5;
+            if (slower || allocates)
+            {
+                ++regressions;
+                status = slower && allocates ? "REGRESSION (time, allocs)" : slower ? "REGRESSION (time)" : "REGRESSION (allocs)";
+            }
+            else
+                status = "ok";
+        }
+        std::printf("%-32s %12.1f %12.2f %14.0f %10s  %s\n", bench.name.c_str(), measurement.nsPerEval,
+            measurement.allocsPerEval, 1e9 / (std::max)(measurement.nsPerEval, 1e-9), ratioText, status.c_str());
+        std::fflush(stdout);
+    }
+
+    if (updateBaseline)
+    {
+        if (!WriteBaseline(baselinePath, calibrationNs, corpus, results))
+        {
+            std::cout << "Could not write " << baselinePath << "\n";
+            return 2;
+        }
+        std::cout << "Baseline written to " << baselinePath << "\n";
+        return 0;
+    }
+
+    std::cout << "\nCases: " << corpus.size() << "  Regressions: " << regressions
+              << "  (tolerance " << static_cast<int>(tolerance * 100 + 0.5) << "%)\n";
+    return regressions == 0 ? 0 : 1;
+}
@@ -9,6 +9,7 @@
 
 #include "src/math_editor.h"
 #include "src/math_manager.h"
+#include "src/unit_registry.h"
 
 // Forward declarations
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
@@ -210,6 +211,27 @@ namespace
         return true;
     }
 
+    // Extra units from "units.txt" next to the executable, if present. Has to
+    // run before the first calculation builds the unit registry.
+    static void ConfigureUnitRegistry()
+    {
+        wchar_t modulePath[MAX_PATH] = L"";
+        const DWORD length = GetModuleFileNameW(nullptr, modulePath, MAX_PATH);
+        if (length == 0 || length >= MAX_PATH)
+            return;
+
+        std::wstring path(modulePath, length);
+        path.erase(path.find_last_of(L"\\/") + 1);
+        path += L"units.txt";
+
+        std::wstring definitions;
+        if (!ReadUtf8File(path, definitions))
+            return;
+        UnitRegistry::Configure(std::move(definitions));
+        for (const std::wstring& problem : UnitRegistry::Shared().Problems())
+            OutputDebugStringW((L"units.txt " + problem + L"\n").c_str());
+    }
+
     static bool PromptForDocumentPath(HWND owner, bool save, std::wstring& outPath)
     {
         wchar_t filePath[MAX_PATH] = L"";
@@ -519,6 +541,8 @@ static HMODULE LoadRichEditWithFallback(const wchar_t** outClassName)
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow)
 {
+    ConfigureUnitRegistry();
+
     const wchar_t* richEditClass = nullptr;
     HMODULE hRichEdit = LoadRichEditWithFallback(&richEditClass);
     if (!hRichEdit || !richEditClass)
@@ -0,0 +1,135 @@
+#include "evaluation_service.h"
+
+#include <algorithm>
+
+EvaluationService::EvaluationService(size_t workerCount, std::function<void()> notifyCallback)
+    : notify(std::move(notifyCallback))
+{
+    if (workerCount == 0)
+        workerCount = 1;
+    workers.reserve(workerCount);
+    for (size_t index = 0; index < workerCount; ++index)
+        workers.emplace_back([this] { WorkerLoop(); });
+}
+
+EvaluationService::~EvaluationService()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (auto& [key, ticket] : latest)
+            ticket.token.Cancel();
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+CancellationToken EvaluationService::Submit(size_t key, Job job, std::chrono::milliseconds budget)
+{
+    Entry entry;
+    entry.key = key;
+    entry.deadline = Clock::now() + budget;
+    entry.job = std::move(job);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry.ticket.generation = ++nextGeneration;
+        const auto previous = latest.find(key);
+        if (previous != latest.end())
+            previous->second.token.Cancel();
+        DropUndelivered(key);
+        latest[key] = entry.ticket;
+        queue.push_back(entry);
+    }
+    wake.notify_one();
+    return entry.ticket.token;
+}
+
+void EvaluationService::Cancel(size_t key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto found = latest.find(key);
+    if (found != latest.end())
+        found->second.token.Cancel();
+    DropUndelivered(key);
+}
+
+void EvaluationService::CancelAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [key, ticket] : latest)
+        ticket.token.Cancel();
+    mailbox.clear();
+}
+
+std::vector<EvaluationService::Update> EvaluationService::Poll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Update> updates;
+    updates.swap(mailbox);
+    return updates;
+}
+
+bool EvaluationService::WaitIdle(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return idle.wait_for(lock, timeout, [this] { return queue.empty() && running == 0; });
+}
+
+void EvaluationService::WorkerLoop()
+{
+    for (;;)
+    {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            entry = std::move(queue.front());
+            queue.pop_front();
+            ++running;
+        }
+
+        // A job superseded while queued never starts.
+        if (!entry.ticket.token.IsCancelled())
+        {
+            const Publish publish = [this, &entry](const std::wstring& text) { Deliver(entry, text, false); };
+            const std::wstring text = entry.job(entry.ticket.token, entry.deadline, publish);
+            Deliver(entry, text, true);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto found = latest.find(entry.key);
+            if (found != latest.end() && found->second.generation == entry.ticket.generation)
+                latest.erase(found);
+            --running;
+            if (queue.empty() && running == 0)
+                idle.notify_all();
+        }
+    }
+}
+
+void EvaluationService::Deliver(const Entry& entry, const std::wstring& text, bool final)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto found = latest.find(entry.key);
+        if (entry.ticket.token.IsCancelled() || found == latest.end() || found->second.generation != entry.ticket.generation)
+            return;
+        Update update;
+        update.key = entry.key;
+        update.text = text;
+        update.final = final;
+        mailbox.push_back(std::move(update));
+    }
+    if (notify)
+        notify();
+}
+
+void EvaluationService::DropUndelivered(size_t key)
+{
+    mailbox.erase(std::remove_if(mailbox.begin(), mailbox.end(), [key](const Update& update) { return update.key == key; }),
+        mailbox.end());
+}
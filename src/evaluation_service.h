@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Flag a running calculation polls to learn that its result is no longer
+// wanted. Copies share the flag, so whoever holds one can cancel the job.
+class CancellationToken
+{
+public:
+    CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void Cancel() const { flag->store(true, std::memory_order_relaxed); }
+    bool IsCancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+// Runs calculations off the UI thread on a fixed set of workers. Jobs belong
+// to a key (an object index): submitting for a key cancels the job already
+// queued or running for it and discards whatever it published that has not
+// been polled yet, so only the newest job of a key is ever seen.
+// Published text waits in a mailbox until the owner drains it with Poll on
+// its own thread, so workers never touch the document. Knows nothing about
+// math; the editor supplies the jobs.
+class EvaluationService
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    // Forwards intermediate text for the job's key; may be called any number of times.
+    using Publish = std::function<void(const std::wstring& text)>;
+    // Runs on a worker and returns the final text. Jobs stop on their own once
+    // `token` is cancelled or `deadline` passes; a cancelled job publishes nothing.
+    using Job = std::function<std::wstring(const CancellationToken& token, Clock::time_point deadline, const Publish& publish)>;
+
+    struct Update
+    {
+        size_t key = 0;
+        std::wstring text;
+        bool final = false;
+    };
+
+    // `notify` runs on a worker after each publish, e.g. to post a window message.
+    explicit EvaluationService(size_t workerCount, std::function<void()> notify = nullptr);
+    ~EvaluationService();
+
+    EvaluationService(const EvaluationService&) = delete;
+    EvaluationService& operator=(const EvaluationService&) = delete;
+
+    CancellationToken Submit(size_t key, Job job, std::chrono::milliseconds budget);
+    void Cancel(size_t key);
+    void CancelAll();
+
+    // Updates published since the last call, oldest first.
+    std::vector<Update> Poll();
+    // Waits until no job is queued or running; false on timeout.
+    bool WaitIdle(std::chrono::milliseconds timeout);
+
+private:
+    struct Ticket
+    {
+        unsigned long long generation = 0;
+        CancellationToken token;
+    };
+
+    struct Entry
+    {
+        size_t key = 0;
+        Ticket ticket;
+        Clock::time_point deadline;
+        Job job;
+    };
+
+    void WorkerLoop();
+    // Queues `text` unless a newer job for the key exists or this one was cancelled.
+    void Deliver(const Entry& entry, const std::wstring& text, bool final);
+    // Forgets text published for `key` but not polled yet; the caller holds the mutex.
+    void DropUndelivered(size_t key);
+
+    std::function<void()> notify;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<Entry> queue;
+    std::map<size_t, Ticket> latest;  // newest unfinished job per key
+    std::vector<Update> mailbox;
+    unsigned long long nextGeneration = 0;
+    size_t running = 0;
+    bool stopping = false;
+};
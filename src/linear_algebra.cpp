@@ -0,0 +1,513 @@
+#include "linear_algebra.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MATH_GEMM_AVX2 1
+#elif defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MATH_GEMM_SSE2 1
+#endif
+
+namespace
+{
+    // Columns factored per panel. The panel and the block row of U it produces
+    // stay in cache while they update the trailing matrix.
+    constexpr size_t kPanelWidth = 48;
+    // Width of the trailing-matrix column strip updated at once, so each strip
+    // of the U block row is reused across every row below it.
+    constexpr size_t kUpdateStrip = 256;
+
+    // Product blocking: a kKernelRows x kKernelColumns tile of C lives in
+    // registers while it runs down a packed kc-long strip of A and of B; an
+    // mc x kc block of A stays in L2 and a kc x nc panel of B in L3.
+    constexpr size_t kKernelRows = 6;
+    constexpr size_t kDepthBlock = 256;
+    constexpr size_t kRowBlock = 72;
+    constexpr size_t kColumnBlock = 1024;
+    // Products with fewer multiply-adds than this stay on the calling thread.
+    constexpr double kParallelProductWork = 2.0e6;
+
+#if defined(MATH_GEMM_AVX2)
+    using GemmVector = __m256d;
+    constexpr size_t kGemmWidth = 4;
+    inline GemmVector GemmLoad(const double* source) { return _mm256_loadu_pd(source); }
+    inline void GemmStore(double* target, GemmVector value) { _mm256_storeu_pd(target, value); }
+    inline GemmVector GemmBroadcast(double value) { return _mm256_set1_pd(value); }
+    inline GemmVector GemmZero() { return _mm256_setzero_pd(); }
+#if defined(__FMA__)
+    inline GemmVector GemmMultiplyAdd(GemmVector sum, GemmVector left, GemmVector right) { return _mm256_fmadd_pd(left, right, sum); }
+#else
+    inline GemmVector GemmMultiplyAdd(GemmVector sum, GemmVector left, GemmVector right) { return _mm256_add_pd(sum, _mm256_mul_pd(left, right)); }
+#endif
+    inline GemmVector GemmAdd(GemmVector left, GemmVector right) { return _mm256_add_pd(left, right); }
+#elif defined(MATH_GEMM_SSE2)
+    using GemmVector = __m128d;
+    constexpr size_t kGemmWidth = 2;
+    inline GemmVector GemmLoad(const double* source) { return _mm_loadu_pd(source); }
+    inline void GemmStore(double* target, GemmVector value) { _mm_storeu_pd(target, value); }
+    inline GemmVector GemmBroadcast(double value) { return _mm_set1_pd(value); }
+    inline GemmVector GemmZero() { return _mm_setzero_pd(); }
+    inline GemmVector GemmMultiplyAdd(GemmVector sum, GemmVector left, GemmVector right) { return _mm_add_pd(sum, _mm_mul_pd(left, right)); }
+    inline GemmVector GemmAdd(GemmVector left, GemmVector right) { return _mm_add_pd(left, right); }
+#else
+    constexpr size_t kGemmWidth = 2;
+#endif
+    constexpr size_t kKernelColumns = 2 * kGemmWidth;
+
+    // Copies rows [rowBegin, rowBegin + rowCount) x columns [depthBegin,
+    // depthBegin + depth) of A into kKernelRows-high strips, each stored
+    // depth-major and zero-padded, so the kernel reads it sequentially.
+    void PackLeft(const Matrix& left, size_t rowBegin, size_t rowCount, size_t depthBegin, size_t depth, double* packed)
+    {
+        for (size_t strip = 0; strip < rowCount; strip += kKernelRows)
+        {
+            const size_t stripRows = (std::min)(kKernelRows, rowCount - strip);
+            for (size_t p = 0; p < depth; ++p)
+            {
+                for (size_t i = 0; i < kKernelRows; ++i)
+                    packed[i] = i < stripRows ? left(rowBegin + strip + i, depthBegin + p) : 0.0;
+                packed += kKernelRows;
+            }
+        }
+    }
+
+    // The matching layout for B: kKernelColumns-wide strips, depth-major.
+    void PackRight(const Matrix& right, size_t depthBegin, size_t depth, size_t columnBegin, size_t columnCount, double* packed)
+    {
+        for (size_t strip = 0; strip < columnCount; strip += kKernelColumns)
+        {
+            const size_t stripColumns = (std::min)(kKernelColumns, columnCount - strip);
+            for (size_t p = 0; p < depth; ++p)
+            {
+                const double* source = right.Data() + (depthBegin + p) * right.Columns() + columnBegin + strip;
+                for (size_t j = 0; j < kKernelColumns; ++j)
+                    packed[j] = j < stripColumns ? source[j] : 0.0;
+                packed += kKernelColumns;
+            }
+        }
+    }
+
+    // C[0, tileRows) x [0, tileColumns) += packed A strip * packed B strip.
+    void MultiplyKernel(size_t depth, const double* packedLeft, const double* packedRight,
+                        double* target, size_t stride, size_t tileRows, size_t tileColumns)
+    {
+        double tile[kKernelRows][kKernelColumns];
+#if defined(MATH_GEMM_AVX2) || defined(MATH_GEMM_SSE2)
+        GemmVector sums[kKernelRows][2];
+        for (size_t i = 0; i < kKernelRows; ++i)
+            sums[i][0] = sums[i][1] = GemmZero();
+        for (size_t p = 0; p < depth; ++p)
+        {
+            const GemmVector low = GemmLoad(packedRight);
+            const GemmVector high = GemmLoad(packedRight + kGemmWidth);
+            for (size_t i = 0; i < kKernelRows; ++i)
+            {
+                const GemmVector factor = GemmBroadcast(packedLeft[i]);
+                sums[i][0] = GemmMultiplyAdd(sums[i][0], factor, low);
+                sums[i][1] = GemmMultiplyAdd(sums[i][1], factor, high);
+            }
+            packedLeft += kKernelRows;
+            packedRight += kKernelColumns;
+        }
+
+        if (tileRows == kKernelRows && tileColumns == kKernelColumns)
+        {
+            for (size_t i = 0; i < kKernelRows; ++i)
+            {
+                double* row = target + i * stride;
+                GemmStore(row, GemmAdd(GemmLoad(row), sums[i][0]));
+                GemmStore(row + kGemmWidth, GemmAdd(GemmLoad(row + kGemmWidth), sums[i][1]));
+            }
+            return;
+        }
+        for (size_t i = 0; i < kKernelRows; ++i)
+        {
+            GemmStore(tile[i], sums[i][0]);
+            GemmStore(tile[i] + kGemmWidth, sums[i][1]);
+        }
+#else
+        for (size_t i = 0; i < kKernelRows; ++i)
+            std::fill(tile[i], tile[i] + kKernelColumns, 0.0);
+        for (size_t p = 0; p < depth; ++p)
+        {
+            for (size_t i = 0; i < kKernelRows; ++i)
+                for (size_t j = 0; j < kKernelColumns; ++j)
+                    tile[i][j] += packedLeft[i] * packedRight[j];
+            packedLeft += kKernelRows;
+            packedRight += kKernelColumns;
+        }
+#endif
+        for (size_t i = 0; i < tileRows; ++i)
+            for (size_t j = 0; j < tileColumns; ++j)
+                target[i * stride + j] += tile[i][j];
+    }
+
+    // Adds the rows [rowBegin, rowEnd) of A[:, depth block] * packed B panel
+    // into C, one kRowBlock block at a time.
+    void MultiplyRowBlocks(const Matrix& left, const double* packedRight, Matrix& product,
+                           size_t rowBegin, size_t rowEnd, size_t depthBegin, size_t depth,
+                           size_t columnBegin, size_t columnCount)
+    {
+        std::vector<double> packedLeft(kRowBlock * depth);
+        for (size_t blockBegin = rowBegin; blockBegin < rowEnd; blockBegin += kRowBlock)
+        {
+            const size_t blockRows = (std::min)(kRowBlock, rowEnd - blockBegin);
+            PackLeft(left, blockBegin, blockRows, depthBegin, depth, packedLeft.data());
+            for (size_t strip = 0; strip < columnCount; strip += kKernelColumns)
+            {
+                const double* rightStrip = packedRight + strip * depth;
+                const size_t tileColumns = (std::min)(kKernelColumns, columnCount - strip);
+                for (size_t rowStrip = 0; rowStrip < blockRows; rowStrip += kKernelRows)
+                {
+                    MultiplyKernel(depth, packedLeft.data() + rowStrip * depth, rightStrip,
+                                   &product(blockBegin + rowStrip, columnBegin + strip), product.Columns(),
+                                   (std::min)(kKernelRows, blockRows - rowStrip), tileColumns);
+                }
+            }
+        }
+    }
+}
+
+Matrix Matrix::Identity(size_t size)
+{
+    Matrix identity(size, size);
+    for (size_t index = 0; index < size; ++index)
+        identity(index, index) = 1.0;
+    return identity;
+}
+
+Matrix Matrix::FromRows(const std::vector<std::vector<double>>& rows)
+{
+    Matrix matrix(rows.size(), rows.empty() ? 0 : rows[0].size());
+    for (size_t row = 0; row < matrix.rows; ++row)
+        std::copy(rows[row].begin(), rows[row].begin() + matrix.columns, matrix.values.begin() + row * matrix.columns);
+    return matrix;
+}
+
+Matrix Matrix::Transposed() const
+{
+    Matrix transposed(columns, rows);
+    for (size_t row = 0; row < rows; ++row)
+        for (size_t column = 0; column < columns; ++column)
+            transposed(column, row) = (*this)(row, column);
+    return transposed;
+}
+
+Matrix Matrix::Scaled(double factor) const
+{
+    Matrix scaled = *this;
+    for (double& value : scaled.values)
+        value *= factor;
+    return scaled;
+}
+
+Matrix Matrix::Add(const Matrix& left, const Matrix& right, bool subtract)
+{
+    Matrix sum = left;
+    const double sign = subtract ? -1.0 : 1.0;
+    for (size_t index = 0; index < sum.values.size(); ++index)
+        sum.values[index] += sign * right.values[index];
+    return sum;
+}
+
+Matrix Matrix::Multiply(const Matrix& left, const Matrix& right)
+{
+    const size_t rowCount = left.rows;
+    const size_t depthCount = left.columns;
+    const size_t columnCount = right.columns;
+    Matrix product(rowCount, columnCount);
+    if (rowCount == 0 || columnCount == 0 || depthCount == 0)
+        return product;
+
+    const bool parallel = static_cast<double>(rowCount) * columnCount * depthCount >= kParallelProductWork &&
+                          rowCount > kRowBlock;
+    std::vector<double> packedRight;
+    for (size_t columnBegin = 0; columnBegin < columnCount; columnBegin += kColumnBlock)
+    {
+        const size_t columns = (std::min)(kColumnBlock, columnCount - columnBegin);
+        const size_t paddedColumns = (columns + kKernelColumns - 1) / kKernelColumns * kKernelColumns;
+        for (size_t depthBegin = 0; depthBegin < depthCount; depthBegin += kDepthBlock)
+        {
+            const size_t depth = (std::min)(kDepthBlock, depthCount - depthBegin);
+            packedRight.resize(paddedColumns * depth);
+            PackRight(right, depthBegin, depth, columnBegin, columns, packedRight.data());
+
+            // Row blocks write disjoint rows of C, and each element is summed
+            // in the same order whichever thread runs it.
+            if (parallel)
+            {
+                const size_t blocks = (rowCount + kRowBlock - 1) / kRowBlock;
+                TaskPool::Shared().ParallelFor(blocks, 1, [&](size_t begin, size_t end) {
+                    MultiplyRowBlocks(left, packedRight.data(), product, begin * kRowBlock,
+                                      (std::min)(rowCount, end * kRowBlock), depthBegin, depth, columnBegin, columns);
+                });
+            }
+            else
+            {
+                MultiplyRowBlocks(left, packedRight.data(), product, 0, rowCount, depthBegin, depth, columnBegin, columns);
+            }
+        }
+    }
+    return product;
+}
+
+bool Matrix::TryPow(long long exponent, Matrix& out) const
+{
+    if (!IsSquare() || rows == 0)
+        return false;
+
+    Matrix base = *this;
+    if (exponent < 0)
+    {
+        LUFactorization factorization;
+        if (!factorization.Factor(*this) || !factorization.Inverse(base))
+            return false;
+    }
+
+    unsigned long long remaining = exponent < 0 ? 0ULL - (unsigned long long)exponent : (unsigned long long)exponent;
+    Matrix result = Identity(rows);
+    bool first = true;
+    while (remaining != 0)
+    {
+        if (remaining & 1)
+        {
+            result = first ? base : Multiply(result, base);
+            first = false;
+        }
+        remaining >>= 1;
+        if (remaining != 0)
+            base = Multiply(base, base);
+    }
+    out = std::move(result);
+    return true;
+}
+
+bool LUFactorization::Factor(const std::vector<std::vector<double>>& rows)
+{
+    size = 0;
+    lu.clear();
+    const size_t n = rows.size();
+    if (n == 0)
+        return false;
+    lu.resize(n * n);
+    for (size_t row = 0; row < n; ++row)
+    {
+        if (rows[row].size() != n)
+        {
+            lu.clear();
+            return false;
+        }
+        std::copy(rows[row].begin(), rows[row].end(), lu.begin() + row * n);
+    }
+    size = n;
+    FactorInPlace();
+    return true;
+}
+
+bool LUFactorization::Factor(const Matrix& matrix)
+{
+    size = 0;
+    lu.clear();
+    if (matrix.Rows() == 0 || !matrix.IsSquare())
+        return false;
+    size = matrix.Rows();
+    lu.assign(matrix.Data(), matrix.Data() + size * size);
+    FactorInPlace();
+    return true;
+}
+
+void LUFactorization::FactorInPlace()
+{
+    const size_t n = size;
+    pivots.assign(n, 0);
+    singular = false;
+    oddSwaps = false;
+
+    // Right-looking blocked elimination: factor a narrow panel with row
+    // pivoting, then apply it to everything to the right and below at once.
+    for (size_t first = 0; first < n; first += kPanelWidth)
+    {
+        const size_t last = (std::min)(n, first + kPanelWidth);
+        FactorPanel(first, last);
+        UpdateTrailing(first, last);
+    }
+}
+
+void LUFactorization::FactorPanel(size_t first, size_t last)
+{
+    const size_t n = size;
+    for (size_t k = first; k < last; ++k)
+    {
+        size_t pivotRow = k;
+        double pivotMagnitude = std::fabs(lu[k * n + k]);
+        for (size_t row = k + 1; row < n; ++row)
+        {
+            const double magnitude = std::fabs(lu[row * n + k]);
+            if (magnitude > pivotMagnitude)
+            {
+                pivotRow = row;
+                pivotMagnitude = magnitude;
+            }
+        }
+
+        pivots[k] = pivotRow;
+        if (pivotRow != k)
+        {
+            std::swap_ranges(lu.begin() + k * n, lu.begin() + (k + 1) * n, lu.begin() + pivotRow * n);
+            oddSwaps = !oddSwaps;
+        }
+        if (pivotMagnitude == 0.0)
+        {
+            // Nothing to eliminate below; the column is already zero.
+            singular = true;
+            continue;
+        }
+
+        const double* pivotValues = &lu[k * n];
+        const double inversePivot = 1.0 / pivotValues[k];
+        for (size_t row = k + 1; row < n; ++row)
+        {
+            double* values = &lu[row * n];
+            const double factor = values[k] * inversePivot;
+            values[k] = factor;
+            if (factor == 0.0)
+                continue;
+            for (size_t col = k + 1; col < last; ++col)
+                values[col] -= factor * pivotValues[col];
+        }
+    }
+}
+
+void LUFactorization::UpdateTrailing(size_t first, size_t last)
+{
+    const size_t n = size;
+    if (last == n)
+        return;
+
+    // U12 = L11^-1 * A12: forward substitution down the panel rows.
+    for (size_t k = first; k < last; ++k)
+    {
+        const double* pivotValues = &lu[k * n];
+        for (size_t row = k + 1; row < last; ++row)
+        {
+            double* values = &lu[row * n];
+            const double factor = values[k];
+            if (factor == 0.0)
+                continue;
+            for (size_t col = last; col < n; ++col)
+                values[col] -= factor * pivotValues[col];
+        }
+    }
+
+    // A22 -= L21 * U12, one column strip at a time.
+    for (size_t stripBegin = last; stripBegin < n; stripBegin += kUpdateStrip)
+    {
+        const size_t stripEnd = (std::min)(n, stripBegin + kUpdateStrip);
+        for (size_t row = last; row < n; ++row)
+        {
+            double* values = &lu[row * n];
+            for (size_t k = first; k < last; ++k)
+            {
+                const double factor = values[k];
+                if (factor == 0.0)
+                    continue;
+                const double* pivotValues = &lu[k * n];
+                for (size_t col = stripBegin; col < stripEnd; ++col)
+                    values[col] -= factor * pivotValues[col];
+            }
+        }
+    }
+}
+
+double LUFactorization::Determinant() const
+{
+    if (size == 0 || singular)
+        return 0.0;
+
+    // Keep mantissa and exponent apart so large matrices do not overflow or
+    // underflow before the final scaling.
+    double mantissa = oddSwaps ? -1.0 : 1.0;
+    long long exponent = 0;
+    for (size_t k = 0; k < size; ++k)
+    {
+        int factorExponent = 0;
+        mantissa *= std::frexp(lu[k * size + k], &factorExponent);
+        exponent += factorExponent;
+        int renormalized = 0;
+        mantissa = std::frexp(mantissa, &renormalized);
+        exponent += renormalized;
+    }
+    if (exponent > 4096)
+        return mantissa > 0 ? HUGE_VAL : -HUGE_VAL;
+    if (exponent < -4096)
+        return 0.0;
+    return std::ldexp(mantissa, static_cast<int>(exponent));
+}
+
+void LUFactorization::SolveInPlace(double* values) const
+{
+    const size_t n = size;
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (pivots[k] != k)
+            std::swap(values[k], values[pivots[k]]);
+    }
+    for (size_t row = 1; row < n; ++row)
+    {
+        const double* factors = &lu[row * n];
+        double sum = values[row];
+        for (size_t col = 0; col < row; ++col)
+            sum -= factors[col] * values[col];
+        values[row] = sum;
+    }
+    for (size_t row = n; row-- > 0;)
+    {
+        const double* upper = &lu[row * n];
+        double sum = values[row];
+        for (size_t col = row + 1; col < n; ++col)
+            sum -= upper[col] * values[col];
+        values[row] = sum / upper[row];
+    }
+}
+
+bool LUFactorization::Solve(const std::vector<double>& rhs, std::vector<double>& x) const
+{
+    if (size == 0 || singular || rhs.size() != size)
+        return false;
+    x = rhs;
+    SolveInPlace(x.data());
+    return true;
+}
+
+bool LUFactorization::Inverse(std::vector<std::vector<double>>& rows) const
+{
+    Matrix inverse;
+    if (!Inverse(inverse))
+        return false;
+    rows.assign(size, std::vector<double>(size));
+    for (size_t row = 0; row < size; ++row)
+        std::copy(inverse.Data() + row * size, inverse.Data() + (row + 1) * size, rows[row].begin());
+    return true;
+}
+
+bool LUFactorization::Inverse(Matrix& inverse) const
+{
+    if (size == 0 || singular)
+        return false;
+
+    inverse = Matrix(size, size);
+    std::vector<double> column(size);
+    for (size_t col = 0; col < size; ++col)
+    {
+        std::fill(column.begin(), column.end(), 0.0);
+        column[col] = 1.0;
+        SolveInPlace(column.data());
+        for (size_t row = 0; row < size; ++row)
+            inverse(row, col) = column[row];
+    }
+    return true;
+}
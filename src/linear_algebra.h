@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Dense row-major matrix of doubles.
+class Matrix
+{
+public:
+    Matrix() = default;
+    Matrix(size_t rowCount, size_t columnCount, double fill = 0.0)
+        : rows(rowCount), columns(columnCount), values(rowCount * columnCount, fill)
+    {
+    }
+
+    static Matrix Identity(size_t size);
+    static Matrix FromRows(const std::vector<std::vector<double>>& rows);
+
+    size_t Rows() const { return rows; }
+    size_t Columns() const { return columns; }
+    bool IsSquare() const { return rows == columns; }
+    double& operator()(size_t row, size_t column) { return values[row * columns + column]; }
+    double operator()(size_t row, size_t column) const { return values[row * columns + column]; }
+    double* Data() { return values.data(); }
+    const double* Data() const { return values.data(); }
+
+    Matrix Transposed() const;
+    Matrix Scaled(double factor) const;
+    // Element-wise sum, or difference with `subtract`; the shapes must match.
+    static Matrix Add(const Matrix& left, const Matrix& right, bool subtract = false);
+    // left * right; left.Columns() must equal right.Rows(). Runs a packed,
+    // register-tiled kernel and splits large products across TaskPool::Shared().
+    static Matrix Multiply(const Matrix& left, const Matrix& right);
+    // Integer power of a square matrix by repeated squaring; negative powers
+    // invert through LUFactorization. Fails when not square or singular.
+    bool TryPow(long long exponent, Matrix& out) const;
+
+private:
+    size_t rows = 0;
+    size_t columns = 0;
+    std::vector<double> values;
+};
+
+// Partial-pivot LU factorization P*A = L*U of a square matrix, kept in place in
+// one row-major array: U on and above the diagonal, the unit lower triangle L
+// below it. Factor once, then take the determinant or solve against any number
+// of right-hand sides without refactoring.
+class LUFactorization
+{
+public:
+    // Fails for empty or non-square input. A column with no nonzero pivot
+    // still factors but leaves the matrix singular.
+    bool Factor(const std::vector<std::vector<double>>& rows);
+    bool Factor(const Matrix& matrix);
+
+    size_t Size() const { return size; }
+    bool IsSingular() const { return singular; }
+    double Determinant() const;
+
+    // x such that A*x = rhs; fails when A is singular or the sizes differ.
+    bool Solve(const std::vector<double>& rhs, std::vector<double>& x) const;
+    // A^-1 as rows; fails when A is singular.
+    bool Inverse(std::vector<std::vector<double>>& rows) const;
+    bool Inverse(Matrix& inverse) const;
+
+private:
+    void FactorInPlace();
+    void FactorPanel(size_t first, size_t last);
+    void UpdateTrailing(size_t first, size_t last);
+    void SolveInPlace(double* values) const;
+
+    size_t size = 0;
+    std::vector<double> lu;
+    std::vector<size_t> pivots;  // row swapped with row k at step k
+    bool singular = false;
+    bool oddSwaps = false;
+};
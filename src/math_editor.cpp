@@ -7,6 +7,8 @@
 #include "math_renderer.h"
 #include <cwctype>
 #include <algorithm>
+#include <chrono>
+#include <map>
 
     // Make anchor characters invisible by setting their text color to the
     // background color.  This prevents RichEdit from drawing U+2500 glyphs;
@@ -150,6 +152,15 @@ namespace
     std::wstring g_currentNumber;
     bool g_suppressNextChar = false;
 
+    // Sums and products are calculated on the evaluation service so a large
+    // range never blocks typing; updates arrive as WM_MATH_EVALUATION.
+    constexpr UINT WM_MATH_EVALUATION = WM_APP + 0x40;
+    constexpr std::chrono::milliseconds kBackgroundBudget(30000);
+    constexpr std::chrono::milliseconds kProgressInterval(100);
+    // Object content by key at submit time; updates for an object that has
+    // changed or moved since are dropped.
+    std::map<size_t, std::wstring> g_backgroundSources;
+
     struct UnitSuggestionContext
     {
         size_t replaceStart = 0;
@@ -170,6 +181,7 @@ namespace
     };
 
     UnitSuggestionPopupState g_unitSuggestionPopup;
+    UnitSymbolMatcher g_unitSymbolMatcher;
 
     static UINT GetMathClipboardFormat()
     {
@@ -814,7 +826,9 @@ namespace
             { L"\\frac", MathNodeKind::Fraction, 0 },
             { L"\\pow",  MathNodeKind::Power, 0 },
             { L"\\abs",  MathNodeKind::AbsoluteValue, 0 },
-            { L"\\log",  MathNodeKind::Logarithm, 1 }
+            { L"\\log",  MathNodeKind::Logarithm, 1 },
+            { L"\\sum",  MathNodeKind::Summation, 0 },
+            { L"\\prod", MathNodeKind::Product, 0 }
         };
 
         for (const auto& command : commands)
@@ -910,21 +924,109 @@ namespace
         return false;
     }
 
+    static EvaluationService& BackgroundEvaluation()
+    {
+        static EvaluationService service(2, [] {
+            if (g_hEdit)
+                PostMessage(g_hEdit, WM_MATH_EVALUATION, 0, 0);
+        });
+        return service;
+    }
+
+    static std::wstring BackgroundSource(const MathObject& obj)
+    {
+        std::wstring source = std::to_wstring((int)obj.type);
+        for (const auto& slot : obj.slots)
+        {
+            source.push_back(L'\x1F');
+            source += slot.text;
+        }
+        return source;
+    }
+
+    // Calculates a copy of the object on a worker. Progress shows as
+    // " \u2248 1.2345\u2026 (62%)" at most every kProgressInterval; editing the
+    // object again cancels the run.
+    static void SubmitBackgroundCalculation(size_t objIdx, MathObject& obj)
+    {
+        g_backgroundSources[objIdx] = BackgroundSource(obj);
+        if (obj.resultText.empty())
+            obj.resultText = L" \u2248 \u2026";
+
+        const MathObject snapshot = obj;
+        BackgroundEvaluation().Submit(objIdx, [snapshot](const CancellationToken& token, EvaluationService::Clock::time_point deadline,
+                                                         const EvaluationService::Publish& publish) {
+            const MathManager& mgr = MathManager::Get();
+            auto lastPublished = EvaluationService::Clock::now();
+            EvaluationControl control;
+            control.token = token;
+            control.deadline = deadline;
+            control.progress = [&](double fraction, const MathValue& partial) {
+                const auto now = EvaluationService::Clock::now();
+                if (now - lastPublished < kProgressInterval) return;
+                lastPublished = now;
+                publish(mgr.FormatProgressResult(partial, fraction));
+            };
+            return mgr.CalculateFormattedResult(snapshot, &control);
+        }, kBackgroundBudget);
+    }
+
+    static void ApplyBackgroundResults(std::vector<MathObject>& objects)
+    {
+        for (const EvaluationService::Update& update : BackgroundEvaluation().Poll())
+        {
+            const auto source = g_backgroundSources.find(update.key);
+            if (source == g_backgroundSources.end())
+                continue;
+            if (update.key >= objects.size() || BackgroundSource(objects[update.key]) != source->second)
+            {
+                BackgroundEvaluation().Cancel(update.key);
+                g_backgroundSources.erase(source);
+                continue;
+            }
+            objects[update.key].resultText = update.text;
+            if (update.final)
+                g_backgroundSources.erase(source);
+        }
+    }
+
+    // Recalculates what reads the variables `objIdx` defines. Sums and
+    // products among them restart on a worker, so a job still running with
+    // the old values is cancelled rather than left to overwrite the new one.
+    static void RecalculateDependentsOf(size_t objIdx)
+    {
+        auto& mgr = MathManager::Get();
+        std::vector<size_t> background;
+        mgr.RecalculateDependents(objIdx, &background);
+        for (size_t index : background)
+            SubmitBackgroundCalculation(index, mgr.GetObjects()[index]);
+    }
+
+    static void CancelBackgroundCalculations()
+    {
+        BackgroundEvaluation().CancelAll();
+        g_backgroundSources.clear();
+    }
+
     static void UpdateResultIfPresent(HWND hwnd, size_t objIdx)
     {
         auto& mgr = MathManager::Get();
         auto& objects = mgr.GetObjects();
         if (objIdx >= objects.size()) return;
         auto& obj = objects[objIdx];
-        if (obj.resultText.empty()) return;
 
         if (obj.type == MathType::SystemOfEquations) {
+            if (obj.resultText.empty()) return;
             // For system of equations, use the dedicated calculation method
             std::wstring systemResult = mgr.CalculateSystemResult(obj);
             obj.resultText = systemResult; // CalculateSystemResult already includes the equals sign
+        } else if (MathManager::RunsInBackground(obj)) {
+            if (obj.resultText.empty()) return;
+            SubmitBackgroundCalculation(objIdx, obj);
         } else {
-            if (!mgr.CanCalculateResult(obj)) return;
-            obj.resultText = mgr.CalculateFormattedResult(obj);
+            // Refreshes this result if shown, and every object reading a
+            // variable this object defines.
+            RecalculateDependentsOf(objIdx);
         }
         RequestMathRepaint(hwnd);
     }
@@ -948,7 +1050,12 @@ namespace
 
         if (!mgr.CanCalculateResult(obj)) return;
 
-        obj.resultText = mgr.CalculateFormattedResult(obj);
+        if (MathManager::RunsInBackground(obj)) {
+            SubmitBackgroundCalculation(objIdx, obj);
+        } else {
+            obj.resultText = mgr.CalculateFormattedResult(obj);
+            RecalculateDependentsOf(objIdx);
+        }
         SendMessage(hwnd, EM_SETSEL, obj.barStart + obj.barLen, obj.barStart + obj.barLen);
         RestoreTypingFormat(hwnd);
         RequestMathRepaint(hwnd);
@@ -1182,7 +1289,7 @@ namespace
             return;
         }
 
-        std::vector<std::wstring> matches = context.showAll ? GetKnownUnitSymbols() : FindMatchingUnitSymbols(context.prefix);
+        std::vector<std::wstring> matches = context.showAll ? GetKnownUnitSymbols() : g_unitSymbolMatcher.Match(context.prefix);
         if (!forceAll && !context.prefix.empty() && matches.size() == 1 && EqualsIgnoreCase(matches[0], context.prefix))
             matches.clear();
         if (matches.empty())
@@ -1362,6 +1469,11 @@ namespace
 
         switch (uMsg)
         {
+        case WM_MATH_EVALUATION:
+            ApplyBackgroundResults(objects);
+            RequestMathRepaint(hwnd);
+            return 0;
+
         case WM_SETCURSOR:
         {
             if (LOWORD(lParam) == HTCLIENT)
@@ -1813,7 +1925,14 @@ namespace
             if (state.active)
             {
                 if (ch == L'\t') return 0; // Tab is handled in WM_KEYDOWN; block the WM_CHAR
-                if (ch == L'=' && state.objectIndex < objects.size()) { 
+                // The '=' of ":=" is typed as text: it starts a definition.
+                bool definesVariable = false;
+                if (ch == L'=' && state.objectIndex < objects.size() && objects[state.objectIndex].type == MathType::Sum &&
+                    state.activeNodePath.empty()) {
+                    const std::wstring& target = GetActiveEditText(objects[state.objectIndex], state.activePart, state.activeNodePath);
+                    definesVariable = !target.empty() && target.back() == L':';
+                }
+                if (ch == L'=' && state.objectIndex < objects.size() && !definesVariable) { 
                     // For system of equations, we allow typing the equals sign in equations (e.g., x+y=5)
                     // Only trigger calculation for non-system types
                     if (objects[state.objectIndex].type != MathType::SystemOfEquations) {
@@ -2062,13 +2181,14 @@ bool InstallMathSupport(HWND hRichEdit)
     if (!hRichEdit) return false;
     g_hEdit = hRichEdit; g_currentNumber.clear(); g_currentCommand.clear();
     ClearUnitSuggestionPopup();
+    CancelBackgroundCalculations();
     MathManager::Get().Clear();
     if (!g_originalProc) g_originalProc = (WNDPROC)SetWindowLongPtr(g_hEdit, GWLP_WNDPROC, (LONG_PTR)MathRichEditProc);
     ApplyMathEditInsets(g_hEdit);
     return !!g_originalProc;
 }
 
-void ResetMathSupport() { g_currentNumber.clear(); g_currentCommand.clear(); ClearUnitSuggestionPopup(); MathManager::Get().Clear(); if (g_hEdit) RedrawWindow(g_hEdit, nullptr, nullptr, RDW_INVALIDATE | RDW_NOERASE); }
+void ResetMathSupport() { g_currentNumber.clear(); g_currentCommand.clear(); ClearUnitSuggestionPopup(); CancelBackgroundCalculations(); MathManager::Get().Clear(); if (g_hEdit) RedrawWindow(g_hEdit, nullptr, nullptr, RDW_INVALIDATE | RDW_NOERASE); }
 
 bool DebugGetUnitSuggestionState(std::vector<std::wstring>& outSuggestions, size_t& outSelectedIndex, std::wstring* outPrefix, RECT* outPopupRect)
 {
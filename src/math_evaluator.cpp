@@ -1,91 +1,43 @@
 #include "math_evaluator.h"
+#include "math_types.h"
+#include "modular_solver.h"
 #include <cwctype>
 #include <cmath>
 #include <cstdlib>
 #include <vector>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
+#include <functional>
 #include <cctype>
+#include <cfloat>
+#include <limits>
+#include <climits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MATH_BATCH_AVX2 1
+#elif defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MATH_BATCH_SSE2 1
+#endif
 
 namespace {
     constexpr double kPiValue = 3.14159265358979323846;
     constexpr double kEValue = 2.71828182845904523536;
 
-    bool TryApplyUnaryFunction(const std::wstring& name, double arg, double& out);
+    enum class UnaryFunction : unsigned char { Unknown, Sin, Cos, Tan, Asin, Acos, Atan, Sqrt, Abs, Exp };
 
-    bool IsFactorStart(wchar_t ch)
-    {
-        return iswdigit(ch) || ch == L'.' || iswalpha(ch) || ch == L'(' || ch == L'{';
-    }
-
-    UnitDimension MakeDimension(int length = 0,
-                                int mass = 0,
-                                int time = 0,
-                                int current = 0,
-                                int temperature = 0,
-                                int amount = 0,
-                                int luminousIntensity = 0)
-    {
-        UnitDimension dimension;
-        dimension.length = length;
-        dimension.mass = mass;
-        dimension.time = time;
-        dimension.current = current;
-        dimension.temperature = temperature;
-        dimension.amount = amount;
-        dimension.luminousIntensity = luminousIntensity;
-        return dimension;
-    }
-
-    struct UnitDefinition
-    {
-        const wchar_t* symbol;
-        double scale;
-        UnitDimension dimension;
-    };
+    bool TryApplyUnaryFunction(UnaryFunction function, double arg, double& out);
 
-    const UnitDefinition kUnitDefinitions[] = {
-        { L"m", 1.0, MakeDimension(1) },
-        { L"cm", 0.01, MakeDimension(1) },
-        { L"mm", 0.001, MakeDimension(1) },
-        { L"km", 1000.0, MakeDimension(1) },
-        { L"s", 1.0, MakeDimension(0, 0, 1) },
-        { L"ms", 0.001, MakeDimension(0, 0, 1) },
-        { L"min", 60.0, MakeDimension(0, 0, 1) },
-        { L"h", 3600.0, MakeDimension(0, 0, 1) },
-        { L"hr", 3600.0, MakeDimension(0, 0, 1) },
-        { L"kg", 1.0, MakeDimension(0, 1) },
-        { L"g", 0.001, MakeDimension(0, 1) },
-        { L"A", 1.0, MakeDimension(0, 0, 0, 1) },
-        { L"K", 1.0, MakeDimension(0, 0, 0, 0, 1) },
-        { L"mol", 1.0, MakeDimension(0, 0, 0, 0, 0, 1) },
-        { L"cd", 1.0, MakeDimension(0, 0, 0, 0, 0, 0, 1) },
-        { L"Hz", 1.0, MakeDimension(0, 0, -1) },
-        { L"N", 1.0, MakeDimension(1, 1, -2) },
-        { L"Pa", 1.0, MakeDimension(-1, 1, -2) },
-        { L"J", 1.0, MakeDimension(2, 1, -2) },
-        { L"W", 1.0, MakeDimension(2, 1, -3) },
-    };
-
-    const UnitDefinition* FindUnitDefinition(const std::wstring& name)
-    {
-        for (const auto& definition : kUnitDefinitions)
-        {
-            if (name == definition.symbol)
-                return &definition;
-        }
-        return nullptr;
-    }
-
-    std::wstring LowercaseCopy(const std::wstring& text)
+    // Registry units take the unit symbol IDs right after kNoUnitSymbol, in order.
+    UnitSymbolId UnitSymbolIdOf(const UnitDefinition& definition)
     {
-        std::wstring lowered = text;
-        std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](wchar_t ch) {
-            return (wchar_t)towlower(ch);
-        });
-        return lowered;
+        return static_cast<UnitSymbolId>(&definition - &UnitRegistry::Shared().At(0)) + 1;
     }
 
     bool NearlyEqual(double left, double right, double epsilon = 1e-9)
@@ -98,47 +50,27 @@ namespace {
         return NearlyEqual(value, std::round(value));
     }
 
-    void AddDimension(UnitDimension& target, const UnitDimension& source, int sign)
-    {
-        target.length += source.length * sign;
-        target.mass += source.mass * sign;
-        target.time += source.time * sign;
-        target.current += source.current * sign;
-        target.temperature += source.temperature * sign;
-        target.amount += source.amount * sign;
-        target.luminousIntensity += source.luminousIntensity * sign;
-    }
-
-    bool TryScaleDimension(const UnitDimension& source, double scale, UnitDimension& outDimension)
-    {
-        auto scaleComponent = [scale](int component, int& outComponent) -> bool {
-            const double scaled = component * scale;
-            const double rounded = std::round(scaled);
-            if (!NearlyEqual(scaled, rounded))
-                return false;
-            outComponent = (int)rounded;
-            return true;
-        };
-
-        return scaleComponent(source.length, outDimension.length) &&
-               scaleComponent(source.mass, outDimension.mass) &&
-               scaleComponent(source.time, outDimension.time) &&
-               scaleComponent(source.current, outDimension.current) &&
-               scaleComponent(source.temperature, outDimension.temperature) &&
-               scaleComponent(source.amount, outDimension.amount) &&
-               scaleComponent(source.luminousIntensity, outDimension.luminousIntensity);
-    }
-
     std::wstring BuildDimensionUnitSymbol(const UnitDimension& dimension)
     {
         if (dimension.IsDimensionless())
             return L"";
 
-        if (dimension == MakeDimension(0, 0, -1)) return L"Hz";
-        if (dimension == MakeDimension(1, 1, -2)) return L"N";
-        if (dimension == MakeDimension(-1, 1, -2)) return L"Pa";
-        if (dimension == MakeDimension(2, 1, -2)) return L"J";
-        if (dimension == MakeDimension(2, 1, -3)) return L"W";
+        // Dimensions with a unit of their own (N, J, ...) use its symbol: the
+        // first unscaled definition of each dimension, keyed by packed word.
+        static const std::unordered_map<unsigned long long, const wchar_t*> namedUnits = [] {
+            std::unordered_map<unsigned long long, const wchar_t*> units;
+            const UnitRegistry& registry = UnitRegistry::Shared();
+            for (size_t index = 0; index < registry.Size(); ++index)
+            {
+                const UnitDefinition& definition = registry.At(index);
+                if (definition.scale == 1.0)
+                    units.emplace(definition.dimension.Packed(), definition.symbol.c_str());
+            }
+            return units;
+        }();
+        const auto named = namedUnits.find(dimension.Packed());
+        if (named != namedUnits.end())
+            return named->second;
 
         std::vector<std::wstring> numerator;
         std::vector<std::wstring> denominator;
@@ -161,13 +93,9 @@ namespace {
                 appendPart(denominator, symbol, exponent);
         };
 
-        appendSignedPart(L"m", dimension.length);
-        appendSignedPart(L"kg", dimension.mass);
-        appendSignedPart(L"s", dimension.time);
-        appendSignedPart(L"A", dimension.current);
-        appendSignedPart(L"K", dimension.temperature);
-        appendSignedPart(L"mol", dimension.amount);
-        appendSignedPart(L"cd", dimension.luminousIntensity);
+        static const wchar_t* const baseSymbols[UnitDimension::kBaseCount] = { L"m", L"kg", L"s", L"A", L"K", L"mol", L"cd" };
+        for (int base = 0; base < UnitDimension::kBaseCount; ++base)
+            appendSignedPart(baseSymbols[base], dimension.Exponent(static_cast<UnitDimension::Base>(base)));
 
         auto joinParts = [](const std::vector<std::wstring>& parts) {
             std::wstring text;
@@ -197,13 +125,13 @@ namespace {
         if (value.IsDimensionless())
         {
             value.displayScale = 1.0;
-            value.displayUnit.clear();
+            value.displayUnit = kNoUnitSymbol;
             return value;
         }
 
-        if (value.displayUnit.empty())
+        if (!value.HasDisplayUnit())
         {
-            value.displayUnit = BuildDimensionUnitSymbol(value.dimension);
+            value.displayUnit = CanonicalUnitSymbolId(value.dimension);
             value.displayScale = 1.0;
         }
         return value;
@@ -214,7 +142,7 @@ namespace {
         if (left.IsError()) return left;
         if (right.IsError()) return right;
         if (left.dimension != right.dimension)
-            return MathValue::Error(L"incompatible units");
+            return MathValue::Error(MathError::IncompatibleUnits);
 
         MathValue result = MathValue::Scalar(left.baseValue + (subtract ? -right.baseValue : right.baseValue));
         result.dimension = left.dimension;
@@ -240,8 +168,8 @@ namespace {
         if (right.IsError()) return right;
 
         MathValue result = MathValue::Scalar(left.baseValue * right.baseValue);
-        result.dimension = left.dimension;
-        AddDimension(result.dimension, right.dimension, 1);
+        if (!UnitDimension::TryMultiply(left.dimension, right.dimension, result.dimension))
+            return MathValue::Error(MathError::InvalidUnitExponent);
 
         if (!result.IsDimensionless())
         {
@@ -265,11 +193,11 @@ namespace {
         if (numerator.IsError()) return numerator;
         if (denominator.IsError()) return denominator;
         if (!std::isfinite(denominator.baseValue) || std::fabs(denominator.baseValue) < 1e-12)
-            return MathValue::Error(L"undefined");
+            return MathValue::Error(MathError::Undefined);
 
         MathValue result = MathValue::Scalar(numerator.baseValue / denominator.baseValue);
-        result.dimension = numerator.dimension;
-        AddDimension(result.dimension, denominator.dimension, -1);
+        if (!UnitDimension::TryDivide(numerator.dimension, denominator.dimension, result.dimension))
+            return MathValue::Error(MathError::InvalidUnitExponent);
 
         if (!result.IsDimensionless() && denominator.IsDimensionless() && numerator.HasDisplayUnit())
         {
@@ -285,33 +213,33 @@ namespace {
         if (base.IsError()) return base;
         if (exponent.IsError()) return exponent;
         if (!exponent.IsDimensionless())
-            return MathValue::Error(L"invalid unit exponent");
+            return MathValue::Error(MathError::InvalidUnitExponent);
 
         const double power = exponent.baseValue;
         if (!std::isfinite(base.baseValue) || !std::isfinite(power))
-            return MathValue::Error(L"undefined");
+            return MathValue::Error(MathError::Undefined);
         if (base.baseValue < 0 && !IsIntegerLike(power))
-            return MathValue::Error(L"undefined");
+            return MathValue::Error(MathError::Undefined);
 
         MathValue result = MathValue::Scalar(std::pow(base.baseValue, power));
         if (!base.IsDimensionless())
         {
-            if (!TryScaleDimension(base.dimension, power, result.dimension))
-                return MathValue::Error(L"invalid unit exponent");
+            if (!base.dimension.TryScale(power, result.dimension))
+                return MathValue::Error(MathError::InvalidUnitExponent);
         }
 
         return WithDisplayUnit(result);
     }
 
-    MathValue ApplyUnaryValueFunction(const std::wstring& name, const MathValue& argument)
+    MathValue ApplyUnaryValueFunction(UnaryFunction function, const MathValue& argument)
     {
         if (argument.IsError())
             return argument;
 
-        if (name == L"sqrt")
+        if (function == UnaryFunction::Sqrt)
             return PowerValue(argument, MathValue::Scalar(0.5));
 
-        if (name == L"abs")
+        if (function == UnaryFunction::Abs)
         {
             MathValue result = argument;
             result.baseValue = std::fabs(result.baseValue);
@@ -320,888 +248,3681 @@ namespace {
 
         if (!argument.IsDimensionless())
         {
-            if (name == L"exp")
-                return MathValue::Error(L"exp requires abstract number");
-            return MathValue::Error(L"function requires abstract number");
+            if (function == UnaryFunction::Exp)
+                return MathValue::Error(MathError::ExpRequiresAbstractNumber);
+            return MathValue::Error(MathError::FunctionRequiresAbstractNumber);
         }
 
         double resultValue = 0;
-        if (!TryApplyUnaryFunction(name, argument.baseValue, resultValue))
-            return MathValue::Error(L"undefined");
+        if (!TryApplyUnaryFunction(function, argument.baseValue, resultValue))
+            return MathValue::Error(MathError::Undefined);
         return MathValue::Scalar(resultValue);
     }
 
-    Rational DoubleToRational(double value)
+    MathValue ApplyLogValue(const MathValue& baseValue, const MathValue& argument)
     {
-        return Rational((long long)llround(value * 1000000.0), 1000000);
-    }
+        if (baseValue.IsError()) return baseValue;
+        if (argument.IsError()) return argument;
+        if (!baseValue.IsDimensionless() || !std::isfinite(baseValue.baseValue) || baseValue.baseValue <= 0 || NearlyEqual(baseValue.baseValue, 1.0))
+            return MathValue::Error(MathError::InvalidLogBase);
+        if (!argument.IsDimensionless())
+            return MathValue::Error(MathError::LogRequiresAbstractNumber);
+        if (!std::isfinite(argument.baseValue) || argument.baseValue <= 0)
+            return MathValue::Error(MathError::InvalidLogArgument);
 
-    bool TryApplyUnaryFunction(const std::wstring& name, double arg, double& out)
-    {
-        if (name == L"sin") { out = sin(arg); return true; }
-        if (name == L"cos") { out = cos(arg); return true; }
-        if (name == L"tan") { out = tan(arg); return true; }
-        if (name == L"asin") { if (arg < -1 || arg > 1) return false; out = asin(arg); return true; }
-        if (name == L"acos") { if (arg < -1 || arg > 1) return false; out = acos(arg); return true; }
-        if (name == L"atan") { out = atan(arg); return true; }
-        if (name == L"sqrt") { if (arg < 0) return false; out = sqrt(arg); return true; }
-        if (name == L"abs") { out = fabs(arg); return true; }
-        if (name == L"exp") { out = exp(arg); return true; }
-        return false;
+        return MathValue::Scalar(std::log(argument.baseValue) / std::log(baseValue.baseValue));
     }
-}
-
-double MathEvaluator::Eval(const std::wstring& e, const std::wstring& vName, double vVal)
-{
-    expr = e; pos = 0; varName = vName; varValue_d = vVal;
-    try { return ParseExpression(); } catch (...) { return 0; }
-}
-
-const std::vector<std::wstring>& GetKnownUnitSymbols()
-{
-    static const std::vector<std::wstring> symbols = []() {
-        std::vector<std::wstring> result;
-        result.reserve(sizeof(kUnitDefinitions) / sizeof(kUnitDefinitions[0]));
-        for (const auto& definition : kUnitDefinitions)
-            result.emplace_back(definition.symbol);
-        return result;
-    }();
-    return symbols;
-}
 
-std::vector<std::wstring> FindMatchingUnitSymbols(const std::wstring& prefix)
-{
-    const std::wstring loweredPrefix = LowercaseCopy(prefix);
-    std::vector<std::wstring> matches;
-    for (const auto& symbol : GetKnownUnitSymbols())
+    MathValue NegateValue(MathValue value)
     {
-        if (loweredPrefix.empty())
-        {
-            matches.push_back(symbol);
-            continue;
-        }
-
-        const std::wstring loweredSymbol = LowercaseCopy(symbol);
-        if (loweredSymbol.compare(0, loweredPrefix.size(), loweredPrefix) == 0)
-            matches.push_back(symbol);
+        if (!value.IsError())
+            value.baseValue = -value.baseValue;
+        return value;
     }
-    return matches;
-}
 
-MathValue MathEvaluator::EvalValue(const std::wstring& e, const std::wstring& vName, const MathValue& vVal)
-{
-    expr = e;
-    pos = 0;
-    varName = vName;
-    varValue_q = vVal;
-
-    try
+    // Lane kernels for CompiledExpression::EvaluateBatch. A lane that would be an
+    // error on the scalar path (the guards in DivideValues, PowerValue,
+    // ApplyLogValue and TryApplyUnaryFunction) is set to NaN instead.
+    constexpr double kBatchNaN = std::numeric_limits<double>::quiet_NaN();
+
+#if defined(MATH_BATCH_AVX2)
+    using BatchVector = __m256d;
+    constexpr size_t kBatchWidth = 4;
+    inline BatchVector BatchLoad(const double* source) { return _mm256_loadu_pd(source); }
+    inline void BatchStore(double* target, BatchVector value) { _mm256_storeu_pd(target, value); }
+    inline BatchVector BatchBroadcast(double value) { return _mm256_set1_pd(value); }
+    inline BatchVector BatchAdd(BatchVector left, BatchVector right) { return _mm256_add_pd(left, right); }
+    inline BatchVector BatchSubtract(BatchVector left, BatchVector right) { return _mm256_sub_pd(left, right); }
+    inline BatchVector BatchMultiply(BatchVector left, BatchVector right) { return _mm256_mul_pd(left, right); }
+    inline BatchVector BatchDivide(BatchVector left, BatchVector right) { return _mm256_div_pd(left, right); }
+    inline BatchVector BatchSqrt(BatchVector value) { return _mm256_sqrt_pd(value); }
+    inline BatchVector BatchAbs(BatchVector value) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), value); }
+    inline BatchVector BatchOr(BatchVector left, BatchVector right) { return _mm256_or_pd(left, right); }
+    inline BatchVector BatchLess(BatchVector left, BatchVector right) { return _mm256_cmp_pd(left, right, _CMP_LT_OQ); }
+    inline BatchVector BatchNotLessEqual(BatchVector left, BatchVector right) { return _mm256_cmp_pd(left, right, _CMP_NLE_UQ); }
+#elif defined(MATH_BATCH_SSE2)
+    using BatchVector = __m128d;
+    constexpr size_t kBatchWidth = 2;
+    inline BatchVector BatchLoad(const double* source) { return _mm_loadu_pd(source); }
+    inline void BatchStore(double* target, BatchVector value) { _mm_storeu_pd(target, value); }
+    inline BatchVector BatchBroadcast(double value) { return _mm_set1_pd(value); }
+    inline BatchVector BatchAdd(BatchVector left, BatchVector right) { return _mm_add_pd(left, right); }
+    inline BatchVector BatchSubtract(BatchVector left, BatchVector right) { return _mm_sub_pd(left, right); }
+    inline BatchVector BatchMultiply(BatchVector left, BatchVector right) { return _mm_mul_pd(left, right); }
+    inline BatchVector BatchDivide(BatchVector left, BatchVector right) { return _mm_div_pd(left, right); }
+    inline BatchVector BatchSqrt(BatchVector value) { return _mm_sqrt_pd(value); }
+    inline BatchVector BatchAbs(BatchVector value) { return _mm_andnot_pd(_mm_set1_pd(-0.0), value); }
+    inline BatchVector BatchOr(BatchVector left, BatchVector right) { return _mm_or_pd(left, right); }
+    inline BatchVector BatchLess(BatchVector left, BatchVector right) { return _mm_cmplt_pd(left, right); }
+    inline BatchVector BatchNotLessEqual(BatchVector left, BatchVector right) { return _mm_cmpnle_pd(left, right); }
+#else
+    constexpr size_t kBatchWidth = 1;
+#endif
+
+    // Comparison masks are all-ones bit patterns, so OR-ing one into a result
+    // turns exactly the flagged lanes into NaN.
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+    inline BatchVector BatchNonFiniteMask(BatchVector value)
     {
-        MathValue value = ParseValueExpression();
-        SkipSpace();
-        if (value.IsError())
-            return value;
-        if (pos != expr.size())
-            return MathValue::Error(L"invalid expression");
-        if (!std::isfinite(value.baseValue))
-            return MathValue::Error(L"undefined");
-        return value;
+        return BatchNotLessEqual(BatchAbs(value), BatchBroadcast(DBL_MAX));
     }
-    catch (...)
+#endif
+
+    void BatchAddLanes(const double* left, const double* right, double* out, size_t count, bool subtract)
     {
-        return MathValue::Error(L"invalid expression");
+        size_t index = 0;
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+        for (; index + kBatchWidth <= count; index += kBatchWidth)
+        {
+            const BatchVector a = BatchLoad(left + index);
+            const BatchVector b = BatchLoad(right + index);
+            BatchStore(out + index, subtract ? BatchSubtract(a, b) : BatchAdd(a, b));
+        }
+#endif
+        for (; index < count; ++index)
+            out[index] = subtract ? left[index] - right[index] : left[index] + right[index];
     }
-}
 
-std::wstring BuildCanonicalUnitSymbol(const UnitDimension& dimension)
-{
-    return BuildDimensionUnitSymbol(dimension);
-}
-
-double MathEvaluator::ParseExpression()
-{
-    double val = ParseTerm();
-    while (true)
+    void BatchMultiplyLanes(const double* left, const double* right, double* out, size_t count)
     {
-        SkipSpace();
-        if (pos >= expr.size()) break;
-        if (expr[pos] == L'+') { pos++; val += ParseTerm(); }
-        else if (expr[pos] == L'-') { pos++; val -= ParseTerm(); }
-        else break;
+        size_t index = 0;
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+        for (; index + kBatchWidth <= count; index += kBatchWidth)
+            BatchStore(out + index, BatchMultiply(BatchLoad(left + index), BatchLoad(right + index)));
+#endif
+        for (; index < count; ++index)
+            out[index] = left[index] * right[index];
     }
-    return val;
-}
 
-double MathEvaluator::ParseTerm()
-{
-    double val = ParseFactor();
-    while (true)
+    void BatchDivideLanes(const double* numerator, const double* denominator, double* out, size_t count)
     {
-        SkipSpace();
-        if (pos >= expr.size()) break;
-        if (expr[pos] == L'*') { pos++; val *= ParseFactor(); }
-        else if (expr[pos] == L'/')
+        size_t index = 0;
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+        const BatchVector epsilon = BatchBroadcast(1e-12);
+        for (; index + kBatchWidth <= count; index += kBatchWidth)
         {
-            pos++;
-            double d = ParseFactor();
-            if (d != 0) val /= d;
+            const BatchVector d = BatchLoad(denominator + index);
+            const BatchVector invalid = BatchOr(BatchLess(BatchAbs(d), epsilon), BatchNonFiniteMask(d));
+            BatchStore(out + index, BatchOr(BatchDivide(BatchLoad(numerator + index), d), invalid));
         }
-        else if (IsFactorStart(expr[pos]))
+#endif
+        for (; index < count; ++index)
         {
-            val *= ParseFactor();
+            const double d = denominator[index];
+            out[index] = (!std::isfinite(d) || std::fabs(d) < 1e-12) ? kBatchNaN : numerator[index] / d;
         }
-        else break;
-    }
-    return val;
-}
-
-double MathEvaluator::ParseFactor()
-{
-    double val = ParsePower();
-    SkipSpace();
-    if (pos < expr.size() && expr[pos] == L'^')
-    {
-        pos++;
-        val = pow(val, ParseFactor());
     }
-    return val;
-}
 
-double MathEvaluator::ParsePower()
-{
-    SkipSpace();
-    if (pos >= expr.size()) return 0;
-    if (expr[pos] == L'(' || expr[pos] == L'{')
+    void BatchNegateLanes(const double* source, double* out, size_t count)
     {
-        wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-        pos++;
-        double val = ParseExpression();
-        SkipSpace();
-        if (pos < expr.size() && expr[pos] == close) pos++;
-        return val;
+        size_t index = 0;
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+        const BatchVector zero = BatchBroadcast(0.0);
+        for (; index + kBatchWidth <= count; index += kBatchWidth)
+            BatchStore(out + index, BatchSubtract(zero, BatchLoad(source + index)));
+#endif
+        for (; index < count; ++index)
+            out[index] = -source[index];
     }
-    if (expr[pos] == L'-') { pos++; return -ParsePower(); }
 
-    if (iswdigit(expr[pos]) || expr[pos] == L'.')
+    void BatchPowerLanes(const double* base, const double* exponent, double* out, size_t count)
     {
-        wchar_t* end;
-        double val = wcstod(&expr[pos], &end);
-        pos = (size_t)(end - expr.c_str());
-        return val;
+        for (size_t index = 0; index < count; ++index)
+        {
+            const double b = base[index];
+            const double p = exponent[index];
+            if (!std::isfinite(b) || !std::isfinite(p) || (b < 0 && !IsIntegerLike(p)))
+                out[index] = kBatchNaN;
+            else
+                out[index] = std::pow(b, p);
+        }
     }
 
-    if (iswalpha(expr[pos]))
+    void BatchLogLanes(const double* base, const double* argument, double* out, size_t count)
     {
-        std::wstring name;
-        while (pos < expr.size() && (iswalpha(expr[pos]) || iswdigit(expr[pos])))
+        for (size_t index = 0; index < count; ++index)
         {
-            name += expr[pos++];
+            const double b = base[index];
+            const double a = argument[index];
+            if (!std::isfinite(b) || b <= 0 || NearlyEqual(b, 1.0) || !std::isfinite(a) || a <= 0)
+                out[index] = kBatchNaN;
+            else
+                out[index] = std::log(a) / std::log(b);
         }
+    }
 
-        if (!varName.empty() && name == varName) return varValue_d;
-        if (name == L"pi") return 3.14159265358979;
-        if (name == L"e") return 2.718281828459;
-        if (name == L"log" || name == L"ln")
+    // sqrt and abs use lane instructions directly. The transcendental kernels are
+    // kept as flat loops over contiguous lanes, the shape the MSVC and GCC
+    // auto-vectorizers map onto their vector math libraries.
+    void BatchUnaryLanes(UnaryFunction function, const double* source, double* out, size_t count)
+    {
+        size_t index = 0;
+        switch (function)
         {
-            SkipSpace();
-            double base = (name == L"ln") ? 2.718281828459 : 10.0;
-            // Check for explicit base: log_base(value) or log(base, value)
-            if (pos < expr.size() && expr[pos] == L'_')
-            {
-                pos++;
-                // Parse base as number or expression in braces
-                SkipSpace();
-                if (pos < expr.size() && expr[pos] == L'{')
-                {
-                    pos++;
-                    std::wstring baseExpr;
-                    int braceCount = 1;
-                    while (pos < expr.size() && braceCount > 0)
-                    {
-                        if (expr[pos] == L'{') braceCount++;
-                        else if (expr[pos] == L'}') braceCount--;
-                        if (braceCount > 0) baseExpr += expr[pos];
-                        pos++;
-                    }
-                    MathEvaluator subEval;
-                    base = subEval.Eval(baseExpr, varName, varValue_d);
-                }
-                else
-                {
-                    // Parse number
-                    std::wstring baseStr;
-                    while (pos < expr.size() && (iswdigit(expr[pos]) || expr[pos] == L'.'))
-                    {
-                        baseStr += expr[pos++];
-                    }
-                    base = _wtof(baseStr.c_str());
-                }
-                SkipSpace();
-            }
-            // Parse argument
-            SkipSpace();
-            if (pos < expr.size() && expr[pos] == L'(')
-            {
-                pos++;
-                double arg = ParseExpression();
-                SkipSpace();
-                if (pos < expr.size() && expr[pos] == L')') pos++;
-                if (arg > 0 && base > 0 && base != 1)
-                    return log(arg) / log(base);
-            }
-            else if (pos < expr.size() && expr[pos] == L'{')
+        case UnaryFunction::Sqrt:
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+            for (; index + kBatchWidth <= count; index += kBatchWidth)
             {
-                pos++;
-                double arg = ParseExpression();
-                SkipSpace();
-                if (pos < expr.size() && expr[pos] == L'}') pos++;
-                if (arg > 0 && base > 0 && base != 1)
-                    return log(arg) / log(base);
+                const BatchVector value = BatchLoad(source + index);
+                const BatchVector invalid = BatchOr(BatchLess(value, BatchBroadcast(0.0)), BatchNonFiniteMask(value));
+                BatchStore(out + index, BatchOr(BatchSqrt(value), invalid));
             }
-            return 0;
+#endif
+            for (; index < count; ++index)
+                out[index] = (!std::isfinite(source[index]) || source[index] < 0) ? kBatchNaN : std::sqrt(source[index]);
+            return;
+        case UnaryFunction::Abs:
+#if defined(MATH_BATCH_AVX2) || defined(MATH_BATCH_SSE2)
+            for (; index + kBatchWidth <= count; index += kBatchWidth)
+                BatchStore(out + index, BatchAbs(BatchLoad(source + index)));
+#endif
+            for (; index < count; ++index)
+                out[index] = std::fabs(source[index]);
+            return;
+        case UnaryFunction::Sin:
+            for (; index < count; ++index) out[index] = std::sin(source[index]);
+            return;
+        case UnaryFunction::Cos:
+            for (; index < count; ++index) out[index] = std::cos(source[index]);
+            return;
+        case UnaryFunction::Tan:
+            for (; index < count; ++index) out[index] = std::tan(source[index]);
+            return;
+        case UnaryFunction::Atan:
+            for (; index < count; ++index) out[index] = std::atan(source[index]);
+            return;
+        case UnaryFunction::Exp:
+            for (; index < count; ++index) out[index] = std::exp(source[index]);
+            return;
+        case UnaryFunction::Asin:
+            for (; index < count; ++index)
+                out[index] = (source[index] < -1 || source[index] > 1) ? kBatchNaN : std::asin(source[index]);
+            return;
+        case UnaryFunction::Acos:
+            for (; index < count; ++index)
+                out[index] = (source[index] < -1 || source[index] > 1) ? kBatchNaN : std::acos(source[index]);
+            return;
+        default:
+            std::fill(out, out + count, kBatchNaN);
+            return;
         }
+    }
 
-        SkipSpace();
-        if (pos < expr.size() && (expr[pos] == L'(' || expr[pos] == L'{'))
-        {
-            wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-            pos++;
-            double arg = ParseExpression();
-            SkipSpace();
-            if (pos < expr.size() && expr[pos] == close) pos++;
+    // `value` on the 1e-6 grid, rounded to nearest or truncated. Past 1e12 the
+    // grid no longer fits in long long, so the integer part converts exactly
+    // and only the fraction goes through the grid. Non-finite values become 0.
+    Rational DoubleToRational(double value, bool truncate = false)
+    {
+        if (!std::isfinite(value))
+            return Rational(0);
+        if (std::fabs(value) < 1.0e12)
+            return Rational(truncate ? (long long)(value * 1000000.0) : (long long)llround(value * 1000000.0), 1000000);
+
+        const double whole = std::trunc(value);
+        int exponent = 0;
+        const double mantissa = std::frexp(whole, &exponent);
+        const BigInteger integer = exponent > 53
+            ? BigInteger((long long)std::ldexp(mantissa, 53)).ShiftLeft((size_t)(exponent - 53))
+            : BigInteger((long long)whole);
+        return Rational(integer, BigInteger(1)) + DoubleToRational(value - whole, truncate);
+    }
 
-            double funcResult = 0;
-            if (TryApplyUnaryFunction(name, arg, funcResult))
-                return funcResult;
-            return 0;
+    bool TryApplyUnaryFunction(UnaryFunction function, double arg, double& out)
+    {
+        switch (function)
+        {
+        case UnaryFunction::Sin: out = sin(arg); return true;
+        case UnaryFunction::Cos: out = cos(arg); return true;
+        case UnaryFunction::Tan: out = tan(arg); return true;
+        case UnaryFunction::Asin: if (arg < -1 || arg > 1) return false; out = asin(arg); return true;
+        case UnaryFunction::Acos: if (arg < -1 || arg > 1) return false; out = acos(arg); return true;
+        case UnaryFunction::Atan: out = atan(arg); return true;
+        case UnaryFunction::Sqrt: if (arg < 0) return false; out = sqrt(arg); return true;
+        case UnaryFunction::Abs: out = fabs(arg); return true;
+        case UnaryFunction::Exp: out = exp(arg); return true;
+        default: return false;
         }
     }
-    return 0;
+
+}
+
+const std::vector<std::wstring>& GetKnownUnitSymbols()
+{
+    static const std::vector<std::wstring> symbols = UnitSymbolMatcher().Match(L"");
+    return symbols;
+}
+
+std::vector<std::wstring> FindMatchingUnitSymbols(const std::wstring& prefix)
+{
+    return UnitSymbolMatcher().Match(prefix);
+}
+
+std::wstring BuildCanonicalUnitSymbol(const UnitDimension& dimension)
+{
+    return BuildDimensionUnitSymbol(dimension);
 }
 
-MathValue MathEvaluator::ParseValueExpression()
+const wchar_t* MathErrorText(MathError error)
 {
-    MathValue value = ParseValueTerm();
-    while (true)
+    switch (error)
     {
-        SkipSpace();
-        if (pos >= expr.size())
-            break;
-        if (expr[pos] == L'+')
-        {
-            ++pos;
-            value = AddValues(value, ParseValueTerm(), false);
-        }
-        else if (expr[pos] == L'-')
-        {
-            ++pos;
-            value = AddValues(value, ParseValueTerm(), true);
-        }
-        else
-        {
-            break;
-        }
+    case MathError::None: return L"";
+    case MathError::InvalidExpression: return L"invalid expression";
+    case MathError::Undefined: return L"undefined";
+    case MathError::UnknownSymbol: return L"unknown symbol";
+    case MathError::IncompatibleUnits: return L"incompatible units";
+    case MathError::InvalidUnitExponent: return L"invalid unit exponent";
+    case MathError::FunctionRequiresAbstractNumber: return L"function requires abstract number";
+    case MathError::ExpRequiresAbstractNumber: return L"exp requires abstract number";
+    case MathError::LogRequiresAbstractNumber: return L"log requires abstract number";
+    case MathError::InvalidLogBase: return L"invalid log base";
+    case MathError::InvalidLogArgument: return L"invalid log argument";
+    case MathError::InvalidMatrix: return L"invalid matrix";
+    case MathError::MatrixRequiresAbstractNumbers: return L"matrix requires abstract numbers";
+    case MathError::IncompatibleMatrixSizes: return L"incompatible matrix sizes";
+    case MathError::InvalidMatrixExponent: return L"invalid matrix exponent";
+    case MathError::MatrixMustBeSquare: return L"matrix must be square";
+    case MathError::SingularMatrix: return L"singular matrix";
+    case MathError::FunctionRequiresNumber: return L"function requires a number";
+    case MathError::DerivativeRequiresAbstractNumbers: return L"derivative requires abstract numbers";
+    case MathError::Incomplete: return L"incomplete";
+    case MathError::InvalidLimits: return L"invalid limits";
+    case MathError::InvalidIndex: return L"invalid index";
+    case MathError::TooManyTerms: return L"too many terms";
+    case MathError::NoIntervalBounds: return L"no interval bounds";
+    case MathError::InvalidEquation: return L"invalid equation";
+    case MathError::EquationNeedsOneUnknown: return L"equation needs exactly one unknown";
+    case MathError::NoRealRoot: return L"no real root found";
+    case MathError::CircularDefinition: return L"circular definition";
+    case MathError::Cancelled: return L"cancelled";
+    case MathError::TimeLimitExceeded: return L"time limit exceeded";
     }
-    return value;
+    return L"";
 }
 
-MathValue MathEvaluator::ParseValueTerm()
-{
-    MathValue value = ParseValueFactor();
-    while (true)
+namespace {
+    class UnitSymbolTable
     {
-        SkipSpace();
-        if (pos >= expr.size())
-            break;
+    public:
+        UnitSymbolTable() : registry(UnitRegistry::Shared()) {}
 
-        if (expr[pos] == L'*')
+        UnitSymbolId Intern(std::wstring_view symbol)
         {
-            ++pos;
-            value = MultiplyValues(value, ParseValueFactor());
+            if (symbol.empty())
+                return kNoUnitSymbol;
+            const size_t index = registry.Find(symbol);
+            if (index != UnitRegistry::kNotFound)
+                return static_cast<UnitSymbolId>(index) + 1;
+            std::lock_guard<std::mutex> lock(mutex);
+            return InternLocked(symbol);
         }
-        else if (expr[pos] == L'/')
+
+        // Registry symbols never change, so only derived ones need the lock.
+        const std::wstring& Text(UnitSymbolId id)
         {
-            ++pos;
-            value = DivideValues(value, ParseValueFactor());
+            static const std::wstring none;
+            if (id == kNoUnitSymbol)
+                return none;
+            if (id <= registry.Size())
+                return registry.At(id - 1).symbol;
+            std::lock_guard<std::mutex> lock(mutex);
+            const size_t index = id - registry.Size() - 1;
+            return index < derived.size() ? derived[index] : none;
         }
-        else if (IsFactorStart(expr[pos]))
+
+        UnitSymbolId Canonical(const UnitDimension& dimension)
         {
-            value = MultiplyValues(value, ParseValueFactor());
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto found = canonical.find(dimension.Packed());
+            if (found != canonical.end())
+                return found->second;
+            const UnitSymbolId id = InternLocked(BuildDimensionUnitSymbol(dimension));
+            canonical.emplace(dimension.Packed(), id);
+            return id;
         }
-        else
+
+    private:
+        UnitSymbolId InternLocked(std::wstring_view symbol)
         {
-            break;
+            if (symbol.empty())
+                return kNoUnitSymbol;
+            const size_t index = registry.Find(symbol);
+            if (index != UnitRegistry::kNotFound)
+                return static_cast<UnitSymbolId>(index) + 1;
+            const auto found = ids.find(std::wstring(symbol));
+            if (found != ids.end())
+                return found->second;
+            derived.emplace_back(symbol);
+            const UnitSymbolId id = static_cast<UnitSymbolId>(registry.Size() + derived.size());
+            ids.emplace(derived.back(), id);
+            return id;
         }
+
+        const UnitRegistry& registry;
+        std::mutex mutex;
+        std::deque<std::wstring> derived;  // symbols past the registry's; growing a deque keeps references valid
+        std::unordered_map<std::wstring, UnitSymbolId> ids;
+        std::unordered_map<unsigned long long, UnitSymbolId> canonical;  // by packed dimension
+    };
+
+    UnitSymbolTable& UnitSymbols()
+    {
+        static UnitSymbolTable table;
+        return table;
     }
-    return value;
 }
 
-MathValue MathEvaluator::ParseValueFactor()
+UnitSymbolId InternUnitSymbol(std::wstring_view symbol)
 {
-    MathValue value = ParseValuePower();
-    SkipSpace();
-    if (pos < expr.size() && expr[pos] == L'^')
-    {
-        ++pos;
-        value = PowerValue(value, ParseValueFactor());
-    }
-    return value;
+    return UnitSymbols().Intern(symbol);
 }
 
-MathValue MathEvaluator::ParseValuePower()
+const std::wstring& UnitSymbolText(UnitSymbolId id)
 {
-    SkipSpace();
-    if (pos >= expr.size())
-        return MathValue::Error(L"invalid expression");
-
-    if (expr[pos] == L'(' || expr[pos] == L'{')
-    {
-        const wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-        ++pos;
-        MathValue value = ParseValueExpression();
-        SkipSpace();
-        if (pos >= expr.size() || expr[pos] != close)
-            return MathValue::Error(L"invalid expression");
-        ++pos;
-        return value;
-    }
+    return UnitSymbols().Text(id);
+}
 
-    if (expr[pos] == L'-')
-    {
-        ++pos;
-        MathValue value = ParseValuePower();
-        if (!value.IsError())
-            value.baseValue = -value.baseValue;
-        return value;
-    }
+UnitSymbolId CanonicalUnitSymbolId(const UnitDimension& dimension)
+{
+    if (dimension.IsDimensionless())
+        return kNoUnitSymbol;
+    // Results of one calculation mostly share a dimension, so the last one
+    // seen on this thread answers without taking the lock.
+    thread_local UnitDimension lastDimension;
+    thread_local UnitSymbolId lastId = kNoUnitSymbol;
+    if (lastId != kNoUnitSymbol && lastDimension == dimension)
+        return lastId;
+    lastId = UnitSymbols().Canonical(dimension);
+    lastDimension = dimension;
+    return lastId;
+}
 
-    if (iswdigit(expr[pos]) || expr[pos] == L'.')
+namespace {
+    struct KeywordEntry
     {
-        wchar_t* end = nullptr;
-        const double value = wcstod(&expr[pos], &end);
-        pos = (size_t)(end - expr.c_str());
-        return MathValue::Scalar(value);
-    }
+        std::wstring_view name;
+        ExpressionToken::Keyword keyword;
+        unsigned char index;
+    };
 
-    if (iswalpha(expr[pos]))
+    // Perfect hash over the reserved names: constants, log/ln and unary
+    // functions. Unit symbols live in the UnitRegistry. The seed is searched
+    // once so that no two names share a slot; a lookup is then one hash and
+    // one comparison.
+    class KeywordTable
     {
-        std::wstring name;
-        while (pos < expr.size() && (iswalpha(expr[pos]) || iswdigit(expr[pos])))
-            name += expr[pos++];
-
-        if (!varName.empty() && name == varName)
-            return varValue_q;
-        if (name == L"pi")
-            return MathValue::Scalar(kPiValue);
-        if (name == L"e")
-            return MathValue::Scalar(kEValue);
-
-        if (name == L"log" || name == L"ln")
+    public:
+        KeywordTable()
         {
-            MathValue baseValue = MathValue::Scalar(name == L"ln" ? kEValue : 10.0);
-            SkipSpace();
-            if (name == L"log" && pos < expr.size() && expr[pos] == L'_')
+            using Keyword = ExpressionToken::Keyword;
+            const KeywordEntry fixed[] = {
+                { L"pi", Keyword::Pi, 0 },
+                { L"e", Keyword::E, 0 },
+                { L"log", Keyword::Log, 0 },
+                { L"ln", Keyword::Ln, 0 },
+                { L"sin", Keyword::Function, (unsigned char)UnaryFunction::Sin },
+                { L"cos", Keyword::Function, (unsigned char)UnaryFunction::Cos },
+                { L"tan", Keyword::Function, (unsigned char)UnaryFunction::Tan },
+                { L"asin", Keyword::Function, (unsigned char)UnaryFunction::Asin },
+                { L"acos", Keyword::Function, (unsigned char)UnaryFunction::Acos },
+                { L"atan", Keyword::Function, (unsigned char)UnaryFunction::Atan },
+                { L"sqrt", Keyword::Function, (unsigned char)UnaryFunction::Sqrt },
+                { L"abs", Keyword::Function, (unsigned char)UnaryFunction::Abs },
+                { L"exp", Keyword::Function, (unsigned char)UnaryFunction::Exp },
+            };
+            entries.assign(std::begin(fixed), std::end(fixed));
+
+            for (seed = 1;; ++seed)
             {
-                ++pos;
-                SkipSpace();
-                baseValue = ParseValuePower();
-                if (baseValue.IsError())
-                    return baseValue;
-                SkipSpace();
+                std::fill(std::begin(slots), std::end(slots), nullptr);
+                bool collision = false;
+                for (const KeywordEntry& entry : entries)
+                {
+                    const KeywordEntry*& slot = slots[Hash(entry.name, seed) & kMask];
+                    if (slot)
+                    {
+                        collision = true;
+                        break;
+                    }
+                    slot = &entry;
+                }
+                if (!collision)
+                    break;
             }
-
-            if (pos >= expr.size() || (expr[pos] != L'(' && expr[pos] != L'{'))
-                return MathValue::Error(L"invalid log argument");
-
-            const wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-            ++pos;
-            MathValue argument = ParseValueExpression();
-            SkipSpace();
-            if (pos >= expr.size() || expr[pos] != close)
-                return MathValue::Error(L"invalid log argument");
-            ++pos;
-
-            if (baseValue.IsError()) return baseValue;
-            if (argument.IsError()) return argument;
-            if (!baseValue.IsDimensionless() || !std::isfinite(baseValue.baseValue) || baseValue.baseValue <= 0 || NearlyEqual(baseValue.baseValue, 1.0))
-                return MathValue::Error(L"invalid log base");
-            if (!argument.IsDimensionless())
-                return MathValue::Error(L"log requires abstract number");
-            if (!std::isfinite(argument.baseValue) || argument.baseValue <= 0)
-                return MathValue::Error(L"invalid log argument");
-
-            return MathValue::Scalar(std::log(argument.baseValue) / std::log(baseValue.baseValue));
         }
 
-        SkipSpace();
-        if (pos < expr.size() && (expr[pos] == L'(' || expr[pos] == L'{'))
+        const KeywordEntry* Find(std::wstring_view name) const
         {
-            const wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-            ++pos;
-            MathValue argument = ParseValueExpression();
-            SkipSpace();
-            if (pos >= expr.size() || expr[pos] != close)
-                return MathValue::Error(L"invalid expression");
-            ++pos;
-            return ApplyUnaryValueFunction(name, argument);
+            const KeywordEntry* entry = slots[Hash(name, seed) & kMask];
+            return (entry && entry->name == name) ? entry : nullptr;
         }
 
-        if (const UnitDefinition* definition = FindUnitDefinition(name))
-            return MathValue::Quantity(definition->scale, definition->dimension, definition->scale, definition->symbol);
-
-        return MathValue::Error(L"unknown symbol");
-    }
+    private:
+        static constexpr size_t kSlotCount = 256;
+        static constexpr size_t kMask = kSlotCount - 1;
 
-    return MathValue::Error(L"invalid expression");
-}
+        std::vector<KeywordEntry> entries;
+        const KeywordEntry* slots[kSlotCount] = {};
+        unsigned int seed = 1;
 
-Rational MathEvaluator::EvalRational(const std::wstring& e, const std::wstring& vName, const Rational& vVal)
-{
-    expr = e; pos = 0; varName = vName; varValue_r = vVal;
-    try { return ParseExpressionRational(); } catch (...) { return Rational(0); }
-}
+        static unsigned int Hash(std::wstring_view name, unsigned int seed)
+        {
+            unsigned int hash = seed * 0x9E3779B1u;
+            for (wchar_t ch : name)
+                hash = (hash ^ (unsigned int)ch) * 0x01000193u;
+            return hash ^ (hash >> 15);
+        }
+    };
 
-Rational MathEvaluator::ParseExpressionRational()
-{
-    Rational val = ParseTermRational();
-    while (true)
+    const KeywordTable& Keywords()
     {
-        SkipSpace();
-        if (pos >= expr.size()) break;
-        if (expr[pos] == L'+') { pos++; val = val + ParseTermRational(); }
-        else if (expr[pos] == L'-') { pos++; val = val - ParseTermRational(); }
-        else break;
+        static const KeywordTable table;
+        return table;
     }
-    return val;
-}
 
-Rational MathEvaluator::ParseTermRational()
-{
-    Rational val = ParseFactorRational();
-    while (true)
+    // Splits text[0, end) into the tokens the grammar reads: numbers as wcstod
+    // sees them, alphanumeric identifiers, and single-character symbols.
+    // Whitespace is dropped. Identifier tokens view into `text`, which must
+    // outlive them.
+    void LexExpressionText(const std::wstring& text, size_t end, std::vector<ExpressionToken>& out)
     {
-        SkipSpace();
-        if (pos >= expr.size()) break;
-        if (expr[pos] == L'*') { pos++; val = val * ParseFactorRational(); }
-        else if (expr[pos] == L'/')
-        {
-            pos++;
-            Rational d = ParseFactorRational();
-            if (d.num != 0) val = val / d;
-        }
-        else if (IsFactorStart(expr[pos]))
+        const KeywordTable& keywords = Keywords();
+        const UnitRegistry& units = UnitRegistry::Shared();
+        size_t pos = 0;
+        while (pos < end)
         {
-            val = val * ParseFactorRational();
-        }
-        else break;
-    }
-    return val;
-}
+            const wchar_t ch = text[pos];
+            if (iswspace(ch))
+            {
+                ++pos;
+                continue;
+            }
 
-Rational MathEvaluator::ParseFactorRational()
-{
-    Rational val = ParsePowerRational();
-    SkipSpace();
-    if (pos < expr.size() && expr[pos] == L'^')
-    {
-        pos++;
-        // For rational arithmetic, we'll only handle integer exponents
-        Rational exp = ParseFactorRational();
-        if (exp.den == 1) {  // integer exponent
-            long long n = exp.num;
-            if (n == 0) return Rational(1);
-            else if (n > 0) {
-                Rational result(1);
-                for (long long i = 0; i < n; i++) {
-                    result = result * val;
+            ExpressionToken token;
+            if (iswdigit(ch) || ch == L'.')
+            {
+                wchar_t* numberEnd = nullptr;
+                double value = wcstod(&text[pos], &numberEnd);
+                size_t next = (size_t)(numberEnd - text.c_str());
+                if (next > end)
+                {
+                    // The number runs past the cut; read only the part before it.
+                    const std::wstring head = text.substr(pos, end - pos);
+                    value = wcstod(head.c_str(), &numberEnd);
+                    next = pos + (size_t)(numberEnd - head.c_str());
                 }
-                return result;
-            } else {  // negative exponent
-                Rational base_inv = Rational(val.den, val.num);  // reciprocal
-                Rational result(1);
-                for (long long i = 0; i < -n; i++) {
-                    result = result * base_inv;
+                if (next > pos)
+                {
+                    token.kind = ExpressionToken::Kind::Number;
+                    token.number = value;
+                    pos = next;
+                    out.push_back(token);
+                    continue;
                 }
-                return result;
+                // A lone '.' is not a number; leave it as a symbol so parsing
+                // stops there instead of looping on it.
+            }
+            else if (iswalpha(ch))
+            {
+                const size_t start = pos;
+                // An underscore between letters or digits stays in the name
+                // (x_1, rate_0), except after "log", where it starts the base.
+                while (pos < end && (iswalpha(text[pos]) || iswdigit(text[pos]) ||
+                                     (text[pos] == L'_' && pos + 1 < end && iswalnum(text[pos + 1]) &&
+                                      std::wstring_view(text.data() + start, pos - start) != L"log")))
+                    ++pos;
+                token.kind = ExpressionToken::Kind::Identifier;
+                token.name = std::wstring_view(text.data() + start, pos - start);
+                if (const KeywordEntry* entry = keywords.Find(token.name))
+                {
+                    token.keyword = entry->keyword;
+                    token.keywordIndex = entry->index;
+                }
+                else
+                {
+                    const size_t unit = units.Find(token.name);
+                    if (unit != UnitRegistry::kNotFound)
+                    {
+                        token.keyword = ExpressionToken::Keyword::Unit;
+                        token.keywordIndex = static_cast<unsigned int>(unit);
+                    }
+                }
+                out.push_back(token);
+                continue;
             }
+
+            token.kind = ExpressionToken::Kind::Symbol;
+            token.symbol = ch;
+            ++pos;
+            out.push_back(token);
         }
-        // If not integer exponent, return the double result as a rational approximation
-        return Rational((long long)(pow(val.toDouble(), exp.toDouble()) * 1000000), 1000000);
     }
-    return val;
-}
 
-Rational MathEvaluator::ParsePowerRational()
-{
-    SkipSpace();
-    if (pos >= expr.size()) return Rational(0);
-    if (expr[pos] == L'(' || expr[pos] == L'{')
+    bool IsBlankText(const std::wstring& text)
     {
-        wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-        pos++;
-        Rational val = ParseExpressionRational();
-        SkipSpace();
-        if (pos < expr.size() && expr[pos] == close) pos++;
-        return val;
+        return text.find_first_not_of(L" \t") == std::wstring::npos;
     }
-    if (expr[pos] == L'-') { pos++; return Rational(0) - ParsePowerRational(); }
 
-    if (iswdigit(expr[pos]) || expr[pos] == L'.')
+    // Square roots written with index 2 parse like the plain radical.
+    bool IsDefaultRootIndex(const std::wstring& text)
     {
-        wchar_t* end;
-        double val = wcstod(&expr[pos], &end);
-        pos = (size_t)(end - expr.c_str());
-        return DoubleToRational(val);
+        const size_t first = text.find_first_not_of(L" \t");
+        const size_t last = text.find_last_not_of(L" \t");
+        return first != std::wstring::npos && first == last && text[first] == L'2';
     }
 
-    if (iswalpha(expr[pos]))
+    // Parser input: a token from a leaf text run, or a structural node.
+    struct ExpressionItem
+    {
+        const ExpressionToken* token = nullptr;
+        const MathNode* node = nullptr;
+    };
+
+    // Slot content: structured children when present, otherwise plain text.
+    struct SlotSource
     {
-        std::wstring name;
-        while (pos < expr.size() && (iswalpha(expr[pos]) || iswdigit(expr[pos])))
+        const std::vector<MathNode>* nodes = nullptr;
+        const std::wstring* text = nullptr;
+    };
+
+    // Turns text and node sequences into parser items. Structural nodes stay
+    // whole; Text and Group nodes are inlined as the tokens of their text.
+    class ExpressionItemBuilder
+    {
+    public:
+        explicit ExpressionItemBuilder(ExpressionTokenCache* tokenCache) : cache(tokenCache) {}
+
+        void AppendText(const std::wstring& text, std::vector<ExpressionItem>& out)
         {
-            name += expr[pos++];
+            AppendTokens(TokensFor(text), out);
         }
-        if (!varName.empty() && name == varName) return varValue_r;
-        if (name == L"pi") return Rational(3141592, 1000000);  // Approximation of pi
-        if (name == L"e") return Rational(2718281, 1000000);  // Approximation of e
 
-        if (name == L"log" || name == L"ln")
+        // With `stopMarker`, items end where the marker first appears in a
+        // top-level text run.
+        void AppendSource(const SlotSource& source, std::vector<ExpressionItem>& out, const wchar_t* stopMarker = nullptr)
         {
-            SkipSpace();
-            double base = (name == L"ln") ? 2.718281828459 : 10.0;
-
-            if (pos < expr.size() && expr[pos] == L'_')
+            if (source.nodes && !source.nodes->empty())
             {
-                pos++;
-                SkipSpace();
-                if (pos < expr.size() && expr[pos] == L'{')
-                {
-                    pos++;
-                    std::wstring baseExpr;
-                    int braceCount = 1;
-                    while (pos < expr.size() && braceCount > 0)
-                    {
-                        if (expr[pos] == L'{') braceCount++;
-                        else if (expr[pos] == L'}') braceCount--;
-                        if (braceCount > 0) baseExpr += expr[pos];
-                        pos++;
-                    }
-                    MathEvaluator subEval;
-                    base = subEval.EvalRational(baseExpr, varName, varValue_r).toDouble();
-                }
-                else
-                {
-                    std::wstring baseStr;
-                    while (pos < expr.size() && (iswdigit(expr[pos]) || expr[pos] == L'.'))
-                    {
-                        baseStr += expr[pos++];
-                    }
-                    base = _wtof(baseStr.c_str());
-                }
-                SkipSpace();
+                AppendNodes(*source.nodes, out, stopMarker);
+                return;
             }
+            if (!source.text)
+                return;
 
-            SkipSpace();
-            if (pos < expr.size() && (expr[pos] == L'(' || expr[pos] == L'{'))
+            const size_t stop = stopMarker ? source.text->find(stopMarker) : std::wstring::npos;
+            if (stop == std::wstring::npos)
+                AppendText(*source.text, out);
+            else
+                AppendTokens(LexOwned(*source.text, stop), out);
+        }
+
+        static void AppendTokens(const std::vector<ExpressionToken>& tokens, std::vector<ExpressionItem>& out)
+        {
+            for (const ExpressionToken& token : tokens)
             {
-                wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-                pos++;
-                double arg = ParseExpressionRational().toDouble();
-                SkipSpace();
-                if (pos < expr.size() && expr[pos] == close) pos++;
-                if (arg > 0 && base > 0 && base != 1)
-                    return DoubleToRational(log(arg) / log(base));
+                ExpressionItem item;
+                item.token = &token;
+                out.push_back(item);
             }
-            return Rational(0);
         }
 
-        SkipSpace();
-        if (pos < expr.size() && (expr[pos] == L'(' || expr[pos] == L'{'))
+    private:
+        ExpressionTokenCache* cache;
+        // Token storage for runs lexed without a cache. Each run has its own
+        // block, so references stay stable, and an unused builder allocates
+        // nothing.
+        std::vector<std::unique_ptr<std::vector<ExpressionToken>>> ownedTokens;
+
+        const std::vector<ExpressionToken>& TokensFor(const std::wstring& text)
         {
-            wchar_t close = (expr[pos] == L'(') ? L')' : L'}';
-            pos++;
-            double arg = ParseExpressionRational().toDouble();
-            SkipSpace();
-            if (pos < expr.size() && expr[pos] == close) pos++;
+            if (cache)
+                return cache->Lookup(text);
+            return LexOwned(text, text.size());
+        }
 
-            double funcResult = 0;
-            if (TryApplyUnaryFunction(name, arg, funcResult))
-                return DoubleToRational(funcResult);
-            return Rational(0);
+        const std::vector<ExpressionToken>& LexOwned(const std::wstring& text, size_t end)
+        {
+            ownedTokens.push_back(std::make_unique<std::vector<ExpressionToken>>());
+            LexExpressionText(text, end, *ownedTokens.back());
+            return *ownedTokens.back();
         }
-    }
-    return Rational(0);
-}
 
-void MathEvaluator::SkipSpace() { while (pos < expr.size() && iswspace(expr[pos])) pos++; }
+        // Returns false once `stopMarker` has been reached.
+        bool AppendNodes(const std::vector<MathNode>& nodes, std::vector<ExpressionItem>& out, const wchar_t* stopMarker)
+        {
+            for (const MathNode& node : nodes)
+            {
+                if (node.IsStructural())
+                {
+                    ExpressionItem item;
+                    item.node = &node;
+                    out.push_back(item);
+                    continue;
+                }
 
-bool ParseLowerLimit(const std::wstring& s, std::wstring& var, double& val)
-{
-    size_t eq = s.find(L'=');
-    if (eq == std::wstring::npos) { var = L"i"; val = _wtof(s.c_str()); return true; }
-    var = s.substr(0, eq);
-    size_t first = var.find_first_not_of(L" ");
-    size_t last = var.find_last_not_of(L" ");
-    if (first != std::wstring::npos && last != std::wstring::npos)
-        var = var.substr(first, last - first + 1);
-    val = _wtof(s.substr(eq + 1).c_str());
+                if (stopMarker)
+                {
+                    const size_t stop = node.text.find(stopMarker);
+                    if (stop != std::wstring::npos)
+                    {
+                        AppendTokens(LexOwned(node.text, stop), out);
+                        return false;
+                    }
+                }
+                if (!node.text.empty())
+                    AppendText(node.text, out);
+                if (!AppendNodes(node.children, out, stopMarker))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // Concatenated text of a slot without nested notation; false if it has any.
+    bool TryGetPlainText(const std::vector<MathNode>& nodes, std::wstring& out)
+    {
+        for (const MathNode& node : nodes)
+        {
+            if (node.IsStructural())
+                return false;
+            out += node.text;
+            if (!TryGetPlainText(node.children, out))
+                return false;
+        }
+        return true;
+    }
+
+    bool TryGetPlainText(const SlotSource& source, std::wstring& out)
+    {
+        if (source.nodes && !source.nodes->empty())
+            return TryGetPlainText(*source.nodes, out);
+        if (source.text)
+            out = *source.text;
+        return true;
+    }
+
+    bool IsBlankSource(const SlotSource& source)
+    {
+        std::wstring text;
+        return TryGetPlainText(source, text) && IsBlankText(text);
+    }
+
+    // The one recursive-descent grammar behind every evaluation path:
+    //
+    //   expression := term (('+' | '-') term)*
+    //   term       := factor (('*' | '/') factor | factor)*      (juxtaposition multiplies)
+    //   factor     := primary ('^' factor)?
+    //   primary    := group | structure | '-' primary | number | identifier
+    //
+    // `Domain` supplies the value type and the arithmetic. Strict domains
+    // (`kStrict`) reject unclosed groups and leftover slot input; lenient ones
+    // accept them and turn every failure into their zero value. Domains with
+    // `kMatrices` also read `[a, b; c, d]` literals as primaries and `^T` as
+    // a transpose. Domains with `kSymbols` offer every identifier other than
+    // the bound variable to `Symbol` before reading it as a keyword. Nested
+    // summation and product nodes need `kLoops`, which hands the index, the
+    // limits and the unparsed body to `Loop`; other domains reject them.
+    template <typename Domain>
+    class ExpressionParser
+    {
+    public:
+        using Value = typename Domain::Value;
+
+        ExpressionParser(Domain& targetDomain, ExpressionItemBuilder& itemBuilder, const std::wstring& variable)
+            : domain(targetDomain), builder(itemBuilder), varName(variable)
+        {
+        }
+
+        std::vector<ExpressionItem>& Items() { return items; }
+
+        Value ParseExpression()
+        {
+            Value value = ParseTerm();
+            while (!AtEnd())
+            {
+                if (AtSymbol(L'+'))
+                {
+                    ++pos;
+                    value = domain.Add(value, ParseTerm());
+                }
+                else if (AtSymbol(L'-'))
+                {
+                    ++pos;
+                    value = domain.Subtract(value, ParseTerm());
+                }
+                else
+                {
+                    break;
+                }
+            }
+            return value;
+        }
+
+        bool AtEnd() const { return pos >= items.size(); }
+
+        // Parses a top-level object as if it were a nested node of `kind`.
+        Value ParseStructure(MathNodeKind kind, const std::vector<SlotSource>& slots)
+        {
+            const SlotSource empty;
+            const SlotSource& first = slots.size() > 0 ? slots[0] : empty;
+            const SlotSource& second = slots.size() > 1 ? slots[1] : empty;
+
+            switch (kind)
+            {
+            case MathNodeKind::SquareRoot:
+            {
+                std::wstring indexText;
+                if (TryGetPlainText(second, indexText) && (IsBlankText(indexText) || IsDefaultRootIndex(indexText)))
+                    return domain.Function(UnaryFunction::Sqrt, ParseSlot(first));
+
+                const Value radicand = ParseSlot(first);
+                const Value one = domain.Number(1.0);
+                return domain.Power(radicand, domain.Divide(one, ParseSlot(second)));
+            }
+            case MathNodeKind::Fraction:
+            {
+                const Value numerator = ParseSlot(first);
+                return domain.Divide(numerator, ParseSlot(second));
+            }
+            case MathNodeKind::Power:
+            {
+                const Value base = ParseSlot(first);
+                return domain.Power(base, ParseSlot(second));
+            }
+            case MathNodeKind::AbsoluteValue:
+                return domain.Function(UnaryFunction::Abs, ParseSlot(first));
+            case MathNodeKind::Logarithm:
+            {
+                const Value base = IsBlankSource(first) ? domain.Number(10.0) : ParseSlot(first);
+                return domain.Log(base, ParseSlot(second));
+            }
+            case MathNodeKind::Summation:
+            case MathNodeKind::Product:
+                if constexpr (Domain::kLoops)
+                    return ParseLoop(kind == MathNodeKind::Product, slots);
+                else
+                    return domain.Error(MathError::InvalidExpression);
+            default:
+                return ParseSlot(first);
+            }
+        }
+
+    private:
+        Domain& domain;
+        ExpressionItemBuilder& builder;
+        const std::wstring& varName;
+        std::vector<ExpressionItem> items;
+        size_t pos = 0;
+
+        const ExpressionToken* CurrentToken() const
+        {
+            return AtEnd() ? nullptr : items[pos].token;
+        }
+
+        bool AtSymbol(wchar_t symbol) const
+        {
+            const ExpressionToken* token = CurrentToken();
+            return token && token->kind == ExpressionToken::Kind::Symbol && token->symbol == symbol;
+        }
+
+        bool AtStructure() const
+        {
+            return !AtEnd() && items[pos].node != nullptr;
+        }
+
+        // A group, or a structural node, which is already delimited.
+        bool AtDelimited() const
+        {
+            return AtStructure() || AtSymbol(L'(') || AtSymbol(L'{');
+        }
+
+        bool AtFactorStart() const
+        {
+            if (AtEnd())
+                return false;
+            const ExpressionToken* token = items[pos].token;
+            if (!token)
+                return true;
+            return token->kind != ExpressionToken::Kind::Symbol || token->symbol == L'(' || token->symbol == L'{' ||
+                   (Domain::kMatrices && token->symbol == L'[');
+        }
+
+        // Parses the delimited operand at the current item. Returns false when
+        // a group is not closed.
+        bool ParseDelimited(Value& value)
+        {
+            if (AtStructure())
+            {
+                value = ParseNode(*items[pos++].node);
+                return true;
+            }
+
+            const wchar_t close = AtSymbol(L'(') ? L')' : L'}';
+            ++pos;
+            value = ParseExpression();
+            if (!AtSymbol(close))
+                return false;
+            ++pos;
+            return true;
+        }
+
+        // A slot parses as a complete expression of its own.
+        Value ParseSlot(const SlotSource& source)
+        {
+            ExpressionParser nested(domain, builder, varName);
+            builder.AppendSource(source, nested.items);
+            const Value value = nested.ParseExpression();
+            if (Domain::kStrict && !nested.AtEnd())
+                return domain.Error(MathError::InvalidExpression);
+            return value;
+        }
+
+        // Slots: "index=start", the upper limit, then the body. The limits are
+        // read here, in the enclosing scope; the body goes to the domain whole
+        // so it can be compiled once with the index bound.
+        Value ParseLoop(bool product, const std::vector<SlotSource>& slots)
+        {
+            if (slots.size() < 3 || IsBlankSource(slots[0]) || IsBlankSource(slots[1]) || IsBlankSource(slots[2]))
+                return domain.Error(MathError::Incomplete);
+
+            ExpressionParser lower(domain, builder, varName);
+            builder.AppendSource(slots[0], lower.items);
+            const ExpressionToken* index = lower.CurrentToken();
+            if (!index || index->kind != ExpressionToken::Kind::Identifier)
+                return domain.Error(MathError::InvalidLimits);
+            ++lower.pos;
+            if (!lower.AtSymbol(L'='))
+                return domain.Error(MathError::InvalidLimits);
+            ++lower.pos;
+            const Value first = lower.ParseExpression();
+            if (!lower.AtEnd())
+                return domain.Error(MathError::InvalidLimits);
+            const Value last = ParseSlot(slots[1]);
+            return domain.Loop(product, std::wstring(index->name), first, last, slots[2], builder, varName);
+        }
+
+        Value ParseNode(const MathNode& node)
+        {
+            std::vector<SlotSource> slots(MathNode::SlotCountForKind(node.kind));
+            for (size_t index = 0; index < slots.size(); ++index)
+                slots[index].nodes = &node.SlotNodes(index);
+            return ParseStructure(node.kind, slots);
+        }
+
+        Value ParseTerm()
+        {
+            Value value = ParseFactor();
+            while (!AtEnd())
+            {
+                if (AtSymbol(L'*'))
+                {
+                    ++pos;
+                    value = domain.Multiply(value, ParseFactor());
+                }
+                else if (AtSymbol(L'/'))
+                {
+                    ++pos;
+                    value = domain.Divide(value, ParseFactor());
+                }
+                else if (AtFactorStart())
+                {
+                    value = domain.Multiply(value, ParseFactor());
+                }
+                else
+                {
+                    break;
+                }
+            }
+            return value;
+        }
+
+        Value ParseFactor()
+        {
+            Value value = ParsePrimary();
+            if (AtSymbol(L'^'))
+            {
+                ++pos;
+                if constexpr (Domain::kMatrices)
+                {
+                    const ExpressionToken* token = CurrentToken();
+                    if (token && token->kind == ExpressionToken::Kind::Identifier && token->name == L"T" && varName != L"T")
+                    {
+                        ++pos;
+                        return domain.Transpose(value);
+                    }
+                }
+                value = domain.Power(value, ParseFactor());
+            }
+            return value;
+        }
+
+        // '[' entry (',' entry)* (';' entry (',' entry)*)* ']'
+        Value ParseMatrixLiteral()
+        {
+            ++pos;
+            std::vector<std::vector<Value>> rows(1);
+            while (true)
+            {
+                rows.back().push_back(ParseExpression());
+                if (AtSymbol(L','))
+                {
+                    ++pos;
+                }
+                else if (AtSymbol(L';'))
+                {
+                    ++pos;
+                    rows.emplace_back();
+                }
+                else if (AtSymbol(L']'))
+                {
+                    ++pos;
+                    return domain.MatrixLiteral(rows);
+                }
+                else
+                {
+                    return domain.Error(MathError::InvalidMatrix);
+                }
+            }
+        }
+
+        Value ParsePrimary()
+        {
+            if (AtEnd())
+                return domain.Error(MathError::InvalidExpression);
+
+            if (AtDelimited())
+            {
+                Value value = Value();
+                if (!ParseDelimited(value) && Domain::kStrict)
+                    return domain.Error(MathError::InvalidExpression);
+                return value;
+            }
+
+            if (AtSymbol(L'-'))
+            {
+                ++pos;
+                return domain.Negate(ParsePrimary());
+            }
+            if (AtSymbol(L'+'))
+            {
+                ++pos;
+                return ParsePrimary();
+            }
+
+            if constexpr (Domain::kMatrices)
+            {
+                if (AtSymbol(L'['))
+                    return ParseMatrixLiteral();
+            }
+
+            const ExpressionToken* token = CurrentToken();
+            if (token->kind == ExpressionToken::Kind::Number)
+            {
+                ++pos;
+                return domain.Number(token->number);
+            }
+
+            if (token->kind == ExpressionToken::Kind::Identifier)
+            {
+                ++pos;
+                return ParseIdentifier(*token);
+            }
+
+            return domain.Error(MathError::InvalidExpression);
+        }
+
+        Value ParseIdentifier(const ExpressionToken& token)
+        {
+            using Keyword = ExpressionToken::Keyword;
+            if (!varName.empty() && token.name == varName)
+                return domain.Variable();
+            // Context bindings shadow keywords the way the bound variable
+            // does; document variables are never keywords.
+            if constexpr (Domain::kSymbols)
+            {
+                Value value = Value();
+                if (domain.Symbol(token.name, value))
+                    return value;
+            }
+            if (token.keyword == Keyword::Pi)
+                return domain.Constant(kPiValue);
+            if (token.keyword == Keyword::E)
+                return domain.Constant(kEValue);
+
+            if (token.keyword == Keyword::Log || token.keyword == Keyword::Ln)
+            {
+                Value base = Value();
+                if (token.keyword == Keyword::Log && AtSymbol(L'_'))
+                {
+                    ++pos;
+                    base = ParsePrimary();
+                }
+                else
+                {
+                    base = domain.Constant(token.keyword == Keyword::Ln ? kEValue : 10.0);
+                }
+
+                // Domains check the base before the argument, so a failing
+                // base wins over anything after it.
+                if (!AtDelimited())
+                    return domain.Log(base, domain.Error(MathError::InvalidLogArgument));
+                Value argument = Value();
+                if (!ParseDelimited(argument) && Domain::kStrict)
+                    return domain.Log(base, domain.Error(MathError::InvalidLogArgument));
+                return domain.Log(base, argument);
+            }
+
+            if (AtDelimited())
+            {
+                Value argument = Value();
+                if (!ParseDelimited(argument) && Domain::kStrict)
+                    return domain.Error(MathError::InvalidExpression);
+                const UnaryFunction function = token.keyword == Keyword::Function ? (UnaryFunction)token.keywordIndex : UnaryFunction::Unknown;
+                return domain.Function(function, argument);
+            }
+
+            if (token.keyword == Keyword::Unit)
+                return domain.Unit(UnitRegistry::Shared().At(token.keywordIndex));
+
+            return domain.Error(MathError::UnknownSymbol);
+        }
+    };
+
+    // Lenient double arithmetic behind `Eval`: malformed input, units and
+    // undefined results evaluate to 0, and division by zero keeps the dividend.
+    struct DoubleDomain
+    {
+        using Value = double;
+        static constexpr bool kStrict = false;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        double varValue = 0.0;
+
+        double Number(double value) { return value; }
+        double Variable() { return varValue; }
+        double Constant(double value) { return value; }
+        double Unit(const UnitDefinition&) { return 0.0; }
+        double Error(MathError) { return 0.0; }
+        double Negate(double value) { return -value; }
+        double Add(double left, double right) { return left + right; }
+        double Subtract(double left, double right) { return left - right; }
+        double Multiply(double left, double right) { return left * right; }
+        double Divide(double left, double right) { return right != 0 ? left / right : left; }
+        double Power(double base, double exponent) { return pow(base, exponent); }
+
+        double Function(UnaryFunction function, double argument)
+        {
+            double result = 0.0;
+            return TryApplyUnaryFunction(function, argument, result) ? result : 0.0;
+        }
+
+        double Log(double base, double argument)
+        {
+            if (argument > 0 && base > 0 && base != 1)
+                return log(argument) / log(base);
+            return 0.0;
+        }
+    };
+
+    // Unit-aware values behind `EvalValue`; failures carry their message and
+    // the leftmost one wins.
+    struct ValueDomain
+    {
+        using Value = MathValue;
+        static constexpr bool kStrict = true;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        MathValue varValue;
+
+        MathValue Number(double value) { return MathValue::Scalar(value); }
+        MathValue Variable() { return varValue; }
+        MathValue Constant(double value) { return MathValue::Scalar(value); }
+        MathValue Unit(const UnitDefinition& definition)
+        {
+            return MathValue::Quantity(definition.scale, definition.dimension, definition.scale, UnitSymbolIdOf(definition));
+        }
+        MathValue Error(MathError code) { return MathValue::Error(code); }
+        MathValue Negate(const MathValue& value) { return NegateValue(value); }
+        MathValue Add(const MathValue& left, const MathValue& right) { return AddValues(left, right, false); }
+        MathValue Subtract(const MathValue& left, const MathValue& right) { return AddValues(left, right, true); }
+        MathValue Multiply(const MathValue& left, const MathValue& right) { return MultiplyValues(left, right); }
+        MathValue Divide(const MathValue& left, const MathValue& right) { return DivideValues(left, right); }
+        MathValue Power(const MathValue& base, const MathValue& exponent) { return PowerValue(base, exponent); }
+        MathValue Function(UnaryFunction function, const MathValue& argument) { return ApplyUnaryValueFunction(function, argument); }
+        MathValue Log(const MathValue& base, const MathValue& argument) { return ApplyLogValue(base, argument); }
+    };
+
+    // Exact fractions behind `EvalRational`, lenient like `DoubleDomain`.
+    // Transcendental results and constants are rounded to 1e-6.
+    struct RationalDomain
+    {
+        using Value = Rational;
+        static constexpr bool kStrict = false;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        Rational varValue;
+        // Cleared once anything is approximated: constants, functions, grid-
+        // rounded numbers, non-integer powers or a failure.
+        bool exact = true;
+
+        Rational Number(double value)
+        {
+            const Rational result = DoubleToRational(value);
+            exact = exact && result.toDouble() == value;
+            return result;
+        }
+        Rational Variable() { return varValue; }
+        Rational Constant(double value) { exact = false; return DoubleToRational(value, true); }
+        Rational Unit(const UnitDefinition&) { exact = false; return Rational(0); }
+        Rational Error(MathError) { exact = false; return Rational(0); }
+        Rational Negate(const Rational& value) { return Rational(0) - value; }
+        Rational Add(const Rational& left, const Rational& right) { return left + right; }
+        Rational Subtract(const Rational& left, const Rational& right) { return left - right; }
+        Rational Multiply(const Rational& left, const Rational& right) { return left * right; }
+
+        Rational Divide(const Rational& left, const Rational& right)
+        {
+            if (!right.IsZero())
+                return left / right;
+            exact = false;
+            return left;
+        }
+
+        Rational Power(const Rational& base, const Rational& exponent)
+        {
+            // Only integer exponents with results of bounded size stay exact.
+            long long power = 0;
+            Rational result;
+            if (exponent.TryGetInteger(power) && base.TryPow(power, result))
+                return result;
+            exact = false;
+            return DoubleToRational(pow(base.toDouble(), exponent.toDouble()), true);
+        }
+
+        Rational Function(UnaryFunction function, const Rational& argument)
+        {
+            exact = false;
+            double result = 0.0;
+            if (TryApplyUnaryFunction(function, argument.toDouble(), result))
+                return DoubleToRational(result);
+            return Rational(0);
+        }
+
+        Rational Log(const Rational& base, const Rational& argument)
+        {
+            exact = false;
+            const double baseValue = base.toDouble();
+            const double argumentValue = argument.toDouble();
+            if (argumentValue > 0 && baseValue > 0 && baseValue != 1)
+                return DoubleToRational(log(argumentValue) / log(baseValue));
+            return Rational(0);
+        }
+    };
+
+    // A constant plus rational multiples of unknowns.
+    struct LinearForm
+    {
+        Rational constant;
+        std::map<std::wstring, Rational, std::less<>> coefficients;
+
+        bool IsConstant() const { return coefficients.empty(); }
+    };
+
+    // Linear forms behind `ParseLinearEquationRational`. Every identifier that
+    // is not a constant, function or unit is an unknown. Anything the solver
+    // cannot represent throws: an unknown in a denominator, exponent or
+    // function argument, a product of unknowns, units and malformed input.
+    struct LinearDomain
+    {
+        using Value = LinearForm;
+        static constexpr bool kStrict = true;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = true;
+        static constexpr bool kLoops = false;
+
+        [[noreturn]] static void Unsupported()
+        {
+            throw std::runtime_error("Unsupported term in linear equation");
+        }
+
+        static LinearForm Scalar(const Rational& value)
+        {
+            LinearForm form;
+            form.constant = value;
+            return form;
+        }
+
+        static LinearForm Scaled(LinearForm form, const Rational& factor)
+        {
+            form.constant = form.constant * factor;
+            for (auto& term : form.coefficients)
+                term.second = term.second * factor;
+            return form;
+        }
+
+        static LinearForm Combined(LinearForm left, const LinearForm& right, const Rational& sign)
+        {
+            left.constant = left.constant + right.constant * sign;
+            for (const auto& term : right.coefficients)
+            {
+                Rational& slot = left.coefficients[term.first];
+                slot = slot + term.second * sign;
+            }
+            return left;
+        }
+
+        bool Symbol(std::wstring_view name, LinearForm& value)
+        {
+            if (Keywords().Find(name) || UnitRegistry::Shared().Find(name) != UnitRegistry::kNotFound)
+                return false;
+            value.coefficients.emplace(std::wstring(name), Rational(1));
+            return true;
+        }
+
+        LinearForm Number(double value) { return Scalar(DoubleToRational(value)); }
+        LinearForm Variable() { Unsupported(); }
+        LinearForm Constant(double value) { return Scalar(DoubleToRational(value, true)); }
+        LinearForm Unit(const UnitDefinition&) { Unsupported(); }
+        LinearForm Error(MathError) { Unsupported(); }
+        LinearForm Negate(const LinearForm& value) { return Scaled(value, Rational(-1)); }
+        LinearForm Add(const LinearForm& left, const LinearForm& right) { return Combined(left, right, Rational(1)); }
+        LinearForm Subtract(const LinearForm& left, const LinearForm& right) { return Combined(left, right, Rational(-1)); }
+
+        LinearForm Multiply(const LinearForm& left, const LinearForm& right)
+        {
+            if (left.IsConstant())
+                return Scaled(right, left.constant);
+            if (right.IsConstant())
+                return Scaled(left, right.constant);
+            Unsupported();
+        }
+
+        LinearForm Divide(const LinearForm& left, const LinearForm& right)
+        {
+            if (!right.IsConstant() || right.constant.IsZero())
+                Unsupported();
+            return Scaled(left, Rational(1) / right.constant);
+        }
+
+        LinearForm Power(const LinearForm& base, const LinearForm& exponent)
+        {
+            if (!exponent.IsConstant())
+                Unsupported();
+            if (!base.IsConstant())
+            {
+                if (exponent.constant == Rational(1))
+                    return base;
+                Unsupported();
+            }
+            long long power = 0;
+            Rational result;
+            if (exponent.constant.TryGetInteger(power) && base.constant.TryPow(power, result))
+                return Scalar(result);
+            const double value = pow(base.constant.toDouble(), exponent.constant.toDouble());
+            if (!std::isfinite(value))
+                Unsupported();
+            return Scalar(DoubleToRational(value, true));
+        }
+
+        LinearForm Function(UnaryFunction function, const LinearForm& argument)
+        {
+            double result = 0.0;
+            if (!argument.IsConstant() || !TryApplyUnaryFunction(function, argument.constant.toDouble(), result))
+                Unsupported();
+            return Scalar(DoubleToRational(result));
+        }
+
+        LinearForm Log(const LinearForm& base, const LinearForm& argument)
+        {
+            if (!base.IsConstant() || !argument.IsConstant())
+                Unsupported();
+            const double baseValue = base.constant.toDouble();
+            const double argumentValue = argument.constant.toDouble();
+            if (!(argumentValue > 0 && baseValue > 0 && baseValue != 1))
+                Unsupported();
+            return Scalar(DoubleToRational(log(argumentValue) / log(baseValue)));
+        }
+    };
+
+    // Dual numbers a + b*eps with eps^2 = 0 behind `EvalDual`: every rule
+    // carries the derivative alongside the value, so f'(x) comes out of the
+    // same single pass as f(x). Failures carry their message and the leftmost
+    // one wins.
+    struct DualDomain
+    {
+        using Value = DualNumber;
+        static constexpr bool kStrict = true;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        DualNumber varValue;
+
+        static DualNumber Make(double value, double derivative)
+        {
+            DualNumber result;
+            result.value = value;
+            result.derivative = derivative;
+            return result;
+        }
+
+        DualNumber Number(double value) { return DualNumber::Constant(value); }
+        DualNumber Variable() { return varValue; }
+        DualNumber Constant(double value) { return DualNumber::Constant(value); }
+        DualNumber Unit(const UnitDefinition&) { return DualNumber::Error(MathError::DerivativeRequiresAbstractNumbers); }
+        DualNumber Error(MathError code) { return DualNumber::Error(code); }
+
+        DualNumber Negate(const DualNumber& value)
+        {
+            if (value.IsError())
+                return value;
+            return Make(-value.value, -value.derivative);
+        }
+
+        DualNumber Add(const DualNumber& left, const DualNumber& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            return Make(left.value + right.value, left.derivative + right.derivative);
+        }
+
+        DualNumber Subtract(const DualNumber& left, const DualNumber& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            return Make(left.value - right.value, left.derivative - right.derivative);
+        }
+
+        DualNumber Multiply(const DualNumber& left, const DualNumber& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            return Make(left.value * right.value, left.derivative * right.value + left.value * right.derivative);
+        }
+
+        DualNumber Divide(const DualNumber& left, const DualNumber& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            if (right.value == 0.0)
+                return DualNumber::Error(MathError::Undefined);
+            const double quotient = left.value / right.value;
+            return Make(quotient, (left.derivative - quotient * right.derivative) / right.value);
+        }
+
+        DualNumber Power(const DualNumber& base, const DualNumber& exponent)
+        {
+            if (base.IsError())
+                return base;
+            if (exponent.IsError())
+                return exponent;
+            const double value = pow(base.value, exponent.value);
+            if (!std::isfinite(value))
+                return DualNumber::Error(MathError::Undefined);
+            // A constant exponent keeps u^c differentiable at u <= 0.
+            if (exponent.derivative == 0.0)
+            {
+                const double slope = base.derivative == 0.0 ? 0.0
+                    : exponent.value * pow(base.value, exponent.value - 1.0) * base.derivative;
+                return Make(value, slope);
+            }
+            if (base.value <= 0.0)
+                return DualNumber::Error(MathError::Undefined);
+            return Make(value, value * (exponent.derivative * log(base.value) + exponent.value * base.derivative / base.value));
+        }
+
+        DualNumber Function(UnaryFunction function, const DualNumber& argument)
+        {
+            if (argument.IsError())
+                return argument;
+            double value = 0.0;
+            if (!TryApplyUnaryFunction(function, argument.value, value))
+                return DualNumber::Error(MathError::Undefined);
+
+            const double u = argument.value;
+            double outer = 0.0;  // f'(u)
+            switch (function)
+            {
+            case UnaryFunction::Sin: outer = cos(u); break;
+            case UnaryFunction::Cos: outer = -sin(u); break;
+            case UnaryFunction::Tan: outer = 1.0 + value * value; break;
+            case UnaryFunction::Asin: outer = 1.0 / sqrt(1.0 - u * u); break;
+            case UnaryFunction::Acos: outer = -1.0 / sqrt(1.0 - u * u); break;
+            case UnaryFunction::Atan: outer = 1.0 / (1.0 + u * u); break;
+            case UnaryFunction::Sqrt: outer = 0.5 / value; break;
+            case UnaryFunction::Abs: outer = u < 0.0 ? -1.0 : 1.0; break;
+            case UnaryFunction::Exp: outer = value; break;
+            default: return DualNumber::Error(MathError::Undefined);
+            }
+            return Make(value, argument.derivative == 0.0 ? 0.0 : outer * argument.derivative);
+        }
+
+        DualNumber Log(const DualNumber& base, const DualNumber& argument)
+        {
+            if (base.IsError())
+                return base;
+            if (argument.IsError())
+                return argument;
+            if (!(base.value > 0 && base.value != 1))
+                return DualNumber::Error(MathError::InvalidLogBase);
+            if (!(argument.value > 0))
+                return DualNumber::Error(MathError::InvalidLogArgument);
+            // log_b(u) = ln u / ln b
+            const double logBase = log(base.value);
+            const double value = log(argument.value) / logBase;
+            return Make(value, (argument.derivative / argument.value - value * base.derivative / base.value) / logBase);
+        }
+    };
+
+    // Outward rounding for interval bounds. One ulp covers an operation that
+    // is correctly rounded (+ - * / sqrt); library transcendentals and pow
+    // get kLibraryUlps.
+    constexpr int kLibraryUlps = 2;
+
+    double RoundDown(double value, int ulps = 1)
+    {
+        for (int step = 0; step < ulps && std::isfinite(value); ++step)
+            value = std::nextafter(value, -HUGE_VAL);
+        return value;
+    }
+
+    double RoundUp(double value, int ulps = 1)
+    {
+        for (int step = 0; step < ulps && std::isfinite(value); ++step)
+            value = std::nextafter(value, HUGE_VAL);
+        return value;
+    }
+
+    // Bound product where 0 times an infinite bound is 0, not NaN.
+    double BoundProduct(double left, double right)
+    {
+        return left == 0.0 || right == 0.0 ? 0.0 : left * right;
+    }
+
+    // Whether some phase + k * period lies in [lower, upper], erring towards
+    // yes by the rounding of pi in the period.
+    bool ContainsPhase(double lower, double upper, double phase, double period)
+    {
+        const double slack = 8.0 * DBL_EPSILON * (std::max)(1.0, (std::max)(std::fabs(lower), std::fabs(upper)));
+        const double k = std::ceil((lower - slack - phase) / period);
+        return phase + k * period <= upper + slack;
+    }
+
+    // Intervals behind `EvalInterval` and CompiledExpression::EvaluateInterval.
+    // Failures carry their message and the leftmost one wins, as in
+    // `ValueDomain`, whose unit rules this follows.
+    struct IntervalDomain
+    {
+        using Value = IntervalValue;
+        static constexpr bool kStrict = true;
+        static constexpr bool kMatrices = false;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        IntervalValue varValue;
+
+        static IntervalValue WithDimension(IntervalValue value, const UnitDimension& dimension)
+        {
+            value.dimension = dimension;
+            return value;
+        }
+
+        // A parsed number is exact when it is an integer double can hold;
+        // otherwise the decimal it came from may lie a rounding away.
+        static IntervalValue Enclose(double value)
+        {
+            if (std::fabs(value) < 9007199254740992.0 && value == std::trunc(value))
+                return IntervalValue::Range(value, value);
+            return IntervalValue::Range(RoundDown(value), RoundUp(value));
+        }
+
+        static IntervalValue Entire(const UnitDimension& dimension)
+        {
+            return WithDimension(IntervalValue::Range(-HUGE_VAL, HUGE_VAL), dimension);
+        }
+
+        IntervalValue Number(double value) { return Enclose(value); }
+        IntervalValue Variable() { return varValue; }
+        IntervalValue Constant(double value) { return IntervalValue::Range(RoundDown(value), RoundUp(value)); }
+        IntervalValue Unit(const UnitDefinition& definition) { return WithDimension(Enclose(definition.scale), definition.dimension); }
+        IntervalValue Error(MathError code) { return IntervalValue::Error(code); }
+
+        IntervalValue Negate(const IntervalValue& value)
+        {
+            if (value.IsError())
+                return value;
+            return WithDimension(IntervalValue::Range(-value.upper, -value.lower), value.dimension);
+        }
+
+        IntervalValue Add(const IntervalValue& left, const IntervalValue& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            if (left.dimension != right.dimension)
+                return IntervalValue::Error(MathError::IncompatibleUnits);
+            return WithDimension(IntervalValue::Range(RoundDown(left.lower + right.lower), RoundUp(left.upper + right.upper)), left.dimension);
+        }
+
+        IntervalValue Subtract(const IntervalValue& left, const IntervalValue& right) { return Add(left, Negate(right)); }
+
+        IntervalValue Multiply(const IntervalValue& left, const IntervalValue& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            const double products[] = {
+                BoundProduct(left.lower, right.lower), BoundProduct(left.lower, right.upper),
+                BoundProduct(left.upper, right.lower), BoundProduct(left.upper, right.upper)
+            };
+            UnitDimension dimension;
+            if (!UnitDimension::TryMultiply(left.dimension, right.dimension, dimension))
+                return IntervalValue::Error(MathError::InvalidUnitExponent);
+            return WithDimension(IntervalValue::Range(RoundDown(*std::min_element(products, products + 4)),
+                                                      RoundUp(*std::max_element(products, products + 4))), dimension);
+        }
+
+        // A divisor that reaches 0 leaves the quotient unbounded.
+        IntervalValue Divide(const IntervalValue& left, const IntervalValue& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            UnitDimension dimension;
+            if (!UnitDimension::TryDivide(left.dimension, right.dimension, dimension))
+                return IntervalValue::Error(MathError::InvalidUnitExponent);
+            if (right.lower == 0.0 && right.upper == 0.0)
+                return IntervalValue::Error(MathError::Undefined);
+            if (right.Contains(0.0))
+                return Entire(dimension);
+
+            IntervalValue reciprocal = IntervalValue::Range(RoundDown(1.0 / right.upper), RoundUp(1.0 / right.lower));
+            IntervalValue quotient = Multiply(WithDimension(left, UnitDimension()), reciprocal);
+            return WithDimension(quotient, dimension);
+        }
+
+        IntervalValue Power(const IntervalValue& base, const IntervalValue& exponent)
+        {
+            if (base.IsError())
+                return base;
+            if (exponent.IsError())
+                return exponent;
+            if (!exponent.IsDimensionless())
+                return IntervalValue::Error(MathError::InvalidUnitExponent);
+
+            UnitDimension dimension;
+            const bool pointExponent = exponent.lower == exponent.upper;
+            if (!base.IsDimensionless() &&
+                (!pointExponent || !base.dimension.TryScale(exponent.lower, dimension)))
+                return IntervalValue::Error(MathError::InvalidUnitExponent);
+
+            if (pointExponent && exponent.lower == std::trunc(exponent.lower) && std::fabs(exponent.lower) <= 1e9)
+                return WithDimension(IntegerPower(base, static_cast<long long>(exponent.lower)), dimension);
+
+            // Real exponents need a positive base; pow is monotone in each
+            // argument there, so the corners bound it.
+            if (base.upper < 0.0)
+                return IntervalValue::Error(MathError::Undefined);
+            const double lowest = (std::max)(base.lower, 0.0);
+            const double corners[] = {
+                pow(lowest, exponent.lower), pow(lowest, exponent.upper),
+                pow(base.upper, exponent.lower), pow(base.upper, exponent.upper)
+            };
+            return WithDimension(IntervalValue::Range(RoundDown(*std::min_element(corners, corners + 4), kLibraryUlps),
+                                                      RoundUp(*std::max_element(corners, corners + 4), kLibraryUlps)), dimension);
+        }
+
+        static IntervalValue IntegerPower(const IntervalValue& base, long long power)
+        {
+            if (power == 0)
+                return IntervalValue::Range(1.0, 1.0);
+            if (power < 0)
+            {
+                IntervalDomain domain;
+                return domain.Divide(IntervalValue::Range(1.0, 1.0), IntegerPower(base, -power));
+            }
+
+            const double exponent = static_cast<double>(power);
+            const double atLower = pow(base.lower, exponent);
+            const double atUpper = pow(base.upper, exponent);
+            if (power % 2 == 1)
+                return IntervalValue::Range(RoundDown(atLower, kLibraryUlps), RoundUp(atUpper, kLibraryUlps));
+            // Even powers fold the negative side over.
+            if (base.Contains(0.0))
+                return IntervalValue::Range(0.0, RoundUp((std::max)(atLower, atUpper), kLibraryUlps));
+            return IntervalValue::Range(RoundDown((std::min)(atLower, atUpper), kLibraryUlps),
+                                        RoundUp((std::max)(atLower, atUpper), kLibraryUlps));
+        }
+
+        static IntervalValue Monotone(double (*function)(double), double lower, double upper, bool increasing)
+        {
+            const double first = function(lower);
+            const double second = function(upper);
+            return increasing ? IntervalValue::Range(RoundDown(first, kLibraryUlps), RoundUp(second, kLibraryUlps))
+                              : IntervalValue::Range(RoundDown(second, kLibraryUlps), RoundUp(first, kLibraryUlps));
+        }
+
+        // sin or cos: the endpoint values, widened to +-1 wherever a peak or
+        // trough falls inside.
+        static IntervalValue Periodic(double (*function)(double), const IntervalValue& argument, double peakPhase)
+        {
+            const double pi = 3.14159265358979323846;
+            if (!(argument.upper - argument.lower < 2.0 * pi) || (std::max)(std::fabs(argument.lower), std::fabs(argument.upper)) > 1e15)
+                return IntervalValue::Range(-1.0, 1.0);
+            const double first = function(argument.lower);
+            const double second = function(argument.upper);
+            double lower = RoundDown((std::min)(first, second), kLibraryUlps);
+            double upper = RoundUp((std::max)(first, second), kLibraryUlps);
+            if (ContainsPhase(argument.lower, argument.upper, peakPhase, 2.0 * pi))
+                upper = 1.0;
+            if (ContainsPhase(argument.lower, argument.upper, peakPhase + pi, 2.0 * pi))
+                lower = -1.0;
+            return IntervalValue::Range((std::max)(lower, -1.0), (std::min)(upper, 1.0));
+        }
+
+        IntervalValue Function(UnaryFunction function, const IntervalValue& argument)
+        {
+            if (argument.IsError())
+                return argument;
+
+            if (function == UnaryFunction::Sqrt)
+            {
+                UnitDimension dimension;
+                if (!argument.IsDimensionless() && !argument.dimension.TryScale(0.5, dimension))
+                    return IntervalValue::Error(MathError::InvalidUnitExponent);
+                if (argument.upper < 0.0)
+                    return IntervalValue::Error(MathError::Undefined);
+                return WithDimension(IntervalValue::Range((std::max)(RoundDown(sqrt((std::max)(argument.lower, 0.0))), 0.0), RoundUp(sqrt(argument.upper))), dimension);
+            }
+
+            if (function == UnaryFunction::Abs)
+            {
+                const double lower = argument.Contains(0.0) ? 0.0 : (std::min)(std::fabs(argument.lower), std::fabs(argument.upper));
+                const double upper = (std::max)(std::fabs(argument.lower), std::fabs(argument.upper));
+                return WithDimension(IntervalValue::Range(lower, upper), argument.dimension);
+            }
+
+            if (!argument.IsDimensionless())
+            {
+                if (function == UnaryFunction::Exp)
+                    return IntervalValue::Error(MathError::ExpRequiresAbstractNumber);
+                return IntervalValue::Error(MathError::FunctionRequiresAbstractNumber);
+            }
+
+            const double pi = 3.14159265358979323846;
+            switch (function)
+            {
+            case UnaryFunction::Sin: return Periodic(static_cast<double (*)(double)>(std::sin), argument, pi / 2.0);
+            case UnaryFunction::Cos: return Periodic(static_cast<double (*)(double)>(std::cos), argument, 0.0);
+            case UnaryFunction::Tan:
+                if (!(argument.upper - argument.lower < pi) || ContainsPhase(argument.lower, argument.upper, pi / 2.0, pi))
+                    return Entire(UnitDimension());
+                return Monotone(static_cast<double (*)(double)>(std::tan), argument.lower, argument.upper, true);
+            case UnaryFunction::Asin:
+            case UnaryFunction::Acos:
+            {
+                if (argument.upper < -1.0 || argument.lower > 1.0)
+                    return IntervalValue::Error(MathError::Undefined);
+                const double lower = (std::max)(argument.lower, -1.0);
+                const double upper = (std::min)(argument.upper, 1.0);
+                return function == UnaryFunction::Asin
+                    ? Monotone(static_cast<double (*)(double)>(std::asin), lower, upper, true)
+                    : Monotone(static_cast<double (*)(double)>(std::acos), lower, upper, false);
+            }
+            case UnaryFunction::Atan: return Monotone(static_cast<double (*)(double)>(std::atan), argument.lower, argument.upper, true);
+            case UnaryFunction::Exp:
+            {
+                IntervalValue result = Monotone(static_cast<double (*)(double)>(std::exp), argument.lower, argument.upper, true);
+                result.lower = (std::max)(result.lower, 0.0);
+                return result;
+            }
+            default: return IntervalValue::Error(MathError::Undefined);
+            }
+        }
+
+        IntervalValue Log(const IntervalValue& base, const IntervalValue& argument)
+        {
+            if (base.IsError())
+                return base;
+            if (argument.IsError())
+                return argument;
+            if (!base.IsDimensionless() || !(base.lower > 0.0) || base.Contains(1.0))
+                return IntervalValue::Error(MathError::InvalidLogBase);
+            if (!argument.IsDimensionless())
+                return IntervalValue::Error(MathError::LogRequiresAbstractNumber);
+            if (!(argument.upper > 0.0))
+                return IntervalValue::Error(MathError::InvalidLogArgument);
+
+            const auto naturalLog = [](double lower, double upper) {
+                return lower <= 0.0 ? IntervalValue::Range(-HUGE_VAL, RoundUp(std::log(upper), kLibraryUlps))
+                                    : Monotone(static_cast<double (*)(double)>(std::log), lower, upper, true);
+            };
+            return Divide(naturalLog(argument.lower, argument.upper), naturalLog(base.lower, base.upper));
+        }
+    };
+
+    // Dense matrices behind `EvalMatrix`. Numbers are 1x1 matrices that scale
+    // whatever they multiply; failures carry their message and the leftmost
+    // one wins.
+    struct MatrixDomain
+    {
+        using Value = MatrixValue;
+        static constexpr bool kStrict = true;
+        static constexpr bool kMatrices = true;
+        static constexpr bool kSymbols = false;
+        static constexpr bool kLoops = false;
+
+        MatrixValue varValue;
+
+        static MatrixValue FromScalar(double value)
+        {
+            MatrixValue result;
+            result.matrix = Matrix(1, 1, value);
+            return result;
+        }
+
+        static MatrixValue FromMatrix(Matrix matrix)
+        {
+            MatrixValue result;
+            result.matrix = std::move(matrix);
+            return result;
+        }
+
+        static double ScalarOf(const MatrixValue& value) { return value.matrix(0, 0); }
+
+        MatrixValue Number(double value) { return FromScalar(value); }
+        MatrixValue Variable() { return varValue; }
+        MatrixValue Constant(double value) { return FromScalar(value); }
+        MatrixValue Unit(const UnitDefinition&) { return MatrixValue::Error(MathError::MatrixRequiresAbstractNumbers); }
+        MatrixValue Error(MathError code) { return MatrixValue::Error(code); }
+
+        MatrixValue Negate(const MatrixValue& value)
+        {
+            if (value.IsError())
+                return value;
+            return FromMatrix(value.matrix.Scaled(-1.0));
+        }
+
+        MatrixValue Add(const MatrixValue& left, const MatrixValue& right) { return Combine(left, right, false); }
+        MatrixValue Subtract(const MatrixValue& left, const MatrixValue& right) { return Combine(left, right, true); }
+
+        MatrixValue Multiply(const MatrixValue& left, const MatrixValue& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            if (left.IsScalar())
+                return FromMatrix(right.matrix.Scaled(ScalarOf(left)));
+            if (right.IsScalar())
+                return FromMatrix(left.matrix.Scaled(ScalarOf(right)));
+            if (left.matrix.Columns() != right.matrix.Rows())
+                return MatrixValue::Error(MathError::IncompatibleMatrixSizes);
+            return FromMatrix(Matrix::Multiply(left.matrix, right.matrix));
+        }
+
+        // A / B is A * B^-1; dividing by a number scales.
+        MatrixValue Divide(const MatrixValue& left, const MatrixValue& right)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            if (right.IsScalar())
+            {
+                if (ScalarOf(right) == 0.0)
+                    return MatrixValue::Error(MathError::Undefined);
+                return FromMatrix(left.matrix.Scaled(1.0 / ScalarOf(right)));
+            }
+            MatrixValue inverse = Power(right, FromScalar(-1.0));
+            if (inverse.IsError())
+                return inverse;
+            return Multiply(left, inverse);
+        }
+
+        MatrixValue Power(const MatrixValue& base, const MatrixValue& exponent)
+        {
+            if (base.IsError())
+                return base;
+            if (exponent.IsError())
+                return exponent;
+            if (!exponent.IsScalar())
+                return MatrixValue::Error(MathError::InvalidMatrixExponent);
+            const double power = ScalarOf(exponent);
+            if (base.IsScalar())
+                return FromScalar(pow(ScalarOf(base), power));
+
+            if (power != std::floor(power) || std::fabs(power) > 1e9)
+                return MatrixValue::Error(MathError::InvalidMatrixExponent);
+            if (!base.matrix.IsSquare())
+                return MatrixValue::Error(MathError::MatrixMustBeSquare);
+            MatrixValue result;
+            if (!base.matrix.TryPow(static_cast<long long>(power), result.matrix))
+                return MatrixValue::Error(MathError::SingularMatrix);
+            return result;
+        }
+
+        MatrixValue Transpose(const MatrixValue& value)
+        {
+            if (value.IsError())
+                return value;
+            return FromMatrix(value.matrix.Transposed());
+        }
+
+        MatrixValue Function(UnaryFunction function, const MatrixValue& argument)
+        {
+            if (argument.IsError())
+                return argument;
+            double result = 0.0;
+            if (!argument.IsScalar())
+                return MatrixValue::Error(MathError::FunctionRequiresNumber);
+            if (!TryApplyUnaryFunction(function, ScalarOf(argument), result))
+                return MatrixValue::Error(MathError::Undefined);
+            return FromScalar(result);
+        }
+
+        MatrixValue Log(const MatrixValue& base, const MatrixValue& argument)
+        {
+            if (base.IsError())
+                return base;
+            if (argument.IsError())
+                return argument;
+            if (!base.IsScalar() || !argument.IsScalar())
+                return MatrixValue::Error(MathError::FunctionRequiresNumber);
+            const double baseValue = ScalarOf(base);
+            const double argumentValue = ScalarOf(argument);
+            if (!(baseValue > 0 && baseValue != 1))
+                return MatrixValue::Error(MathError::InvalidLogBase);
+            if (!(argumentValue > 0))
+                return MatrixValue::Error(MathError::InvalidLogArgument);
+            return FromScalar(log(argumentValue) / log(baseValue));
+        }
+
+        // Every entry must be a number and every row the same length.
+        MatrixValue MatrixLiteral(const std::vector<std::vector<MatrixValue>>& rows)
+        {
+            const size_t columns = rows[0].size();
+            Matrix matrix(rows.size(), columns);
+            for (size_t row = 0; row < rows.size(); ++row)
+            {
+                if (rows[row].size() != columns)
+                    return MatrixValue::Error(MathError::InvalidMatrix);
+                for (size_t column = 0; column < columns; ++column)
+                {
+                    const MatrixValue& entry = rows[row][column];
+                    if (entry.IsError())
+                        return entry;
+                    if (!entry.IsScalar())
+                        return MatrixValue::Error(MathError::InvalidMatrix);
+                    matrix(row, column) = ScalarOf(entry);
+                }
+            }
+            return FromMatrix(std::move(matrix));
+        }
+
+    private:
+        MatrixValue Combine(const MatrixValue& left, const MatrixValue& right, bool subtract)
+        {
+            if (left.IsError())
+                return left;
+            if (right.IsError())
+                return right;
+            if (left.matrix.Rows() != right.matrix.Rows() || left.matrix.Columns() != right.matrix.Columns())
+                return MatrixValue::Error(MathError::IncompatibleMatrixSizes);
+            return FromMatrix(Matrix::Add(left.matrix, right.matrix, subtract));
+        }
+    };
+}
+
+const std::vector<ExpressionToken>& ExpressionTokenCache::Lookup(const std::wstring& text)
+{
+    auto found = entries.find(text);
+    if (found != entries.end())
+        return found->second;
+
+    // Tokens view into the stored key, which stays put for the entry's lifetime.
+    auto inserted = entries.emplace(text, std::vector<ExpressionToken>()).first;
+    LexExpressionText(inserted->first, inserted->first.size(), inserted->second);
+    return inserted->second;
+}
+
+void ExpressionTokenCache::Trim(size_t maxEntries)
+{
+    if (entries.size() > maxEntries)
+        entries.clear();
+}
+
+size_t EvaluationContext::Bind(const std::wstring& name)
+{
+    size_t slot = 0;
+    if (Find(name, slot))
+        return slot;
+    names.push_back(name);
+    values.push_back(MathValue::Scalar(0.0));
+    return values.size() - 1;
+}
+
+bool EvaluationContext::Find(std::wstring_view name, size_t& slot) const
+{
+    for (size_t index = 0; index < names.size(); ++index)
+    {
+        if (names[index] == name)
+        {
+            slot = index;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The parser domain that emits program nodes instead of values. Parse failures
+// become error literals at the position `ValueDomain` would have produced them,
+// so leftmost-error propagation matches `EvalValue`.
+class CompiledExpression::Compiler
+{
+public:
+    using Value = unsigned int;
+    static constexpr bool kStrict = true;
+    static constexpr bool kMatrices = false;
+    static constexpr bool kSymbols = true;
+    static constexpr bool kLoops = true;
+
+    explicit Compiler(CompiledExpression& target, const SymbolTable* symbolTable = nullptr,
+        const EvaluationContext* bindingContext = nullptr)
+        : program(target), symbols(symbolTable), context(bindingContext)
+    {
+    }
+
+    unsigned int Number(double value) { return EmitLiteral(MathValue::Scalar(value)); }
+    unsigned int Constant(double value) { return EmitLiteral(MathValue::Scalar(value)); }
+    unsigned int Error(MathError code) { return EmitLiteral(MathValue::Error(code)); }
+
+    unsigned int Variable()
+    {
+        program.usesVariable = true;
+        return Emit(Op::Variable);
+    }
+
+    unsigned int Unit(const UnitDefinition& definition)
+    {
+        program.usesUnits = true;
+        return EmitLiteral(MathValue::Quantity(definition.scale, definition.dimension, definition.scale, UnitSymbolIdOf(definition)));
+    }
+
+    unsigned int Negate(unsigned int value) { return Emit(Op::Negate, value); }
+    unsigned int Add(unsigned int left, unsigned int right) { return Emit(Op::Add, left, right); }
+    unsigned int Subtract(unsigned int left, unsigned int right) { return Emit(Op::Subtract, left, right); }
+    unsigned int Multiply(unsigned int left, unsigned int right) { return Emit(Op::Multiply, left, right); }
+    unsigned int Divide(unsigned int left, unsigned int right) { return Emit(Op::Divide, left, right); }
+    unsigned int Power(unsigned int base, unsigned int exponent) { return Emit(Op::Power, base, exponent); }
+    unsigned int Log(unsigned int base, unsigned int argument) { return Emit(Op::Log, base, argument); }
+
+    unsigned int Function(UnaryFunction function, unsigned int argument)
+    {
+        return Emit(Op::Function, argument, 0, (unsigned char)function);
+    }
+
+    unsigned int Literal(const MathValue& value) { return EmitLiteral(value); }
+
+    unsigned int Binding(size_t slot) { return Emit(Op::Binding, (unsigned int)slot); }
+
+    // The body becomes a program of its own, compiled against this context
+    // plus the index. `varName` stays the bound variable inside it unless the
+    // index shadows it.
+    unsigned int Loop(bool product, const std::wstring& index, unsigned int first, unsigned int last,
+        const SlotSource& body, ExpressionItemBuilder& builder, const std::wstring& varName)
+    {
+        auto scope = std::make_shared<EvaluationContext>(context ? *context : EvaluationContext());
+        const size_t slot = scope->Bind(index);
+
+        auto bodyProgram = std::make_shared<CompiledExpression>();
+        const std::wstring noVariable;
+        Compiler compiler(*bodyProgram, symbols, scope.get());
+        ExpressionParser<Compiler> parser(compiler, builder, index == varName ? noVariable : varName);
+        builder.AppendSource(body, parser.Items());
+        bodyProgram->root = parser.ParseExpression();
+        bodyProgram->hasTrailingInput = !parser.AtEnd();
+        program.usesVariable = program.usesVariable || bodyProgram->usesVariable;
+        program.usesUnits = program.usesUnits || bodyProgram->usesUnits;
+
+        CompiledExpression::Loop loop;
+        loop.body = std::move(bodyProgram);
+        loop.scope = std::move(scope);
+        loop.first = first;
+        loop.last = last;
+        loop.slot = slot;
+        loop.product = product;
+        program.loops.push_back(std::move(loop));
+        return Emit(Op::Loop, (unsigned int)(program.loops.size() - 1));
+    }
+
+    // Context bindings compile to their slot; document variables to their
+    // current value.
+    bool Symbol(std::wstring_view name, unsigned int& value)
+    {
+        size_t slot = 0;
+        if (context && context->Find(name, slot))
+        {
+            value = Binding(slot);
+            return true;
+        }
+        if (!symbols)
+            return false;
+        const auto found = symbols->find(name);
+        if (found == symbols->end())
+            return false;
+        if (!found->second.IsDimensionless())
+            program.usesUnits = true;
+        value = EmitLiteral(found->second);
+        return true;
+    }
+
+private:
+    CompiledExpression& program;
+    const SymbolTable* symbols = nullptr;
+    const EvaluationContext* context = nullptr;
+
+    // Per-node facts used to decide whether the program can run lane-wise.
+    std::vector<bool> varying;
+    std::vector<bool> dimensional;
+
+    unsigned int Emit(Op op, unsigned int left = 0, unsigned int right = 0, unsigned char function = 0)
+    {
+        Node node;
+        node.op = op;
+        node.function = function;
+        node.left = left;
+        node.right = right;
+        program.nodes.push_back(node);
+
+        bool nodeVarying = false;
+        bool nodeDimensional = false;
+        switch (op)
+        {
+        case Op::Literal:
+            nodeDimensional = !program.literals[left].IsDimensionless();
+            if (program.literals[left].IsError())
+                program.batchSafe = false;
+            break;
+        case Op::Variable:
+            nodeVarying = true;
+            break;
+        case Op::Binding:
+        case Op::Loop:
+            // Lanes carry only the bound variable. A loop may read it anywhere
+            // in its body, so it counts as varying.
+            nodeVarying = op == Op::Loop;
+            nodeDimensional = true;
+            program.batchSafe = false;
+            break;
+        case Op::Negate:
+            nodeVarying = varying[left];
+            nodeDimensional = dimensional[left];
+            break;
+        case Op::Function:
+            nodeVarying = varying[left];
+            nodeDimensional = dimensional[left] && ((UnaryFunction)function == UnaryFunction::Sqrt || (UnaryFunction)function == UnaryFunction::Abs);
+            break;
+        case Op::Log:
+            nodeVarying = varying[left] || varying[right];
+            break;
+        case Op::Power:
+            nodeVarying = varying[left] || varying[right];
+            nodeDimensional = dimensional[left];
+            // The result unit depends on the exponent, so a bound exponent on a
+            // quantity would give every lane its own unit.
+            if (dimensional[left] && varying[right])
+                program.batchSafe = false;
+            break;
+        default:
+            nodeVarying = varying[left] || varying[right];
+            nodeDimensional = dimensional[left] || dimensional[right];
+            break;
+        }
+        varying.push_back(nodeVarying);
+        dimensional.push_back(nodeDimensional);
+        return (unsigned int)(program.nodes.size() - 1);
+    }
+
+    unsigned int EmitLiteral(const MathValue& value)
+    {
+        program.literals.push_back(value);
+        return Emit(Op::Literal, (unsigned int)(program.literals.size() - 1));
+    }
+};
+
+CompiledExpression CompiledExpression::Compile(const std::wstring& expr, const std::wstring& varName, const SymbolTable* symbols)
+{
+    CompiledExpression program;
+    try
+    {
+        ExpressionItemBuilder builder(nullptr);
+        Compiler compiler(program, symbols);
+        ExpressionParser<Compiler> parser(compiler, builder, varName);
+        builder.AppendText(expr, parser.Items());
+        program.root = parser.ParseExpression();
+        program.hasTrailingInput = !parser.AtEnd();
+    }
+    catch (...)
+    {
+        program = Failure();
+    }
+    return program;
+}
+
+CompiledExpression CompiledExpression::Compile(const std::wstring& expr, const EvaluationContext& context,
+    const std::wstring& varName, const SymbolTable* symbols)
+{
+    CompiledExpression program;
+    try
+    {
+        ExpressionItemBuilder builder(nullptr);
+        Compiler compiler(program, symbols, &context);
+        ExpressionParser<Compiler> parser(compiler, builder, varName);
+        builder.AppendText(expr, parser.Items());
+        program.root = parser.ParseExpression();
+        program.hasTrailingInput = !parser.AtEnd();
+    }
+    catch (...)
+    {
+        program = Failure();
+    }
+    return program;
+}
+
+CompiledExpression CompiledExpression::CompileSlot(const MathSlot& slot, const std::wstring& varName,
+    ExpressionTokenCache* cache, const SymbolTable* symbols, const wchar_t* stopMarker)
+{
+    CompiledExpression program;
+    try
+    {
+        if (cache)
+            cache->Trim();
+        SlotSource source;
+        source.nodes = &slot.children;
+        source.text = &slot.text;
+
+        ExpressionItemBuilder builder(cache);
+        Compiler compiler(program, symbols);
+        ExpressionParser<Compiler> parser(compiler, builder, varName);
+        builder.AppendSource(source, parser.Items(), stopMarker);
+        program.root = parser.ParseExpression();
+        program.hasTrailingInput = !parser.AtEnd();
+    }
+    catch (...)
+    {
+        program = Failure();
+    }
+    return program;
+}
+
+CompiledExpression CompiledExpression::CompileStructure(MathNodeKind kind, const std::vector<const MathSlot*>& slots,
+    ExpressionTokenCache* cache, const SymbolTable* symbols)
+{
+    CompiledExpression program;
+    try
+    {
+        if (cache)
+            cache->Trim();
+        std::vector<SlotSource> sources(slots.size());
+        for (size_t index = 0; index < slots.size(); ++index)
+        {
+            sources[index].nodes = &slots[index]->children;
+            sources[index].text = &slots[index]->text;
+        }
+
+        const std::wstring noVariable;
+        ExpressionItemBuilder builder(cache);
+        Compiler compiler(program, symbols);
+        ExpressionParser<Compiler> parser(compiler, builder, noVariable);
+        program.root = parser.ParseStructure(kind, sources);
+    }
+    catch (...)
+    {
+        program = Failure();
+    }
+    return program;
+}
+
+CompiledExpression CompiledExpression::Derivative() const
+{
+    // A program that cannot evaluate differentiates to the same failure.
+    // Nested loops have no rule here.
+    if (hasTrailingInput || nodes.empty() || !loops.empty())
+        return Failure();
+    for (const MathValue& literal : literals)
+    {
+        if (literal.IsError())
+            return *this;
+    }
+
+    CompiledExpression program;
+    program.usesUnits = usesUnits;
+    Compiler compiler(program);
+
+    // Operand values are copied into the new program only when a rule needs
+    // them, once each; kZero marks a derivative known to vanish, so constant
+    // subtrees add no nodes at all.
+    constexpr unsigned int kZero = UINT_MAX;
+    constexpr unsigned int kUnset = UINT_MAX - 1;
+    std::vector<unsigned int> values(nodes.size(), kUnset);
+    std::vector<unsigned int> slopes(nodes.size(), kZero);
+
+    const std::function<unsigned int(unsigned int)> value = [&](unsigned int index) -> unsigned int {
+        if (values[index] != kUnset)
+            return values[index];
+        const Node& node = nodes[index];
+        unsigned int emitted = 0;
+        switch (node.op)
+        {
+        case Op::Literal: emitted = compiler.Literal(literals[node.left]); break;
+        case Op::Variable: emitted = compiler.Variable(); break;
+        case Op::Binding: emitted = compiler.Binding(node.left); break;
+        case Op::Negate: emitted = compiler.Negate(value(node.left)); break;
+        case Op::Function: emitted = compiler.Function((UnaryFunction)node.function, value(node.left)); break;
+        case Op::Add: emitted = compiler.Add(value(node.left), value(node.right)); break;
+        case Op::Subtract: emitted = compiler.Subtract(value(node.left), value(node.right)); break;
+        case Op::Multiply: emitted = compiler.Multiply(value(node.left), value(node.right)); break;
+        case Op::Divide: emitted = compiler.Divide(value(node.left), value(node.right)); break;
+        case Op::Power: emitted = compiler.Power(value(node.left), value(node.right)); break;
+        case Op::Log: emitted = compiler.Log(value(node.left), value(node.right)); break;
+        case Op::Loop: emitted = compiler.Error(MathError::InvalidExpression); break;
+        }
+        values[index] = emitted;
+        return emitted;
+    };
+    const auto add = [&](unsigned int left, unsigned int right) {
+        return left == kZero ? right : right == kZero ? left : compiler.Add(left, right);
+    };
+    const auto subtract = [&](unsigned int left, unsigned int right) {
+        return right == kZero ? left : left == kZero ? compiler.Negate(right) : compiler.Subtract(left, right);
+    };
+    const auto divide = [&](unsigned int left, unsigned int right) {
+        return left == kZero ? kZero : compiler.Divide(left, right);
+    };
+    const auto naturalLog = [&](unsigned int argument) { return compiler.Log(compiler.Number(std::exp(1.0)), argument); };
+
+    for (size_t index = 0; index < nodes.size(); ++index)
+    {
+        const Node& node = nodes[index];
+        const unsigned int left = node.left;
+        const unsigned int right = node.right;
+        unsigned int& slope = slopes[index];
+        // Bindings are constant with respect to the bound variable.
+        if (node.op == Op::Literal || node.op == Op::Binding)
+            continue;
+        if (node.op != Op::Variable && slopes[left] == kZero &&
+            (node.op == Op::Negate || node.op == Op::Function || slopes[right] == kZero))
+            continue;
+        switch (node.op)
+        {
+        case Op::Literal:
+        case Op::Binding:
+        case Op::Loop:
+            break;
+        case Op::Variable:
+            slope = compiler.Number(1.0);
+            break;
+        case Op::Negate:
+            slope = slopes[left] == kZero ? kZero : compiler.Negate(slopes[left]);
+            break;
+        case Op::Add:
+            slope = add(slopes[left], slopes[right]);
+            break;
+        case Op::Subtract:
+            slope = subtract(slopes[left], slopes[right]);
+            break;
+        case Op::Multiply:
+            slope = add(slopes[left] == kZero ? kZero : compiler.Multiply(slopes[left], value(right)),
+                        slopes[right] == kZero ? kZero : compiler.Multiply(value(left), slopes[right]));
+            break;
+        case Op::Divide:
+            // (u/v)' = u'/v - (u/v) * v'/v
+            slope = subtract(divide(slopes[left], value(right)),
+                             slopes[right] == kZero ? kZero : compiler.Multiply(value(static_cast<unsigned int>(index)), compiler.Divide(slopes[right], value(right))));
+            break;
+        case Op::Power:
+            if (slopes[right] == kZero)
+            {
+                // (u^c)' = c * u^(c-1) * u'
+                const unsigned int reduced = compiler.Power(value(left), compiler.Subtract(value(right), compiler.Number(1.0)));
+                slope = compiler.Multiply(compiler.Multiply(value(right), reduced), slopes[left]);
+                break;
+            }
+            // (u^v)' = u^v * (v' ln u + v u'/u)
+            slope = compiler.Multiply(value(static_cast<unsigned int>(index)),
+                                      add(compiler.Multiply(slopes[right], naturalLog(value(left))),
+                                          slopes[left] == kZero ? kZero
+                                              : compiler.Multiply(value(right), compiler.Divide(slopes[left], value(left)))));
+            break;
+        case Op::Log:
+        {
+            // log_b(u) = ln u / ln b, so its derivative is
+            // (u'/u - log_b(u) * b'/b) / ln b.
+            const unsigned int numerator = subtract(divide(slopes[right], value(right)),
+                slopes[left] == kZero ? kZero : compiler.Multiply(value(static_cast<unsigned int>(index)), compiler.Divide(slopes[left], value(left))));
+            slope = divide(numerator, naturalLog(value(left)));
+            break;
+        }
+        case Op::Function:
+        {
+            const unsigned int u = value(left);
+            unsigned int outer = 0;  // f'(u)
+            switch ((UnaryFunction)node.function)
+            {
+            case UnaryFunction::Sin:
+                outer = compiler.Function(UnaryFunction::Cos, u);
+                break;
+            case UnaryFunction::Cos:
+                outer = compiler.Negate(compiler.Function(UnaryFunction::Sin, u));
+                break;
+            case UnaryFunction::Tan:
+                outer = compiler.Add(compiler.Number(1.0), compiler.Power(value(static_cast<unsigned int>(index)), compiler.Number(2.0)));
+                break;
+            case UnaryFunction::Asin:
+            case UnaryFunction::Acos:
+            {
+                const unsigned int root = compiler.Function(UnaryFunction::Sqrt,
+                    compiler.Subtract(compiler.Number(1.0), compiler.Power(u, compiler.Number(2.0))));
+                outer = compiler.Divide(compiler.Number((UnaryFunction)node.function == UnaryFunction::Asin ? 1.0 : -1.0), root);
+                break;
+            }
+            case UnaryFunction::Atan:
+                outer = compiler.Divide(compiler.Number(1.0), compiler.Add(compiler.Number(1.0), compiler.Power(u, compiler.Number(2.0))));
+                break;
+            case UnaryFunction::Sqrt:
+                outer = compiler.Divide(compiler.Number(0.5), value(static_cast<unsigned int>(index)));
+                break;
+            case UnaryFunction::Abs:
+                outer = compiler.Divide(u, value(static_cast<unsigned int>(index)));
+                break;
+            case UnaryFunction::Exp:
+                outer = value(static_cast<unsigned int>(index));
+                break;
+            default:
+                return Failure();
+            }
+            slope = compiler.Multiply(outer, slopes[left]);
+            break;
+        }
+        }
+    }
+
+    program.root = slopes[root] == kZero ? compiler.Number(0.0) : slopes[root];
+    return program;
+}
+
+CompiledExpression CompiledExpression::Failure()
+{
+    CompiledExpression program;
+    program.literals.push_back(MathValue::Error(MathError::InvalidExpression));
+    program.nodes.push_back(Node());
+    return program;
+}
+
+MathValue CompiledExpression::ApplyOperation(const Node& node, const MathValue& left, const MathValue& right)
+{
+    switch (node.op)
+    {
+    case Op::Negate: return NegateValue(left);
+    case Op::Add: return AddValues(left, right, false);
+    case Op::Subtract: return AddValues(left, right, true);
+    case Op::Multiply: return MultiplyValues(left, right);
+    case Op::Divide: return DivideValues(left, right);
+    case Op::Power: return PowerValue(left, right);
+    case Op::Function: return ApplyUnaryValueFunction((UnaryFunction)node.function, left);
+    case Op::Log: return ApplyLogValue(left, right);
+    default: return MathValue::Error(MathError::InvalidExpression);
+    }
+}
+
+namespace {
+    // Terms between checks of an EvaluationControl in nested loops, counted
+    // across every level.
+    constexpr size_t kLoopControlInterval = 4096;
+    // Below this many terms summing directly is cheaper than analysing the
+    // body for a closed form.
+    constexpr size_t kLoopClosedFormTerms = 16;
+}
+
+// State a program shares with its nested loop bodies during one evaluation.
+// Each loop body was compiled against the enclosing scope plus its index, so
+// one slot array serves every level: a loop writes its index slot and puts
+// the old value back when it ends. Scratch is kept per nesting depth, so
+// neither bindings nor node storage are reallocated per loop.
+struct CompiledExpression::LoopFrame
+{
+    std::vector<MathValue> bindings;
+    std::deque<std::vector<MathValue>> scratch;
+    size_t depth = 0;
+    size_t terms = 0;
+    const EvaluationControl* control = nullptr;
+};
+
+// Index of a closed-form sum over a loop body: the binding `slot`, with
+// every other binding and the bound variable fixed at their current values.
+struct CompiledExpression::SeriesIndex
+{
+    const std::vector<MathValue>* bindings = nullptr;
+    size_t slot = 0;
+    MathValue varValue;
+};
+
+MathValue CompiledExpression::Evaluate(const MathValue& varValue) const
+{
+    std::vector<MathValue> scratch;
+    return Evaluate(varValue, scratch);
+}
+
+MathValue CompiledExpression::Evaluate(const MathValue& varValue, std::vector<MathValue>& scratch) const
+{
+    return Evaluate(varValue, nullptr, scratch, nullptr);
+}
+
+MathValue CompiledExpression::Evaluate(const EvaluationContext& context, const MathValue& varValue) const
+{
+    std::vector<MathValue> scratch;
+    return Evaluate(varValue, &context, scratch, nullptr);
+}
+
+MathValue CompiledExpression::Evaluate(const EvaluationContext& context, const MathValue& varValue, std::vector<MathValue>& scratch) const
+{
+    return Evaluate(varValue, &context, scratch, nullptr);
+}
+
+MathValue CompiledExpression::Evaluate(const MathValue& varValue, std::vector<MathValue>& scratch, const EvaluationControl* control) const
+{
+    return Evaluate(varValue, nullptr, scratch, control);
+}
+
+MathValue CompiledExpression::Evaluate(const MathValue& varValue, const EvaluationContext* context, std::vector<MathValue>& scratch,
+    const EvaluationControl* control) const
+{
+    if (loops.empty())
+        return EvaluateNodes(varValue, context, scratch, nullptr);
+
+    LoopFrame frame;
+    frame.control = control;
+    if (context)
+    {
+        frame.bindings.reserve(context->Size());
+        for (size_t slot = 0; slot < context->Size(); ++slot)
+            frame.bindings.push_back(context->Get(slot));
+    }
+    return EvaluateNodes(varValue, nullptr, scratch, &frame);
+}
+
+// Bindings come from `frame` inside loops and from `context` otherwise.
+MathValue CompiledExpression::EvaluateNodes(const MathValue& varValue, const EvaluationContext* context, std::vector<MathValue>& scratch,
+    LoopFrame* frame) const
+{
+    if (nodes.empty())
+        return MathValue::Error(MathError::InvalidExpression);
+
+    scratch.resize(nodes.size());
+    for (size_t index = 0; index < nodes.size(); ++index)
+    {
+        const Node& node = nodes[index];
+        MathValue& out = scratch[index];
+        switch (node.op)
+        {
+        case Op::Literal: out = literals[node.left]; break;
+        case Op::Variable: out = varValue; break;
+        case Op::Binding:
+            if (frame)
+                out = node.left < frame->bindings.size() ? frame->bindings[node.left] : MathValue::Error(MathError::UnknownSymbol);
+            else
+                out = context && node.left < context->Size() ? context->Get(node.left) : MathValue::Error(MathError::UnknownSymbol);
+            break;
+        case Op::Loop:
+        {
+            const Loop& loop = loops[node.left];
+            out = EvaluateLoop(loop, scratch[loop.first], scratch[loop.last], varValue, *frame);
+            break;
+        }
+        default: out = ApplyOperation(node, scratch[node.left], scratch[node.right]); break;
+        }
+    }
+
+    const MathValue& value = scratch[root];
+    if (value.IsError())
+        return value;
+    if (hasTrailingInput)
+        return MathValue::Error(MathError::InvalidExpression);
+    if (!std::isfinite(value.baseValue))
+        return MathValue::Error(MathError::Undefined);
+    return value;
+}
+
+// Terms run index = first, first + 1, ... up to last, as in the manager's
+// summation loop; an empty range sums to 0 and multiplies to 1. Sums take the
+// closed form when the body has one and are otherwise compensated like the
+// manager's reductions.
+MathValue CompiledExpression::EvaluateLoop(const Loop& loop, const MathValue& first, const MathValue& last, const MathValue& varValue,
+    LoopFrame& frame) const
+{
+    if (first.IsError())
+        return first;
+    if (last.IsError())
+        return last;
+    // Past 2^53 `++index` no longer moves, so such limits are rejected.
+    const double kExactIndexLimit = 9007199254740992.0;
+    if (!first.IsDimensionless() || !last.IsDimensionless()
+        || !(std::fabs(first.baseValue) < kExactIndexLimit) || !(std::fabs(last.baseValue) < kExactIndexLimit))
+        return MathValue::Error(MathError::InvalidLimits);
+    if (!(last.baseValue >= first.baseValue))
+        return MathValue::Scalar(loop.product ? 1.0 : 0.0);
+
+    // The index may shadow an outer binding of the same name; restore it
+    // and the depth however the loop ends.
+    if (frame.bindings.size() <= loop.slot)
+        frame.bindings.resize(loop.slot + 1, MathValue::Scalar(0.0));
+    if (frame.scratch.size() <= frame.depth)
+        frame.scratch.emplace_back();
+    struct Restore
+    {
+        LoopFrame& frame;
+        size_t slot;
+        MathValue saved;
+        ~Restore()
+        {
+            frame.bindings[slot] = saved;
+            --frame.depth;
+        }
+    } restore{ frame, loop.slot, frame.bindings[loop.slot] };
+    std::vector<MathValue>& scratch = frame.scratch[frame.depth++];
+    const auto term = [&](double index) {
+        frame.bindings[loop.slot] = MathValue::Scalar(index);
+        return loop.body->EvaluateNodes(varValue, nullptr, scratch, &frame);
+    };
+
+    const double count = std::floor(last.baseValue - first.baseValue) + 1.0;
+    const MathValue head = term(first.baseValue);
+    if (head.IsError())
+        return head;
+    if (!loop.product && count >= (double)kLoopClosedFormTerms)
+    {
+        const MathValue tail = term(first.baseValue + count - 1.0);
+        if (tail.IsError())
+            return tail;
+        SeriesIndex index;
+        index.bindings = &frame.bindings;
+        index.slot = loop.slot;
+        index.varValue = varValue;
+        double sum = 0.0;
+        if (loop.body->SumSeries(first.baseValue, (size_t)count, &index, sum))
+        {
+            MathValue result = head;
+            result.baseValue = sum;
+            return result;
+        }
+    }
+
+    Node combine;
+    combine.op = Op::Multiply;
+    MathValue total = loop.product ? ApplyOperation(combine, MathValue::Scalar(1.0), head) : head;
+    CompensatedSum sum;
+    sum.Add(head.baseValue);
+    for (double index = first.baseValue + 1.0; index <= last.baseValue; ++index)
+    {
+        if (frame.control && ++frame.terms % kLoopControlInterval == 0 && frame.control->ShouldStop())
+            return MathValue::Error(frame.control->StopError());
+        const MathValue value = term(index);
+        if (value.IsError())
+            return value;
+        if (loop.product)
+        {
+            total = ApplyOperation(combine, total, value);
+            if (total.IsError())
+                return total;
+        }
+        else
+        {
+            if (value.dimension != total.dimension)
+                return MathValue::Error(MathError::IncompatibleUnits);
+            sum.Add(value.baseValue);
+        }
+    }
+    if (loop.product)
+        return total;
+    total.baseValue = sum.Value();
+    return WithDisplayUnit(total);
+}
+
+IntervalValue AddIntervals(const IntervalValue& left, const IntervalValue& right)
+{
+    return IntervalDomain().Add(left, right);
+}
+
+IntervalValue MultiplyIntervals(const IntervalValue& left, const IntervalValue& right)
+{
+    return IntervalDomain().Multiply(left, right);
+}
+
+IntervalValue CompiledExpression::EvaluateInterval(const IntervalValue& varValue) const
+{
+    if (nodes.empty() || hasTrailingInput)
+        return IntervalValue::Error(MathError::InvalidExpression);
+
+    IntervalDomain domain;
+    std::vector<IntervalValue> scratch(nodes.size());
+    for (size_t index = 0; index < nodes.size(); ++index)
+    {
+        const Node& node = nodes[index];
+        IntervalValue& out = scratch[index];
+        if (node.op == Op::Literal)
+        {
+            const MathValue& literal = literals[node.left];
+            out = literal.IsError() ? IntervalValue::Error(literal.error)
+                                    : IntervalDomain::WithDimension(IntervalDomain::Enclose(literal.baseValue), literal.dimension);
+            continue;
+        }
+        if (node.op == Op::Binding || node.op == Op::Loop)
+        {
+            out = IntervalValue::Error(node.op == Op::Binding ? MathError::UnknownSymbol : MathError::InvalidExpression);
+            continue;
+        }
+
+        const IntervalValue& left = scratch[node.left];
+        const IntervalValue& right = scratch[node.right];
+        switch (node.op)
+        {
+        case Op::Literal:
+        case Op::Binding:
+        case Op::Loop:
+            break;
+        case Op::Variable: out = varValue; break;
+        case Op::Negate: out = domain.Negate(left); break;
+        case Op::Add: out = domain.Add(left, right); break;
+        case Op::Subtract: out = domain.Subtract(left, right); break;
+        case Op::Multiply: out = domain.Multiply(left, right); break;
+        case Op::Divide: out = domain.Divide(left, right); break;
+        case Op::Power: out = domain.Power(left, right); break;
+        case Op::Function: out = domain.Function((UnaryFunction)node.function, left); break;
+        case Op::Log: out = domain.Log(left, right); break;
+        }
+    }
+    return scratch[root];
+}
+
+bool CompiledExpression::EvaluateBatch(const double* varValues, double* out, size_t count, MathValue* sampleValue) const
+{
+    if (count == 0)
+        return true;
+    if (nodes.empty() || !batchSafe || hasTrailingInput)
+        return false;
+
+    // Units, display units and unit errors are identical across lanes here, so
+    // one scalar evaluation settles them for the whole batch.
+    const MathValue sample = Evaluate(MathValue::Scalar(varValues[0]));
+    if (sample.IsError())
+        return false;
+    if (sampleValue)
+        *sampleValue = sample;
+
+    constexpr size_t kBlockLanes = 256;
+    std::vector<double> lanes(nodes.size() * kBlockLanes);
+    for (size_t blockStart = 0; blockStart < count; blockStart += kBlockLanes)
+    {
+        const size_t width = (std::min)(kBlockLanes, count - blockStart);
+        for (size_t index = 0; index < nodes.size(); ++index)
+        {
+            const Node& node = nodes[index];
+            double* target = lanes.data() + index * kBlockLanes;
+            if (node.op == Op::Literal)
+            {
+                std::fill(target, target + width, literals[node.left].baseValue);
+                continue;
+            }
+            if (node.op == Op::Variable)
+            {
+                std::copy(varValues + blockStart, varValues + blockStart + width, target);
+                continue;
+            }
+
+            const double* left = lanes.data() + (size_t)node.left * kBlockLanes;
+            const double* right = lanes.data() + (size_t)node.right * kBlockLanes;
+            switch (node.op)
+            {
+            case Op::Negate: BatchNegateLanes(left, target, width); break;
+            case Op::Add: BatchAddLanes(left, right, target, width, false); break;
+            case Op::Subtract: BatchAddLanes(left, right, target, width, true); break;
+            case Op::Multiply: BatchMultiplyLanes(left, right, target, width); break;
+            case Op::Divide: BatchDivideLanes(left, right, target, width); break;
+            case Op::Power: BatchPowerLanes(left, right, target, width); break;
+            case Op::Function: BatchUnaryLanes((UnaryFunction)node.function, left, target, width); break;
+            case Op::Log: BatchLogLanes(left, right, target, width); break;
+            default: break;
+            }
+        }
+
+        const double* result = &lanes[root * kBlockLanes];
+        for (size_t lane = 0; lane < width; ++lane)
+        {
+            if (!std::isfinite(result[lane]))
+                return false;
+            out[blockStart + lane] = result[lane];
+        }
+    }
+    return true;
+}
+
+namespace {
+    constexpr size_t kMaxClosedFormDegree = 16;
+
+    // Exact arithmetic for closed-form sums. It fails only for coefficients
+    // without a small rational form and for powers too large to expand, and
+    // the caller then redoes the sum in double.
+    class ExactSeriesArithmetic
+    {
+    public:
+        using Number = Rational;
+
+        bool failed = false;
+
+        Number Integer(long long value) { return Rational(value); }
+
+        // The rational with the smallest denominator that rounds to `value`,
+        // e.g. 1/10 for 0.1; fails for values such as pi that have none.
+        Number FromDouble(double value)
+        {
+            if (std::fabs(value) < 4.0e18 && value == std::floor(value))
+                return Rational((long long)value);
+
+            const double magnitude = std::fabs(value);
+            double remainder = magnitude;
+            double numerator = 1.0, previousNumerator = 0.0;
+            double denominator = 0.0, previousDenominator = 1.0;
+            for (int step = 0; step < 64 && std::isfinite(remainder); ++step)
+            {
+                const double term = std::floor(remainder);
+                const double nextNumerator = term * numerator + previousNumerator;
+                const double nextDenominator = term * denominator + previousDenominator;
+                if (nextNumerator > 1.0e15 || nextDenominator > 1.0e12)
+                    break;
+                previousNumerator = numerator;
+                previousDenominator = denominator;
+                numerator = nextNumerator;
+                denominator = nextDenominator;
+                if (numerator / denominator == magnitude)
+                    return Rational(value < 0 ? -(long long)numerator : (long long)numerator, (long long)denominator);
+                if (remainder == term)
+                    break;
+                remainder = 1.0 / (remainder - term);
+            }
+            failed = true;
+            return Rational();
+        }
+
+        Number Negate(const Number& value) { return Rational(0) - value; }
+        Number Add(const Number& left, const Number& right) { return left + right; }
+        Number Multiply(const Number& left, const Number& right) { return left * right; }
+
+        Number Divide(const Number& left, const Number& right)
+        {
+            if (right.IsZero())
+            {
+                failed = true;
+                return Rational();
+            }
+            return left / right;
+        }
+
+        bool IsZero(const Number& value) { return value.IsZero(); }
+        bool Equal(const Number& left, const Number& right) { return left == right; }
+        double ToDouble(const Number& value) { return value.toDouble(); }
+
+        bool TryPower(const Number& base, const Number& exponent, Number& out)
+        {
+            long long power = 0;
+            if (!exponent.TryGetInteger(power) || (base.IsZero() && power < 0) || !base.TryPow(power, out))
+            {
+                failed = true;
+                return false;
+            }
+            return true;
+        }
+
+        // coefficient * (ratio^start + ... + ratio^(start + count - 1))
+        Number GeometricSum(const Number& coefficient, const Number& ratio, const Number& start, const Number& count)
+        {
+            if (Equal(ratio, Integer(1)))
+                return Multiply(coefficient, count);
+            Number first, last;
+            if (!TryPower(ratio, start, first) || !TryPower(ratio, count, last))
+                return Rational();
+            const Number series = Divide(Add(last, Integer(-1)), Add(ratio, Integer(-1)));
+            return Multiply(Multiply(coefficient, first), series);
+        }
+    };
+
+    // The same operations in double, used when a coefficient is irrational or
+    // the exact computation overflows.
+    class FloatSeriesArithmetic
+    {
+    public:
+        using Number = double;
+
+        bool failed = false;
+
+        Number Integer(long long value) { return (double)value; }
+        Number FromDouble(double value) { return value; }
+        Number Negate(Number value) { return -value; }
+        Number Add(Number left, Number right) { return left + right; }
+        Number Multiply(Number left, Number right) { return left * right; }
+
+        Number Divide(Number left, Number right)
+        {
+            if (right == 0.0)
+                failed = true;
+            return left / right;
+        }
+
+        bool IsZero(Number value) { return value == 0.0; }
+        bool Equal(Number left, Number right) { return left == right; }
+        double ToDouble(Number value) { return value; }
+
+        bool TryPower(Number base, Number exponent, Number& out)
+        {
+            if ((base < 0 && exponent != std::floor(exponent)) || (base == 0 && exponent < 0))
+                return false;
+            out = std::pow(base, exponent);
+            return true;
+        }
+
+        Number GeometricSum(Number coefficient, Number ratio, Number start, Number count)
+        {
+            if (ratio == 1.0)
+                return coefficient * count;
+            // expm1/log1p keep the sum accurate for ratios close to one.
+            const double series = ratio > 0
+                ? std::expm1(count * std::log1p(ratio - 1.0)) / (ratio - 1.0)
+                : (std::pow(ratio, count) - 1.0) / (ratio - 1.0);
+            return coefficient * std::pow(ratio, start) * series;
+        }
+    };
+}
+
+bool CompiledExpression::SumClosedForm(double start, size_t count, MathValue& result) const
+{
+    // Nested loops have no series here; rule them out before evaluating.
+    if (count == 0 || nodes.empty() || hasTrailingInput || !loops.empty())
+        return false;
+
+    const MathValue first = Evaluate(MathValue::Scalar(start));
+    if (first.IsError() || Evaluate(MathValue::Scalar(start + (double)(count - 1))).IsError())
+        return false;
+
+    double sum = 0.0;
+    if (!SumSeries(start, count, nullptr, sum))
+        return false;
+    result = first;
+    result.baseValue = sum;
     return true;
 }
 
-// Helper class for linear equation parsing with rationals
-struct LinearEquationRational {
-    Rational x_coeff = Rational(0);
-    Rational y_coeff = Rational(0);
-    Rational z_coeff = Rational(0);
-    Rational constant = Rational(0);
-};
+// Exact first; in double when a coefficient has no small rational form.
+bool CompiledExpression::SumSeries(double start, size_t count, const SeriesIndex* index, double& sum) const
+{
+    ExactSeriesArithmetic exact;
+    if (SumSeries(exact, start, count, index, sum))
+        return true;
+    if (!exact.failed)
+        return false;
+    FloatSeriesArithmetic floating;
+    return SumSeries(floating, start, count, index, sum);
+}
+
+// Without `loopIndex` the series runs over the bound variable.
+template <typename Arithmetic>
+bool CompiledExpression::SumSeries(Arithmetic& arithmetic, double start, size_t count, const SeriesIndex* loopIndex, double& sum) const
+{
+    using Number = typename Arithmetic::Number;
+
+    // A node's value as a function of the variable: constant subtrees keep the
+    // exact MathValue the evaluator would produce, anything else is
+    // polynomial[k] * var^k summed with geometric terms coefficient * ratio^var.
+    struct Series
+    {
+        bool constant = false;
+        MathValue value;
+        std::vector<Number> polynomial;
+        std::vector<std::pair<Number, Number>> geometric;
+    };
+
+    const auto lift = [&](const Series& series) {
+        if (!series.constant)
+            return series;
+        Series lifted;
+        if (series.value.baseValue != 0.0)
+            lifted.polynomial.push_back(arithmetic.FromDouble(series.value.baseValue));
+        return lifted;
+    };
+    const auto isScalar = [](const Series& series) {
+        return series.geometric.empty() && series.polynomial.size() <= 1;
+    };
+    const auto scalarOf = [&](const Series& series) {
+        return series.polynomial.empty() ? arithmetic.Integer(0) : series.polynomial[0];
+    };
+    const auto normalize = [&](Series& series) {
+        while (!series.polynomial.empty() && arithmetic.IsZero(series.polynomial.back()))
+            series.polynomial.pop_back();
+        std::vector<std::pair<Number, Number>> merged;
+        for (const auto& term : series.geometric)
+        {
+            auto match = std::find_if(merged.begin(), merged.end(), [&](const std::pair<Number, Number>& existing) {
+                return arithmetic.Equal(existing.second, term.second);
+            });
+            if (match == merged.end())
+                merged.push_back(term);
+            else
+                match->first = arithmetic.Add(match->first, term.first);
+        }
+        merged.erase(std::remove_if(merged.begin(), merged.end(), [&](const std::pair<Number, Number>& term) {
+            return arithmetic.IsZero(term.first);
+        }), merged.end());
+        series.geometric = merged;
+    };
+    const auto add = [&](const Series& left, const Series& right, bool subtract) {
+        Series out = left;
+        if (out.polynomial.size() < right.polynomial.size())
+            out.polynomial.resize(right.polynomial.size(), arithmetic.Integer(0));
+        for (size_t power = 0; power < right.polynomial.size(); ++power)
+        {
+            const Number term = subtract ? arithmetic.Negate(right.polynomial[power]) : right.polynomial[power];
+            out.polynomial[power] = arithmetic.Add(out.polynomial[power], term);
+        }
+        for (const auto& term : right.geometric)
+            out.geometric.emplace_back(subtract ? arithmetic.Negate(term.first) : term.first, term.second);
+        normalize(out);
+        return out;
+    };
+    // Products of a non-constant polynomial with a geometric term have no
+    // closed form here; `ok` is cleared for them.
+    const auto multiply = [&](const Series& left, const Series& right, bool& ok) {
+        Series out;
+        if (!left.polynomial.empty() && !right.polynomial.empty())
+        {
+            const size_t length = left.polynomial.size() + right.polynomial.size() - 1;
+            if (length > kMaxClosedFormDegree + 1)
+            {
+                ok = false;
+                return out;
+            }
+            out.polynomial.assign(length, arithmetic.Integer(0));
+            for (size_t i = 0; i < left.polynomial.size(); ++i)
+                for (size_t j = 0; j < right.polynomial.size(); ++j)
+                    out.polynomial[i + j] = arithmetic.Add(out.polynomial[i + j], arithmetic.Multiply(left.polynomial[i], right.polynomial[j]));
+        }
+        if ((!left.geometric.empty() && right.polynomial.size() > 1) || (!right.geometric.empty() && left.polynomial.size() > 1))
+        {
+            ok = false;
+            return out;
+        }
+        for (const auto& term : left.geometric)
+        {
+            if (!right.polynomial.empty())
+                out.geometric.emplace_back(arithmetic.Multiply(term.first, right.polynomial[0]), term.second);
+            for (const auto& other : right.geometric)
+                out.geometric.emplace_back(arithmetic.Multiply(term.first, other.first), arithmetic.Multiply(term.second, other.second));
+        }
+        if (!left.polynomial.empty())
+        {
+            for (const auto& term : right.geometric)
+                out.geometric.emplace_back(arithmetic.Multiply(left.polynomial[0], term.first), term.second);
+        }
+        normalize(out);
+        return out;
+    };
+
+    std::vector<Series> series(nodes.size());
+    for (size_t index = 0; index < nodes.size(); ++index)
+    {
+        const Node& node = nodes[index];
+        Series& out = series[index];
+        if (node.op == Op::Literal)
+        {
+            out.constant = true;
+            out.value = literals[node.left];
+            continue;
+        }
+        if (loopIndex ? node.op == Op::Binding && node.left == loopIndex->slot : node.op == Op::Variable)
+        {
+            out.polynomial = { arithmetic.Integer(0), arithmetic.Integer(1) };
+            continue;
+        }
+        if (loopIndex && node.op == Op::Variable)
+        {
+            out.constant = true;
+            out.value = loopIndex->varValue;
+            continue;
+        }
+        if (loopIndex && node.op == Op::Binding && node.left < loopIndex->bindings->size())
+        {
+            out.constant = true;
+            out.value = (*loopIndex->bindings)[node.left];
+            continue;
+        }
+        if (node.op == Op::Binding || node.op == Op::Loop)
+            return false;
+
+        const Series& leftSeries = series[node.left];
+        const Series& rightSeries = series[node.right];
+        const bool unary = node.op == Op::Negate || node.op == Op::Function;
+        if (leftSeries.constant && (unary || rightSeries.constant))
+        {
+            out.constant = true;
+            out.value = ApplyOperation(node, leftSeries.value, rightSeries.value);
+            if (out.value.IsError())
+                return false;
+            continue;
+        }
+
+        const Series left = lift(leftSeries);
+        const Series right = lift(rightSeries);
+        bool ok = true;
+        switch (node.op)
+        {
+        case Op::Negate:
+            out = add(Series(), left, true);
+            break;
+        case Op::Add:
+        case Op::Subtract:
+            out = add(left, right, node.op == Op::Subtract);
+            break;
+        case Op::Multiply:
+            out = multiply(left, right, ok);
+            break;
+        case Op::Divide:
+        {
+            // Only constant and single geometric divisors invert in closed form.
+            Series reciprocal;
+            if (isScalar(right) && !right.polynomial.empty())
+                reciprocal.polynomial.push_back(arithmetic.Divide(arithmetic.Integer(1), right.polynomial[0]));
+            else if (right.polynomial.empty() && right.geometric.size() == 1)
+                reciprocal.geometric.emplace_back(arithmetic.Divide(arithmetic.Integer(1), right.geometric[0].first),
+                    arithmetic.Divide(arithmetic.Integer(1), right.geometric[0].second));
+            else
+                return false;
+            out = multiply(left, reciprocal, ok);
+            break;
+        }
+        case Op::Power:
+            if (isScalar(right))
+            {
+                // Small non-negative integer powers expand by repeated products.
+                const double exponent = rightSeries.constant ? rightSeries.value.baseValue : arithmetic.ToDouble(scalarOf(right));
+                if (exponent < 0 || exponent > (double)kMaxClosedFormDegree || exponent != std::floor(exponent))
+                    return false;
+                out.polynomial.push_back(arithmetic.Integer(1));
+                for (int step = 0; step < (int)exponent && ok; ++step)
+                    out = multiply(out, left, ok);
+            }
+            else if (leftSeries.constant && leftSeries.value.IsDimensionless() && right.geometric.empty() && right.polynomial.size() == 2)
+            {
+                // r^(a var + b) = r^b * (r^a)^var
+                const Number base = scalarOf(left);
+                Number coefficient, ratio;
+                if (arithmetic.IsZero(base) ||
+                    !arithmetic.TryPower(base, right.polynomial[0], coefficient) ||
+                    !arithmetic.TryPower(base, right.polynomial[1], ratio))
+                    return false;
+                out.geometric.emplace_back(coefficient, ratio);
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        if (!ok || arithmetic.failed)
+            return false;
+    }
+
+    const Series body = lift(series[root]);
+    if (arithmetic.failed)
+        return false;
 
-// Parse a linear equation into rational coefficients
-LinearEquationRational ParseLinearEquationRational(const std::wstring& equation) {
-    LinearEquationRational result;
-    MathEvaluator eval;
+    const Number first = arithmetic.FromDouble(start);
+    const Number terms = arithmetic.Integer((long long)count);
 
-    size_t eq_pos = equation.find(L'=');
-    if (eq_pos == std::wstring::npos) {
-        throw std::runtime_error("Equation must contain '='");
+    // Shift the polynomial to the index j = var - start, so that the sum runs
+    // over j = 0 .. count - 1: q[m] = sum over k >= m of p[k] C(k, m) start^(k - m).
+    const size_t degree = body.polynomial.size();
+    std::vector<std::vector<long long>> binomial(degree + 2);
+    for (size_t row = 0; row < binomial.size(); ++row)
+    {
+        binomial[row].assign(row + 1, 1);
+        for (size_t column = 1; column < row; ++column)
+            binomial[row][column] = binomial[row - 1][column - 1] + binomial[row - 1][column];
+    }
+    std::vector<Number> shifted(degree, arithmetic.Integer(0));
+    for (size_t k = 0; k < degree; ++k)
+    {
+        Number startPower = arithmetic.Integer(1);
+        for (size_t m = k + 1; m-- > 0;)
+        {
+            shifted[m] = arithmetic.Add(shifted[m], arithmetic.Multiply(body.polynomial[k], arithmetic.Multiply(arithmetic.Integer(binomial[k][m]), startPower)));
+            startPower = arithmetic.Multiply(startPower, first);
+        }
     }
 
-    std::wstring left_side = equation.substr(0, eq_pos);
-    std::wstring right_side = equation.substr(eq_pos + 1);
+    // Faulhaber: sum of j^m over j < n is (1/(m+1)) sum over t <= m of
+    // C(m+1, t) B[t] n^(m+1-t), with the Bernoulli convention B[1] = -1/2.
+    std::vector<Number> bernoulli;
+    std::vector<Number> countPowers(1, arithmetic.Integer(1));
+    for (size_t m = 0; m < degree; ++m)
+    {
+        Number next = arithmetic.Integer(m == 0 ? 1 : 0);
+        for (size_t t = 0; t < m; ++t)
+            next = arithmetic.Add(next, arithmetic.Negate(arithmetic.Divide(arithmetic.Multiply(arithmetic.Integer(binomial[m + 1][t]), bernoulli[t]), arithmetic.Integer((long long)m + 1))));
+        bernoulli.push_back(next);
+        countPowers.push_back(arithmetic.Multiply(countPowers.back(), terms));
+    }
 
-    // Evaluate right side as constant using rational arithmetic
-    Rational right_value = eval.EvalRational(right_side);
+    Number total = arithmetic.Integer(0);
+    for (size_t m = 0; m < degree; ++m)
+    {
+        Number powerSum = arithmetic.Integer(0);
+        for (size_t t = 0; t <= m; ++t)
+            powerSum = arithmetic.Add(powerSum, arithmetic.Multiply(arithmetic.Multiply(arithmetic.Integer(binomial[m + 1][t]), bernoulli[t]), countPowers[m + 1 - t]));
+        powerSum = arithmetic.Divide(powerSum, arithmetic.Integer((long long)m + 1));
+        total = arithmetic.Add(total, arithmetic.Multiply(shifted[m], powerSum));
+    }
+    for (const auto& term : body.geometric)
+        total = arithmetic.Add(total, arithmetic.GeometricSum(term.first, term.second, first, terms));
 
-    // Parse left side to get coefficients
-    std::wstring term;
-    Rational sign(1);
-    size_t pos = 0;
+    if (arithmetic.failed)
+        return false;
+    sum = arithmetic.ToDouble(total);
+    return true;
+}
 
-    while (pos < left_side.size()) {
-        // Skip spaces
-        while (pos < left_side.size() && iswspace(left_side[pos])) pos++;
-        if (pos >= left_side.size()) break;
+bool MathEvaluator::EvalBatch(const std::wstring& e, const std::wstring& vName, const double* varValues, double* out, size_t count, MathValue* sampleValue) const
+{
+    return CompiledExpression::Compile(e, vName).EvaluateBatch(varValues, out, count, sampleValue);
+}
 
-        // Check for sign
-        if (left_side[pos] == L'+') {
-            sign = Rational(1);
-            pos++;
-        } else if (left_side[pos] == L'-') {
-            sign = Rational(-1);
-            pos++;
+namespace {
+    // Token and item buffers for parsing plain text. Each thread keeps its
+    // own and clears them instead of freeing them, so once they have grown to
+    // fit, a parse allocates nothing. A parse started from inside another one
+    // takes the next level.
+    struct TextParseBuffers
+    {
+        std::vector<ExpressionToken> tokens;
+        std::vector<ExpressionItem> items;
+    };
+
+    class TextParseLease
+    {
+    public:
+        TextParseLease()
+        {
+            if (depth == pool.size())
+                pool.push_back(std::make_unique<TextParseBuffers>());
+            buffers = pool[depth++].get();
+            buffers->tokens.clear();
+            buffers->items.clear();
         }
+        ~TextParseLease() { --depth; }
+        TextParseLease(const TextParseLease&) = delete;
+        TextParseLease& operator=(const TextParseLease&) = delete;
 
-        // Skip spaces after sign
-        while (pos < left_side.size() && iswspace(left_side[pos])) pos++;
-        if (pos >= left_side.size()) break;
+        TextParseBuffers& Buffers() const { return *buffers; }
 
-        // Parse term
-        term.clear();
-        while (pos < left_side.size() && !iswspace(left_side[pos]) &&
-               left_side[pos] != L'+' && left_side[pos] != L'-') {
-            term += left_side[pos++];
-        }
+    private:
+        static thread_local std::vector<std::unique_ptr<TextParseBuffers>> pool;
+        static thread_local size_t depth;
+        TextParseBuffers* buffers = nullptr;
+    };
 
-        if (term.empty()) continue;
+    thread_local std::vector<std::unique_ptr<TextParseBuffers>> TextParseLease::pool;
+    thread_local size_t TextParseLease::depth = 0;
 
-        // Check if term contains a variable
-        bool has_variable = false;
-        for (wchar_t c : term) {
-            if (iswalpha(c) && c != L'.') {
-                has_variable = true;
-                break;
-            }
-        }
+    template <typename Domain>
+    typename Domain::Value ParseExpressionText(Domain& domain, const std::wstring& text, const std::wstring& varName, bool* complete = nullptr)
+    {
+        const TextParseLease lease;
+        TextParseBuffers& buffers = lease.Buffers();
+        LexExpressionText(text, text.size(), buffers.tokens);
+
+        ExpressionItemBuilder builder(nullptr);
+        ExpressionParser<Domain> parser(domain, builder, varName);
+        // The parser works in the leased item buffer and hands it back on the
+        // way out, exceptions included.
+        parser.Items().swap(buffers.items);
+        struct ReturnItems
+        {
+            std::vector<ExpressionItem>& parserItems;
+            std::vector<ExpressionItem>& leased;
+            ~ReturnItems() { parserItems.swap(leased); }
+        } returnItems{ parser.Items(), buffers.items };
+
+        builder.AppendTokens(buffers.tokens, parser.Items());
+        typename Domain::Value value = parser.ParseExpression();
+        if (complete)
+            *complete = parser.AtEnd();
+        return value;
+    }
+}
 
-        if (has_variable) {
-            // Parse coefficient and variable
-            std::wstring coeff_str, var_name;
-            for (wchar_t c : term) {
-                if (iswalpha(c) && c != L'.') {
-                    var_name += c;
-                } else {
-                    coeff_str += c;
-                }
-            }
+double MathEvaluator::Eval(const std::wstring& e, const std::wstring& vName, double vVal) const
+{
+    try
+    {
+        DoubleDomain domain;
+        domain.varValue = vVal;
+        return ParseExpressionText(domain, e, vName);
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
 
-            Rational coefficient(1);
-            if (!coeff_str.empty()) {
-                if (coeff_str == L"-") coefficient = Rational(-1);
-                else if (coeff_str == L"+") coefficient = Rational(1);
-                else coefficient = eval.EvalRational(coeff_str);
-            }
+MathValue MathEvaluator::EvalValue(const std::wstring& expr, const EvaluationContext& context) const
+{
+    return CompiledExpression::Compile(expr, context).Evaluate(context);
+}
 
-            coefficient = coefficient * sign;
+MathValue MathEvaluator::EvalValue(const std::wstring& e, const std::wstring& vName, const MathValue& vVal) const
+{
+    try
+    {
+        ValueDomain domain;
+        domain.varValue = vVal;
+        bool complete = false;
+        MathValue value = ParseExpressionText(domain, e, vName, &complete);
+        if (value.IsError())
+            return value;
+        if (!complete)
+            return MathValue::Error(MathError::InvalidExpression);
+        if (!std::isfinite(value.baseValue))
+            return MathValue::Error(MathError::Undefined);
+        return value;
+    }
+    catch (...)
+    {
+        return MathValue::Error(MathError::InvalidExpression);
+    }
+}
 
-            if (var_name == L"x") result.x_coeff = result.x_coeff + coefficient;
-            else if (var_name == L"y") result.y_coeff = result.y_coeff + coefficient;
-            else if (var_name == L"z") result.z_coeff = result.z_coeff + coefficient;
-        } else {
-            // Constant term on left side
-            Rational constant = eval.EvalRational(term) * sign;
-            result.constant = result.constant - constant; // Move to right side
+MatrixValue MathEvaluator::EvalMatrix(const std::wstring& e) const
+{
+    try
+    {
+        MatrixDomain domain;
+        bool complete = false;
+        MatrixValue value = ParseExpressionText(domain, e, L"", &complete);
+        if (value.IsError())
+            return value;
+        if (!complete)
+            return MatrixValue::Error(MathError::InvalidExpression);
+        for (size_t row = 0; row < value.matrix.Rows(); ++row)
+        {
+            for (size_t column = 0; column < value.matrix.Columns(); ++column)
+            {
+                if (!std::isfinite(value.matrix(row, column)))
+                    return MatrixValue::Error(MathError::Undefined);
+            }
         }
+        return value;
+    }
+    catch (...)
+    {
+        return MatrixValue::Error(MathError::InvalidExpression);
     }
+}
 
-    result.constant = result.constant + right_value;
-    return result;
+DualNumber MathEvaluator::EvalDual(const std::wstring& e, const std::wstring& vName, double vVal) const
+{
+    try
+    {
+        DualDomain domain;
+        domain.varValue = DualDomain::Make(vVal, 1.0);
+        bool complete = false;
+        DualNumber value = ParseExpressionText(domain, e, vName, &complete);
+        if (value.IsError())
+            return value;
+        if (!complete)
+            return DualNumber::Error(MathError::InvalidExpression);
+        if (!std::isfinite(value.value) || !std::isfinite(value.derivative))
+            return DualNumber::Error(MathError::Undefined);
+        return value;
+    }
+    catch (...)
+    {
+        return DualNumber::Error(MathError::InvalidExpression);
+    }
 }
 
-// Solve 2x2 linear system using rational arithmetic
-std::map<std::wstring, Rational> Solve2x2SystemRational(const Rational& a1, const Rational& b1, const Rational& c1,
-                                                        const Rational& a2, const Rational& b2, const Rational& c2) {
-    std::map<std::wstring, Rational> result;
+IntervalValue MathEvaluator::EvalInterval(const std::wstring& e, const std::wstring& vName, double vLower, double vUpper) const
+{
+    try
+    {
+        IntervalDomain domain;
+        domain.varValue = IntervalValue::Range((std::min)(vLower, vUpper), (std::max)(vLower, vUpper));
+        bool complete = false;
+        IntervalValue value = ParseExpressionText(domain, e, vName, &complete);
+        if (value.IsError())
+            return value;
+        if (!complete)
+            return IntervalValue::Error(MathError::InvalidExpression);
+        return value;
+    }
+    catch (...)
+    {
+        return IntervalValue::Error(MathError::InvalidExpression);
+    }
+}
 
-    // Calculate determinant: a1*b2 - a2*b1
-    Rational det = a1 * b2 - a2 * b1;
-    
-    if (det.num == 0) {  // Determinant is zero
-        // Check if system is inconsistent or has infinite solutions
-        Rational check1 = a1 * c2 - a2 * c1;
-        Rational check2 = b1 * c2 - b2 * c1;
-        
-        if (check1.num == 0 && check2.num == 0) {
-            result[L"x"] = Rational(0);
-            result[L"y"] = Rational(0);
-            result[L"status"] = Rational(-1); // Infinite solutions
-        } else {
-            result[L"x"] = Rational(0);
-            result[L"y"] = Rational(0);
-            result[L"status"] = Rational(-2); // No solution
-        }
-        return result;
+Rational MathEvaluator::EvalRational(const std::wstring& e, const std::wstring& vName, const Rational& vVal) const
+{
+    try
+    {
+        RationalDomain domain;
+        domain.varValue = vVal;
+        return ParseExpressionText(domain, e, vName);
+    }
+    catch (...)
+    {
+        return Rational(0);
     }
+}
 
-    // Calculate solutions: x = (c1*b2 - c2*b1) / det, y = (a1*c2 - a2*c1) / det
-    result[L"x"] = (c1 * b2 - c2 * b1) / det;
-    result[L"y"] = (a1 * c2 - a2 * c1) / det;
-    result[L"status"] = Rational(0); // Success
-    return result;
+bool MathEvaluator::EvalRationalExact(const std::wstring& e, Rational& out) const
+{
+    try
+    {
+        RationalDomain domain;
+        bool complete = false;
+        out = ParseExpressionText(domain, e, L"", &complete);
+        return complete && domain.exact;
+    }
+    catch (...)
+    {
+        return false;
+    }
 }
 
-// Solve 3x3 linear system using rational arithmetic
-std::map<std::wstring, Rational> Solve3x3SystemRational(const Rational& a1, const Rational& b1, const Rational& c1, const Rational& d1,
-                                                        const Rational& a2, const Rational& b2, const Rational& c2, const Rational& d2,
-                                                        const Rational& a3, const Rational& b3, const Rational& c3, const Rational& d3) {
-    std::map<std::wstring, Rational> result;
+bool ParseLowerLimit(const std::wstring& s, std::wstring& var, double& val)
+{
+    size_t eq = s.find(L'=');
+    if (eq == std::wstring::npos) { var = L"i"; val = _wtof(s.c_str()); return true; }
+    var = s.substr(0, eq);
+    size_t first = var.find_first_not_of(L" ");
+    size_t last = var.find_last_not_of(L" ");
+    if (first != std::wstring::npos && last != std::wstring::npos)
+        var = var.substr(first, last - first + 1);
+    val = _wtof(s.substr(eq + 1).c_str());
+    return true;
+}
 
-    // Calculate determinant
-    Rational det = a1 * (b2 * c3 - b3 * c2) - b1 * (a2 * c3 - a3 * c2) + c1 * (a2 * b3 - a3 * b2);
+// Helper class for linear equation parsing with rationals
+struct LinearEquationRational {
+    std::map<std::wstring, Rational> coefficients;  // by variable name
+    Rational constant = Rational(0);
+};
 
-    if (det.num == 0) {
-        result[L"x"] = Rational(0);
-        result[L"y"] = Rational(0);
-        result[L"z"] = Rational(0);
-        result[L"status"] = Rational(-2); // No unique solution
-        return result;
+// Parse a linear equation into rational coefficients. Both sides are read
+// with the expression grammar; unknowns move to the left and constants to
+// the right ("2x = x + 3" becomes x = 3). Throws on anything not linear.
+LinearEquationRational ParseLinearEquationRational(const std::wstring& equation) {
+    size_t eq_pos = equation.find(L'=');
+    if (eq_pos == std::wstring::npos || equation.find(L'=', eq_pos + 1) != std::wstring::npos) {
+        throw std::runtime_error("Equation must contain exactly one '='");
     }
 
-    // Calculate determinants for x, y, z
-    Rational det_x = d1 * (b2 * c3 - b3 * c2) - b1 * (d2 * c3 - d3 * c2) + c1 * (d2 * b3 - d3 * b2);
-    Rational det_y = a1 * (d2 * c3 - d3 * c2) - d1 * (a2 * c3 - a3 * c2) + c1 * (a2 * d3 - a3 * d2);
-    Rational det_z = a1 * (b2 * d3 - b3 * d2) - b1 * (a2 * d3 - a3 * d2) + d1 * (a2 * b3 - a3 * b2);
+    LinearDomain domain;
+    bool complete = false;
+    const LinearForm left = ParseExpressionText(domain, equation.substr(0, eq_pos), L"", &complete);
+    if (!complete) throw std::runtime_error("Unsupported term in linear equation");
+    const LinearForm right = ParseExpressionText(domain, equation.substr(eq_pos + 1), L"", &complete);
+    if (!complete) throw std::runtime_error("Unsupported term in linear equation");
 
-    result[L"x"] = det_x / det;
-    result[L"y"] = det_y / det;
-    result[L"z"] = det_z / det;
-    result[L"status"] = Rational(0); // Success
+    LinearEquationRational result;
+    const LinearForm moved = LinearDomain::Combined(left, right, Rational(-1));
+    result.coefficients.insert(moved.coefficients.begin(), moved.coefficients.end());
+    result.constant = Rational(0) - moved.constant;
     return result;
 }
 
-std::map<std::wstring, Rational> MathEvaluator::SolveSystemOfEquationsRational(const std::vector<std::wstring>& equations) {
+namespace {
+    // Below this many unknowns Bareiss elimination is as fast as going through
+    // the primes.
+    constexpr size_t kModularSystemSize = 16;
+
+    // Least common multiple of the denominators in one equation, so the row
+    // can be scaled to integers before elimination.
+    BigInteger RowDenominatorLcm(const std::vector<Rational>& row) {
+        BigInteger lcm(1);
+        for (const Rational& value : row) {
+            const BigInteger den = value.Denominator();
+            if (den == BigInteger(1)) continue;
+            BigInteger factor, remainder;
+            BigInteger::DivMod(den, BigInteger::Gcd(lcm, den), factor, remainder);
+            lcm = lcm * factor;
+        }
+        return lcm;
+    }
+}
+
+LinearSystemSolution MathEvaluator::SolveLinearSystemRational(const std::vector<std::wstring>& equations) const {
+    LinearSystemSolution solution;
     if (equations.empty()) {
-        std::map<std::wstring, Rational> result;
-        result[L"status"] = Rational(-3); // No equations
-        return result;
+        solution.status = -3; // No equations
+        return solution;
     }
 
     // Parse all equations
     std::vector<LinearEquationRational> parsed_equations;
+    parsed_equations.reserve(equations.size());
+    std::map<std::wstring, size_t> columns;
     for (const auto& eq : equations) {
         try {
             parsed_equations.push_back(ParseLinearEquationRational(eq));
         } catch (...) {
-            std::map<std::wstring, Rational> result;
-            result[L"status"] = Rational(-4); // Parse error
-            return result;
+            solution.status = -4; // Parse error
+            return solution;
+        }
+        for (const auto& [name, coefficient] : parsed_equations.back().coefficients) {
+            columns.emplace(name, 0);
         }
     }
 
-    size_t num_equations = parsed_equations.size();
-
-    if (num_equations == 1) {
-        // Single equation - solve for one variable if possible
-        const auto& eq = parsed_equations[0];
-        std::map<std::wstring, Rational> result;
+    // One column per variable in name order, plus the right-hand side.
+    for (auto& [name, column] : columns) {
+        column = solution.variables.size();
+        solution.variables.push_back(name);
+    }
+    const size_t n = solution.variables.size();
+    const size_t m = parsed_equations.size();
+
+    std::vector<std::vector<BigInteger>> matrix(m, std::vector<BigInteger>(n + 1));
+    std::vector<Rational> row(n + 1);
+    for (size_t r = 0; r < m; ++r) {
+        std::fill(row.begin(), row.end(), Rational(0));
+        for (const auto& [name, coefficient] : parsed_equations[r].coefficients) {
+            row[columns[name]] = coefficient;
+        }
+        row[n] = parsed_equations[r].constant;
 
-        if (eq.x_coeff.num != 0 && eq.y_coeff.num == 0 && eq.z_coeff.num == 0) {
-            result[L"x"] = eq.constant / eq.x_coeff;
-            result[L"y"] = Rational(0);
-            result[L"z"] = Rational(0);
-            result[L"status"] = Rational(0);
-        } else if (eq.y_coeff.num != 0 && eq.x_coeff.num == 0 && eq.z_coeff.num == 0) {
-            result[L"x"] = Rational(0);
-            result[L"y"] = eq.constant / eq.y_coeff;
-            result[L"z"] = Rational(0);
-            result[L"status"] = Rational(0);
-        } else if (eq.z_coeff.num != 0 && eq.x_coeff.num == 0 && eq.y_coeff.num == 0) {
-            result[L"x"] = Rational(0);
-            result[L"y"] = Rational(0);
-            result[L"z"] = eq.constant / eq.z_coeff;
-            result[L"status"] = Rational(0);
-        } else {
-            result[L"status"] = Rational(-5); // Underdetermined
+        const BigInteger lcm = RowDenominatorLcm(row);
+        for (size_t col = 0; col <= n; ++col) {
+            BigInteger scaled, remainder;
+            BigInteger::DivMod(row[col].Numerator() * lcm, row[col].Denominator(), scaled, remainder);
+            matrix[r][col] = std::move(scaled);
         }
-        return result;
     }
 
-    if (num_equations == 2) {
-        // 2 equations - solve 2x2 system
-        const auto& eq1 = parsed_equations[0];
-        const auto& eq2 = parsed_equations[1];
+    // Larger square systems are usually nonsingular; the multi-modular solver
+    // avoids coefficient growth there. Singular ones fall through to Bareiss,
+    // which also sorts out free variables and inconsistency.
+    if (m == n && n >= kModularSystemSize) {
+        std::vector<std::vector<Rational>> coefficients(n);
+        std::vector<Rational> rhs(n);
+        for (size_t r = 0; r < n; ++r) {
+            coefficients[r].reserve(n);
+            for (size_t col = 0; col < n; ++col) {
+                coefficients[r].push_back(Rational(matrix[r][col], BigInteger(1)));
+            }
+            rhs[r] = Rational(matrix[r][n], BigInteger(1));
+        }
+        if (ModularSolve(coefficients, rhs, solution.constants)) {
+            solution.isFree.assign(n, false);
+            solution.freeCoefficients.assign(n, std::vector<Rational>());
+            solution.status = 0;
+            return solution;
+        }
+    }
 
-        // Check which variables are present
-        bool has_x = eq1.x_coeff.num != 0 || eq2.x_coeff.num != 0;
-        bool has_y = eq1.y_coeff.num != 0 || eq2.y_coeff.num != 0;
-        bool has_z = eq1.z_coeff.num != 0 || eq2.z_coeff.num != 0;
+    // Fraction-free elimination (Bareiss): every update is divided exactly by
+    // the previous pivot, so entries stay integer minors of the input instead
+    // of growing into fractions and no gcd is ever taken. Columns without a
+    // pivot become free variables.
+    std::vector<size_t> pivotColumns;
+    BigInteger previousPivot(1);
+    BigInteger remainder;
+    size_t rank = 0;
+    for (size_t col = 0; col < n && rank < m; ++col) {
+        // Any nonzero pivot keeps the division exact; the shortest one keeps
+        // the products cheap.
+        size_t pivotRow = m;
+        for (size_t r = rank; r < m; ++r) {
+            if (!matrix[r][col].IsZero() &&
+                (pivotRow == m || matrix[r][col].BitLength() < matrix[pivotRow][col].BitLength())) {
+                pivotRow = r;
+            }
+        }
+        if (pivotRow == m) continue;
+        std::swap(matrix[rank], matrix[pivotRow]);
+
+        const std::vector<BigInteger>& pivotRowValues = matrix[rank];
+        const BigInteger& pivot = pivotRowValues[col];
+        for (size_t r = rank + 1; r < m; ++r) {
+            std::vector<BigInteger>& target = matrix[r];
+            const BigInteger factor = target[col];
+            for (size_t j = col + 1; j <= n; ++j) {
+                BigInteger::DivMod(pivot * target[j] - factor * pivotRowValues[j], previousPivot, target[j], remainder);
+            }
+            target[col] = BigInteger();
+        }
+        previousPivot = pivot;
+        pivotColumns.push_back(col);
+        ++rank;
+    }
 
-        if (has_z && !has_x && !has_y) {
-            // Solve for z only
-            return Solve2x2SystemRational(eq1.z_coeff, Rational(0), eq1.constant,
-                                         eq2.z_coeff, Rational(0), eq2.constant);
-        } else if (has_z && has_x && !has_y) {
-            // Solve for x and z
-            auto result = Solve2x2SystemRational(eq1.x_coeff, eq1.z_coeff, eq1.constant,
-                                                eq2.x_coeff, eq2.z_coeff, eq2.constant);
-            result[L"y"] = Rational(0);
-            return result;
-        } else if (has_z && has_y && !has_x) {
-            // Solve for y and z
-            auto result = Solve2x2SystemRational(eq1.y_coeff, eq1.z_coeff, eq1.constant,
-                                                eq2.y_coeff, eq2.z_coeff, eq2.constant);
-            result[L"x"] = Rational(0);
-            return result;
-        } else {
-            // Solve for x and y (ignore z)
-            return Solve2x2SystemRational(eq1.x_coeff, eq1.y_coeff, eq1.constant,
-                                         eq2.x_coeff, eq2.y_coeff, eq2.constant);
+    // Leftover rows are all zero on the left; a nonzero right side is 0 = c.
+    for (size_t r = rank; r < m; ++r) {
+        if (!matrix[r][n].IsZero()) {
+            solution.status = -2; // No solution
+            return solution;
         }
     }
 
-    if (num_equations == 3) {
-        // 3 equations - solve 3x3 system
-        const auto& eq1 = parsed_equations[0];
-        const auto& eq2 = parsed_equations[1];
-        const auto& eq3 = parsed_equations[2];
+    solution.isFree.assign(n, true);
+    for (size_t col : pivotColumns) solution.isFree[col] = false;
+    std::vector<size_t> freeIndex(n, 0);
+    for (size_t col = 0; col < n; ++col) {
+        if (solution.isFree[col]) {
+            freeIndex[col] = solution.freeVariables.size();
+            solution.freeVariables.push_back(col);
+        }
+    }
+    const size_t freeCount = solution.freeVariables.size();
+
+    // Fraction-free back substitution. The last pivot is the determinant D of
+    // the pivot columns, so by Cramer's rule D times every variable is an
+    // integer combination of 1 and the free variables; only the final values
+    // are reduced to fractions. terms[col][0] is the constant part and
+    // terms[col][1 + k] the coefficient of free variable k.
+    const BigInteger& determinant = previousPivot;
+    std::vector<std::vector<BigInteger>> terms(n, std::vector<BigInteger>(freeCount + 1));
+    for (size_t col : solution.freeVariables) {
+        terms[col][1 + freeIndex[col]] = determinant;
+    }
+    for (size_t k = rank; k-- > 0;) {
+        const std::vector<BigInteger>& pivotRowValues = matrix[k];
+        const size_t col = pivotColumns[k];
+        std::vector<BigInteger>& target = terms[col];
+        target[0] = determinant * pivotRowValues[n];
+        for (size_t j = col + 1; j < n; ++j) {
+            if (pivotRowValues[j].IsZero()) continue;
+            for (size_t t = 0; t <= freeCount; ++t) {
+                if (!terms[j][t].IsZero()) target[t] = target[t] - pivotRowValues[j] * terms[j][t];
+            }
+        }
+        for (size_t t = 0; t <= freeCount; ++t) {
+            BigInteger::DivMod(target[t], pivotRowValues[col], target[t], remainder);
+        }
+    }
 
-        return Solve3x3SystemRational(eq1.x_coeff, eq1.y_coeff, eq1.z_coeff, eq1.constant,
-                                     eq2.x_coeff, eq2.y_coeff, eq2.z_coeff, eq2.constant,
-                                     eq3.x_coeff, eq3.y_coeff, eq3.z_coeff, eq3.constant);
+    solution.constants.assign(n, Rational(0));
+    solution.freeCoefficients.assign(n, std::vector<Rational>(freeCount));
+    for (size_t col = 0; col < n; ++col) {
+        solution.constants[col] = Rational(terms[col][0], determinant);
+        for (size_t k = 0; k < freeCount; ++k) {
+            solution.freeCoefficients[col][k] = Rational(terms[col][1 + k], determinant);
+        }
     }
 
-    // More than 3 equations - not supported
+    solution.status = freeCount == 0 ? 0 : -1; // Unique or infinite solutions
+    return solution;
+}
+
+std::map<std::wstring, Rational> MathEvaluator::SolveSystemOfEquationsRational(const std::vector<std::wstring>& equations) const {
+    const LinearSystemSolution solution = SolveLinearSystemRational(equations);
     std::map<std::wstring, Rational> result;
-    result[L"status"] = Rational(-6);
+    // A variable named "status" would overwrite the status entry.
+    const bool statusClash = std::find(solution.variables.begin(), solution.variables.end(), L"status") !=
+                             solution.variables.end();
+    result[L"status"] = Rational(statusClash ? -4 : solution.status);
+    if (!statusClash && (solution.status == 0 || solution.status == -1)) {
+        // With free variables this is the particular solution where they are 0.
+        for (size_t col = 0; col < solution.variables.size(); ++col) {
+            result[solution.variables[col]] = solution.constants[col];
+        }
+    }
     return result;
 }
 
@@ -1370,7 +4091,7 @@ std::map<std::wstring, double> Solve3x3System(double a1, double b1, double c1, d
     return result;
 }
 
-std::map<std::wstring, double> MathEvaluator::SolveSystemOfEquations(const std::vector<std::wstring>& equations) {
+std::map<std::wstring, double> MathEvaluator::SolveSystemOfEquations(const std::vector<std::wstring>& equations) const {
     if (equations.empty()) {
         return {{L"status", -3}}; // No equations
     }
@@ -1,40 +1,80 @@
 #pragma once
 
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
-struct UnitDimension {
-    int length = 0;
-    int mass = 0;
-    int time = 0;
-    int current = 0;
-    int temperature = 0;
-    int amount = 0;
-    int luminousIntensity = 0;
+#include "evaluation_service.h"
+#include "linear_algebra.h"
+#include "rational.h"
+#include "unit_registry.h"
 
-    bool IsDimensionless() const {
-        return length == 0 && mass == 0 && time == 0 && current == 0 &&
-               temperature == 0 && amount == 0 && luminousIntensity == 0;
-    }
-
-    bool operator==(const UnitDimension& other) const {
-        return length == other.length && mass == other.mass && time == other.time &&
-               current == other.current && temperature == other.temperature &&
-               amount == other.amount && luminousIntensity == other.luminousIntensity;
-    }
+struct MathNode;
+struct MathSlot;
+enum class MathNodeKind;
 
-    bool operator!=(const UnitDimension& other) const {
-        return !(*this == other);
-    }
+// Why a calculation failed. Values carry only the code; the message is
+// formatted when it is shown, see MathErrorText.
+enum class MathError : unsigned char {
+    None,
+    InvalidExpression,
+    Undefined,
+    UnknownSymbol,
+    IncompatibleUnits,
+    InvalidUnitExponent,
+    FunctionRequiresAbstractNumber,
+    ExpRequiresAbstractNumber,
+    LogRequiresAbstractNumber,
+    InvalidLogBase,
+    InvalidLogArgument,
+    InvalidMatrix,
+    MatrixRequiresAbstractNumbers,
+    IncompatibleMatrixSizes,
+    InvalidMatrixExponent,
+    MatrixMustBeSquare,
+    SingularMatrix,
+    FunctionRequiresNumber,
+    DerivativeRequiresAbstractNumbers,
+    Incomplete,
+    InvalidLimits,
+    InvalidIndex,
+    TooManyTerms,
+    NoIntervalBounds,
+    InvalidEquation,
+    EquationNeedsOneUnknown,
+    NoRealRoot,
+    CircularDefinition,
+    Cancelled,
+    TimeLimitExceeded,
 };
 
+const wchar_t* MathErrorText(MathError error);
+
+// Display units are small IDs into a process-wide table of unit symbols.
+// ID 0 is "no unit". The units the parser knows are registered up front;
+// derived symbols such as "kg*m/s^2" are added the first time they are
+// built. Entries are never removed, so IDs and the text they name stay
+// valid for the life of the process. Safe to call from any thread.
+using UnitSymbolId = unsigned int;
+constexpr UnitSymbolId kNoUnitSymbol = 0;
+
+UnitSymbolId InternUnitSymbol(std::wstring_view symbol);
+const std::wstring& UnitSymbolText(UnitSymbolId id);
+
+// Plain data, so the arithmetic on it copies no strings and never allocates.
 struct MathValue {
     double baseValue = 0.0;
     UnitDimension dimension = {};
     double displayScale = 1.0;
-    std::wstring displayUnit;
-    std::wstring errorText;
+    UnitSymbolId displayUnit = kNoUnitSymbol;
+    MathError error = MathError::None;
 
     static MathValue Scalar(double value) {
         MathValue result;
@@ -42,7 +82,7 @@ struct MathValue {
         return result;
     }
 
-    static MathValue Quantity(double value, const UnitDimension& dim, double scale, const std::wstring& unit) {
+    static MathValue Quantity(double value, const UnitDimension& dim, double scale, UnitSymbolId unit) {
         MathValue result;
         result.baseValue = value;
         result.dimension = dim;
@@ -51,14 +91,14 @@ struct MathValue {
         return result;
     }
 
-    static MathValue Error(const std::wstring& message) {
+    static MathValue Error(MathError code) {
         MathValue result;
-        result.errorText = message;
+        result.error = code;
         return result;
     }
 
     bool IsError() const {
-        return !errorText.empty();
+        return error != MathError::None;
     }
 
     bool IsDimensionless() const {
@@ -66,111 +106,391 @@ struct MathValue {
     }
 
     bool HasDisplayUnit() const {
-        return !displayUnit.empty();
+        return displayUnit != kNoUnitSymbol;
+    }
+
+    const std::wstring& DisplayUnitText() const {
+        return UnitSymbolText(displayUnit);
+    }
+
+    std::wstring ErrorText() const {
+        return MathErrorText(error);
     }
 };
 
-std::wstring BuildCanonicalUnitSymbol(const UnitDimension& dimension);
-const std::vector<std::wstring>& GetKnownUnitSymbols();
-std::vector<std::wstring> FindMatchingUnitSymbols(const std::wstring& prefix);
+static_assert(std::is_trivially_copyable<MathValue>::value, "MathValue must stay plain data");
 
-// Rational number class for exact arithmetic
-class Rational {
-public:
-    long long num;   // numerator
-    long long den;   // denominator
+// Result of interval evaluation: every base value the expression can take
+// lies in [lower, upper], with its unit dimension, or an error code.
+// Bounds are rounded outward, so the enclosure holds in exact arithmetic too.
+struct IntervalValue {
+    double lower = 0.0;
+    double upper = 0.0;
+    UnitDimension dimension = {};
+    MathError error = MathError::None;
 
-    Rational(long long n = 0, long long d = 1) : num(n), den(d) {
-        if (den < 0) { num = -num; den = -den; }  // keep denominator positive
-        normalize();
+    static IntervalValue Range(double lower, double upper) {
+        IntervalValue result;
+        result.lower = lower;
+        result.upper = upper;
+        return result;
     }
 
-    void normalize() {
-        if (num == 0) { den = 1; return; }
-        long long g = gcd(llabs(num), llabs(den));
-        num /= g;
-        den /= g;
+    static IntervalValue Error(MathError code) {
+        IntervalValue result;
+        result.error = code;
+        return result;
     }
 
-    static long long gcd(long long a, long long b) {
-        while (b != 0) {
-            long long t = b;
-            b = a % b;
-            a = t;
-        }
-        return a;
+    bool IsError() const {
+        return error != MathError::None;
     }
 
-    Rational operator+(const Rational& other) const {
-        return Rational(num * other.den + other.num * den, den * other.den);
+    std::wstring ErrorText() const {
+        return MathErrorText(error);
     }
 
-    Rational operator-(const Rational& other) const {
-        return Rational(num * other.den - other.num * den, den * other.den);
+    bool IsDimensionless() const {
+        return dimension.IsDimensionless();
     }
 
-    Rational operator*(const Rational& other) const {
-        return Rational(num * other.num, den * other.den);
+    bool Contains(double value) const {
+        return lower <= value && value <= upper;
     }
+};
+
+static_assert(std::is_trivially_copyable<IntervalValue>::value, "IntervalValue must stay plain data");
+
+// Stop conditions and progress reporting for a calculation running in the
+// background; see EvaluationService. Term-by-term loops check it between
+// blocks and report the fraction done with the value so far.
+struct EvaluationControl
+{
+    CancellationToken token;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    std::function<void(double fraction, const MathValue& partial)> progress;
+
+    bool ShouldStop() const { return token.IsCancelled() || std::chrono::steady_clock::now() >= deadline; }
+    // The error a calculation that stopped early returns.
+    MathError StopError() const { return token.IsCancelled() ? MathError::Cancelled : MathError::TimeLimitExceeded; }
+};
+
+// Neumaier's variant of Kahan summation: the low-order bits lost by each
+// addition are collected separately, also when the term is the larger one.
+struct CompensatedSum
+{
+    double sum = 0.0;
+    double compensation = 0.0;
+
+    void Add(double value)
+    {
+        const double next = sum + value;
+        if (std::fabs(sum) >= std::fabs(value))
+            compensation += (sum - next) + value;
+        else
+            compensation += (value - next) + sum;
+        sum = next;
+    }
+
+    void Add(const CompensatedSum& other)
+    {
+        Add(other.sum);
+        Add(other.compensation);
+    }
+
+    double Value() const { return sum + compensation; }
+};
+
+// Values of document variables by name. Compiled expressions read them where
+// an identifier is not the bound variable, a constant, a function or a unit.
+using SymbolTable = std::map<std::wstring, MathValue, std::less<>>;
+
+// Outward-rounded interval sum and product, under the unit rules of EvalValue.
+IntervalValue AddIntervals(const IntervalValue& left, const IntervalValue& right);
+IntervalValue MultiplyIntervals(const IntervalValue& left, const IntervalValue& right);
+
+std::wstring BuildCanonicalUnitSymbol(const UnitDimension& dimension);
+// Interned BuildCanonicalUnitSymbol(dimension); cached per dimension.
+UnitSymbolId CanonicalUnitSymbolId(const UnitDimension& dimension);
+// Every unit symbol in suggestion rank order (see UnitSymbolIndex).
+const std::vector<std::wstring>& GetKnownUnitSymbols();
+// One-off prefix lookup; keep a UnitSymbolMatcher to narrow while typing.
+std::vector<std::wstring> FindMatchingUnitSymbols(const std::wstring& prefix);
+
+// One lexical unit of a leaf text run. Identifiers are views into the lexed
+// text and are resolved against the keyword table once, at lex time.
+struct ExpressionToken
+{
+    enum class Kind : unsigned char { Number, Identifier, Symbol };
+    // What an identifier names when it is not the bound variable.
+    enum class Keyword : unsigned char { None, Pi, E, Log, Ln, Function, Unit };
+
+    Kind kind = Kind::Symbol;
+    Keyword keyword = Keyword::None;
+    unsigned int keywordIndex = 0;  // function id or UnitRegistry index
+    wchar_t symbol = 0;
+    double number = 0.0;
+    std::wstring_view name;
+};
+
+// Lexed leaf text runs keyed by their content. Structured slots are compiled
+// straight from their node trees, so after an edit only the run that changed
+// has to be lexed again. Not synchronized: keep one cache per thread.
+class ExpressionTokenCache
+{
+public:
+    const std::vector<ExpressionToken>& Lookup(const std::wstring& text);
+    // Drops every entry once the cache grows past `maxEntries`; call only
+    // between compiles, since it invalidates references returned by Lookup.
+    void Trim(size_t maxEntries = 512);
+    void Clear() { entries.clear(); }
+    size_t Size() const { return entries.size(); }
+
+private:
+    std::unordered_map<std::wstring, std::vector<ExpressionToken>> entries;
+};
+
+// Named bindings for compiled expressions, held in a flat slot array. Names
+// are resolved to slots when a program is compiled against the context, so
+// evaluation reads a binding by index and rebinding never recompiles. Slots
+// are only ever appended, so programs stay valid as the context grows.
+class EvaluationContext
+{
+public:
+    // Slot of `name`, appended unbound (0) on first use.
+    size_t Bind(const std::wstring& name);
+    bool Find(std::wstring_view name, size_t& slot) const;
+
+    void Set(size_t slot, const MathValue& value) { values[slot] = value; }
+    void Set(size_t slot, double value) { values[slot] = MathValue::Scalar(value); }
+    const MathValue& Get(size_t slot) const { return values[slot]; }
+    size_t Size() const { return values.size(); }
+
+private:
+    std::vector<std::wstring> names;
+    std::vector<MathValue> values;
+};
+
+// Expression parsed once into a flat postfix node list. Loop bodies (summation,
+// product and integral samples) compile their text a single time and then
+// re-evaluate the program with only the bound variable changing. Results match
+// `MathEvaluator::EvalValue` for the same text and binding.
+class CompiledExpression
+{
+public:
+    static CompiledExpression Compile(const std::wstring& expr, const std::wstring& varName = L"", const SymbolTable* symbols = nullptr);
+    // Compiles against `context`: names bound there read their slot at
+    // evaluation time and, like `varName`, shadow constants and units. Any
+    // number of bindings can change between evaluations, so nested loops
+    // reuse one program.
+    static CompiledExpression Compile(const std::wstring& expr, const EvaluationContext& context,
+        const std::wstring& varName = L"", const SymbolTable* symbols = nullptr);
+    // Compiles a slot from its structured children (plain `text` when it has
+    // none). Nested fractions, powers, roots, absolute values and logarithms
+    // become operands directly instead of being flattened to text and re-parsed.
+    // A nested summation or product compiles its body once, with its index
+    // bound through an EvaluationContext slot, so the body reads both that
+    // index and `varName` (an integrand can hold a sum over x^j).
+    // With `stopMarker`, compilation ends where the marker first appears in a
+    // top-level text run (the " dx" suffix of an integrand). Values from
+    // `symbols` are copied in as literals, so recompile after they change.
+    static CompiledExpression CompileSlot(const MathSlot& slot, const std::wstring& varName = L"",
+        ExpressionTokenCache* cache = nullptr, const SymbolTable* symbols = nullptr, const wchar_t* stopMarker = nullptr);
+    // Compiles a top-level object as if it were a nested node of `kind` whose
+    // slots are `slots`, e.g. a fraction object as numerator / denominator.
+    static CompiledExpression CompileStructure(MathNodeKind kind, const std::vector<const MathSlot*>& slots,
+        ExpressionTokenCache* cache = nullptr, const SymbolTable* symbols = nullptr);
+
+    // Symbolic derivative with respect to the bound variable, as a program of
+    // its own: sums, products, quotients, powers, logarithms and the unary
+    // functions follow the usual rules, and constant subtrees contribute no
+    // nodes. A program that fails to evaluate differentiates to that failure.
+    CompiledExpression Derivative() const;
+
+    MathValue Evaluate(const MathValue& varValue = MathValue::Scalar(0.0)) const;
+    // Reuses `scratch` across calls so tight loops avoid reallocating node storage.
+    MathValue Evaluate(const MathValue& varValue, std::vector<MathValue>& scratch) const;
+    // Evaluates with the bindings of the context the program was compiled
+    // against; without one, bound names are "unknown symbol".
+    MathValue Evaluate(const EvaluationContext& context, const MathValue& varValue = MathValue::Scalar(0.0)) const;
+    MathValue Evaluate(const EvaluationContext& context, const MathValue& varValue, std::vector<MathValue>& scratch) const;
+    // With `control`, nested sums and products check it every few thousand
+    // terms and stop with its StopError.
+    MathValue Evaluate(const MathValue& varValue, std::vector<MathValue>& scratch, const EvaluationControl* control) const;
+
+    // Evaluates base values for `count` scalar bindings at once using SIMD lane
+    // kernels. All lanes share one unit, reported through `sampleValue`. Returns
+    // false when any lane is an error or non-finite, or when the unit would vary
+    // per lane; callers then fall back to `Evaluate` for exact error text.
+    bool EvaluateBatch(const double* varValues, double* out, size_t count, MathValue* sampleValue = nullptr) const;
+
+    // Enclosure of the expression over every binding in `varValue`; see
+    // MathEvaluator::EvalInterval. Context bindings are not enclosed.
+    IntervalValue EvaluateInterval(const IntervalValue& varValue) const;
+
+    // Sums the expression over the `count` bindings start, start + 1, ... in
+    // closed form when it is a polynomial in the variable plus geometric terms
+    // c * r^var (Faulhaber's formula and the geometric series), so the cost does
+    // not grow with `count`. Exact in Rational while every coefficient has a
+    // small rational form, in double otherwise. Returns false for any
+    // other shape or when the first or last term is an error; callers then
+    // iterate. The unit of `result` is that of the first term.
+    bool SumClosedForm(double start, size_t count, MathValue& result) const;
+
+    bool UsesVariable() const { return usesVariable; }
+    bool UsesUnits() const { return usesUnits; }
+    size_t NodeCount() const { return nodes.size(); }
+
+private:
+    class Compiler;
+
+    static CompiledExpression Failure();
 
-    Rational operator/(const Rational& other) const {
-        return Rational(num * other.den, den * other.num);
+    enum class Op : unsigned char { Literal, Variable, Binding, Negate, Add, Subtract, Multiply, Divide, Power, Function, Log, Loop };
+
+    struct Node
+    {
+        Op op = Op::Literal;
+        unsigned char function = 0;
+        unsigned int left = 0;   // literal index, binding slot, loop index, or operand node index
+        unsigned int right = 0;  // second operand node index
+    };
+
+    // A nested summation or product. The limits are nodes of this program;
+    // the body is a program of its own, compiled against `scope`, which is
+    // the enclosing context plus the index at `slot`.
+    struct Loop
+    {
+        std::shared_ptr<const CompiledExpression> body;
+        std::shared_ptr<const EvaluationContext> scope;
+        unsigned int first = 0;
+        unsigned int last = 0;
+        size_t slot = 0;
+        bool product = false;
+    };
+
+    struct LoopFrame;
+    struct SeriesIndex;
+
+    static MathValue ApplyOperation(const Node& node, const MathValue& left, const MathValue& right);
+    MathValue Evaluate(const MathValue& varValue, const EvaluationContext* context, std::vector<MathValue>& scratch,
+        const EvaluationControl* control) const;
+    MathValue EvaluateNodes(const MathValue& varValue, const EvaluationContext* context, std::vector<MathValue>& scratch,
+        LoopFrame* frame) const;
+    MathValue EvaluateLoop(const Loop& loop, const MathValue& first, const MathValue& last, const MathValue& varValue,
+        LoopFrame& frame) const;
+    bool SumSeries(double start, size_t count, const SeriesIndex* index, double& sum) const;
+    template <typename Arithmetic>
+    bool SumSeries(Arithmetic& arithmetic, double start, size_t count, const SeriesIndex* index, double& sum) const;
+
+    std::vector<Node> nodes;
+    std::vector<MathValue> literals;
+    std::vector<Loop> loops;
+    unsigned int root = 0;
+    bool usesVariable = false;
+    bool usesUnits = false;
+    bool hasTrailingInput = false;
+    bool batchSafe = true;
+};
+
+// General solution of a linear system, one column per variable in name order.
+// Free variables stand for themselves; every other variable equals its
+// constant plus the sum of freeCoefficients[variable][k] * freeVariables[k].
+struct LinearSystemSolution
+{
+    int status = 0;  // 0 unique, -1 infinite, -2 none, -3 no equations, -4 parse error
+    std::vector<std::wstring> variables;
+    std::vector<bool> isFree;
+    std::vector<size_t> freeVariables;
+    std::vector<Rational> constants;
+    std::vector<std::vector<Rational>> freeCoefficients;
+};
+
+// Result of `MathEvaluator::EvalMatrix`: a matrix, where plain numbers are
+// 1x1, or an error code.
+struct MatrixValue
+{
+    Matrix matrix;
+    MathError error = MathError::None;
+
+    static MatrixValue Error(MathError code)
+    {
+        MatrixValue result;
+        result.error = code;
+        return result;
     }
 
-    double toDouble() const {
-        return (double)num / den;
+    bool IsError() const { return error != MathError::None; }
+    std::wstring ErrorText() const { return MathErrorText(error); }
+    bool IsScalar() const { return matrix.Rows() == 1 && matrix.Columns() == 1; }
+};
+
+// Result of `MathEvaluator::EvalDual`: f(x) and the exact f'(x) carried
+// through the same pass (forward-mode automatic differentiation), or an
+// error code.
+struct DualNumber
+{
+    double value = 0.0;
+    double derivative = 0.0;
+    MathError error = MathError::None;
+
+    static DualNumber Constant(double value)
+    {
+        DualNumber result;
+        result.value = value;
+        return result;
     }
 
-    std::wstring toString() const {
-        if (den == 1) return std::to_wstring(num);
-        return std::to_wstring(num) + L"/" + std::to_wstring(den);
+    static DualNumber Error(MathError code)
+    {
+        DualNumber result;
+        result.error = code;
+        return result;
     }
+
+    bool IsError() const { return error != MathError::None; }
+    std::wstring ErrorText() const { return MathErrorText(error); }
 };
 
+static_assert(std::is_trivially_copyable<DualNumber>::value, "DualNumber must stay plain data");
+
+// Entry points for one-off text evaluation. The evaluator holds no state:
+// every call parses with a cursor of its own, so a single instance, like a
+// single CompiledExpression, may serve any number of threads at once.
 class MathEvaluator
 {
 public:
     // Double-based evaluation methods
-    double Eval(const std::wstring& expr, const std::wstring& varName = L"", double varValue = 0);
-    MathValue EvalValue(const std::wstring& expr, const std::wstring& varName = L"", const MathValue& varValue = MathValue::Scalar(0.0));
-    std::map<std::wstring, double> SolveSystemOfEquations(const std::vector<std::wstring>& equations);
+    double Eval(const std::wstring& expr, const std::wstring& varName = L"", double varValue = 0) const;
+    MathValue EvalValue(const std::wstring& expr, const std::wstring& varName = L"", const MathValue& varValue = MathValue::Scalar(0.0)) const;
+    // EvalValue with every binding in `context` visible by name.
+    MathValue EvalValue(const std::wstring& expr, const EvaluationContext& context) const;
+    // Batched EvalValue over `count` scalar bindings of `varName`; see CompiledExpression::EvaluateBatch.
+    bool EvalBatch(const std::wstring& expr, const std::wstring& varName, const double* varValues, double* out, size_t count, MathValue* sampleValue = nullptr) const;
+    std::map<std::wstring, double> SolveSystemOfEquations(const std::vector<std::wstring>& equations) const;
+    // Matrix expressions: literals `[1, 2; 3, 4]` (',' between entries, ';'
+    // between rows), + - *, scaling by numbers, integer powers and `^T`.
+    MatrixValue EvalMatrix(const std::wstring& expr) const;
+    // Value and derivative with respect to `varName` at `varValue` in one
+    // evaluation; unit symbols are errors.
+    DualNumber EvalDual(const std::wstring& expr, const std::wstring& varName, double varValue) const;
+    // Guaranteed enclosure of the expression, units included, for `varName`
+    // anywhere in [varLower, varUpper]. Points where the scalar path fails (a
+    // root of a negative number, a pole) are left out; only an interval with
+    // no valid point at all is an error.
+    IntervalValue EvalInterval(const std::wstring& expr, const std::wstring& varName = L"", double varLower = 0, double varUpper = 0) const;
 
     // Rational-based evaluation methods
-    Rational EvalRational(const std::wstring& expr, const std::wstring& varName = L"", const Rational& varValue = Rational(0));
-    std::map<std::wstring, Rational> SolveSystemOfEquationsRational(const std::vector<std::wstring>& equations);
-
-private:
-    std::wstring expr;
-    size_t pos = 0;
-    std::wstring varName;
-    
-    // Double-based parsing members
-    double varValue_d = 0;
-
-    // Quantity-based parsing members
-    MathValue varValue_q;
-    
-    // Rational-based parsing members  
-    Rational varValue_r;
-
-    // Double-based parsing methods
-    double ParseExpression();
-    double ParseTerm();
-    double ParseFactor();
-    double ParsePower();
-
-    MathValue ParseValueExpression();
-    MathValue ParseValueTerm();
-    MathValue ParseValueFactor();
-    MathValue ParseValuePower();
-    
-    // Rational-based parsing methods
-    Rational ParseExpressionRational();
-    Rational ParseTermRational();
-    Rational ParseFactorRational();
-    Rational ParsePowerRational();
-    
-    void SkipSpace();
+    Rational EvalRational(const std::wstring& expr, const std::wstring& varName = L"", const Rational& varValue = Rational(0)) const;
+    // Fails unless `expr` parses completely and its value is exact: integers,
+    // decimals and fractions combined with + - * / and integer powers.
+    bool EvalRationalExact(const std::wstring& expr, Rational& out) const;
+    // Values by variable name plus "status"; when solutions are infinite the
+    // values are the particular solution with every free variable at 0. A
+    // variable named "status" reports a parse error (-4); use
+    // `SolveLinearSystemRational` for such systems.
+    std::map<std::wstring, Rational> SolveSystemOfEquationsRational(const std::vector<std::wstring>& equations) const;
+    LinearSystemSolution SolveLinearSystemRational(const std::vector<std::wstring>& equations) const;
 };
 
 bool ParseLowerLimit(const std::wstring& s, std::wstring& var, double& val);
@@ -1,10 +1,16 @@
 #include "math_manager.h"
 #include "math_evaluator.h"
+#include "linear_algebra.h"
+#include "modular_solver.h"
+#include "task_pool.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cfloat>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 
 namespace
 {
@@ -21,6 +27,13 @@ namespace
             value = 0;
 
         std::wostringstream stream;
+        // Past the range of long long, fall back to scientific notation.
+        if (std::fabs(value) >= 9.0e18)
+        {
+            stream << std::setprecision(15) << value;
+            return stream.str();
+        }
+
         const double nearestInt = std::round(value);
         if (std::fabs(value - nearestInt) < 1e-9)
         {
@@ -43,6 +56,22 @@ namespace
         return text;
     }
 
+    // Row text in the literal syntax EvalMatrix reads back: "[1, 2; 3, 4]".
+    static std::wstring FormatMatrix(const Matrix& matrix)
+    {
+        std::wstring text = L"[";
+        for (size_t row = 0; row < matrix.Rows(); ++row)
+        {
+            if (row > 0) text += L"; ";
+            for (size_t column = 0; column < matrix.Columns(); ++column)
+            {
+                if (column > 0) text += L", ";
+                text += FormatBareNumber(matrix(row, column));
+            }
+        }
+        return text + L"]";
+    }
+
     static std::wstring TrimCopy(const std::wstring& text)
     {
         const size_t first = text.find_first_not_of(L" \t");
@@ -51,15 +80,75 @@ namespace
         return text.substr(first, last - first + 1);
     }
 
-    static void AddDimension(UnitDimension& target, const UnitDimension& source, int sign)
+    static bool IsBlank(const std::wstring& text)
+    {
+        return text.find_first_not_of(L" \t") == std::wstring::npos;
+    }
+
+    static const MathSlot& SlotAt(const MathObject& obj, int partIndex)
+    {
+        static const MathSlot kEmpty;
+        const size_t slotIndex = MathObject::SlotIndexFromPart(partIndex);
+        return slotIndex < obj.slots.size() ? obj.slots[slotIndex] : kEmpty;
+    }
+
+    static bool IsVariableName(const std::wstring& text)
+    {
+        ExpressionTokenCache cache;
+        const std::vector<ExpressionToken>& tokens = cache.Lookup(text);
+        return tokens.size() == 1 && tokens[0].kind == ExpressionToken::Kind::Identifier &&
+               tokens[0].keyword == ExpressionToken::Keyword::None;
+    }
+
+    // A plain expression object reading "name := expr" defines a document
+    // variable. The name has to lead the first text run and be a single
+    // identifier that is not a constant, function or unit; `body` is the slot
+    // with "name :=" removed.
+    static bool SplitDefinition(const MathObject& obj, std::wstring& name, MathSlot& body)
     {
-        target.length += source.length * sign;
-        target.mass += source.mass * sign;
-        target.time += source.time * sign;
-        target.current += source.current * sign;
-        target.temperature += source.temperature * sign;
-        target.amount += source.amount * sign;
-        target.luminousIntensity += source.luminousIntensity * sign;
+        if (obj.type != MathType::Sum)
+            return false;
+        const MathSlot& slot = SlotAt(obj, 1);
+        const size_t marker = slot.text.find(L":=");
+        if (marker == std::wstring::npos)
+            return false;
+        if (!slot.children.empty() &&
+            (slot.children[0].kind != MathNodeKind::Text || slot.children[0].text.find(L":=") == std::wstring::npos))
+            return false;
+        name = TrimCopy(slot.text.substr(0, marker));
+        if (!IsVariableName(name))
+            return false;
+
+        body = slot;
+        body.text.erase(0, marker + 2);
+        if (!body.children.empty())
+            body.children[0].text.erase(0, body.children[0].text.find(L":=") + 2);
+        return true;
+    }
+
+    // The variable `obj` defines, if any, and the other identifiers it reads.
+    // Objects evaluated outside the compiled path (systems, matrices) take
+    // no part in the dependency graph.
+    static void ScanDependencies(const MathObject& obj, ExpressionTokenCache& cache, std::wstring& defines, std::vector<std::wstring>& reads)
+    {
+        defines.clear();
+        reads.clear();
+        if (obj.type == MathType::SystemOfEquations || obj.type == MathType::Matrix || obj.type == MathType::Determinant)
+            return;
+
+        MathSlot body;
+        const bool isDefinition = SplitDefinition(obj, defines, body);
+        for (size_t slot = 1; slot <= obj.slots.size(); ++slot)
+        {
+            const std::wstring& text = isDefinition && slot == 1 ? body.text : obj.SlotText(static_cast<int>(slot));
+            for (const ExpressionToken& token : cache.Lookup(text))
+            {
+                if (token.kind != ExpressionToken::Kind::Identifier || token.keyword != ExpressionToken::Keyword::None)
+                    continue;
+                if (std::find(reads.begin(), reads.end(), token.name) == reads.end())
+                    reads.emplace_back(token.name);
+            }
+        }
     }
 
     static MathValue NormalizeDisplay(MathValue value)
@@ -70,13 +159,13 @@ namespace
         if (value.IsDimensionless())
         {
             value.displayScale = 1.0;
-            value.displayUnit.clear();
+            value.displayUnit = kNoUnitSymbol;
             return value;
         }
 
-        if (value.displayUnit.empty())
+        if (!value.HasDisplayUnit())
         {
-            value.displayUnit = BuildCanonicalUnitSymbol(value.dimension);
+            value.displayUnit = CanonicalUnitSymbolId(value.dimension);
             value.displayScale = 1.0;
         }
         return value;
@@ -87,7 +176,7 @@ namespace
         if (left.IsError()) return left;
         if (right.IsError()) return right;
         if (left.dimension != right.dimension)
-            return MathValue::Error(L"incompatible units");
+            return MathValue::Error(MathError::IncompatibleUnits);
 
         MathValue result = MathValue::Scalar(left.baseValue + right.baseValue);
         result.dimension = left.dimension;
@@ -114,43 +203,723 @@ namespace
         if (right.IsError()) return right;
 
         MathValue result = MathValue::Scalar(left.baseValue * right.baseValue);
-        result.dimension = left.dimension;
-        AddDimension(result.dimension, right.dimension, 1);
+        if (!UnitDimension::TryMultiply(left.dimension, right.dimension, result.dimension))
+            return MathValue::Error(MathError::InvalidUnitExponent);
         return NormalizeDisplay(result);
     }
 
-    static bool ParseMatrixRows(const MathObject& obj, std::vector<std::vector<double>>& matrix)
+    // Running product kept as a signed mantissa in [0.5, 1) and a binary
+    // exponent, so long products neither overflow nor underflow part way and
+    // exact products stay exact. Equivalent to summing logarithms with a sign
+    // bit, without the rounding of log/exp.
+    struct ScaledProduct
     {
-        matrix.clear();
-        MathEvaluator eval;
+        double mantissa = 0.5;
+        long long exponent = 1;
+
+        void Multiply(double value)
+        {
+            int shift = 0;
+            mantissa = std::frexp(mantissa * value, &shift);
+            exponent += shift;
+        }
+
+        void Multiply(const ScaledProduct& other)
+        {
+            Multiply(other.mantissa);
+            exponent += other.exponent;
+        }
+
+        double Value() const
+        {
+            if (mantissa == 0.0)
+                return 0.0;
+            const long long clamped = (std::max)(-4096LL, (std::min)(4096LL, exponent));
+            return std::ldexp(mantissa, static_cast<int>(clamped));
+        }
+    };
+
+    constexpr size_t kReductionBlock = 256;
+    constexpr size_t kReductionGrain = 4096;
+    constexpr size_t kMaxReductionChunks = 4096;
+    // Terms between checks of an EvaluationControl in scalar loops.
+    constexpr size_t kControlInterval = 4096;
+
+    // Whether a summation or product appears anywhere in `nodes`; each one
+    // compiles to a loop.
+    static bool ContainsLoop(const std::vector<MathNode>& nodes)
+    {
+        for (const MathNode& node : nodes)
+        {
+            if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product || ContainsLoop(node.children))
+                return true;
+        }
+        return false;
+    }
+
+    // Value of a program without a bound variable; sums and products nested
+    // in it stop under `control`.
+    static MathValue EvaluateControlled(const CompiledExpression& program, const EvaluationControl* control)
+    {
+        std::vector<MathValue> scratch;
+        return program.Evaluate(MathValue::Scalar(0.0), scratch, control);
+    }
+
+    // Result of a controlled calculation that stopped early.
+    static MathValue StoppedResult(const EvaluationControl& control)
+    {
+        return MathValue::Error(control.StopError());
+    }
 
-        if (obj.slots.size() >= 4)
+    // Reduces the body over the `count` bindings start, start + 1, ... with the
+    // batch kernels. Units are taken from the first term and checked once per
+    // batch of lanes rather than per term. Large ranges are split into fixed chunks run
+    // on the shared task pool; the chunk layout depends only on `count` and
+    // partial results combine in chunk order, so the result is deterministic.
+    // Returns false when any term is an error, non-finite or changes unit, or
+    // when a product's terms carry units; callers then fall back to the
+    // sequential loop, which reports the exact error.
+    static bool ReduceIndexRange(const CompiledExpression& body, double start, size_t count, bool product, MathValue& result,
+        const EvaluationControl* control = nullptr)
+    {
+        MathValue unit;
+        double first = 0.0;
+        if (!body.EvaluateBatch(&start, &first, 1, &unit))
+            return false;
+        if (product && !unit.IsDimensionless())
+            return false;
+
+        const size_t chunkSize = (std::max)(kReductionGrain, (count + kMaxReductionChunks - 1) / kMaxReductionChunks);
+        const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        std::vector<CompensatedSum> sums(product ? 0 : chunkCount);
+        std::vector<ScaledProduct> products(product ? chunkCount : 0);
+        std::atomic<bool> failed{ false };
+
+        const auto reduceChunks = [&](size_t firstChunk, size_t lastChunk) {
+            double bindings[kReductionBlock];
+            double values[kReductionBlock];
+            for (size_t chunk = firstChunk; chunk < lastChunk && !failed.load(std::memory_order_relaxed); ++chunk)
+            {
+                const size_t chunkEnd = (std::min)(count, (chunk + 1) * chunkSize);
+                CompensatedSum sum;
+                ScaledProduct running;
+                for (size_t begin = chunk * chunkSize; begin < chunkEnd; begin += kReductionBlock)
+                {
+                    const size_t lanes = (std::min)(kReductionBlock, chunkEnd - begin);
+                    for (size_t lane = 0; lane < lanes; ++lane)
+                        bindings[lane] = start + static_cast<double>(begin + lane);
+
+                    MathValue laneUnit;
+                    if (!body.EvaluateBatch(bindings, values, lanes, &laneUnit) || laneUnit.dimension != unit.dimension)
+                    {
+                        failed.store(true, std::memory_order_relaxed);
+                        return;
+                    }
+                    for (size_t lane = 0; lane < lanes; ++lane)
+                    {
+                        if (product)
+                            running.Multiply(values[lane]);
+                        else
+                            sum.Add(values[lane]);
+                    }
+                }
+                if (product)
+                    products[chunk] = running;
+                else
+                    sums[chunk] = sum;
+            }
+        };
+
+        // Chunks run in waves and are combined in chunk order as each wave
+        // ends, so the result does not depend on the wave size. Uncontrolled
+        // runs take a single wave; controlled ones stop or report between waves.
+        const size_t waveSize = control ? (TaskPool::Shared().WorkerCount() + 1) * 4 : chunkCount;
+        CompensatedSum total;
+        ScaledProduct totalProduct;
+        const auto combined = [&] {
+            MathValue value = unit;
+            value.baseValue = product ? totalProduct.Value() : total.Value();
+            return value;
+        };
+        for (size_t waveStart = 0; waveStart < chunkCount; waveStart += waveSize)
         {
-            std::vector<double> firstRow;
-            std::vector<double> secondRow;
-            const std::wstring cells[] = {
-                TrimCopy(obj.SlotText(1)), TrimCopy(obj.SlotText(2)),
-                TrimCopy(obj.SlotText(3)), TrimCopy(obj.SlotText(4))
-            };
+            const size_t waveEnd = (std::min)(chunkCount, waveStart + waveSize);
+            if (count >= 2 * kReductionGrain)
+                TaskPool::Shared().ParallelFor(waveEnd - waveStart, 1, [&](size_t first, size_t last) {
+                    reduceChunks(waveStart + first, waveStart + last);
+                });
+            else
+                reduceChunks(waveStart, waveEnd);
+            if (failed.load())
+                return false;
 
-            for (size_t cellIndex = 0; cellIndex < 4; ++cellIndex)
+            for (size_t chunk = waveStart; chunk < waveEnd; ++chunk)
+            {
+                if (product)
+                    totalProduct.Multiply(products[chunk]);
+                else
+                    total.Add(sums[chunk]);
+            }
+            if (!control || waveEnd == chunkCount)
+                continue;
+            if (control->ShouldStop())
             {
-                if (cells[cellIndex].empty())
+                result = StoppedResult(*control);
+                return true;
+            }
+            if (control->progress)
+                control->progress(static_cast<double>(waveEnd) / static_cast<double>(chunkCount), combined());
+        }
+
+        result = combined();
+        return true;
+    }
+
+    // Number of bindings the `for (i = start; i <= upper; ++i)` loop visits.
+    static size_t IndexRangeCount(double start, double upper)
+    {
+        if (!(upper >= start))
+            return 0;
+        const double span = std::floor(upper - start) + 1.0;
+        return span < 9007199254740992.0 ? static_cast<size_t>(span) : 0;
+    }
+
+    // Gauss-Kronrod 7/15 abscissae on [-1, 1] (non-negative half, centre last)
+    // with the Kronrod weights; the embedded Gauss rule uses every odd node.
+    const double kKronrodNodes[8] = {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245, 0.0,
+    };
+    const double kKronrodWeights[8] = {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714,
+    };
+    const double kGaussWeights[4] = {
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327,
+    };
+    constexpr size_t kKronrodPoints = 15;
+
+    struct QuadraturePanel
+    {
+        double lower = 0.0;
+        double upper = 0.0;
+        MathValue integral;
+        double error = 0.0;
+    };
+
+    // Applies the 15-point Kronrod rule on the panel and estimates its error
+    // from the embedded 7-point Gauss rule, scaled as in QUADPACK's QK15.
+    // Samples come from the batched kernel when the integrand allows it, and
+    // otherwise one by one, accumulating units like the summation loops do.
+    // On failure, `failure` holds the first sample error.
+    static bool EvaluateKronrodPanel(const CompiledExpression& integrand, std::vector<MathValue>& scratch,
+        QuadraturePanel& panel, MathValue& failure)
+    {
+        const double center = 0.5 * (panel.lower + panel.upper);
+        const double halfLength = 0.5 * (panel.upper - panel.lower);
+
+        double points[kKronrodPoints];
+        double samples[kKronrodPoints];
+        points[0] = center;
+        for (size_t node = 0; node < 7; ++node)
+        {
+            points[1 + 2 * node] = center - halfLength * kKronrodNodes[node];
+            points[2 + 2 * node] = center + halfLength * kKronrodNodes[node];
+        }
+
+        MathValue unit;
+        if (!integrand.EvaluateBatch(points, samples, kKronrodPoints, &unit))
+        {
+            MathValue weighted = MathValue::Scalar(0.0);
+            for (size_t index = 0; index < kKronrodPoints; ++index)
+            {
+                MathValue sample = integrand.Evaluate(MathValue::Scalar(points[index]), scratch);
+                if (sample.IsError())
+                {
+                    failure = sample;
+                    return false;
+                }
+                samples[index] = sample.baseValue;
+                sample.baseValue = 0.0;
+                weighted = index == 0 ? sample : AddAccumulatedValues(weighted, sample);
+                if (weighted.IsError())
+                {
+                    failure = weighted;
                     return false;
+                }
+            }
+            unit = weighted;
+        }
 
-                const double value = eval.Eval(cells[cellIndex]);
-                if (cellIndex < 2)
-                    firstRow.push_back(value);
-                else
-                    secondRow.push_back(value);
+        double kronrod = kKronrodWeights[7] * samples[0];
+        double gauss = kGaussWeights[3] * samples[0];
+        double absolute = kKronrodWeights[7] * std::fabs(samples[0]);
+        for (size_t node = 0; node < 7; ++node)
+        {
+            const double pair = samples[1 + 2 * node] + samples[2 + 2 * node];
+            kronrod += kKronrodWeights[node] * pair;
+            if (node % 2 == 1)
+                gauss += kGaussWeights[node / 2] * pair;
+            absolute += kKronrodWeights[node] * (std::fabs(samples[1 + 2 * node]) + std::fabs(samples[2 + 2 * node]));
+        }
+
+        const double mean = 0.5 * kronrod;
+        double deviation = kKronrodWeights[7] * std::fabs(samples[0] - mean);
+        for (size_t node = 0; node < 7; ++node)
+            deviation += kKronrodWeights[node] * (std::fabs(samples[1 + 2 * node] - mean) + std::fabs(samples[2 + 2 * node] - mean));
+
+        const double scale = std::fabs(halfLength);
+        absolute *= scale;
+        deviation *= scale;
+        double error = std::fabs((kronrod - gauss) * halfLength);
+        if (deviation != 0.0 && error != 0.0)
+            error = deviation * (std::min)(1.0, std::pow(200.0 * error / deviation, 1.5));
+        if (absolute > DBL_MIN / (50.0 * DBL_EPSILON))
+            error = (std::max)(50.0 * DBL_EPSILON * absolute, error);
+
+        panel.integral = unit;
+        panel.integral.baseValue = kronrod * halfLength;
+        panel.error = error;
+        return true;
+    }
+
+    // Globally adaptive integration: the panel with the largest error estimate
+    // is bisected until the summed estimate meets the tolerance or the budget
+    // runs out.
+    static MathValue IntegrateAdaptive(const CompiledExpression& integrand, double lower, double upper,
+        const QuadratureOptions& options, QuadratureReport& report)
+    {
+        const auto byError = [](const QuadraturePanel& left, const QuadraturePanel& right) { return left.error < right.error; };
+
+        std::vector<MathValue> scratch;
+        std::vector<QuadraturePanel> panels(1);
+        panels[0].lower = lower;
+        panels[0].upper = upper;
+        MathValue failure;
+        if (!EvaluateKronrodPanel(integrand, scratch, panels[0], failure))
+            return failure;
+        report.evaluations = kKronrodPoints;
+
+        double total = panels[0].integral.baseValue;
+        double totalError = panels[0].error;
+        while (true)
+        {
+            const double tolerance = (std::max)(options.absoluteTolerance, options.relativeTolerance * std::fabs(total));
+            if (totalError <= tolerance)
+            {
+                report.converged = true;
+                break;
             }
+            if (report.evaluations + 2 * kKronrodPoints > options.maxEvaluations)
+                break;
 
-            matrix.push_back(std::move(firstRow));
-            matrix.push_back(std::move(secondRow));
+            std::pop_heap(panels.begin(), panels.end(), byError);
+            const QuadraturePanel worst = panels.back();
+            const double middle = 0.5 * (worst.lower + worst.upper);
+            if (middle == worst.lower || middle == worst.upper)
+            {
+                std::push_heap(panels.begin(), panels.end(), byError);
+                break;
+            }
+
+            QuadraturePanel left;
+            left.lower = worst.lower;
+            left.upper = middle;
+            QuadraturePanel right;
+            right.lower = middle;
+            right.upper = worst.upper;
+            if (!EvaluateKronrodPanel(integrand, scratch, left, failure) ||
+                !EvaluateKronrodPanel(integrand, scratch, right, failure))
+                return failure;
+            report.evaluations += 2 * kKronrodPoints;
+
+            total += left.integral.baseValue + right.integral.baseValue - worst.integral.baseValue;
+            totalError += left.error + right.error - worst.error;
+            panels.back() = left;
+            std::push_heap(panels.begin(), panels.end(), byError);
+            panels.push_back(right);
+            std::push_heap(panels.begin(), panels.end(), byError);
+        }
+
+        // Sum in domain order so the result does not depend on heap layout.
+        std::sort(panels.begin(), panels.end(), [](const QuadraturePanel& left, const QuadraturePanel& right) {
+            return left.lower < right.lower;
+        });
+        MathValue integral = panels[0].integral;
+        report.errorEstimate = panels[0].error;
+        for (size_t index = 1; index < panels.size(); ++index)
+        {
+            integral = AddAccumulatedValues(integral, panels[index].integral);
+            if (integral.IsError())
+                return integral;
+            report.errorEstimate += panels[index].error;
+        }
+        return NormalizeDisplay(integral);
+    }
+
+    // Interval results: terms enclosed one by one, and panels per integral.
+    constexpr size_t kMaxIntervalTerms = 1000000;
+    constexpr size_t kIntervalPanels = 1024;
+
+    static IntervalValue SubtractIntervals(const IntervalValue& left, const IntervalValue& right)
+    {
+        return AddIntervals(left, MultiplyIntervals(right, IntervalValue::Range(-1.0, -1.0)));
+    }
+
+    // Enclosure of the integral over one panel: width * f(panel), intersected
+    // with the second-order Taylor form about the middle c,
+    //   h f(c) + f'(c) * integral of (x - c) + f''(panel) * integral of (x - c)^2 / 2,
+    // whose width shrinks with the cube of the panel. Both are rigorous, so
+    // their intersection is too; the Taylor form drops out wherever f'' is
+    // unbounded (kinks, poles).
+    static IntervalValue EnclosePanel(const CompiledExpression& integrand, const CompiledExpression& slope,
+        const CompiledExpression& curvature, double left, double right)
+    {
+        const auto point = [](double value) { return IntervalValue::Range(value, value); };
+        const IntervalValue width = SubtractIntervals(point(right), point(left));
+        const IntervalValue plain = MultiplyIntervals(integrand.EvaluateInterval(IntervalValue::Range(left, right)), width);
+
+        const double middle = 0.5 * (left + right);
+        const IntervalValue toRight = SubtractIntervals(point(right), point(middle));
+        const IntervalValue toLeft = SubtractIntervals(point(left), point(middle));
+        const IntervalValue firstMoment = MultiplyIntervals(
+            SubtractIntervals(MultiplyIntervals(toRight, toRight), MultiplyIntervals(toLeft, toLeft)), point(0.5));
+        const IntervalValue sixth = IntervalValue::Range(std::nextafter(1.0 / 6.0, 0.0), std::nextafter(1.0 / 6.0, 1.0));
+        const IntervalValue secondMoment = MultiplyIntervals(SubtractIntervals(
+            MultiplyIntervals(MultiplyIntervals(toRight, toRight), toRight),
+            MultiplyIntervals(MultiplyIntervals(toLeft, toLeft), toLeft)), sixth);
+
+        const IntervalValue taylor = AddIntervals(
+            AddIntervals(MultiplyIntervals(integrand.EvaluateInterval(point(middle)), width),
+                         MultiplyIntervals(slope.EvaluateInterval(point(middle)), firstMoment)),
+            MultiplyIntervals(curvature.EvaluateInterval(IntervalValue::Range(left, right)), secondMoment));
+
+        if (plain.IsError() || taylor.IsError() || plain.dimension != taylor.dimension)
+            return plain;
+        IntervalValue result = plain;
+        result.lower = (std::max)(plain.lower, taylor.lower);
+        result.upper = (std::min)(plain.upper, taylor.upper);
+        return result.lower <= result.upper ? result : plain;
+    }
+
+    // Base value of `function` at the scalar `x`; fails on errors.
+    static bool EvaluateAt(const CompiledExpression& function, double x, std::vector<MathValue>& scratch, double& out)
+    {
+        const MathValue value = function.Evaluate(MathValue::Scalar(x), scratch);
+        if (value.IsError())
+            return false;
+        out = value.baseValue;
+        return true;
+    }
+
+    // The one identifier in `text` that is not a constant, function or unit.
+    static bool FindSingleUnknown(const std::wstring& text, std::wstring& unknown)
+    {
+        ExpressionTokenCache cache;
+        unknown.clear();
+        for (const ExpressionToken& token : cache.Lookup(text))
+        {
+            if (token.kind != ExpressionToken::Kind::Identifier || token.keyword != ExpressionToken::Keyword::None)
+                continue;
+            if (!unknown.empty() && token.name != unknown)
+                return false;
+            unknown = std::wstring(token.name);
+        }
+        return !unknown.empty();
+    }
+
+    // Samples 0 and +-2^k/8 out to the search limit and lists the sign
+    // changes between neighbouring samples that both evaluate, nearest 0
+    // first (the positive side on ties). An exact zero is a bracket of width
+    // 0. `closest` is the sample with the smallest |f|.
+    static void FindSignChanges(const CompiledExpression& function, const RootFindingOptions& options,
+        std::vector<MathValue>& scratch, std::vector<std::pair<double, double>>& brackets, double& closest)
+    {
+        std::vector<double> points(1, 0.0);
+        for (double offset = 0.125; offset <= options.searchLimit; offset *= 2.0)
+        {
+            points.push_back(offset);
+            points.push_back(-offset);
+        }
+        std::sort(points.begin(), points.end());
+
+        // Brackets by distance from 0; a point where the function fails (a
+        // pole, a domain edge) separates its neighbours.
+        std::vector<std::pair<double, std::pair<double, double>>> found;
+        double smallest = HUGE_VAL;
+        bool previousValid = false;
+        double previousX = 0.0;
+        double previousValue = 0.0;
+        for (double x : points)
+        {
+            double value = 0.0;
+            const bool valid = EvaluateAt(function, x, scratch, value);
+            if (valid)
+            {
+                if (std::fabs(value) < smallest)
+                {
+                    smallest = std::fabs(value);
+                    closest = x;
+                }
+                if (value == 0.0)
+                    found.push_back({std::fabs(x), {x, x}});
+                else if (previousValid && previousValue != 0.0 && (previousValue < 0.0) != (value < 0.0))
+                {
+                    const double distance = previousX < 0.0 && x > 0.0 ? 0.0 : (std::min)(std::fabs(previousX), std::fabs(x));
+                    found.push_back({distance, {previousX, x}});
+                }
+            }
+            previousValid = valid;
+            previousX = x;
+            previousValue = value;
+        }
+
+        std::stable_sort(found.begin(), found.end(), [](const auto& left, const auto& right) {
+            return left.first < right.first || (left.first == right.first && left.second.second > right.second.second);
+        });
+        brackets.clear();
+        for (const auto& entry : found)
+            brackets.push_back(entry.second);
+    }
+
+    // Branch and bound over [-limit, limit] with interval enclosures: a box
+    // whose enclosure excludes 0 holds no root and is dropped whole, the rest
+    // are halved, nearest 0 first. Stops at the first box narrow enough to
+    // start Newton from, or when the budget runs out. Returns false when
+    // every box was dropped, which proves there is no root in the range
+    // away from poles.
+    static bool IsolateRoot(const CompiledExpression& function, const RootFindingOptions& options, double& candidate)
+    {
+        constexpr size_t kBoxBudget = 4096;
+        const auto distance = [](const std::pair<double, double>& box) {
+            return box.first > 0.0 ? box.first : box.second < 0.0 ? -box.second : 0.0;
+        };
+        const auto fartherFromZero = [&](const std::pair<double, double>& left, const std::pair<double, double>& right) {
+            return distance(left) > distance(right);
+        };
+
+        std::vector<std::pair<double, double>> boxes(1, std::make_pair(-options.searchLimit, options.searchLimit));
+        for (size_t evaluation = 0; evaluation < kBoxBudget && !boxes.empty(); ++evaluation)
+        {
+            std::pop_heap(boxes.begin(), boxes.end(), fartherFromZero);
+            const auto [lower, upper] = boxes.back();
+            boxes.pop_back();
+
+            const IntervalValue enclosure = function.EvaluateInterval(IntervalValue::Range(lower, upper));
+            if (enclosure.IsError() || !enclosure.Contains(0.0))
+                continue;
+
+            const double middle = 0.5 * (lower + upper);
+            if (upper - lower <= 1e-9 * (std::max)(1.0, std::fabs(middle)) || middle == lower || middle == upper)
+            {
+                // A narrow box whose enclosure is still unbounded holds a
+                // pole, not a root.
+                if (!std::isfinite(enclosure.lower) || !std::isfinite(enclosure.upper))
+                    continue;
+                candidate = middle;
+                return true;
+            }
+            boxes.emplace_back(lower, middle);
+            std::push_heap(boxes.begin(), boxes.end(), fartherFromZero);
+            boxes.emplace_back(middle, upper);
+            std::push_heap(boxes.begin(), boxes.end(), fartherFromZero);
+        }
+        if (boxes.empty())
+            return false;
+        std::pop_heap(boxes.begin(), boxes.end(), fartherFromZero);
+        candidate = 0.5 * (boxes.back().first + boxes.back().second);
+        return true;
+    }
+
+    // Newton's method on the symbolic derivative, safeguarded by a bracket
+    // when there is one: a step that would leave the bracket, or that fails
+    // to halve the previous step, becomes a bisection instead. Newton
+    // converges quadratically near a simple root; the bracket bounds the
+    // iterations everywhere else. Without a bracket, starts from `x`.
+    static bool RefineRoot(const CompiledExpression& function, const CompiledExpression& derivative,
+        const RootFindingOptions& options, std::vector<MathValue>& scratch, bool bracketed,
+        double lower, double upper, double& x, size_t& iterations)
+    {
+        // Keep f(negative) < 0 < f(positive) as the bracket shrinks.
+        double negative = lower;
+        double positive = upper;
+        double bracketScale = 0.0;
+        if (bracketed)
+        {
+            double lowerValue = 0.0;
+            double upperValue = 0.0;
+            EvaluateAt(function, lower, scratch, lowerValue);
+            EvaluateAt(function, upper, scratch, upperValue);
+            if (lowerValue > 0.0)
+                std::swap(negative, positive);
+            bracketScale = (std::min)(std::fabs(lowerValue), std::fabs(upperValue));
+            x = 0.5 * (lower + upper);
+        }
+
+        bool converged = false;
+        double step = std::fabs(upper - lower);
+        for (size_t iteration = 0; iteration < options.maxIterations; ++iteration, ++iterations)
+        {
+            double value = 0.0;
+            if (!EvaluateAt(function, x, scratch, value))
+                break;
+            if (value == 0.0)
+            {
+                converged = true;
+                break;
+            }
+
+            double slope = 0.0;
+            const bool haveSlope = EvaluateAt(derivative, x, scratch, slope) && slope != 0.0;
+            double next = haveSlope ? x - value / slope : x;
+            if (haveSlope && std::fabs(next - x) <= options.relativeTolerance * (std::max)(1.0, std::fabs(x)))
+            {
+                // The Newton correction is below the tolerance, which rounding
+                // can also put just outside the bracket.
+                x = next;
+                converged = true;
+                break;
+            }
+            if (bracketed)
+            {
+                (value < 0.0 ? negative : positive) = x;
+                const double bisection = 0.5 * (negative + positive);
+                const bool inside = haveSlope && next > (std::min)(negative, positive) && next < (std::max)(negative, positive);
+                if (!inside || 2.0 * std::fabs(next - x) > step)
+                    next = bisection;
+                if (bisection == negative || bisection == positive)
+                {
+                    converged = true;
+                    break;
+                }
+            }
+            else if (!haveSlope)
+            {
+                break;
+            }
+
+            step = std::fabs(next - x);
+            x = next;
+            if (step <= options.relativeTolerance * (std::max)(1.0, std::fabs(x)))
+            {
+                converged = true;
+                break;
+            }
+        }
+
+        // A sign change across a pole also shrinks to a point; only keep
+        // roots where |f| has actually come down to zero.
+        double residual = 0.0;
+        return converged && EvaluateAt(function, x, scratch, residual) &&
+               std::fabs(residual) <= 1e-8 * (1.0 + bracketScale);
+    }
+
+    // Refines each sign change in turn, nearest 0 first, until one holds a
+    // root. When none does (a double root, only poles, or no root at all),
+    // interval bounds either rule the range out or pick the start point.
+    static MathValue FindRoot(const CompiledExpression& function, const CompiledExpression& derivative,
+        const RootFindingOptions& options, RootFindingReport& report)
+    {
+        std::vector<MathValue> scratch;
+        std::vector<std::pair<double, double>> brackets;
+        double x = 0.0;
+        FindSignChanges(function, options, scratch, brackets, x);
+        for (const auto& [lower, upper] : brackets)
+        {
+            if (RefineRoot(function, derivative, options, scratch, true, lower, upper, x, report.iterations))
+            {
+                report.bracketed = true;
+                report.converged = true;
+                return MathValue::Scalar(x);
+            }
+        }
+
+        if (IsolateRoot(function, options, x) &&
+            RefineRoot(function, derivative, options, scratch, false, x, x, x, report.iterations))
+        {
+            report.converged = true;
+            return MathValue::Scalar(x);
+        }
+        return MathValue::Error(MathError::NoRealRoot);
+    }
+
+    // Value of a solved variable: its constant, then each free variable with
+    // its coefficient ("3/2-y+(1/2)t"). Fractional coefficients are bracketed
+    // so "1/2t" cannot be read as 1/(2t).
+    static std::wstring FormatLinearCombination(const LinearSystemSolution& solution, size_t col)
+    {
+        std::wstring text;
+        if (!solution.constants[col].IsZero())
+            text = solution.constants[col].toString();
+
+        for (size_t index = 0; index < solution.freeVariables.size(); ++index)
+        {
+            const Rational& coefficient = solution.freeCoefficients[col][index];
+            if (coefficient.IsZero())
+                continue;
+
+            const Rational magnitude = coefficient.Sign() < 0 ? Rational(0) - coefficient : coefficient;
+            if (coefficient.Sign() < 0)
+                text += L"-";
+            else if (!text.empty())
+                text += L"+";
+
+            if (!magnitude.IsInteger())
+                text += L"(" + magnitude.toString() + L")";
+            else if (magnitude != Rational(1))
+                text += magnitude.toString();
+            text += solution.variables[solution.freeVariables[index]];
+        }
+        return text.empty() ? L"0" : text;
+    }
+
+    // Cell text of a matrix object, row by row. Four or more slots without a
+    // ';' are the 2x2 cells; otherwise each slot holds one or more rows
+    // separated by ';', cells by ','. Fails on empty cells or ragged rows.
+    static bool SplitMatrixCells(const MathObject& obj, std::vector<std::vector<std::wstring>>& cells)
+    {
+        cells.clear();
+
+        // A ';' anywhere means the slots hold row text rather than 2x2 cells.
+        bool hasRowSeparator = false;
+        for (const MathSlot& slot : obj.slots)
+            hasRowSeparator = hasRowSeparator || slot.text.find(L';') != std::wstring::npos;
+
+        if (obj.slots.size() >= 4 && !hasRowSeparator)
+        {
+            for (int row = 0; row < 2; ++row)
+            {
+                std::vector<std::wstring> rowCells;
+                for (int column = 0; column < 2; ++column)
+                {
+                    std::wstring cell = TrimCopy(obj.SlotText(row * 2 + column + 1));
+                    if (cell.empty())
+                        return false;
+                    rowCells.push_back(std::move(cell));
+                }
+                cells.push_back(std::move(rowCells));
+            }
             return true;
         }
 
-        const std::wstring rows[] = { obj.SlotText(1), obj.SlotText(2), obj.SlotText(3) };
+        std::vector<std::wstring> rows;
+        for (size_t slotIndex = 1; slotIndex <= obj.slots.size(); ++slotIndex)
+        {
+            const std::wstring& slotText = obj.SlotText(static_cast<int>(slotIndex));
+            size_t start = 0;
+            while (start <= slotText.size())
+            {
+                const size_t separator = slotText.find(L';', start);
+                rows.push_back(slotText.substr(start, separator == std::wstring::npos ? std::wstring::npos : separator - start));
+                if (separator == std::wstring::npos) break;
+                start = separator + 1;
+            }
+        }
         size_t expectedCols = 0;
 
         for (const auto& rowTextRaw : rows)
@@ -158,28 +927,75 @@ namespace
             const std::wstring rowText = TrimCopy(rowTextRaw);
             if (rowText.empty()) continue;
 
-            std::vector<double> row;
+            std::vector<std::wstring> row;
+            row.reserve(expectedCols);
             size_t start = 0;
             while (start <= rowText.size())
             {
                 size_t comma = rowText.find(L',', start);
                 std::wstring cell = TrimCopy(rowText.substr(start, comma == std::wstring::npos ? std::wstring::npos : comma - start));
                 if (cell.empty()) return false;
-                row.push_back(eval.Eval(cell));
+                row.push_back(std::move(cell));
                 if (comma == std::wstring::npos) break;
                 start = comma + 1;
             }
 
-            if (row.empty()) return false;
             if (expectedCols == 0) expectedCols = row.size();
             else if (row.size() != expectedCols) return false;
+            cells.push_back(std::move(row));
+        }
+
+        return !cells.empty();
+    }
+
+    static bool ParseMatrixRows(const MathObject& obj, std::vector<std::vector<double>>& matrix)
+    {
+        matrix.clear();
+        std::vector<std::vector<std::wstring>> cells;
+        if (!SplitMatrixCells(obj, cells))
+            return false;
+
+        MathEvaluator eval;
+        for (const auto& rowCells : cells)
+        {
+            std::vector<double> row;
+            row.reserve(rowCells.size());
+            for (const std::wstring& cell : rowCells)
+                row.push_back(eval.Eval(cell));
             matrix.push_back(std::move(row));
         }
+        return true;
+    }
+
+    // Like ParseMatrixRows, but fails unless every cell is an exact fraction.
+    static bool ParseExactMatrixRows(const MathObject& obj, std::vector<std::vector<Rational>>& matrix)
+    {
+        matrix.clear();
+        std::vector<std::vector<std::wstring>> cells;
+        if (!SplitMatrixCells(obj, cells))
+            return false;
 
-        return !matrix.empty();
+        MathEvaluator eval;
+        for (const auto& rowCells : cells)
+        {
+            std::vector<Rational> row(rowCells.size());
+            for (size_t column = 0; column < rowCells.size(); ++column)
+            {
+                if (!eval.EvalRationalExact(rowCells[column], row[column]))
+                    return false;
+            }
+            matrix.push_back(std::move(row));
+        }
+        return true;
     }
 }
 
+ExpressionTokenCache& MathManager::TokenCache()
+{
+    static thread_local ExpressionTokenCache cache;
+    return cache;
+}
+
 void MathManager::ShiftObjectsAfter(LONG atPosInclusive, LONG delta)
 {
     if (delta == 0) return;
@@ -230,24 +1046,229 @@ bool MathManager::IsPosInsideAnyObject(LONG pos, size_t* outIndex)
 
 bool MathManager::CanCalculateResult(const MathObject& obj) const
 {
-    return obj.type != MathType::Matrix && obj.type != MathType::SystemOfEquations;
+    return obj.type != MathType::SystemOfEquations;
 }
 
-std::wstring MathManager::CalculateFormattedResult(const MathObject& obj) const
+std::wstring MathManager::CalculateFormattedResult(const MathObject& obj, const EvaluationControl* control) const
 {
     if (obj.type == MathType::Determinant)
     {
         std::vector<std::vector<double>> matrix;
         if (!ParseMatrixRows(obj, matrix))
             return FormatMessageResult(L"invalid matrix");
-        if (!(matrix.size() == 2 || matrix.size() == 3))
-            return FormatMessageResult(L"unsupported matrix size");
         if (matrix[0].size() != matrix.size())
             return FormatMessageResult(L"matrix must be square");
+
+        // Integer and fractional entries get the exact determinant; anything
+        // irrational or approximate falls back to the floating-point LU.
+        std::vector<std::vector<Rational>> exactMatrix;
+        Rational determinant;
+        if (ParseExactMatrixRows(obj, exactMatrix) && ModularDeterminant(exactMatrix, determinant))
+            return FormatMessageResult(determinant.toString());
         return FormatNumericResult(CalculateResult(obj));
     }
 
-    return FormatValueResult(CalculateValueResult(obj));
+    if (obj.type == MathType::Matrix)
+    {
+        std::vector<std::vector<double>> matrix;
+        if (!ParseMatrixRows(obj, matrix))
+            return FormatMessageResult(L"invalid matrix");
+        return FormatMessageResult(FormatMatrix(Matrix::FromRows(matrix)));
+    }
+
+    // Expressions with matrix literals evaluate as matrices, not unit values.
+    if (obj.type == MathType::Sum && obj.SlotText(1).find(L'[') != std::wstring::npos &&
+        obj.SlotText(1).find(L":=") == std::wstring::npos)
+    {
+        MathEvaluator eval;
+        const MatrixValue value = eval.EvalMatrix(obj.SlotText(1));
+        if (value.IsError())
+            return FormatMessageResult(value.ErrorText());
+        if (value.IsScalar())
+            return FormatNumericResult(value.matrix(0, 0));
+        return FormatMessageResult(FormatMatrix(value.matrix));
+    }
+
+    if (obj.type == MathType::Integral)
+    {
+        QuadratureReport report;
+        const MathValue integral = CalculateIntegralResult(obj, QuadratureOptions(), &report);
+        std::wstring text = FormatValueResult(integral);
+        // Out of budget: show how far the value can be trusted.
+        if (!integral.IsError() && !report.converged && std::isfinite(report.errorEstimate))
+        {
+            const double displayScale = (integral.IsDimensionless() || std::fabs(integral.displayScale) < 1e-12) ? 1.0 : integral.displayScale;
+            text += L" \u00B1 " + FormatBareNumber(report.errorEstimate / displayScale);
+        }
+        return text;
+    }
+
+    return FormatValueResult(CalculateValueResult(obj, control));
+}
+
+bool MathManager::RunsInBackground(const MathObject& obj)
+{
+    if (obj.type == MathType::Summation || obj.type == MathType::Product)
+        return true;
+    // A nested sum or product compiles to a loop and can take as long. A
+    // definition still runs here: its value has to be published before the
+    // objects reading it are recalculated.
+    const bool nested = std::any_of(obj.slots.begin(), obj.slots.end(), [](const MathSlot& slot) {
+        return ContainsLoop(slot.children);
+    });
+    std::wstring name;
+    MathSlot body;
+    return nested && !SplitDefinition(obj, name, body);
+}
+
+std::vector<size_t> MathManager::RecalculateDependents(size_t objectIndex, std::vector<size_t>* background)
+{
+    std::vector<size_t> order;
+    if (objectIndex >= m_objects.size())
+        return order;
+
+    // The graph itself is rebuilt from the object texts, which only lexes
+    // runs the token cache has not seen; evaluation is what stays incremental.
+    const size_t count = m_objects.size();
+    std::vector<std::wstring> defines(count);
+    std::vector<std::vector<std::wstring>> reads(count);
+    std::map<std::wstring, size_t, std::less<>> definers;
+    std::map<std::wstring, std::vector<size_t>, std::less<>> readers;
+    std::vector<bool> duplicate(count, false);
+    for (size_t index = 0; index < count; ++index)
+    {
+        ScanDependencies(m_objects[index], TokenCache(), defines[index], reads[index]);
+        // The first definition of a name wins; later ones only report it.
+        if (!defines[index].empty() && !definers.emplace(defines[index], index).second)
+            duplicate[index] = true;
+        for (const std::wstring& name : reads[index])
+            readers[name].push_back(index);
+    }
+
+    const auto isDefiner = [&](size_t index) { return !defines[index].empty() && !duplicate[index]; };
+
+    // Values are republished as a fresh table after every change, so
+    // calculations running elsewhere keep reading a consistent snapshot.
+    SymbolTable variables = *GetVariables();
+    const auto publish = [&] { std::atomic_store(&m_variables, std::make_shared<const SymbolTable>(variables)); };
+
+    // Besides the edited object, names that lost their definition and
+    // definitions not evaluated yet start a recalculation.
+    std::vector<size_t> pending(1, objectIndex);
+    for (auto it = variables.begin(); it != variables.end();)
+    {
+        if (definers.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        const auto found = readers.find(it->first);
+        if (found != readers.end())
+            pending.insert(pending.end(), found->second.begin(), found->second.end());
+        it = variables.erase(it);
+    }
+    for (const auto& [name, index] : definers)
+    {
+        if (!variables.count(name))
+            pending.push_back(index);
+    }
+
+    std::vector<bool> affected(count, false);
+    while (!pending.empty())
+    {
+        const size_t index = pending.back();
+        pending.pop_back();
+        if (affected[index])
+            continue;
+        affected[index] = true;
+        if (!isDefiner(index))
+            continue;
+        const auto found = readers.find(defines[index]);
+        if (found != readers.end())
+            pending.insert(pending.end(), found->second.begin(), found->second.end());
+    }
+
+    // Kahn's algorithm over the affected objects. Whatever never becomes
+    // ready lies on a cycle or below one.
+    std::vector<size_t> inDegree(count, 0);
+    std::vector<size_t> ready;
+    for (size_t index = 0; index < count; ++index)
+    {
+        if (!affected[index])
+            continue;
+        for (const std::wstring& name : reads[index])
+        {
+            const auto found = definers.find(name);
+            if (found != definers.end() && affected[found->second])
+                ++inDegree[index];
+        }
+        if (inDegree[index] == 0)
+            ready.push_back(index);
+    }
+    for (size_t next = 0; next < ready.size(); ++next)
+    {
+        const size_t index = ready[next];
+        if (!isDefiner(index))
+            continue;
+        const auto found = readers.find(defines[index]);
+        if (found == readers.end())
+            continue;
+        for (size_t reader : found->second)
+        {
+            if (affected[reader] && --inDegree[reader] == 0)
+                ready.push_back(reader);
+        }
+    }
+
+    std::vector<bool> scheduled(count, false);
+    for (size_t index : ready)
+        scheduled[index] = true;
+    std::vector<size_t> blocked;
+    for (size_t index = 0; index < count; ++index)
+    {
+        if (!affected[index] || scheduled[index])
+            continue;
+        blocked.push_back(index);
+        if (isDefiner(index))
+            variables[defines[index]] = MathValue::Error(MathError::CircularDefinition);
+    }
+    publish();
+
+    const auto recalculate = [&](size_t index) {
+        MathObject& obj = m_objects[index];
+        const bool shown = !obj.resultText.empty() && CanCalculateResult(obj);
+        if (duplicate[index])
+        {
+            if (shown)
+                obj.resultText = FormatMessageResult(defines[index] + L" is already defined");
+        }
+        else if (isDefiner(index))
+        {
+            if (scheduled[index])
+            {
+                variables[defines[index]] = CalculateValueResult(obj);
+                publish();
+            }
+            if (shown)
+                obj.resultText = FormatValueResult(variables[defines[index]]);
+        }
+        else if (RunsInBackground(obj))
+        {
+            if (shown && background)
+                background->push_back(index);
+            return;
+        }
+        else if (shown)
+        {
+            obj.resultText = CalculateFormattedResult(obj);
+        }
+        order.push_back(index);
+    };
+    for (size_t index : ready)
+        recalculate(index);
+    for (size_t index : blocked)
+        recalculate(index);
+    return order;
 }
 
 std::wstring MathManager::FormatNumericResult(double value) const
@@ -255,10 +1276,23 @@ std::wstring MathManager::FormatNumericResult(double value) const
     return L" \uFF1D " + FormatBareNumber(value);
 }
 
+std::wstring MathManager::FormatProgressResult(const MathValue& partial, double fraction) const
+{
+    if (partial.IsError() || !std::isfinite(partial.baseValue))
+        return FormatValueResult(partial);
+
+    const double displayScale = partial.IsDimensionless() || std::fabs(partial.displayScale) < 1e-12 ? 1.0 : partial.displayScale;
+    std::wstring result = L" \u2248 " + FormatBareNumber(partial.baseValue / displayScale) + L"\u2026";
+    if (!partial.IsDimensionless() && partial.HasDisplayUnit())
+        result += L" " + partial.DisplayUnitText();
+    const int percent = static_cast<int>((std::min)((std::max)(fraction, 0.0), 1.0) * 100.0);
+    return result + L" (" + std::to_wstring(percent) + L"%)";
+}
+
 std::wstring MathManager::FormatValueResult(const MathValue& value) const
 {
     if (value.IsError())
-        return FormatMessageResult(value.errorText);
+        return FormatMessageResult(value.ErrorText());
     if (!std::isfinite(value.baseValue))
         return FormatMessageResult(L"undefined");
     if (value.IsDimensionless())
@@ -266,48 +1300,59 @@ std::wstring MathManager::FormatValueResult(const MathValue& value) const
 
     const double displayScale = std::fabs(value.displayScale) < 1e-12 ? 1.0 : value.displayScale;
     std::wstring result = L" \uFF1D " + FormatBareNumber(value.baseValue / displayScale);
-    if (!value.displayUnit.empty())
-        result += L" " + value.displayUnit;
+    if (value.HasDisplayUnit())
+        result += L" " + value.DisplayUnitText();
     return result;
 }
 
-MathValue MathManager::CalculateValueResult(const MathObject& obj) const
+MathValue MathManager::CalculateValueResult(const MathObject& obj, const EvaluationControl* control) const
 {
-    MathEvaluator eval;
-
     if (obj.type == MathType::Fraction)
     {
-        const std::wstring numerator = TrimCopy(obj.SlotText(1));
-        const std::wstring denominator = TrimCopy(obj.SlotText(2));
-        if (numerator.empty() || denominator.empty())
-            return MathValue::Error(L"incomplete");
-        return eval.EvalValue(L"((" + numerator + L")/(" + denominator + L"))");
+        if (IsBlank(obj.SlotText(1)) || IsBlank(obj.SlotText(2)))
+            return MathValue::Error(MathError::Incomplete);
+        return EvaluateControlled(CompiledExpression::CompileStructure(MathNodeKind::Fraction, { &SlotAt(obj, 1), &SlotAt(obj, 2) }, &TokenCache(), GetVariables().get()), control);
     }
 
     if (obj.type == MathType::Summation)
     {
-        const std::wstring upperText = TrimCopy(obj.SlotText(1));
         const std::wstring lowerText = TrimCopy(obj.SlotText(2));
-        const std::wstring bodyText = TrimCopy(obj.SlotText(3));
-        if (upperText.empty() || lowerText.empty() || bodyText.empty())
-            return MathValue::Error(L"incomplete");
+        if (IsBlank(obj.SlotText(1)) || lowerText.empty() || IsBlank(obj.SlotText(3)))
+            return MathValue::Error(MathError::Incomplete);
 
         std::wstring var;
         double start = 0;
         if (!ParseLowerLimit(lowerText, var, start))
-            return MathValue::Error(L"invalid limits");
+            return MathValue::Error(MathError::InvalidLimits);
 
-        const MathValue upperValue = eval.EvalValue(upperText);
+        const MathValue upperValue = EvaluateControlled(CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()), control);
         if (upperValue.IsError())
             return upperValue;
         if (!upperValue.IsDimensionless())
-            return MathValue::Error(L"invalid limits");
+            return MathValue::Error(MathError::InvalidLimits);
+
+        const CompiledExpression body = CompiledExpression::CompileSlot(SlotAt(obj, 3), var, &TokenCache(), GetVariables().get());
+        const size_t count = IndexRangeCount(start, upperValue.baseValue);
+        MathValue reduced;
+        if (body.SumClosedForm(start, count, reduced))
+            return NormalizeDisplay(reduced);
+        if (count > 0 && ReduceIndexRange(body, start, count, false, reduced, control))
+            return NormalizeDisplay(reduced);
 
+        std::vector<MathValue> scratch;
         MathValue sum = MathValue::Scalar(0.0);
         bool hasTerm = false;
+        size_t visited = 0;
         for (double i = start; i <= upperValue.baseValue; ++i)
         {
-            MathValue termValue = eval.EvalValue(bodyText, var, MathValue::Scalar(i));
+            if (control && ++visited % kControlInterval == 0)
+            {
+                if (control->ShouldStop())
+                    return StoppedResult(*control);
+                if (control->progress && hasTerm)
+                    control->progress(static_cast<double>(visited) / static_cast<double>(count), NormalizeDisplay(sum));
+            }
+            MathValue termValue = body.Evaluate(MathValue::Scalar(i), scratch, control);
             if (termValue.IsError())
                 return termValue;
 
@@ -328,27 +1373,40 @@ MathValue MathManager::CalculateValueResult(const MathObject& obj) const
 
     if (obj.type == MathType::Product)
     {
-        const std::wstring upperText = TrimCopy(obj.SlotText(1));
         const std::wstring lowerText = TrimCopy(obj.SlotText(2));
-        const std::wstring bodyText = TrimCopy(obj.SlotText(3));
-        if (upperText.empty() || lowerText.empty() || bodyText.empty())
-            return MathValue::Error(L"incomplete");
+        if (IsBlank(obj.SlotText(1)) || lowerText.empty() || IsBlank(obj.SlotText(3)))
+            return MathValue::Error(MathError::Incomplete);
 
         std::wstring var;
         double start = 0;
         if (!ParseLowerLimit(lowerText, var, start))
-            return MathValue::Error(L"invalid limits");
+            return MathValue::Error(MathError::InvalidLimits);
 
-        const MathValue upperValue = eval.EvalValue(upperText);
+        const MathValue upperValue = EvaluateControlled(CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()), control);
         if (upperValue.IsError())
             return upperValue;
         if (!upperValue.IsDimensionless())
-            return MathValue::Error(L"invalid limits");
+            return MathValue::Error(MathError::InvalidLimits);
+
+        const CompiledExpression body = CompiledExpression::CompileSlot(SlotAt(obj, 3), var, &TokenCache(), GetVariables().get());
+        const size_t count = IndexRangeCount(start, upperValue.baseValue);
+        MathValue reduced;
+        if (count > 0 && ReduceIndexRange(body, start, count, true, reduced, control))
+            return NormalizeDisplay(reduced);
 
+        std::vector<MathValue> scratch;
         MathValue product = MathValue::Scalar(1.0);
+        size_t visited = 0;
         for (double i = start; i <= upperValue.baseValue; ++i)
         {
-            product = MultiplyAccumulatedValues(product, eval.EvalValue(bodyText, var, MathValue::Scalar(i)));
+            if (control && ++visited % kControlInterval == 0)
+            {
+                if (control->ShouldStop())
+                    return StoppedResult(*control);
+                if (control->progress)
+                    control->progress(static_cast<double>(visited) / static_cast<double>(count), NormalizeDisplay(product));
+            }
+            product = MultiplyAccumulatedValues(product, body.Evaluate(MathValue::Scalar(i), scratch, control));
             if (product.IsError())
                 return product;
         }
@@ -357,114 +1415,60 @@ MathValue MathManager::CalculateValueResult(const MathObject& obj) const
 
     if (obj.type == MathType::Sum)
     {
-        const std::wstring expression = TrimCopy(obj.SlotText(1));
-        if (expression.empty())
-            return MathValue::Error(L"incomplete");
-        return eval.EvalValue(expression);
+        std::wstring name;
+        MathSlot body;
+        if (SplitDefinition(obj, name, body))
+        {
+            if (IsBlank(body.text))
+                return MathValue::Error(MathError::Incomplete);
+            return EvaluateControlled(CompiledExpression::CompileSlot(body, L"", &TokenCache(), GetVariables().get()), control);
+        }
+        if (IsBlank(obj.SlotText(1)))
+            return MathValue::Error(MathError::Incomplete);
+        return EvaluateControlled(CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()), control);
     }
 
     if (obj.type == MathType::SquareRoot)
     {
-        const std::wstring radicand = TrimCopy(obj.SlotText(1));
-        const std::wstring indexText = TrimCopy(obj.SlotText(2));
-        if (radicand.empty())
-            return MathValue::Error(L"incomplete");
-
-        if (indexText.empty() || indexText == L"2")
-            return eval.EvalValue(L"sqrt(" + radicand + L")");
-
-        const MathValue indexValue = eval.EvalValue(indexText);
-        if (indexValue.IsError())
-            return indexValue;
-        if (!indexValue.IsDimensionless() || std::fabs(indexValue.baseValue) < 1e-12)
-            return MathValue::Error(L"invalid index");
-
-        return eval.EvalValue(L"((" + radicand + L")^(1/(" + indexText + L")))");
-    }
-
-    if (obj.type == MathType::Integral)
-    {
-        const std::wstring upperText = TrimCopy(obj.SlotText(1));
-        const std::wstring lowerText = TrimCopy(obj.SlotText(2));
-        const std::wstring slotText = TrimCopy(obj.SlotText(3));
-        if (upperText.empty() || lowerText.empty() || slotText.empty())
-            return MathValue::Error(L"incomplete");
-
-        const MathValue lowerValue = eval.EvalValue(lowerText);
-        const MathValue upperValue = eval.EvalValue(upperText);
-        if (lowerValue.IsError()) return lowerValue;
-        if (upperValue.IsError()) return upperValue;
-        if (!lowerValue.IsDimensionless() || !upperValue.IsDimensionless())
-            return MathValue::Error(L"invalid limits");
+        if (IsBlank(obj.SlotText(1)))
+            return MathValue::Error(MathError::Incomplete);
 
-        std::wstring var = L"x";
-        std::wstring exprText = slotText;
-        const size_t dPos = slotText.find(L" d");
-        if (dPos != std::wstring::npos)
-        {
-            if (dPos + 2 < slotText.size())
-                var = slotText.substr(dPos + 2, 1);
-            exprText = slotText.substr(0, dPos);
-        }
-
-        const int steps = 200;
-        const double dx = (upperValue.baseValue - lowerValue.baseValue) / steps;
-        MathValue integral = MathValue::Scalar(0.0);
-        bool hasSample = false;
-        for (int i = 0; i <= steps; ++i)
+        const std::wstring indexText = TrimCopy(obj.SlotText(2));
+        if (!indexText.empty() && indexText != L"2")
         {
-            const double x = lowerValue.baseValue + i * dx;
-            MathValue sample = eval.EvalValue(exprText, var, MathValue::Scalar(x));
-            if (sample.IsError())
-                return sample;
-
-            sample.baseValue *= (i == 0 || i == steps) ? 0.5 : 1.0;
-            if (!hasSample)
-            {
-                integral = sample;
-                hasSample = true;
-            }
-            else
-            {
-                integral = AddAccumulatedValues(integral, sample);
-                if (integral.IsError())
-                    return integral;
-            }
+            const MathValue indexValue = EvaluateControlled(CompiledExpression::CompileSlot(SlotAt(obj, 2), L"", &TokenCache(), GetVariables().get()), control);
+            if (indexValue.IsError())
+                return indexValue;
+            if (!indexValue.IsDimensionless() || std::fabs(indexValue.baseValue) < 1e-12)
+                return MathValue::Error(MathError::InvalidIndex);
         }
 
-        if (!hasSample)
-            return MathValue::Scalar(0.0);
-        integral.baseValue *= dx;
-        return NormalizeDisplay(integral);
+        return EvaluateControlled(CompiledExpression::CompileStructure(MathNodeKind::SquareRoot, { &SlotAt(obj, 1), &SlotAt(obj, 2) }, &TokenCache(), GetVariables().get()), control);
     }
 
+    if (obj.type == MathType::Integral)
+        return CalculateIntegralResult(obj);
+
     if (obj.type == MathType::AbsoluteValue)
     {
-        const std::wstring expression = TrimCopy(obj.SlotText(1));
-        if (expression.empty())
-            return MathValue::Error(L"incomplete");
-        return eval.EvalValue(L"abs(" + expression + L")");
+        if (IsBlank(obj.SlotText(1)))
+            return MathValue::Error(MathError::Incomplete);
+        return EvaluateControlled(CompiledExpression::CompileStructure(MathNodeKind::AbsoluteValue, { &SlotAt(obj, 1) }, &TokenCache(), GetVariables().get()), control);
     }
 
     if (obj.type == MathType::Power)
     {
-        const std::wstring base = TrimCopy(obj.SlotText(1));
-        const std::wstring exponent = TrimCopy(obj.SlotText(2));
-        if (base.empty() || exponent.empty())
-            return MathValue::Error(L"incomplete");
-        return eval.EvalValue(L"((" + base + L")^(" + exponent + L"))");
+        if (IsBlank(obj.SlotText(1)) || IsBlank(obj.SlotText(2)))
+            return MathValue::Error(MathError::Incomplete);
+        return EvaluateControlled(CompiledExpression::CompileStructure(MathNodeKind::Power, { &SlotAt(obj, 1), &SlotAt(obj, 2) }, &TokenCache(), GetVariables().get()), control);
     }
 
     if (obj.type == MathType::Logarithm)
     {
-        const std::wstring argText = TrimCopy(obj.SlotText(2));
-        if (argText.empty())
-            return MathValue::Error(L"incomplete");
-
-        const std::wstring baseText = TrimCopy(obj.SlotText(1));
-        if (baseText.empty())
-            return eval.EvalValue(L"log(" + argText + L")");
-        return eval.EvalValue(L"log_{" + baseText + L"}(" + argText + L")");
+        if (IsBlank(obj.SlotText(2)))
+            return MathValue::Error(MathError::Incomplete);
+        // A blank base slot compiles as the default base 10.
+        return EvaluateControlled(CompiledExpression::CompileStructure(MathNodeKind::Logarithm, { &SlotAt(obj, 1), &SlotAt(obj, 2) }, &TokenCache(), GetVariables().get()), control);
     }
 
     if (obj.type == MathType::Determinant)
@@ -473,6 +1477,124 @@ MathValue MathManager::CalculateValueResult(const MathObject& obj) const
     return MathValue::Scalar(CalculateResult(obj));
 }
 
+MathValue MathManager::CalculateIntegralResult(const MathObject& obj, const QuadratureOptions& options, QuadratureReport* report) const
+{
+    QuadratureReport localReport;
+    QuadratureReport& result = report ? *report : localReport;
+    result = QuadratureReport();
+
+    const std::wstring& slotText = obj.SlotText(3);
+    if (IsBlank(obj.SlotText(1)) || IsBlank(obj.SlotText(2)) || IsBlank(slotText))
+        return MathValue::Error(MathError::Incomplete);
+
+    const MathValue lowerValue = CompiledExpression::CompileSlot(SlotAt(obj, 2), L"", &TokenCache(), GetVariables().get()).Evaluate();
+    const MathValue upperValue = CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()).Evaluate();
+    if (lowerValue.IsError()) return lowerValue;
+    if (upperValue.IsError()) return upperValue;
+    if (!lowerValue.IsDimensionless() || !upperValue.IsDimensionless())
+        return MathValue::Error(MathError::InvalidLimits);
+
+    std::wstring var = L"x";
+    const size_t dPos = slotText.find(L" d");
+    if (dPos != std::wstring::npos && dPos + 2 < slotText.size())
+        var = slotText.substr(dPos + 2, 1);
+
+    const CompiledExpression integrand = CompiledExpression::CompileSlot(SlotAt(obj, 3), var, &TokenCache(), GetVariables().get(), L" d");
+    return IntegrateAdaptive(integrand, lowerValue.baseValue, upperValue.baseValue, options, result);
+}
+
+IntervalValue MathManager::CalculateIntervalResult(const MathObject& obj) const
+{
+    if (obj.type == MathType::Summation || obj.type == MathType::Product)
+    {
+        const bool product = obj.type == MathType::Product;
+        const std::wstring lowerText = TrimCopy(obj.SlotText(2));
+        if (IsBlank(obj.SlotText(1)) || lowerText.empty() || IsBlank(obj.SlotText(3)))
+            return IntervalValue::Error(MathError::Incomplete);
+
+        std::wstring var;
+        double start = 0;
+        if (!ParseLowerLimit(lowerText, var, start))
+            return IntervalValue::Error(MathError::InvalidLimits);
+        const MathValue upperValue = CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()).Evaluate();
+        if (upperValue.IsError())
+            return IntervalValue::Error(upperValue.error);
+        if (!upperValue.IsDimensionless())
+            return IntervalValue::Error(MathError::InvalidLimits);
+
+        // Every term is enclosed on its own, so the cost is one evaluation per
+        // term; past the budget there is no rigorous shortcut.
+        const size_t count = IndexRangeCount(start, upperValue.baseValue);
+        if (count > kMaxIntervalTerms)
+            return IntervalValue::Error(MathError::TooManyTerms);
+        const CompiledExpression body = CompiledExpression::CompileSlot(SlotAt(obj, 3), var, &TokenCache(), GetVariables().get());
+        IntervalValue total = IntervalValue::Range(product ? 1.0 : 0.0, product ? 1.0 : 0.0);
+        for (size_t index = 0; index < count; ++index)
+        {
+            const double i = start + static_cast<double>(index);
+            const IntervalValue term = body.EvaluateInterval(IntervalValue::Range(i, i));
+            if (term.IsError())
+                return term;
+            total = index == 0 ? term : product ? MultiplyIntervals(total, term) : AddIntervals(total, term);
+            if (total.IsError())
+                return total;
+        }
+        return total;
+    }
+
+    if (obj.type == MathType::Integral)
+    {
+        const std::wstring& slotText = obj.SlotText(3);
+        if (IsBlank(obj.SlotText(1)) || IsBlank(obj.SlotText(2)) || IsBlank(slotText))
+            return IntervalValue::Error(MathError::Incomplete);
+        const MathValue lowerValue = CompiledExpression::CompileSlot(SlotAt(obj, 2), L"", &TokenCache(), GetVariables().get()).Evaluate();
+        const MathValue upperValue = CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()).Evaluate();
+        if (lowerValue.IsError()) return IntervalValue::Error(lowerValue.error);
+        if (upperValue.IsError()) return IntervalValue::Error(upperValue.error);
+        if (!lowerValue.IsDimensionless() || !upperValue.IsDimensionless())
+            return IntervalValue::Error(MathError::InvalidLimits);
+
+        std::wstring var = L"x";
+        const size_t dPos = slotText.find(L" d");
+        if (dPos != std::wstring::npos && dPos + 2 < slotText.size())
+            var = slotText.substr(dPos + 2, 1);
+        const CompiledExpression integrand = CompiledExpression::CompileSlot(SlotAt(obj, 3), var, &TokenCache(), GetVariables().get(), L" d");
+
+        // The panel edges tile [a, b] exactly; only the widths are rounded,
+        // and outward.
+        const CompiledExpression slope = integrand.Derivative();
+        const CompiledExpression curvature = slope.Derivative();
+        const double a = (std::min)(lowerValue.baseValue, upperValue.baseValue);
+        const double b = (std::max)(lowerValue.baseValue, upperValue.baseValue);
+        IntervalValue total;
+        double left = a;
+        for (size_t panel = 0; panel < kIntervalPanels; ++panel)
+        {
+            const double right = panel + 1 == kIntervalPanels ? b : a + (b - a) * static_cast<double>(panel + 1) / kIntervalPanels;
+            const IntervalValue area = EnclosePanel(integrand, slope, curvature, left, right);
+            if (area.IsError())
+                return area;
+            total = panel == 0 ? area : AddIntervals(total, area);
+            left = right;
+        }
+        if (lowerValue.baseValue > upperValue.baseValue)
+            total = MultiplyIntervals(total, IntervalValue::Range(-1.0, -1.0));
+        return total;
+    }
+
+    if (obj.type == MathType::Fraction)
+    {
+        if (IsBlank(obj.SlotText(1)) || IsBlank(obj.SlotText(2)))
+            return IntervalValue::Error(MathError::Incomplete);
+        return CompiledExpression::CompileStructure(MathNodeKind::Fraction, { &SlotAt(obj, 1), &SlotAt(obj, 2) }, &TokenCache(), GetVariables().get())
+            .EvaluateInterval(IntervalValue());
+    }
+
+    if (obj.type == MathType::Sum)
+        return CompiledExpression::CompileSlot(SlotAt(obj, 1), L"", &TokenCache(), GetVariables().get()).EvaluateInterval(IntervalValue());
+    return IntervalValue::Error(MathError::NoIntervalBounds);
+}
+
 double MathManager::CalculateResult(const MathObject& obj) const
 {
     MathEvaluator eval;
@@ -537,6 +1659,18 @@ double MathManager::CalculateResult(const MathObject& obj) const
             if (dPos + 2 < obj.SlotText(3).size()) var = obj.SlotText(3).substr(dPos + 2, 1);
             expr = obj.SlotText(3).substr(0, dPos);
         }
+        // Unit symbols mean something different to Eval, so only unit-free
+        // integrands take the adaptive path; integrands it rejects keep
+        // Eval's lenient trapezoid.
+        const CompiledExpression integrand = CompiledExpression::Compile(expr, var);
+        if (!integrand.UsesUnits())
+        {
+            QuadratureReport report;
+            const MathValue integral = IntegrateAdaptive(integrand, a, b, QuadratureOptions(), report);
+            if (!integral.IsError())
+                return integral.baseValue;
+        }
+
         int steps = 200;
         double dx = (b - a) / steps;
         double sum = 0;
@@ -578,61 +1712,77 @@ double MathManager::CalculateResult(const MathObject& obj) const
     {
         std::vector<std::vector<double>> matrix;
         if (!ParseMatrixRows(obj, matrix)) return 0;
-        if (matrix.size() == 2 && matrix[0].size() == 2)
-        {
-            return matrix[0][0] * matrix[1][1] - matrix[0][1] * matrix[1][0];
-        }
-        if (matrix.size() == 3 && matrix[0].size() == 3)
-        {
-            return matrix[0][0] * (matrix[1][1] * matrix[2][2] - matrix[1][2] * matrix[2][1])
-                - matrix[0][1] * (matrix[1][0] * matrix[2][2] - matrix[1][2] * matrix[2][0])
-                + matrix[0][2] * (matrix[1][0] * matrix[2][1] - matrix[1][1] * matrix[2][0]);
-        }
-        return 0;
+        LUFactorization factorization;
+        if (!factorization.Factor(matrix)) return 0;
+        return factorization.Determinant();
     }
     return 0;
 }
 
+MathValue MathManager::CalculateEquationRoot(const std::wstring& equation, const RootFindingOptions& options,
+    RootFindingReport* report) const
+{
+    RootFindingReport localReport;
+    RootFindingReport& result = report ? *report : localReport;
+    result = RootFindingReport();
+
+    const size_t equals = equation.find(L'=');
+    if (equals == std::wstring::npos || equation.find(L'=', equals + 1) != std::wstring::npos)
+        return MathValue::Error(MathError::InvalidEquation);
+
+    // Roots of lhs - rhs are the solutions of lhs = rhs.
+    const std::wstring difference = L"(" + equation.substr(0, equals) + L")-(" + equation.substr(equals + 1) + L")";
+    if (!FindSingleUnknown(difference, result.variable))
+        return MathValue::Error(MathError::EquationNeedsOneUnknown);
+
+    const CompiledExpression function = CompiledExpression::Compile(difference, result.variable);
+    return FindRoot(function, function.Derivative(), options, result);
+}
+
 std::wstring MathManager::CalculateSystemResult(const MathObject& obj)
 {
     MathEvaluator eval;
     std::vector<std::wstring> equations;
 
-    // Parse equations from the parts - for system of equations, we use part1 and part2 as separate equations
-    // and part3 could be a third equation if present
-    if (!obj.SlotText(1).empty()) equations.push_back(obj.SlotText(1));
-    if (!obj.SlotText(2).empty()) equations.push_back(obj.SlotText(2));
-    if (!obj.SlotText(3).empty()) equations.push_back(obj.SlotText(3));
+    // Every non-empty slot holds one equation
+    for (size_t slot = 1; slot <= obj.slots.size(); ++slot)
+    {
+        if (!obj.SlotText(static_cast<int>(slot)).empty())
+            equations.push_back(obj.SlotText(static_cast<int>(slot)));
+    }
 
     // Solve the system using rational arithmetic for exact results
-    auto solution = eval.SolveSystemOfEquationsRational(equations);
+    const LinearSystemSolution solution = eval.SolveLinearSystemRational(equations);
 
-    // Format the result
-    long long status = 0;
-    if (solution.find(L"status") != solution.end()) {
-        status = solution[L"status"].num;  // Get numerator of status rational
+    // A single equation that is not linear is solved numerically.
+    if (solution.status == -4 && equations.size() == 1)
+    {
+        RootFindingReport report;
+        const MathValue root = CalculateEquationRoot(equations[0], RootFindingOptions(), &report);
+        if (root.IsError())
+            return FormatMessageResult(root.ErrorText());
+        return FormatMessageResult(report.variable + L"=" + FormatBareNumber(root.baseValue));
     }
 
-    if (status == 0) {
-        // Build result string directly
+    if (solution.status == 0 || solution.status == -1) {
+        // Build result string directly; free variables are listed last
         std::wstring result = L" \uFF1D ";  // Full-width equals sign
         bool first = true;
-        for (const auto& [var, val] : solution) {
-            if (var == L"status") continue;
+        for (size_t col = 0; col < solution.variables.size(); ++col) {
+            if (solution.isFree[col]) continue;
 
             if (!first) {
                 result += L", ";
             }
 
-            result += var + L"=";
-            
-            // Format as fraction if denominator is not 1, otherwise as integer
-            if (val.den == 1) {
-                result += std::to_wstring(val.num);
-            } else {
-                result += val.toString();  // Will format as "num/den"
+            result += solution.variables[col] + L"=" + FormatLinearCombination(solution, col);
+            first = false;
+        }
+        for (size_t col : solution.freeVariables) {
+            if (!first) {
+                result += L", ";
             }
-
+            result += solution.variables[col] + L" free";
             first = false;
         }
 
@@ -643,13 +1793,10 @@ std::wstring MathManager::CalculateSystemResult(const MathObject& obj)
         return result;
     } else {
         // Error cases
-        switch (status) {
-            case -1: return L" \uFF1D Infinite solutions";
+        switch (solution.status) {
             case -2: return L" \uFF1D No solution";
             case -3: return L" \uFF1D No equations";
             case -4: return L" \uFF1D Parse error";
-            case -5: return L" \uFF1D Underdetermined system";
-            case -6: return L" \uFF1D Too many equations (max 3)";
             default: return L" \uFF1D Unknown error";
         }
     }
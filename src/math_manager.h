@@ -1,10 +1,52 @@
 #pragma once
 
+#include "evaluation_service.h"
 #include "math_evaluator.h"
 #include "math_types.h"
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 
+// Accuracy target and evaluation budget for adaptive integration.
+struct QuadratureOptions
+{
+    double absoluteTolerance = 1e-12;
+    double relativeTolerance = 1e-10;
+    size_t maxEvaluations = 1500;
+};
+
+// What an adaptive integration achieved: the estimated absolute error of the
+// returned value (in base units), integrand evaluations spent, and whether the
+// tolerance was met within the budget.
+struct QuadratureReport
+{
+    double errorEstimate = 0.0;
+    size_t evaluations = 0;
+    bool converged = false;
+};
+
+// Search range, accuracy target and iteration budget for solving one
+// equation in one unknown.
+struct RootFindingOptions
+{
+    double searchLimit = 1e6;          // sign changes are looked for in [-limit, limit]
+    double relativeTolerance = 1e-14;  // on the final step, relative to the root
+    size_t maxIterations = 100;
+};
+
+// What a root search achieved: the unknown it solved for, iterations spent
+// after the search, whether a sign change bracketed the root, and whether the
+// tolerance was met within the budget.
+struct RootFindingReport
+{
+    std::wstring variable;
+    size_t iterations = 0;
+    bool bracketed = false;
+    bool converged = false;
+};
+
 class MathManager
 {
 public:
@@ -17,21 +59,58 @@ public:
  */
     MathTypingState& GetState() { return m_state; } // Return reference to the math typing state
 
-    void Clear() { m_objects.clear(); m_state = {}; }
+    void Clear() { m_objects.clear(); m_state = {}; std::atomic_store(&m_variables, std::make_shared<const SymbolTable>()); }
     
     void ShiftObjectsAfter(LONG atPosInclusive, LONG delta);
     void DeleteObjectsInRange(LONG start, LONG end);
     bool IsPosInsideAnyObject(LONG pos, size_t* outIndex = nullptr);
     bool CanCalculateResult(const MathObject& obj) const;
-    MathValue CalculateValueResult(const MathObject& obj) const;
+    // With `control`, sums and products, also nested ones, stop early with
+    // "cancelled" or "time limit exceeded"; top-level ones report progress
+    // along the way.
+    MathValue CalculateValueResult(const MathObject& obj, const EvaluationControl* control = nullptr) const;
+    MathValue CalculateIntegralResult(const MathObject& obj, const QuadratureOptions& options = QuadratureOptions(), QuadratureReport* report = nullptr) const;
+    // Guaranteed bounds on the result of a sum, product, integral, fraction or
+    // plain expression object, in base units. Integrals are enclosed panel by
+    // panel with a second-order Taylor form, so the width shrinks with the
+    // square of the panel size wherever the integrand is twice differentiable.
+    IntervalValue CalculateIntervalResult(const MathObject& obj) const;
     double CalculateResult(const MathObject& obj) const;
     std::wstring CalculateSystemResult(const MathObject& obj);
-    std::wstring CalculateFormattedResult(const MathObject& obj) const;
+    // Real root of one equation "lhs = rhs" in its single unknown, by Newton
+    // steps on the symbolic derivative kept inside a sign-change bracket.
+    MathValue CalculateEquationRoot(const std::wstring& equation, const RootFindingOptions& options = RootFindingOptions(),
+        RootFindingReport* report = nullptr) const;
+    std::wstring CalculateFormattedResult(const MathObject& obj, const EvaluationControl* control = nullptr) const;
+    // Document variables: a plain expression object reading "name := expr"
+    // defines `name` for every other object. Re-evaluates the object at
+    // `objectIndex`, then each object that reads a name it defines, directly
+    // or through further definitions, in dependency order; objects on or
+    // below a cycle get "circular definition". Results are refreshed only
+    // where shown. Returns the indices re-evaluated, in order. Objects that
+    // RunsInBackground are left alone; the shown ones are listed in
+    // `background` for the caller to calculate off this thread.
+    std::vector<size_t> RecalculateDependents(size_t objectIndex, std::vector<size_t>* background = nullptr);
+    // Summations and products, and objects with one nested in a slot, whose
+    // results can take seconds; the editor calculates them on a worker
+    // instead of the UI thread. Definitions never do.
+    static bool RunsInBackground(const MathObject& obj);
+    // Snapshot of the document variables. Updates publish a new table, so a
+    // snapshot stays valid and unchanged on any thread.
+    std::shared_ptr<const SymbolTable> GetVariables() const { return std::atomic_load(&m_variables); }
     std::wstring FormatNumericResult(double value) const;
     std::wstring FormatValueResult(const MathValue& value) const;
+    // Partial value of an unfinished calculation, e.g. " \u2248 1.2345\u2026 (62%)".
+    std::wstring FormatProgressResult(const MathValue& partial, double fraction) const;
 
 private:
     MathManager() = default;
     std::vector<MathObject> m_objects;
     MathTypingState m_state;
+    // Lexed leaf text shared by result calculations on the calling thread; see
+    // CompiledExpression::CompileSlot. With one cache per thread, the const
+    // calculations can run concurrently while nothing edits the objects.
+    static ExpressionTokenCache& TokenCache();
+    // Current value of every document variable; see RecalculateDependents.
+    std::shared_ptr<const SymbolTable> m_variables = std::make_shared<const SymbolTable>();
 };
@@ -119,6 +119,49 @@ namespace {
         return total;
     }
 
+    // Summation and product nodes stack the limits above and below the operator glyph and put the
+    // body to its right; caret, hit testing and drawing all share this one placement.
+    struct LoopNodeLayout
+    {
+        NodeMetrics metrics;
+        NodeMetrics lower;
+        NodeMetrics upper;
+        const wchar_t* symbol = L"";
+        int symbolX = 0;
+        int lowerX = 0;
+        int lowerBaseline = 0;
+        int upperX = 0;
+        int upperBaseline = 0;
+        int bodyX = 0;
+    };
+
+    static LoopNodeLayout MeasureLoopNode(HDC hdc, const MathNode& node, int x, int baseline, const TEXTMETRICW& tmBase)
+    {
+        const int limitGap = (std::max<int>)(1, tmBase.tmHeight / 10);
+        const int superGap = (std::max<int>)(2, tmBase.tmAveCharWidth / 3);
+
+        LoopNodeLayout layout;
+        layout.symbol = node.kind == MathNodeKind::Product ? L"\u220F" : L"\u2211";
+        SIZE symbolSize = {};
+        GetTextExtentPoint32W(hdc, layout.symbol, 1, &symbolSize);
+        layout.lower = MeasureMathSequenceMetrics(hdc, node.SlotNodes(0), tmBase);
+        layout.upper = MeasureMathSequenceMetrics(hdc, node.SlotNodes(1), tmBase);
+        const NodeMetrics body = MeasureMathSequenceMetrics(hdc, node.SlotNodes(2), tmBase);
+
+        const int column = (std::max)({ (int)symbolSize.cx, layout.lower.cx, layout.upper.cx });
+        layout.symbolX = x + (column - symbolSize.cx) / 2;
+        layout.lowerX = x + (column - layout.lower.cx) / 2;
+        layout.upperX = x + (column - layout.upper.cx) / 2;
+        layout.upperBaseline = baseline - tmBase.tmAscent - limitGap - layout.upper.descent;
+        layout.lowerBaseline = baseline + tmBase.tmDescent + limitGap + layout.lower.ascent;
+        layout.bodyX = x + column + superGap;
+
+        layout.metrics.cx = column + superGap + body.cx;
+        layout.metrics.ascent = (std::max)(body.ascent, (int)tmBase.tmAscent + limitGap + layout.upper.Height());
+        layout.metrics.descent = (std::max)(body.descent, (int)tmBase.tmDescent + limitGap + layout.lower.Height());
+        return layout;
+    }
+
     static bool TryGetSequenceCaret(HDC hdc, const std::vector<MathNode>& nodes, const std::vector<size_t>& path, size_t pathOffset, int x, int baseline, const TEXTMETRICW& tmBase, POINT& outPt)
     {
         if (pathOffset >= path.size())
@@ -240,6 +283,18 @@ namespace {
             return false;
         }
 
+        if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product)
+        {
+            const LoopNodeLayout layout = MeasureLoopNode(hdc, node, x, baseline, tmBase);
+            if (slotIndex == 0)
+                return TryGetSequenceCaret(hdc, node.SlotNodes(0), path, pathOffset + 1, layout.lowerX, layout.lowerBaseline, tmBase, outPt);
+            if (slotIndex == 1)
+                return TryGetSequenceCaret(hdc, node.SlotNodes(1), path, pathOffset + 1, layout.upperX, layout.upperBaseline, tmBase, outPt);
+            if (slotIndex == 2)
+                return TryGetSequenceCaret(hdc, node.SlotNodes(2), path, pathOffset + 1, layout.bodyX, baseline, tmBase, outPt);
+            return false;
+        }
+
         return false;
     }
 
@@ -320,6 +375,9 @@ namespace {
             return metrics;
         }
 
+        if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product)
+            return MeasureLoopNode(hdc, node, 0, 0, tmBase).metrics;
+
         NodeMetrics textMetrics = MeasureDisplayTextMetrics(hdc, node.text, tmBase);
         if (!node.children.empty())
         {
@@ -456,6 +514,17 @@ namespace {
             return;
         }
 
+        if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product)
+        {
+            const LoopNodeLayout layout = MeasureLoopNode(hdc, node, x, baseline, tmBase);
+            SetTextColor(hdc, color);
+            TextOutW(hdc, layout.symbolX, baseline, layout.symbol, 1);
+            DrawMathNodeSequence(hdc, node.SlotNodes(1), layout.upperX, layout.upperBaseline, tmBase, color);
+            DrawMathNodeSequence(hdc, node.SlotNodes(0), layout.lowerX, layout.lowerBaseline, tmBase, color);
+            DrawMathNodeSequence(hdc, node.SlotNodes(2), layout.bodyX, baseline, tmBase, color);
+            return;
+        }
+
         const wchar_t* text = node.text.empty() ? L"?" : node.text.c_str();
         const int len = node.text.empty() ? 1 : (int)node.text.size();
         SIZE textSize = {};
@@ -639,6 +708,42 @@ namespace {
             return false;
         }
 
+        if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product)
+        {
+            const LoopNodeLayout layout = MeasureLoopNode(hdc, node, x, baseline, tmBase);
+            const auto& lowerNodes = node.SlotNodes(0);
+            const auto& upperNodes = node.SlotNodes(1);
+            const auto& bodyNodes = node.SlotNodes(2);
+            RECT rcUpper = { x - 4, layout.upperBaseline - layout.upper.ascent - 4, layout.bodyX, layout.upperBaseline + layout.upper.descent + 1 };
+            if (PtInRect(&rcUpper, ptMouse))
+            {
+                nodePrefix.push_back(nodeIndex);
+                nodePrefix.push_back(1);
+                if (!HitTestMathNodeSequence(hdc, upperNodes, layout.upperX, layout.upperBaseline, tmBase, ptMouse, nodePrefix, outPath))
+                    SetSequenceTailPath(upperNodes, nodePrefix, outPath);
+                return true;
+            }
+            RECT rcLower = { x - 4, layout.lowerBaseline - layout.lower.ascent - 1, layout.bodyX, layout.lowerBaseline + layout.lower.descent + 4 };
+            if (PtInRect(&rcLower, ptMouse))
+            {
+                nodePrefix.push_back(nodeIndex);
+                nodePrefix.push_back(0);
+                if (!HitTestMathNodeSequence(hdc, lowerNodes, layout.lowerX, layout.lowerBaseline, tmBase, ptMouse, nodePrefix, outPath))
+                    SetSequenceTailPath(lowerNodes, nodePrefix, outPath);
+                return true;
+            }
+            RECT rcBody = { x - 4, baseline - layout.metrics.ascent - 4, x + layout.metrics.cx + 6, baseline + layout.metrics.descent + 4 };
+            if (PtInRect(&rcBody, ptMouse))
+            {
+                nodePrefix.push_back(nodeIndex);
+                nodePrefix.push_back(2);
+                if (!HitTestMathNodeSequence(hdc, bodyNodes, layout.bodyX, baseline, tmBase, ptMouse, nodePrefix, outPath))
+                    SetSequenceTailPath(bodyNodes, nodePrefix, outPath);
+                return true;
+            }
+            return false;
+        }
+
         SIZE textSize = {};
         const wchar_t* text = node.text.empty() ? L"?" : node.text.c_str();
         const int len = node.text.empty() ? 1 : (int)node.text.size();
@@ -16,7 +16,7 @@
 
 enum class MathType { Fraction, Summation, Integral, SystemOfEquations, SquareRoot, AbsoluteValue, Power, Logarithm, Sum, Product, Matrix, Determinant };
 
-enum class MathNodeKind { Text, Group, SquareRoot, Fraction, Power, AbsoluteValue, Logarithm };
+enum class MathNodeKind { Text, Group, SquareRoot, Fraction, Power, AbsoluteValue, Logarithm, Summation, Product };
 
 struct MathNode
 {
@@ -69,6 +69,9 @@ struct MathNode
             return 1;
         case MathNodeKind::Logarithm:
             return 2;
+        case MathNodeKind::Summation:
+        case MathNodeKind::Product:
+            return 3;  // "index=start", upper limit, body
         default:
             return 0;
         }
@@ -186,6 +189,8 @@ struct MathObject
         case MathNodeKind::Power: return L'P';
         case MathNodeKind::AbsoluteValue: return L'A';
         case MathNodeKind::Logarithm: return L'L';
+        case MathNodeKind::Summation: return L'S';
+        case MathNodeKind::Product: return L'X';
         default: return L'?';
         }
     }
@@ -201,6 +206,8 @@ struct MathObject
         case L'P': nodeKind = MathNodeKind::Power; return true;
         case L'A': nodeKind = MathNodeKind::AbsoluteValue; return true;
         case L'L': nodeKind = MathNodeKind::Logarithm; return true;
+        case L'S': nodeKind = MathNodeKind::Summation; return true;
+        case L'X': nodeKind = MathNodeKind::Product; return true;
         default: return false;
         }
     }
@@ -493,6 +500,13 @@ struct MathObject
             return L"log_{" + base + L"}(" + arg + L")";
         }
 
+        if (node.kind == MathNodeKind::Summation || node.kind == MathNodeKind::Product)
+        {
+            const std::wstring symbol = node.kind == MathNodeKind::Summation ? L"\u2211" : L"\u220F";
+            return symbol + L"_{" + FlattenNodes(node.SlotNodes(0)) + L"}^{" + FlattenNodes(node.SlotNodes(1)) + L"}(" +
+                   FlattenNodes(node.SlotNodes(2)) + L")";
+        }
+
         std::wstring text = node.text;
         for (const auto& child : node.children)
             text += FlattenNode(child);
@@ -0,0 +1,479 @@
+#include "modular_solver.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // Every prime lies in (2^61, 2^62), so each one adds at least 61 bits of
+    // modulus and sums of two residues never overflow.
+    constexpr uint64_t kPrimeCeiling = uint64_t(1) << 62;
+    constexpr double kBitsPerPrime = 61.0;
+
+    // 64 x 64 -> 128-bit product; returns the low word.
+    inline uint64_t MultiplyWide(uint64_t left, uint64_t right, uint64_t& high)
+    {
+#if defined(__SIZEOF_INT128__)
+        const unsigned __int128 product = (unsigned __int128)left * right;
+        high = (uint64_t)(product >> 64);
+        return (uint64_t)product;
+#elif defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+        return _umul128(left, right, &high);
+#else
+        const uint64_t leftLow = left & 0xFFFFFFFFu;
+        const uint64_t leftHigh = left >> 32;
+        const uint64_t rightLow = right & 0xFFFFFFFFu;
+        const uint64_t rightHigh = right >> 32;
+        const uint64_t lowLow = leftLow * rightLow;
+        const uint64_t highLow = leftHigh * rightLow;
+        const uint64_t lowHigh = leftLow * rightHigh;
+        const uint64_t middle = (lowLow >> 32) + (highLow & 0xFFFFFFFFu) + (lowHigh & 0xFFFFFFFFu);
+        high = leftHigh * rightHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+        return (middle << 32) | (lowLow & 0xFFFFFFFFu);
+#endif
+    }
+
+    // Arithmetic modulo an odd prime below 2^62 in Montgomery form (x * 2^64
+    // mod p): a product reduces with two more multiplications instead of a
+    // 128-bit division.
+    class MontgomeryField
+    {
+    public:
+        explicit MontgomeryField(uint64_t prime) : p(prime)
+        {
+            // Newton's iteration doubles the correct low bits of p^-1 mod 2^64;
+            // an odd p is its own inverse to 3 bits.
+            uint64_t inverse = prime;
+            for (int step = 0; step < 5; ++step)
+                inverse *= 2 - prime * inverse;
+            negativeInverse = 0 - inverse;
+
+            rSquared = (0 - prime) % prime;  // 2^64 mod p
+            for (int bit = 0; bit < 64; ++bit)
+                rSquared = Add(rSquared, rSquared);
+            one = ToField(1);
+        }
+
+        uint64_t Prime() const { return p; }
+        uint64_t One() const { return one; }
+
+        uint64_t Add(uint64_t left, uint64_t right) const
+        {
+            const uint64_t sum = left + right;
+            return sum >= p ? sum - p : sum;
+        }
+
+        uint64_t Subtract(uint64_t left, uint64_t right) const
+        {
+            return left >= right ? left - right : left + p - right;
+        }
+
+        uint64_t Multiply(uint64_t left, uint64_t right) const
+        {
+            uint64_t high = 0;
+            const uint64_t low = MultiplyWide(left, right, high);
+            return Reduce(high, low);
+        }
+
+        uint64_t ToField(uint64_t value) const { return Multiply(value % p, rSquared); }
+        uint64_t FromField(uint64_t value) const { return Reduce(0, value); }
+
+        uint64_t Power(uint64_t base, uint64_t exponent) const
+        {
+            uint64_t result = one;
+            while (exponent != 0)
+            {
+                if (exponent & 1)
+                    result = Multiply(result, base);
+                base = Multiply(base, base);
+                exponent >>= 1;
+            }
+            return result;
+        }
+
+        // Fermat's little theorem; `value` must be nonzero.
+        uint64_t Inverse(uint64_t value) const { return Power(value, p - 2); }
+
+    private:
+        uint64_t p;
+        uint64_t negativeInverse = 0;  // -p^-1 mod 2^64
+        uint64_t rSquared = 0;         // 2^128 mod p
+        uint64_t one = 0;
+
+        // (high * 2^64 + low) / 2^64 mod p for high < p.
+        uint64_t Reduce(uint64_t high, uint64_t low) const
+        {
+            const uint64_t factor = low * negativeInverse;
+            uint64_t productHigh = 0;
+            const uint64_t productLow = MultiplyWide(factor, p, productHigh);
+            // low + productLow is 0 mod 2^64, so it carries unless low is 0.
+            (void)productLow;
+            const uint64_t carry = low != 0 ? 1 : 0;
+            const uint64_t result = high + productHigh + carry;
+            return result >= p ? result - p : result;
+        }
+    };
+
+    // Deterministic Miller-Rabin; these bases cover every 64-bit integer.
+    bool IsPrime(uint64_t candidate)
+    {
+        if (candidate % 2 == 0)
+            return false;
+        const MontgomeryField field(candidate);
+        uint64_t odd = candidate - 1;
+        int twos = 0;
+        while (odd % 2 == 0)
+        {
+            odd /= 2;
+            ++twos;
+        }
+
+        const uint64_t minusOne = field.Subtract(0, field.One());
+        const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+        for (uint64_t base : bases)
+        {
+            uint64_t x = field.Power(field.ToField(base), odd);
+            if (x == field.One() || x == minusOne)
+                continue;
+            bool witness = true;
+            for (int round = 1; round < twos && witness; ++round)
+            {
+                x = field.Multiply(x, x);
+                witness = x != minusOne;
+            }
+            if (witness)
+                return false;
+        }
+        return true;
+    }
+
+    // The largest primes below 2^62, in descending order, found on first use.
+    uint64_t PrimeAt(size_t index)
+    {
+        static std::mutex mutex;
+        static std::vector<uint64_t> primes;
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t candidate = primes.empty() ? kPrimeCeiling - 1 : primes.back() - 2;
+        while (primes.size() <= index)
+        {
+            if (IsPrime(candidate))
+                primes.push_back(candidate);
+            candidate -= 2;
+        }
+        return primes[index];
+    }
+
+    // The system with every row scaled to integers. Entries that fit 64 bits
+    // stay inline; `large` holds the rest by position.
+    struct IntegerSystem
+    {
+        size_t size = 0;
+        size_t columns = 0;  // size, plus one with a right-hand side
+        std::vector<long long> values;
+        std::vector<std::pair<size_t, BigInteger>> large;
+        BigInteger rowScale = BigInteger(1);  // product of the row multipliers
+        double boundBits = 0.0;               // log2 of the Hadamard bound
+        bool hasZeroRow = false;
+    };
+
+    IntegerSystem BuildIntegerSystem(const std::vector<std::vector<Rational>>& matrix, const std::vector<Rational>* rhs)
+    {
+        IntegerSystem system;
+        system.size = matrix.size();
+        system.columns = system.size + (rhs ? 1 : 0);
+        system.values.assign(system.size * system.columns, 0);
+
+        std::vector<Rational> row(system.columns);
+        for (size_t r = 0; r < system.size; ++r)
+        {
+            std::copy(matrix[r].begin(), matrix[r].end(), row.begin());
+            if (rhs)
+                row.back() = (*rhs)[r];
+
+            BigInteger lcm(1);
+            for (const Rational& value : row)
+            {
+                const BigInteger denominator = value.Denominator();
+                if (denominator == BigInteger(1))
+                    continue;
+                BigInteger factor, remainder;
+                BigInteger::DivMod(denominator, BigInteger::Gcd(lcm, denominator), factor, remainder);
+                lcm = lcm * factor;
+            }
+            system.rowScale = system.rowScale * lcm;
+
+            // Hadamard: |det| <= product of row norms, and a row norm is at
+            // most sqrt(nonzero entries) times its largest entry. The bound
+            // over the augmented row also covers every Cramer numerator.
+            size_t maxBits = 0;
+            size_t nonzero = 0;
+            for (size_t c = 0; c < system.columns; ++c)
+            {
+                BigInteger scaled, remainder;
+                BigInteger::DivMod(row[c].Numerator() * lcm, row[c].Denominator(), scaled, remainder);
+                if (scaled.IsZero())
+                    continue;
+                ++nonzero;
+                maxBits = (std::max)(maxBits, scaled.BitLength());
+                long long small = 0;
+                if (scaled.TryToInt64(small))
+                    system.values[r * system.columns + c] = small;
+                else
+                    system.large.emplace_back(r * system.columns + c, std::move(scaled));
+            }
+            if (nonzero == 0)
+                system.hasZeroRow = true;
+            else
+                system.boundBits += static_cast<double>(maxBits) + 0.5 * std::log2(static_cast<double>(nonzero));
+        }
+        return system;
+    }
+
+    // Residues of one elimination: the determinant, and with a right-hand
+    // side and a nonzero determinant the Cramer numerators det * x.
+    struct ModularResult
+    {
+        uint64_t determinant = 0;
+        std::vector<uint64_t> numerators;
+    };
+
+    ModularResult EliminateModulo(const IntegerSystem& system, uint64_t prime)
+    {
+        const MontgomeryField field(prime);
+        const size_t n = system.size;
+        const size_t columns = system.columns;
+        const BigInteger primeValue(static_cast<long long>(prime));
+
+        std::vector<uint64_t> a(system.values.size());
+        for (size_t index = 0; index < a.size(); ++index)
+        {
+            const long long value = system.values[index];
+            const uint64_t residue = value >= 0 ? static_cast<uint64_t>(value) % prime
+                                                : (prime - (static_cast<uint64_t>(-value) % prime)) % prime;
+            a[index] = field.ToField(residue);
+        }
+        for (const auto& [index, value] : system.large)
+        {
+            BigInteger quotient, remainder;
+            BigInteger::DivMod(value, primeValue, quotient, remainder);
+            long long residue = 0;
+            remainder.TryToInt64(residue);
+            a[index] = field.ToField(static_cast<uint64_t>(residue < 0 ? residue + static_cast<long long>(prime) : residue));
+        }
+
+        ModularResult result;
+        uint64_t determinant = field.One();
+        std::vector<uint64_t> pivotInverses(n);
+        for (size_t k = 0; k < n; ++k)
+        {
+            size_t pivotRow = k;
+            while (pivotRow < n && a[pivotRow * columns + k] == 0)
+                ++pivotRow;
+            if (pivotRow == n)
+                return result;
+            if (pivotRow != k)
+            {
+                std::swap_ranges(a.begin() + k * columns, a.begin() + (k + 1) * columns, a.begin() + pivotRow * columns);
+                determinant = field.Subtract(0, determinant);
+            }
+
+            const uint64_t* pivotValues = &a[k * columns];
+            determinant = field.Multiply(determinant, pivotValues[k]);
+            pivotInverses[k] = field.Inverse(pivotValues[k]);
+            for (size_t row = k + 1; row < n; ++row)
+            {
+                uint64_t* values = &a[row * columns];
+                if (values[k] == 0)
+                    continue;
+                const uint64_t factor = field.Multiply(values[k], pivotInverses[k]);
+                for (size_t c = k + 1; c < columns; ++c)
+                    values[c] = field.Subtract(values[c], field.Multiply(factor, pivotValues[c]));
+            }
+        }
+        result.determinant = field.FromField(determinant);
+
+        if (columns > n)
+        {
+            std::vector<uint64_t> x(n);
+            for (size_t k = n; k-- > 0;)
+            {
+                const uint64_t* values = &a[k * columns];
+                uint64_t sum = values[n];
+                for (size_t c = k + 1; c < n; ++c)
+                    sum = field.Subtract(sum, field.Multiply(values[c], x[c]));
+                x[k] = field.Multiply(sum, pivotInverses[k]);
+            }
+            result.numerators.resize(n);
+            for (size_t k = 0; k < n; ++k)
+                result.numerators[k] = field.FromField(field.Multiply(x[k], determinant));
+        }
+        return result;
+    }
+
+    // Chinese remaindering in mixed radix (Garner): the digits come from
+    // word-sized arithmetic and only the final Horner pass touches BigInteger.
+    class ResidueCombiner
+    {
+    public:
+        explicit ResidueCombiner(const std::vector<uint64_t>& moduli) : primes(moduli)
+        {
+            fields.reserve(primes.size());
+            for (uint64_t prime : primes)
+                fields.emplace_back(prime);
+
+            // inverses[i] = (p_0 * ... * p_{i-1})^-1 mod p_i, in field form.
+            inverses.resize(primes.size());
+            modulus = BigInteger(1);
+            for (size_t i = 0; i < primes.size(); ++i)
+            {
+                const MontgomeryField& field = fields[i];
+                uint64_t product = field.One();
+                for (size_t j = 0; j < i; ++j)
+                    product = field.Multiply(product, field.ToField(primes[j]));
+                inverses[i] = field.Inverse(product);
+                modulus = modulus * BigInteger(static_cast<long long>(primes[i]));
+            }
+        }
+
+        // The unique value congruent to every residue, in (-M/2, M/2].
+        BigInteger Combine(const std::vector<uint64_t>& residues) const
+        {
+            std::vector<uint64_t> digits(primes.size());
+            for (size_t i = 0; i < primes.size(); ++i)
+            {
+                const MontgomeryField& field = fields[i];
+                // Value of the digits so far, modulo p_i, by Horner.
+                uint64_t partial = 0;
+                for (size_t j = i; j-- > 0;)
+                    partial = field.Add(field.Multiply(partial, field.ToField(primes[j])), field.ToField(digits[j]));
+                const uint64_t difference = field.Subtract(field.ToField(residues[i]), partial);
+                digits[i] = field.FromField(field.Multiply(difference, inverses[i]));
+            }
+
+            BigInteger value;
+            for (size_t i = primes.size(); i-- > 0;)
+                value = value * BigInteger(static_cast<long long>(primes[i])) + BigInteger(static_cast<long long>(digits[i]));
+            if ((value.ShiftLeft(1) - modulus).Sign() > 0)
+                value = value - modulus;
+            return value;
+        }
+
+    private:
+        std::vector<uint64_t> primes;
+        std::vector<MontgomeryField> fields;
+        std::vector<uint64_t> inverses;
+        BigInteger modulus;
+    };
+
+    std::vector<ModularResult> EliminateAll(const IntegerSystem& system, const std::vector<uint64_t>& primes)
+    {
+        std::vector<ModularResult> results(primes.size());
+        TaskPool::Shared().ParallelFor(primes.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; ++index)
+                results[index] = EliminateModulo(system, primes[index]);
+        });
+        return results;
+    }
+
+    size_t PrimesFor(double bits)
+    {
+        // One extra bit for the sign of the symmetric residue.
+        return static_cast<size_t>(std::ceil((bits + 1.0) / kBitsPerPrime));
+    }
+}
+
+bool ModularDeterminant(const std::vector<std::vector<Rational>>& matrix, Rational& determinant)
+{
+    const size_t n = matrix.size();
+    if (n == 0)
+        return false;
+    for (const auto& row : matrix)
+    {
+        if (row.size() != n)
+            return false;
+    }
+
+    const IntegerSystem system = BuildIntegerSystem(matrix, nullptr);
+    if (system.hasZeroRow)
+    {
+        determinant = Rational(0);
+        return true;
+    }
+
+    std::vector<uint64_t> primes(PrimesFor(system.boundBits));
+    for (size_t index = 0; index < primes.size(); ++index)
+        primes[index] = PrimeAt(index);
+    const std::vector<ModularResult> results = EliminateAll(system, primes);
+
+    std::vector<uint64_t> residues(primes.size());
+    for (size_t index = 0; index < primes.size(); ++index)
+        residues[index] = results[index].determinant;
+    determinant = Rational(ResidueCombiner(primes).Combine(residues), system.rowScale);
+    return true;
+}
+
+bool ModularSolve(const std::vector<std::vector<Rational>>& matrix, const std::vector<Rational>& rhs,
+                  std::vector<Rational>& solution)
+{
+    const size_t n = matrix.size();
+    if (n == 0 || rhs.size() != n)
+        return false;
+    for (const auto& row : matrix)
+    {
+        if (row.size() != n)
+            return false;
+    }
+
+    const IntegerSystem system = BuildIntegerSystem(matrix, &rhs);
+    const size_t needed = PrimesFor(system.boundBits);
+
+    // A prime dividing the determinant cannot solve; set it aside and take
+    // the next one. Once the discarded primes alone exceed the bound, the
+    // determinant is a multiple of a number larger than itself, so it is 0.
+    std::vector<uint64_t> lucky;
+    std::vector<ModularResult> luckyResults;
+    size_t unlucky = 0;
+    size_t nextPrime = 0;
+    while (lucky.size() < needed)
+    {
+        std::vector<uint64_t> batch(needed - lucky.size());
+        for (uint64_t& prime : batch)
+            prime = PrimeAt(nextPrime++);
+        std::vector<ModularResult> results = EliminateAll(system, batch);
+        for (size_t index = 0; index < batch.size(); ++index)
+        {
+            if (results[index].determinant == 0)
+            {
+                ++unlucky;
+                continue;
+            }
+            lucky.push_back(batch[index]);
+            luckyResults.push_back(std::move(results[index]));
+        }
+        if (unlucky >= needed)
+            return false;
+    }
+
+    const ResidueCombiner combiner(lucky);
+    std::vector<uint64_t> residues(lucky.size());
+    for (size_t index = 0; index < lucky.size(); ++index)
+        residues[index] = luckyResults[index].determinant;
+    const BigInteger determinant = combiner.Combine(residues);
+
+    solution.assign(n, Rational(0));
+    for (size_t k = 0; k < n; ++k)
+    {
+        for (size_t index = 0; index < lucky.size(); ++index)
+            residues[index] = luckyResults[index].numerators[k];
+        solution[k] = Rational(combiner.Combine(residues), determinant);
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+#include "rational.h"
+
+// Exact linear algebra over the rationals by multi-modular arithmetic. Rows are
+// scaled to integers, eliminated independently modulo enough 62-bit primes to
+// cover the Hadamard bound of the result, and the residues are recombined with
+// the Chinese remainder theorem. Intermediate values never grow past one machine
+// word, so cost scales with the size of the answer instead of with coefficient
+// blow-up during elimination. Primes are processed in parallel on TaskPool::Shared().
+
+// Fails when `matrix` is empty or not square.
+bool ModularDeterminant(const std::vector<std::vector<Rational>>& matrix, Rational& determinant);
+
+// The unique x with matrix * x = rhs. Fails when `matrix` is not square, the
+// sizes differ, or the matrix is singular.
+bool ModularSolve(const std::vector<std::vector<Rational>>& matrix, const std::vector<Rational>& rhs,
+                  std::vector<Rational>& solution);
@@ -0,0 +1,468 @@
+#include "rational.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using Limbs = std::vector<uint32_t>;
+
+    void TrimLimbs(Limbs& limbs)
+    {
+        while (!limbs.empty() && limbs.back() == 0)
+            limbs.pop_back();
+    }
+
+    int CompareMagnitudes(const Limbs& left, const Limbs& right)
+    {
+        if (left.size() != right.size())
+            return left.size() < right.size() ? -1 : 1;
+        for (size_t index = left.size(); index-- > 0;)
+        {
+            if (left[index] != right[index])
+                return left[index] < right[index] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    Limbs AddMagnitudes(const Limbs& left, const Limbs& right)
+    {
+        const Limbs& longer = left.size() >= right.size() ? left : right;
+        const Limbs& shorter = left.size() >= right.size() ? right : left;
+        Limbs sum(longer.size() + 1, 0);
+        uint64_t carry = 0;
+        for (size_t index = 0; index < longer.size(); ++index)
+        {
+            const uint64_t total = (uint64_t)longer[index] + (index < shorter.size() ? shorter[index] : 0) + carry;
+            sum[index] = (uint32_t)total;
+            carry = total >> 32;
+        }
+        sum[longer.size()] = (uint32_t)carry;
+        TrimLimbs(sum);
+        return sum;
+    }
+
+    // |left| - |right| for |left| >= |right|.
+    Limbs SubtractMagnitudes(const Limbs& left, const Limbs& right)
+    {
+        Limbs difference(left.size(), 0);
+        int64_t borrow = 0;
+        for (size_t index = 0; index < left.size(); ++index)
+        {
+            int64_t value = (int64_t)left[index] - borrow - (index < right.size() ? (int64_t)right[index] : 0);
+            borrow = value < 0 ? 1 : 0;
+            difference[index] = (uint32_t)(value + (borrow << 32));
+        }
+        TrimLimbs(difference);
+        return difference;
+    }
+
+    Limbs MultiplyMagnitudes(const Limbs& left, const Limbs& right)
+    {
+        if (left.empty() || right.empty())
+            return Limbs();
+        Limbs product(left.size() + right.size(), 0);
+        for (size_t i = 0; i < left.size(); ++i)
+        {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < right.size(); ++j)
+            {
+                const uint64_t total = (uint64_t)left[i] * right[j] + product[i + j] + carry;
+                product[i + j] = (uint32_t)total;
+                carry = total >> 32;
+            }
+            product[i + right.size()] = (uint32_t)carry;
+        }
+        TrimLimbs(product);
+        return product;
+    }
+
+    Limbs ShiftLimbsLeft(const Limbs& limbs, size_t bits)
+    {
+        if (limbs.empty())
+            return Limbs();
+        const size_t whole = bits / 32;
+        const unsigned int part = (unsigned int)(bits % 32);
+        Limbs shifted(limbs.size() + whole + 1, 0);
+        for (size_t index = 0; index < limbs.size(); ++index)
+        {
+            const uint64_t value = (uint64_t)limbs[index] << part;
+            shifted[index + whole] |= (uint32_t)value;
+            shifted[index + whole + 1] |= (uint32_t)(value >> 32);
+        }
+        TrimLimbs(shifted);
+        return shifted;
+    }
+
+    unsigned int LeadingZeros(uint32_t value)
+    {
+        unsigned int count = 0;
+        while (count < 32 && (value & 0x80000000u) == 0)
+        {
+            value <<= 1;
+            ++count;
+        }
+        return count;
+    }
+
+    // Knuth's algorithm D (TAOCP 4.3.1) on 32-bit limbs; `divisor` is non-empty.
+    void DivideMagnitudes(const Limbs& dividend, const Limbs& divisor, Limbs& quotient, Limbs& remainder)
+    {
+        if (CompareMagnitudes(dividend, divisor) < 0)
+        {
+            quotient.clear();
+            remainder = dividend;
+            return;
+        }
+
+        if (divisor.size() == 1)
+        {
+            quotient.assign(dividend.size(), 0);
+            uint64_t rest = 0;
+            for (size_t index = dividend.size(); index-- > 0;)
+            {
+                const uint64_t current = (rest << 32) | dividend[index];
+                quotient[index] = (uint32_t)(current / divisor[0]);
+                rest = current % divisor[0];
+            }
+            TrimLimbs(quotient);
+            remainder.clear();
+            if (rest != 0)
+                remainder.push_back((uint32_t)rest);
+            return;
+        }
+
+        // Normalise so the divisor's top limb has its high bit set.
+        const unsigned int shift = LeadingZeros(divisor.back());
+        Limbs v = ShiftLimbsLeft(divisor, shift);
+        Limbs u = ShiftLimbsLeft(dividend, shift);
+        u.resize(dividend.size() + 1, 0);
+        const size_t n = v.size();
+        const size_t m = dividend.size() - n;
+        quotient.assign(m + 1, 0);
+
+        for (size_t j = m + 1; j-- > 0;)
+        {
+            const uint64_t top = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+            uint64_t estimate = top / v[n - 1];
+            uint64_t rest = top % v[n - 1];
+            while (estimate >= (1ULL << 32) || estimate * v[n - 2] > ((rest << 32) | u[j + n - 2]))
+            {
+                --estimate;
+                rest += v[n - 1];
+                if (rest >= (1ULL << 32))
+                    break;
+            }
+
+            int64_t borrow = 0;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                const uint64_t product = estimate * v[i] + carry;
+                carry = product >> 32;
+                const int64_t value = (int64_t)u[i + j] - borrow - (int64_t)(product & 0xFFFFFFFFu);
+                u[i + j] = (uint32_t)value;
+                borrow = value < 0 ? 1 : 0;
+            }
+            const int64_t value = (int64_t)u[j + n] - borrow - (int64_t)carry;
+            u[j + n] = (uint32_t)value;
+
+            if (value < 0)
+            {
+                // The estimate was one too large; add the divisor back.
+                --estimate;
+                uint64_t sumCarry = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const uint64_t total = (uint64_t)u[i + j] + v[i] + sumCarry;
+                    u[i + j] = (uint32_t)total;
+                    sumCarry = total >> 32;
+                }
+                u[j + n] += (uint32_t)sumCarry;
+            }
+            quotient[j] = (uint32_t)estimate;
+        }
+        TrimLimbs(quotient);
+
+        remainder.assign(n, 0);
+        for (size_t index = 0; index < n; ++index)
+        {
+            const uint64_t pair = ((index + 1 < n ? (uint64_t)u[index + 1] : 0) << 32) | u[index];
+            remainder[index] = (uint32_t)(pair >> shift);
+        }
+        TrimLimbs(remainder);
+    }
+}
+
+BigInteger::BigInteger(long long value)
+{
+    negative = value < 0;
+    uint64_t magnitude = negative ? 0ULL - (uint64_t)value : (uint64_t)value;
+    while (magnitude != 0)
+    {
+        limbs.push_back((uint32_t)magnitude);
+        magnitude >>= 32;
+    }
+}
+
+size_t BigInteger::BitLength() const
+{
+    if (limbs.empty())
+        return 0;
+    return limbs.size() * 32 - LeadingZeros(limbs.back());
+}
+
+bool BigInteger::TryToInt64(long long& out) const
+{
+    if (limbs.size() > 2)
+        return false;
+    uint64_t magnitude = 0;
+    for (size_t index = limbs.size(); index-- > 0;)
+        magnitude = (magnitude << 32) | limbs[index];
+    if (magnitude > (uint64_t)LLONG_MAX)
+        return false;
+    out = negative ? -(long long)magnitude : (long long)magnitude;
+    return true;
+}
+
+double BigInteger::ToDouble() const
+{
+    double value = 0.0;
+    for (size_t index = limbs.size(); index-- > 0;)
+        value = value * 4294967296.0 + limbs[index];
+    return negative ? -value : value;
+}
+
+std::wstring BigInteger::ToString() const
+{
+    if (limbs.empty())
+        return L"0";
+
+    // Peel off nine decimal digits at a time.
+    std::wstring digits;
+    Limbs rest = limbs;
+    while (!rest.empty())
+    {
+        uint64_t chunk = 0;
+        for (size_t index = rest.size(); index-- > 0;)
+        {
+            const uint64_t current = (chunk << 32) | rest[index];
+            rest[index] = (uint32_t)(current / 1000000000u);
+            chunk = current % 1000000000u;
+        }
+        TrimLimbs(rest);
+        for (int digit = 0; digit < 9 && (chunk != 0 || !rest.empty()); ++digit)
+        {
+            digits.push_back((wchar_t)(L'0' + chunk % 10));
+            chunk /= 10;
+        }
+    }
+    if (negative)
+        digits.push_back(L'-');
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+BigInteger BigInteger::operator-() const
+{
+    BigInteger result = *this;
+    if (!result.limbs.empty())
+        result.negative = !result.negative;
+    return result;
+}
+
+BigInteger BigInteger::ShiftLeft(size_t bits) const
+{
+    BigInteger result;
+    result.negative = negative;
+    result.limbs = ShiftLimbsLeft(limbs, bits);
+    return result;
+}
+
+BigInteger BigInteger::AddSigned(const BigInteger& left, const BigInteger& right, bool negateRight)
+{
+    const bool rightNegative = right.negative != negateRight;
+    BigInteger result;
+    if (left.negative == rightNegative)
+    {
+        result.limbs = AddMagnitudes(left.limbs, right.limbs);
+        result.negative = left.negative;
+    }
+    else if (CompareMagnitudes(left.limbs, right.limbs) >= 0)
+    {
+        result.limbs = SubtractMagnitudes(left.limbs, right.limbs);
+        result.negative = left.negative;
+    }
+    else
+    {
+        result.limbs = SubtractMagnitudes(right.limbs, left.limbs);
+        result.negative = rightNegative;
+    }
+    if (result.limbs.empty())
+        result.negative = false;
+    return result;
+}
+
+BigInteger operator+(const BigInteger& left, const BigInteger& right)
+{
+    return BigInteger::AddSigned(left, right, false);
+}
+
+BigInteger operator-(const BigInteger& left, const BigInteger& right)
+{
+    return BigInteger::AddSigned(left, right, true);
+}
+
+BigInteger operator*(const BigInteger& left, const BigInteger& right)
+{
+    BigInteger result;
+    result.limbs = MultiplyMagnitudes(left.limbs, right.limbs);
+    result.negative = !result.limbs.empty() && left.negative != right.negative;
+    return result;
+}
+
+void BigInteger::DivMod(const BigInteger& dividend, const BigInteger& divisor, BigInteger& quotient, BigInteger& remainder)
+{
+    Limbs quotientLimbs;
+    Limbs remainderLimbs;
+    DivideMagnitudes(dividend.limbs, divisor.limbs, quotientLimbs, remainderLimbs);
+    // Signs are settled before writing, since the outputs may alias the inputs.
+    const bool quotientNegative = !quotientLimbs.empty() && dividend.negative != divisor.negative;
+    const bool remainderNegative = !remainderLimbs.empty() && dividend.negative;
+    quotient.limbs = quotientLimbs;
+    quotient.negative = quotientNegative;
+    remainder.limbs = remainderLimbs;
+    remainder.negative = remainderNegative;
+}
+
+BigInteger BigInteger::Gcd(BigInteger left, BigInteger right)
+{
+    left.negative = false;
+    right.negative = false;
+    while (!right.IsZero())
+    {
+        BigInteger quotient;
+        BigInteger remainder;
+        DivMod(left, right, quotient, remainder);
+        left = right;
+        right = remainder;
+    }
+    return left;
+}
+
+bool Rational::operator==(const Rational& other) const
+{
+    if (!big && !other.big)
+        return num == other.num && den == other.den;
+    if (!big || !other.big)
+        return false;
+    return big->num == other.big->num && big->den == other.big->den;
+}
+
+Rational Rational::Reciprocal() const
+{
+    if (!big)
+        return Rational(den, num);
+    return FromBig(big->den, big->num);
+}
+
+size_t Rational::BitLength() const
+{
+    if (big)
+        return (std::max)(big->num.BitLength(), big->den.BitLength());
+    return (std::max)(BigInteger(num).BitLength(), BigInteger(den).BitLength());
+}
+
+bool Rational::TryPow(long long exponent, Rational& out) const
+{
+    const unsigned long long magnitude = exponent < 0 ? 0ULL - (unsigned long long)exponent : (unsigned long long)exponent;
+    const size_t bits = BitLength();
+    if (bits > 1 && (double)bits * (double)magnitude > (double)kMaxPowerBits)
+        return false;
+
+    Rational factor = exponent < 0 ? Reciprocal() : *this;
+    Rational result(1);
+    for (unsigned long long rest = magnitude; rest != 0; rest >>= 1)
+    {
+        if (rest & 1)
+            result = result * factor;
+        if (rest > 1)
+            factor = factor * factor;
+    }
+    out = result;
+    return true;
+}
+
+std::wstring Rational::toString() const
+{
+    if (big)
+    {
+        if (big->den == BigInteger(1))
+            return big->num.ToString();
+        return big->num.ToString() + L"/" + big->den.ToString();
+    }
+    if (den == 1) return std::to_wstring(num);
+    return std::to_wstring(num) + L"/" + std::to_wstring(den);
+}
+
+Rational Rational::FromBig(BigInteger numerator, BigInteger denominator)
+{
+    // A zero denominator keeps the inline "n/0" form of plain division by zero.
+    if (denominator.IsZero())
+        return Rational(numerator.Sign(), 0);
+    if (denominator.Sign() < 0)
+    {
+        numerator = -numerator;
+        denominator = -denominator;
+    }
+
+    const BigInteger divisor = BigInteger::Gcd(numerator, denominator);
+    if (divisor != BigInteger(1))
+    {
+        BigInteger remainder;
+        BigInteger::DivMod(numerator, divisor, numerator, remainder);
+        BigInteger::DivMod(denominator, divisor, denominator, remainder);
+    }
+
+    Rational result;
+    long long smallNumerator = 0;
+    long long smallDenominator = 0;
+    if (numerator.TryToInt64(smallNumerator) && denominator.TryToInt64(smallDenominator))
+    {
+        result.num = smallNumerator;
+        result.den = smallDenominator;
+        return result;
+    }
+    result.big = std::make_shared<const BigParts>(BigParts{ numerator, denominator });
+    return result;
+}
+
+Rational Rational::AddBig(const Rational& left, const Rational& right, bool subtract)
+{
+    const BigInteger leftPart = left.Numerator() * right.Denominator();
+    const BigInteger rightPart = right.Numerator() * left.Denominator();
+    return FromBig(subtract ? leftPart - rightPart : leftPart + rightPart, left.Denominator() * right.Denominator());
+}
+
+Rational Rational::MultiplyBig(const Rational& left, const Rational& right, bool divide)
+{
+    if (divide)
+        return FromBig(left.Numerator() * right.Denominator(), left.Denominator() * right.Numerator());
+    return FromBig(left.Numerator() * right.Numerator(), left.Denominator() * right.Denominator());
+}
+
+double Rational::BigToDouble() const
+{
+    // Scale the quotient to about 64 significant bits before converting, so
+    // numerators and denominators beyond the double range still divide.
+    const BigInteger& numerator = big->num;
+    const BigInteger& denominator = big->den;
+    const long long shift = 64 + (long long)denominator.BitLength() - (long long)numerator.BitLength();
+    const BigInteger scaledNumerator = shift > 0 ? numerator.ShiftLeft((size_t)shift) : numerator;
+    const BigInteger scaledDenominator = shift < 0 ? denominator.ShiftLeft((size_t)-shift) : denominator;
+    BigInteger quotient;
+    BigInteger remainder;
+    BigInteger::DivMod(scaledNumerator, scaledDenominator, quotient, remainder);
+    const long long exponent = (std::max)(-100000LL, (std::min)(100000LL, -shift));
+    return std::ldexp(quotient.ToDouble(), (int)exponent);
+}
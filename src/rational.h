@@ -0,0 +1,229 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Signed integer of unbounded size: a sign and little-endian 32-bit limbs
+// without leading zero limbs (zero has none).
+class BigInteger
+{
+public:
+    BigInteger() = default;
+    BigInteger(long long value);
+
+    bool IsZero() const { return limbs.empty(); }
+    int Sign() const { return limbs.empty() ? 0 : (negative ? -1 : 1); }
+    size_t BitLength() const;
+    // Fails when the value lies outside [-LLONG_MAX, LLONG_MAX].
+    bool TryToInt64(long long& out) const;
+    double ToDouble() const;
+    std::wstring ToString() const;
+
+    BigInteger operator-() const;
+    BigInteger ShiftLeft(size_t bits) const;
+
+    friend BigInteger operator+(const BigInteger& left, const BigInteger& right);
+    friend BigInteger operator-(const BigInteger& left, const BigInteger& right);
+    friend BigInteger operator*(const BigInteger& left, const BigInteger& right);
+    bool operator==(const BigInteger& other) const { return negative == other.negative && limbs == other.limbs; }
+    bool operator!=(const BigInteger& other) const { return !(*this == other); }
+
+    // Truncating division; `divisor` must not be zero.
+    static void DivMod(const BigInteger& dividend, const BigInteger& divisor, BigInteger& quotient, BigInteger& remainder);
+    // Non-negative greatest common divisor.
+    static BigInteger Gcd(BigInteger left, BigInteger right);
+
+private:
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+
+    static BigInteger AddSigned(const BigInteger& left, const BigInteger& right, bool negateRight);
+};
+
+// Exact fraction in lowest terms with a positive denominator. Values that fit
+// 64-bit numerator and denominator stay inline and use overflow-checked
+// machine arithmetic; a result that would overflow is redone with BigInteger
+// and kept on the heap until it fits again.
+class Rational
+{
+public:
+    // Bit budget for TryPow results.
+    static constexpr size_t kMaxPowerBits = 1 << 14;
+
+    Rational(long long n = 0, long long d = 1) : num(n), den(d)
+    {
+        if (n == LLONG_MIN || d == LLONG_MIN)
+        {
+            *this = FromBig(BigInteger(n), BigInteger(d));
+            return;
+        }
+        if (den < 0) { num = -num; den = -den; }  // keep denominator positive
+        normalize();
+    }
+
+    Rational(const BigInteger& n, const BigInteger& d) { *this = FromBig(n, d); }
+
+    Rational operator+(const Rational& other) const
+    {
+        long long left = 0, right = 0, sum = 0, denominator = 0;
+        if (!big && !other.big && CheckedMultiply(num, other.den, left) && CheckedMultiply(other.num, den, right) &&
+            CheckedAdd(left, right, sum) && CheckedMultiply(den, other.den, denominator))
+            return Rational(sum, denominator);
+        return AddBig(*this, other, false);
+    }
+
+    Rational operator-(const Rational& other) const
+    {
+        long long left = 0, right = 0, difference = 0, denominator = 0;
+        if (!big && !other.big && CheckedMultiply(num, other.den, left) && CheckedMultiply(other.num, den, right) &&
+            CheckedAdd(left, -right, difference) && CheckedMultiply(den, other.den, denominator))
+            return Rational(difference, denominator);
+        return AddBig(*this, other, true);
+    }
+
+    Rational operator*(const Rational& other) const
+    {
+        long long numerator = 0, denominator = 0;
+        if (!big && !other.big && CheckedMultiply(num, other.num, numerator) && CheckedMultiply(den, other.den, denominator))
+            return Rational(numerator, denominator);
+        return MultiplyBig(*this, other, false);
+    }
+
+    Rational operator/(const Rational& other) const
+    {
+        long long numerator = 0, denominator = 0;
+        if (!big && !other.big && CheckedMultiply(num, other.den, numerator) && CheckedMultiply(den, other.num, denominator))
+            return Rational(numerator, denominator);
+        return MultiplyBig(*this, other, true);
+    }
+
+    bool operator==(const Rational& other) const;
+    bool operator!=(const Rational& other) const { return !(*this == other); }
+
+    bool IsZero() const { return !big && num == 0; }
+    bool IsInteger() const { return big ? big->den == BigInteger(1) : den == 1; }
+    int Sign() const { return big ? big->num.Sign() : (num > 0) - (num < 0); }
+    bool TryGetInteger(long long& out) const
+    {
+        if (big || den != 1)
+            return false;
+        out = num;
+        return true;
+    }
+
+    BigInteger Numerator() const { return big ? big->num : BigInteger(num); }
+    BigInteger Denominator() const { return big ? big->den : BigInteger(den); }
+    Rational Reciprocal() const;
+    // Bits in the larger of numerator and denominator.
+    size_t BitLength() const;
+    // *this raised to `exponent` by repeated squaring. Fails when the exact
+    // result could exceed kMaxPowerBits, so callers can fall back to doubles.
+    bool TryPow(long long exponent, Rational& out) const;
+
+    double toDouble() const
+    {
+        if (big)
+            return BigToDouble();
+        return (double)num / den;
+    }
+
+    std::wstring toString() const;
+
+private:
+    struct BigParts
+    {
+        BigInteger num;
+        BigInteger den;
+    };
+
+    long long num;   // numerator, when `big` is empty
+    long long den;   // denominator, when `big` is empty
+    std::shared_ptr<const BigParts> big;
+
+    void normalize()
+    {
+        if (num == 0) { den = 1; return; }
+        long long g = gcd(num < 0 ? -num : num, den);
+        num /= g;
+        den /= g;
+    }
+
+    // Binary GCD of non-negative values; shifts and subtractions are much
+    // cheaper than the divisions of Euclid's algorithm.
+    static long long gcd(long long a, long long b)
+    {
+        unsigned long long left = (unsigned long long)a;
+        unsigned long long right = (unsigned long long)b;
+        if (left == 0 || right == 0)
+            return (long long)(left | right);
+        const unsigned int shift = TrailingZeros(left | right);
+        left >>= TrailingZeros(left);
+        do {
+            right >>= TrailingZeros(right);
+            if (left > right) {
+                const unsigned long long t = right;
+                right = left;
+                left = t;
+            }
+            right -= left;
+        } while (right != 0);
+        return (long long)(left << shift);
+    }
+
+    static unsigned int TrailingZeros(unsigned long long value)
+    {
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index = 0;
+        _BitScanForward64(&index, value);
+        return (unsigned int)index;
+#elif defined(_MSC_VER) && !defined(__clang__)
+        unsigned int count = 0;
+        while ((value & 1) == 0) { value >>= 1; ++count; }
+        return count;
+#else
+        return (unsigned int)__builtin_ctzll(value);
+#endif
+    }
+
+    // Both helpers fail on overflow and on LLONG_MIN, which has no positive
+    // counterpart and would break negation.
+    static bool CheckedMultiply(long long left, long long right, long long& out)
+    {
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+        long long high = 0;
+        out = _mul128(left, right, &high);
+        return high == (out >> 63) && out != LLONG_MIN;
+#elif defined(_MSC_VER) && !defined(__clang__)
+        if (left != 0 && right != 0 && (left < 0 ? -left : left) > LLONG_MAX / (right < 0 ? -right : right))
+            return false;
+        out = left * right;
+        return true;
+#else
+        return !__builtin_mul_overflow(left, right, &out) && out != LLONG_MIN;
+#endif
+    }
+
+    static bool CheckedAdd(long long left, long long right, long long& out)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        if ((right > 0 && left > LLONG_MAX - right) || (right < 0 && left < -LLONG_MAX - right))
+            return false;
+        out = left + right;
+        return true;
+#else
+        return !__builtin_add_overflow(left, right, &out) && out != LLONG_MIN;
+#endif
+    }
+
+    static Rational FromBig(BigInteger numerator, BigInteger denominator);
+    static Rational AddBig(const Rational& left, const Rational& right, bool subtract);
+    static Rational MultiplyBig(const Rational& left, const Rational& right, bool divide);
+    double BigToDouble() const;
+};
@@ -0,0 +1,153 @@
+#include "task_pool.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Queue owned by the current thread when it is a worker of `tlsPool`.
+    thread_local const TaskPool* tlsPool = nullptr;
+    thread_local size_t tlsQueueIndex = 0;
+}
+
+TaskPool& TaskPool::Shared()
+{
+    static TaskPool pool([] {
+        const unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? static_cast<size_t>(cores - 1) : static_cast<size_t>(1);
+    }());
+    return pool;
+}
+
+TaskPool::TaskPool(size_t workerCount)
+{
+    queues.reserve(workerCount + 1);
+    for (size_t index = 0; index <= workerCount; ++index)
+        queues.push_back(std::make_unique<WorkQueue>());
+
+    workers.reserve(workerCount);
+    for (size_t index = 0; index < workerCount; ++index)
+        workers.emplace_back([this, index] { WorkerLoop(index + 1); });
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void TaskPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+    if (count == 0)
+        return;
+    grain = (std::max)(grain, static_cast<size_t>(1));
+    if (count <= grain || workers.empty())
+    {
+        for (size_t begin = 0; begin < count; begin += grain)
+            body(begin, (std::min)(count, begin + grain));
+        return;
+    }
+
+    const size_t queueIndex = tlsPool == this ? tlsQueueIndex : 0;
+    std::atomic<size_t> remaining{ count };
+    RangeTask task;
+    task.body = &body;
+    task.begin = 0;
+    task.end = count;
+    task.grain = grain;
+    task.remaining = &remaining;
+    Run(queueIndex, task);
+
+    // Help with whatever is queued, ours or not, until our range is done.
+    while (remaining.load(std::memory_order_acquire) != 0)
+    {
+        RangeTask pending;
+        if (TryTake(queueIndex, pending))
+            Run(queueIndex, pending);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void TaskPool::Push(size_t queueIndex, const RangeTask& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake.notify_one();
+}
+
+bool TaskPool::TryTake(size_t queueIndex, RangeTask& task)
+{
+    {
+        WorkQueue& own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < queues.size(); ++offset)
+    {
+        WorkQueue& victim = *queues[(queueIndex + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::Run(size_t queueIndex, RangeTask task)
+{
+    // Keep the left half and publish the right half until one grain is left;
+    // the largest pieces sit at the front of the queue where thieves look.
+    while (task.end - task.begin > task.grain)
+    {
+        const size_t grains = (task.end - task.begin + task.grain - 1) / task.grain;
+        RangeTask right = task;
+        right.begin = task.begin + (grains / 2) * task.grain;
+        task.end = right.begin;
+        Push(queueIndex, right);
+    }
+
+    (*task.body)(task.begin, task.end);
+    task.remaining->fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+}
+
+void TaskPool::WorkerLoop(size_t queueIndex)
+{
+    tlsPool = this;
+    tlsQueueIndex = queueIndex;
+    while (true)
+    {
+        RangeTask task;
+        if (TryTake(queueIndex, task))
+        {
+            Run(queueIndex, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_relaxed) != 0; });
+        if (stopping)
+            return;
+    }
+}
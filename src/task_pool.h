@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run index ranges. Each worker owns a queue
+// of ranges: it splits and pops from the back of its own queue and steals from
+// the front of the others when it runs dry, so uneven ranges rebalance without
+// a central scheduler. Calling threads take part through a shared queue while
+// they wait, which also makes nested ParallelFor calls safe.
+class TaskPool
+{
+public:
+    // Process-wide pool sized to the hardware, leaving one core for the caller.
+    static TaskPool& Shared();
+
+    explicit TaskPool(size_t workerCount);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    size_t WorkerCount() const { return workers.size(); }
+
+    // Calls `body(begin, end)` on disjoint subranges covering [0, count) and
+    // returns once all of them have run. Subranges are at most `grain` long and
+    // start on multiples of `grain`, so per-range results stay independent of
+    // how the work was scheduled. Ranges no longer than `grain` run inline.
+    void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+private:
+    struct RangeTask
+    {
+        const std::function<void(size_t, size_t)>* body = nullptr;
+        size_t begin = 0;
+        size_t end = 0;
+        size_t grain = 1;
+        std::atomic<size_t>* remaining = nullptr;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<RangeTask> tasks;
+    };
+
+    void Push(size_t queueIndex, const RangeTask& task);
+    bool TryTake(size_t queueIndex, RangeTask& task);
+    void Run(size_t queueIndex, RangeTask task);
+    void WorkerLoop(size_t queueIndex);
+
+    // queues[0] is shared by outside callers; worker i owns queues[i + 1].
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    bool stopping = false;
+};
@@ -0,0 +1,447 @@
+#include "unit_registry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cwctype>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+    struct BuiltInUnit
+    {
+        const wchar_t* symbol;
+        double scale;
+        UnitDimension dimension;
+        bool prefixes;
+    };
+
+    const BuiltInUnit kBuiltInUnits[] = {
+        { L"m", 1.0, UnitDimension::Make(1), true },
+        { L"s", 1.0, UnitDimension::Make(0, 0, 1), true },
+        { L"min", 60.0, UnitDimension::Make(0, 0, 1), false },
+        { L"h", 3600.0, UnitDimension::Make(0, 0, 1), false },
+        { L"hr", 3600.0, UnitDimension::Make(0, 0, 1), false },
+        { L"g", 0.001, UnitDimension::Make(0, 1), true },
+        { L"A", 1.0, UnitDimension::Make(0, 0, 0, 1), true },
+        { L"K", 1.0, UnitDimension::Make(0, 0, 0, 0, 1), true },
+        { L"mol", 1.0, UnitDimension::Make(0, 0, 0, 0, 0, 1), true },
+        { L"cd", 1.0, UnitDimension::Make(0, 0, 0, 0, 0, 0, 1), true },
+        { L"Hz", 1.0, UnitDimension::Make(0, 0, -1), true },
+        { L"N", 1.0, UnitDimension::Make(1, 1, -2), true },
+        { L"Pa", 1.0, UnitDimension::Make(-1, 1, -2), true },
+        { L"J", 1.0, UnitDimension::Make(2, 1, -2), true },
+        { L"W", 1.0, UnitDimension::Make(2, 1, -3), true },
+    };
+
+    struct SiPrefix
+    {
+        const wchar_t* symbol;
+        double factor;
+    };
+
+    // Both the Greek mu and a plain 'u' spell micro, so either can be typed.
+    const SiPrefix kSiPrefixes[] = {
+        { L"Q", 1e30 }, { L"R", 1e27 }, { L"Y", 1e24 }, { L"Z", 1e21 }, { L"E", 1e18 }, { L"P", 1e15 },
+        { L"T", 1e12 }, { L"G", 1e9 }, { L"M", 1e6 }, { L"k", 1e3 }, { L"h", 1e2 }, { L"da", 1e1 },
+        { L"d", 1e-1 }, { L"c", 1e-2 }, { L"m", 1e-3 }, { L"\u03BC", 1e-6 }, { L"u", 1e-6 }, { L"n", 1e-9 },
+        { L"p", 1e-12 }, { L"f", 1e-15 }, { L"a", 1e-18 }, { L"z", 1e-21 }, { L"y", 1e-24 }, { L"r", 1e-27 },
+        { L"q", 1e-30 },
+    };
+
+    unsigned int HashSymbol(std::wstring_view symbol)
+    {
+        unsigned int hash = 2166136261u;
+        for (wchar_t ch : symbol)
+            hash = (hash ^ (unsigned int)ch) * 16777619u;
+        return hash ^ (hash >> 15);
+    }
+
+    // Symbols have to lex as a single identifier: a letter, then letters or digits.
+    bool IsUnitSymbol(std::wstring_view symbol)
+    {
+        if (symbol.empty() || !iswalpha(symbol[0]))
+            return false;
+        for (wchar_t ch : symbol)
+        {
+            if (!iswalpha(ch) && !iswdigit(ch))
+                return false;
+        }
+        return true;
+    }
+
+    std::wstring_view NextField(std::wstring_view& line)
+    {
+        size_t start = 0;
+        while (start < line.size() && iswspace(line[start]))
+            ++start;
+        size_t end = start;
+        while (end < line.size() && !iswspace(line[end]))
+            ++end;
+        const std::wstring_view field = line.substr(start, end - start);
+        line.remove_prefix(end);
+        return field;
+    }
+
+    wchar_t FoldUnitChar(wchar_t ch)
+    {
+        return static_cast<wchar_t>(towlower(ch));
+    }
+
+    unsigned long long EdgeKey(unsigned int node, wchar_t ch)
+    {
+        return (static_cast<unsigned long long>(node) << 32) | static_cast<unsigned int>(ch);
+    }
+
+    bool ParseNumber(std::wstring_view text, double& out)
+    {
+        const std::wstring copy(text);
+        wchar_t* end = nullptr;
+        out = wcstod(copy.c_str(), &end);
+        return !copy.empty() && end == copy.c_str() + copy.size() && std::isfinite(out) && out > 0.0;
+    }
+}
+
+bool UnitDimension::TryScale(double power, UnitDimension& out) const
+{
+    if (power == 1.0)
+    {
+        out = *this;
+        return true;
+    }
+    if (power == 2.0)
+        return TryMultiply(*this, *this, out);
+
+    UnitDimension scaled;
+    for (int base = 0; base < kBaseCount; ++base)
+    {
+        const double exponent = Exponent(static_cast<Base>(base)) * power;
+        const double rounded = std::round(exponent);
+        if (std::fabs(exponent - rounded) > 1e-9 || rounded < -128 || rounded > 127)
+            return false;
+        scaled.packed |= Lane(static_cast<int>(rounded), static_cast<Base>(base));
+    }
+    out = scaled;
+    return true;
+}
+
+namespace
+{
+    std::mutex g_configureMutex;
+    std::wstring g_configuredDefinitions;
+    bool g_sharedBuilt = false;
+}
+
+const UnitRegistry& UnitRegistry::Shared()
+{
+    static const std::unique_ptr<UnitRegistry> shared = [] {
+        const auto start = std::chrono::steady_clock::now();
+        std::wstring definitions;
+        {
+            std::lock_guard<std::mutex> lock(g_configureMutex);
+            g_sharedBuilt = true;
+            definitions.swap(g_configuredDefinitions);
+        }
+        auto registry = std::make_unique<UnitRegistry>();
+        if (!definitions.empty())
+            registry->LoadDefinitions(definitions, &registry->problems);
+        registry->buildMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return registry;
+    }();
+    return *shared;
+}
+
+bool UnitRegistry::Configure(std::wstring definitions)
+{
+    std::lock_guard<std::mutex> lock(g_configureMutex);
+    if (g_sharedBuilt)
+        return false;
+    g_configuredDefinitions = std::move(definitions);
+    return true;
+}
+
+UnitRegistry::UnitRegistry()
+{
+    const size_t prefixed = sizeof(kBuiltInUnits) / sizeof(kBuiltInUnits[0]) * (sizeof(kSiPrefixes) / sizeof(kSiPrefixes[0]) + 1);
+    units.reserve(prefixed);
+    Rehash(prefixed * 2);
+
+    // Every plain symbol goes in before any prefixed form, so a declared unit
+    // always wins over a prefix combination that happens to spell it.
+    for (const BuiltInUnit& unit : kBuiltInUnits)
+        Add(unit.symbol, unit.scale, unit.dimension);
+    for (const BuiltInUnit& unit : kBuiltInUnits)
+    {
+        if (unit.prefixes)
+            AddWithPrefixes(unit.symbol, unit.scale, unit.dimension);
+    }
+}
+
+size_t UnitRegistry::LoadDefinitions(std::wstring_view text, std::vector<std::wstring>* problems)
+{
+    const size_t before = units.size();
+    const auto report = [problems](size_t lineNumber, const std::wstring& message) {
+        if (problems)
+            problems->push_back(L"line " + std::to_wstring(lineNumber) + L": " + message);
+    };
+
+    size_t lineNumber = 0;
+    while (!text.empty())
+    {
+        ++lineNumber;
+        const size_t lineEnd = text.find(L'\n');
+        std::wstring_view line = text.substr(0, lineEnd);
+        text.remove_prefix(lineEnd == std::wstring_view::npos ? text.size() : lineEnd + 1);
+        line = line.substr(0, line.find(L'#'));
+
+        const std::wstring_view symbol = NextField(line);
+        if (symbol.empty())
+            continue;
+        const std::wstring_view factorText = NextField(line);
+        std::wstring_view expression = NextField(line);
+        std::wstring_view flag = NextField(line);
+        if (flag.empty() && expression == L"prefixes")
+            std::swap(flag, expression);
+
+        double scale = 0.0;
+        if (!IsUnitSymbol(symbol))
+        {
+            report(lineNumber, L"invalid symbol '" + std::wstring(symbol) + L"'");
+            continue;
+        }
+        if (!ParseNumber(factorText, scale))
+        {
+            report(lineNumber, L"invalid factor for '" + std::wstring(symbol) + L"'");
+            continue;
+        }
+        if ((!flag.empty() && flag != L"prefixes") || !NextField(line).empty())
+        {
+            report(lineNumber, L"unexpected text after '" + std::wstring(symbol) + L"'");
+            continue;
+        }
+
+        // Product of known units, each with an optional integer power.
+        UnitDimension dimension;
+        bool valid = true;
+        bool divide = false;
+        while (valid && !expression.empty())
+        {
+            size_t end = 0;
+            while (end < expression.size() && expression[end] != L'*' && expression[end] != L'/')
+                ++end;
+            std::wstring_view factor = expression.substr(0, end);
+            int power = 1;
+            const size_t caret = factor.find(L'^');
+            if (caret != std::wstring_view::npos)
+            {
+                const std::wstring powerText(factor.substr(caret + 1));
+                wchar_t* powerEnd = nullptr;
+                power = static_cast<int>(wcstol(powerText.c_str(), &powerEnd, 10));
+                valid = !powerText.empty() && powerEnd == powerText.c_str() + powerText.size();
+                factor = factor.substr(0, caret);
+            }
+            if (divide)
+                power = -power;
+
+            UnitDimension factorDimension;
+            const size_t index = factor == L"1" ? kNotFound : Find(factor);
+            if (valid && index != kNotFound)
+            {
+                scale *= std::pow(units[index].scale, power);
+                valid = units[index].dimension.TryScale(power, factorDimension) &&
+                        UnitDimension::TryMultiply(dimension, factorDimension, dimension);
+            }
+            else if (factor != L"1")
+                valid = false;
+
+            if (end < expression.size())
+            {
+                divide = expression[end] == L'/';
+                expression.remove_prefix(end + 1);
+                valid = valid && !expression.empty();
+            }
+            else
+                expression = std::wstring_view();
+        }
+        if (!valid || !std::isfinite(scale) || scale <= 0.0)
+        {
+            report(lineNumber, L"invalid unit expression for '" + std::wstring(symbol) + L"'");
+            continue;
+        }
+
+        if (!Add(std::wstring(symbol), scale, dimension))
+        {
+            report(lineNumber, L"'" + std::wstring(symbol) + L"' is already defined");
+            continue;
+        }
+        if (!flag.empty())
+            AddWithPrefixes(std::wstring(symbol), scale, dimension);
+    }
+    return units.size() - before;
+}
+
+size_t UnitRegistry::Find(std::wstring_view symbol) const
+{
+    const size_t mask = slots.size() - 1;
+    for (size_t slot = HashSymbol(symbol) & mask;; slot = (slot + 1) & mask)
+    {
+        const unsigned int entry = slots[slot];
+        if (entry == 0)
+            return kNotFound;
+        if (units[entry - 1].symbol == symbol)
+            return entry - 1;
+    }
+}
+
+bool UnitRegistry::Add(std::wstring symbol, double scale, const UnitDimension& dimension, bool prefixed)
+{
+    if (Find(symbol) != kNotFound)
+        return false;
+    // Keep the table at most half full so probe runs stay short.
+    if ((units.size() + 1) * 2 > slots.size())
+        Rehash(slots.size() * 2);
+
+    UnitDefinition definition;
+    definition.symbol = std::move(symbol);
+    definition.scale = scale;
+    definition.dimension = dimension;
+    definition.prefixed = prefixed;
+    units.push_back(std::move(definition));
+
+    const size_t mask = slots.size() - 1;
+    size_t slot = HashSymbol(units.back().symbol) & mask;
+    while (slots[slot] != 0)
+        slot = (slot + 1) & mask;
+    slots[slot] = static_cast<unsigned int>(units.size());
+    return true;
+}
+
+void UnitRegistry::AddWithPrefixes(const std::wstring& symbol, double scale, const UnitDimension& dimension)
+{
+    for (const SiPrefix& prefix : kSiPrefixes)
+        Add(prefix.symbol + symbol, scale * prefix.factor, dimension, true);
+}
+
+void UnitRegistry::Rehash(size_t slotCount)
+{
+    size_t size = 16;
+    while (size < slotCount)
+        size *= 2;
+    slots.assign(size, 0);
+    const size_t mask = size - 1;
+    for (size_t index = 0; index < units.size(); ++index)
+    {
+        size_t slot = HashSymbol(units[index].symbol) & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = static_cast<unsigned int>(index + 1);
+    }
+}
+
+const UnitSymbolIndex& UnitSymbolIndex::Shared()
+{
+    static const UnitSymbolIndex shared(UnitRegistry::Shared());
+    return shared;
+}
+
+UnitSymbolIndex::UnitSymbolIndex(const UnitRegistry& registry) : registry(&registry)
+{
+    std::vector<unsigned int> ranked(registry.Size());
+    for (size_t index = 0; index < ranked.size(); ++index)
+        ranked[index] = static_cast<unsigned int>(index);
+    std::stable_sort(ranked.begin(), ranked.end(), [&registry](unsigned int left, unsigned int right) {
+        const UnitDefinition& a = registry.At(left);
+        const UnitDefinition& b = registry.At(right);
+        if (a.prefixed != b.prefixed)
+            return !a.prefixed;
+        return a.symbol.size() < b.symbol.size();
+    });
+
+    // Feeding symbols in rank order leaves every node's list ranked.
+    std::vector<std::vector<unsigned int>> lists(1);
+    for (unsigned int index : ranked)
+    {
+        unsigned int node = kRoot;
+        lists[node].push_back(index);
+        for (wchar_t ch : registry.At(index).symbol)
+        {
+            const auto inserted = children.emplace(EdgeKey(node, FoldUnitChar(ch)), static_cast<unsigned int>(lists.size()));
+            if (inserted.second)
+                lists.emplace_back();
+            node = inserted.first->second;
+            lists[node].push_back(index);
+        }
+    }
+
+    nodes.resize(lists.size());
+    size_t total = 0;
+    for (const auto& list : lists)
+        total += list.size();
+    matches.reserve(total);
+    for (size_t node = 0; node < lists.size(); ++node)
+    {
+        nodes[node].matchBegin = static_cast<unsigned int>(matches.size());
+        matches.insert(matches.end(), lists[node].begin(), lists[node].end());
+        nodes[node].matchEnd = static_cast<unsigned int>(matches.size());
+    }
+}
+
+unsigned int UnitSymbolIndex::Child(unsigned int node, wchar_t ch) const
+{
+    if (node == kNoNode)
+        return kNoNode;
+    const auto it = children.find(EdgeKey(node, FoldUnitChar(ch)));
+    return it == children.end() ? kNoNode : it->second;
+}
+
+unsigned int UnitSymbolIndex::Find(std::wstring_view prefix) const
+{
+    unsigned int node = kRoot;
+    for (size_t i = 0; i < prefix.size() && node != kNoNode; ++i)
+        node = Child(node, prefix[i]);
+    return node;
+}
+
+std::vector<std::wstring> UnitSymbolMatcher::Match(std::wstring_view prefix)
+{
+    if (!index)
+        index = &UnitSymbolIndex::Shared();
+
+    // Keep the path for the part of the prefix that has not changed.
+    size_t common = 0;
+    while (common < foldedPrefix.size() && common < prefix.size() && foldedPrefix[common] == FoldUnitChar(prefix[common]))
+        ++common;
+    foldedPrefix.resize(common);
+    path.resize(common);
+    for (size_t i = common; i < prefix.size(); ++i)
+    {
+        path.push_back(index->Child(path.empty() ? UnitSymbolIndex::kRoot : path.back(), prefix[i]));
+        foldedPrefix.push_back(FoldUnitChar(prefix[i]));
+    }
+
+    std::vector<std::wstring> result;
+    const unsigned int node = path.empty() ? UnitSymbolIndex::kRoot : path.back();
+    if (node == UnitSymbolIndex::kNoNode)
+        return result;
+
+    const UnitRegistry& registry = index->Registry();
+    const unsigned int* begin = index->MatchesBegin(node);
+    const unsigned int* end = index->MatchesEnd(node);
+    result.reserve(end - begin);
+    const auto sameCase = [&registry, prefix](unsigned int unit) {
+        return registry.At(unit).symbol.compare(0, prefix.size(), prefix) == 0;
+    };
+    for (const unsigned int* it = begin; it != end; ++it)
+    {
+        if (sameCase(*it))
+            result.push_back(registry.At(*it).symbol);
+    }
+    for (const unsigned int* it = begin; it != end; ++it)
+    {
+        if (!sameCase(*it))
+            result.push_back(registry.At(*it).symbol);
+    }
+    return result;
+}
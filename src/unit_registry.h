@@ -0,0 +1,196 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Exponents of the seven SI base units as signed bytes packed into one
+// 64-bit word, length in the low byte and the top byte always zero. The
+// lanes are combined all at once (SWAR), so multiplying or dividing two
+// quantities costs one add or subtract on the word and equality is a single
+// compare. Each exponent has to fit a signed byte; the Try functions fail
+// rather than wrap.
+class UnitDimension {
+public:
+    enum Base { Length, Mass, Time, Current, Temperature, Amount, LuminousIntensity, kBaseCount };
+
+    constexpr UnitDimension() = default;
+
+    static constexpr UnitDimension Make(int length = 0, int mass = 0, int time = 0, int current = 0,
+                                        int temperature = 0, int amount = 0, int luminousIntensity = 0) {
+        UnitDimension dimension;
+        dimension.packed = Lane(length, Length) | Lane(mass, Mass) | Lane(time, Time) | Lane(current, Current) |
+                           Lane(temperature, Temperature) | Lane(amount, Amount) |
+                           Lane(luminousIntensity, LuminousIntensity);
+        return dimension;
+    }
+
+    constexpr int Exponent(Base base) const {
+        return static_cast<signed char>((packed >> (8 * base)) & 0xFF);
+    }
+
+    // The packed word; equal dimensions have equal words, so it can key a hash table.
+    constexpr unsigned long long Packed() const { return packed; }
+
+    constexpr bool IsDimensionless() const { return packed == 0; }
+    constexpr bool operator==(const UnitDimension& other) const { return packed == other.packed; }
+    constexpr bool operator!=(const UnitDimension& other) const { return packed != other.packed; }
+
+    // Dimension of a product or quotient of quantities.
+    static bool TryMultiply(const UnitDimension& left, const UnitDimension& right, UnitDimension& out) {
+        const unsigned long long sum = ((left.packed & ~kSignBits) + (right.packed & ~kSignBits)) ^
+                                       ((left.packed ^ right.packed) & kSignBits);
+        // A lane overflows when both inputs share a sign the result lacks.
+        if (~(left.packed ^ right.packed) & (left.packed ^ sum) & kSignBits)
+            return false;
+        out.packed = sum;
+        return true;
+    }
+
+    static bool TryDivide(const UnitDimension& left, const UnitDimension& right, UnitDimension& out) {
+        const unsigned long long difference = ((left.packed | kSignBits) - (right.packed & ~kSignBits)) ^
+                                              ((left.packed ^ ~right.packed) & kSignBits);
+        // A lane overflows when the inputs differ in sign and the result takes the right's.
+        if ((left.packed ^ right.packed) & (left.packed ^ difference) & kSignBits)
+            return false;
+        out.packed = difference;
+        return true;
+    }
+
+    // Dimension of a quantity raised to `power`; fails unless every exponent
+    // times `power` is an integer within range.
+    bool TryScale(double power, UnitDimension& out) const;
+
+private:
+    static constexpr unsigned long long kSignBits = 0x0080808080808080ULL;
+
+    static constexpr unsigned long long Lane(int exponent, Base base) {
+        return static_cast<unsigned long long>(static_cast<unsigned char>(static_cast<signed char>(exponent))) << (8 * base);
+    }
+
+    unsigned long long packed = 0;
+};
+
+struct UnitDefinition
+{
+    std::wstring symbol;
+    double scale = 1.0;  // size of one unit in base units
+    UnitDimension dimension;
+    bool prefixed = false;  // an SI-prefixed form of another unit
+};
+
+// Every unit the parser recognises, indexed by symbol. The built-in SI set is
+// declared once and expanded with the SI prefixes (km, ms, kPa, GHz, ...);
+// further units come from a definitions text, usually a data file read at
+// startup. Symbols resolve through an open-addressing table in constant
+// time. The shared registry is built on first use and never changes after,
+// so it is safe to read from any thread.
+//
+// Definitions text, one unit per line, '#' starting a comment:
+//
+//     symbol  factor  [unit expression]  [prefixes]
+//
+// The unit is `factor` times the expression, a product of known units with
+// optional integer powers such as "kg*m/s^2" or "ft"; no expression makes a
+// dimensionless unit. A trailing "prefixes" also defines the SI-prefixed
+// forms. A symbol that is already taken keeps its first meaning.
+class UnitRegistry
+{
+public:
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+    // The built-in units plus the text passed to Configure.
+    static const UnitRegistry& Shared();
+    // Sets extra definitions for Shared; call before anything is evaluated.
+    // Returns false once the shared registry exists.
+    static bool Configure(std::wstring definitions);
+
+    // Registry holding only the built-in units.
+    UnitRegistry();
+
+    // Adds the units in `text`; returns how many symbols were added. Lines
+    // that cannot be read are skipped and described in `problems`.
+    size_t LoadDefinitions(std::wstring_view text, std::vector<std::wstring>* problems = nullptr);
+
+    size_t Find(std::wstring_view symbol) const;
+    const UnitDefinition& At(size_t index) const { return units[index]; }
+    size_t Size() const { return units.size(); }
+
+    // Wall-clock time Shared spent building the registry, in microseconds.
+    double BuildMicroseconds() const { return buildMicroseconds; }
+    // Lines of the Configure text that were skipped, for diagnostics.
+    const std::vector<std::wstring>& Problems() const { return problems; }
+
+private:
+    bool Add(std::wstring symbol, double scale, const UnitDimension& dimension, bool prefixed = false);
+    void AddWithPrefixes(const std::wstring& symbol, double scale, const UnitDimension& dimension);
+    void Rehash(size_t slotCount);
+
+    std::vector<UnitDefinition> units;
+    std::vector<unsigned int> slots;  // unit index + 1, or 0 for an empty slot
+    double buildMicroseconds = 0.0;
+    std::vector<std::wstring> problems;
+};
+
+// Case-insensitive prefix search over the symbols of a registry, for the
+// unit suggestion popup. The lowercased symbols form a trie and every node
+// keeps the ranked list of symbols below it, so a lookup walks one edge per
+// character and hands back a ready list: O(prefix length + matches). Plain
+// units rank ahead of prefixed forms, then shorter symbols ahead of longer
+// ones, then registry order.
+class UnitSymbolIndex
+{
+public:
+    static constexpr unsigned int kRoot = 0;
+    static constexpr unsigned int kNoNode = static_cast<unsigned int>(-1);
+
+    // Index over UnitRegistry::Shared(), built on first use.
+    static const UnitSymbolIndex& Shared();
+
+    // `registry` must outlive the index.
+    explicit UnitSymbolIndex(const UnitRegistry& registry);
+
+    // Node reached from `node` by one more character, or kNoNode.
+    unsigned int Child(unsigned int node, wchar_t ch) const;
+    // Node for a whole prefix, or kNoNode when no symbol starts with it.
+    unsigned int Find(std::wstring_view prefix) const;
+
+    // Registry indices of the symbols under `node`, in rank order.
+    const unsigned int* MatchesBegin(unsigned int node) const { return matches.data() + nodes[node].matchBegin; }
+    const unsigned int* MatchesEnd(unsigned int node) const { return matches.data() + nodes[node].matchEnd; }
+    const UnitRegistry& Registry() const { return *registry; }
+
+private:
+    struct Node
+    {
+        unsigned int matchBegin = 0;
+        unsigned int matchEnd = 0;
+    };
+
+    const UnitRegistry* registry;
+    std::vector<Node> nodes;
+    std::vector<unsigned int> matches;
+    std::unordered_map<unsigned long long, unsigned int> children;  // (node, folded char) -> node
+};
+
+// Prefix lookups that remember the trie path of the previous prefix. While
+// the user types, each call reuses the shared part of the path, so one more
+// character costs a single edge and a backspace costs nothing to find.
+class UnitSymbolMatcher
+{
+public:
+    // Searches UnitSymbolIndex::Shared(), resolved on the first Match so a
+    // matcher can be a static without building the registry early.
+    UnitSymbolMatcher() = default;
+    explicit UnitSymbolMatcher(const UnitSymbolIndex& index) : index(&index) {}
+
+    // Symbols starting with `prefix` ignoring case, in rank order except that
+    // symbols matching the typed case come first.
+    std::vector<std::wstring> Match(std::wstring_view prefix);
+
+private:
+    const UnitSymbolIndex* index = nullptr;
+    std::wstring foldedPrefix;
+    std::vector<unsigned int> path;  // node after each character of foldedPrefix
+};
@@ -1,6 +1,7 @@
 #include <cmath>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "src/math_evaluator.h"
 
 namespace {
@@ -11,6 +12,12 @@ namespace {
         return std::fabs(actual - expected) <= eps;
     }
 
+    bool Check(bool condition, const std::wstring& label)
+    {
+        std::wcout << (condition ? L"[PASS] " : L"[FAIL] ") << label << std::endl;
+        return condition;
+    }
+
     bool CheckNear(MathEvaluator& eval, const std::wstring& expr, double expected, const std::wstring& label)
     {
         double actual = eval.Eval(expr);
@@ -59,7 +66,7 @@ namespace {
         const MathValue actual = eval.EvalValue(expr);
         const double scale = std::fabs(actual.displayScale) < 1e-12 ? 1.0 : actual.displayScale;
         const double displayedValue = actual.baseValue / scale;
-        const bool ok = !actual.IsError() && NearlyEqual(displayedValue, expectedDisplayValue) && actual.displayUnit == expectedDisplayUnit;
+        const bool ok = !actual.IsError() && NearlyEqual(displayedValue, expectedDisplayValue) && actual.DisplayUnitText() == expectedDisplayUnit;
 
         std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
                    << label << L" | expr=" << expr
@@ -69,30 +76,128 @@ namespace {
 
         if (actual.IsError())
         {
-            std::wcout << L" | actual error=" << actual.errorText << std::endl;
+            std::wcout << L" | actual error=" << actual.ErrorText() << std::endl;
         }
         else
         {
             std::wcout << L" | actual=" << displayedValue;
-            if (!actual.displayUnit.empty())
-                std::wcout << L" " << actual.displayUnit;
+            if (actual.HasDisplayUnit())
+                std::wcout << L" " << actual.DisplayUnitText();
             std::wcout << std::endl;
         }
 
         return ok;
     }
 
+    bool CheckCompiledMatchesEvalValue(MathEvaluator& eval,
+                                       const std::wstring& expr,
+                                       const std::wstring& varName,
+                                       double varValue)
+    {
+        const MathValue expected = eval.EvalValue(expr, varName, MathValue::Scalar(varValue));
+        const MathValue actual = CompiledExpression::Compile(expr, varName).Evaluate(MathValue::Scalar(varValue));
+        const bool ok = expected.error == actual.error &&
+                        expected.displayUnit == actual.displayUnit &&
+                        expected.dimension == actual.dimension &&
+                        (expected.IsError() || NearlyEqual(expected.baseValue, actual.baseValue));
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << L"compiled matches EvalValue | expr=" << expr
+                   << L" | " << varName << L"=" << varValue
+                   << L" | expected=" << (expected.IsError() ? expected.ErrorText() : std::to_wstring(expected.baseValue))
+                   << L" | actual=" << (actual.IsError() ? actual.ErrorText() : std::to_wstring(actual.baseValue)) << std::endl;
+        return ok;
+    }
+
+    bool CheckBatchMatchesEvalValue(MathEvaluator& eval, const std::wstring& expr, const std::wstring& varName)
+    {
+        std::vector<double> points;
+        for (int i = 0; i < 37; ++i)
+            points.push_back(0.25 + i * 0.125);
+        std::vector<double> samples(points.size());
+        MathValue unitSample;
+        bool ok = eval.EvalBatch(expr, varName, points.data(), samples.data(), points.size(), &unitSample);
+        for (size_t i = 0; ok && i < points.size(); ++i)
+        {
+            const MathValue expected = eval.EvalValue(expr, varName, MathValue::Scalar(points[i]));
+            ok = !expected.IsError() && NearlyEqual(expected.baseValue, samples[i], 1e-9) &&
+                 expected.displayUnit == unitSample.displayUnit;
+        }
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << L"batch matches EvalValue | expr=" << expr << std::endl;
+        return ok;
+    }
+
+    bool CheckBatchFallsBack(MathEvaluator& eval, const std::wstring& expr, const std::wstring& varName, double badValue)
+    {
+        const double points[] = { 1.0, 2.0, badValue, 3.0, 4.0 };
+        double samples[5] = {};
+        const bool ok = !eval.EvalBatch(expr, varName, points, samples, 5);
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << L"batch defers to scalar path | expr=" << expr
+                   << L" | " << varName << L"=" << badValue << std::endl;
+        return ok;
+    }
+
+    bool CheckMatrix(MathEvaluator& eval,
+                     const std::wstring& expr,
+                     const std::vector<std::vector<double>>& expected,
+                     const std::wstring& label)
+    {
+        const MatrixValue actual = eval.EvalMatrix(expr);
+        bool ok = !actual.IsError() && actual.matrix.Rows() == expected.size() &&
+                  actual.matrix.Columns() == expected[0].size();
+        for (size_t row = 0; ok && row < expected.size(); ++row)
+        {
+            for (size_t column = 0; ok && column < expected[row].size(); ++column)
+                ok = NearlyEqual(actual.matrix(row, column), expected[row][column]);
+        }
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << label << L" | expr=" << expr
+                   << L" | actual=" << (actual.IsError() ? actual.ErrorText() : std::to_wstring(actual.matrix.Rows()) + L"x" + std::to_wstring(actual.matrix.Columns()))
+                   << std::endl;
+        return ok;
+    }
+
+    bool CheckMatrixError(MathEvaluator& eval, const std::wstring& expr, const std::wstring& expectedError, const std::wstring& label)
+    {
+        const MatrixValue actual = eval.EvalMatrix(expr);
+        const bool ok = actual.IsError() && actual.ErrorText() == expectedError;
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << label << L" | expr=" << expr
+                   << L" | expected error=" << expectedError
+                   << L" | actual=" << (actual.IsError() ? actual.ErrorText() : L"<matrix>") << std::endl;
+        return ok;
+    }
+
+    bool CheckDual(MathEvaluator& eval,
+                   const std::wstring& expr,
+                   double at,
+                   double expectedValue,
+                   double expectedDerivative,
+                   const std::wstring& label)
+    {
+        const DualNumber actual = eval.EvalDual(expr, L"x", at);
+        const bool ok = !actual.IsError() && NearlyEqual(actual.value, expectedValue) &&
+                        NearlyEqual(actual.derivative, expectedDerivative);
+        std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
+                   << label << L" | expr=" << expr << L" | x=" << at
+                   << L" | expected=" << expectedValue << L", " << expectedDerivative
+                   << L" | actual=" << (actual.IsError() ? actual.ErrorText() : std::to_wstring(actual.value) + L", " + std::to_wstring(actual.derivative))
+                   << std::endl;
+        return ok;
+    }
+
     bool CheckValueError(MathEvaluator& eval,
                          const std::wstring& expr,
                          const std::wstring& expectedError,
                          const std::wstring& label)
     {
         const MathValue actual = eval.EvalValue(expr);
-        const bool ok = actual.IsError() && actual.errorText == expectedError;
+        const bool ok = actual.IsError() && actual.ErrorText() == expectedError;
         std::wcout << (ok ? L"[PASS] " : L"[FAIL] ")
                    << label << L" | expr=" << expr
                    << L" | expected error=" << expectedError
-                   << L" | actual=" << (actual.IsError() ? actual.errorText : L"<value>") << std::endl;
+                   << L" | actual=" << (actual.IsError() ? actual.ErrorText() : L"<value>") << std::endl;
         return ok;
     }
 }
@@ -142,7 +247,142 @@ int main()
     run(CheckValue(eval, L"sqrt(9m^2)", 3.0, L"m", L"square root reduces even unit exponents"));
     run(CheckValueError(eval, L"3m + 2s", L"incompatible units", L"incompatible unit addition surfaces explicit error"));
     run(CheckValueError(eval, L"sqrt(9m)", L"invalid unit exponent", L"invalid unit exponent is rejected"));
+
+    const MathValue newtons = eval.EvalValue(L"3 N");
+    const MathValue derivedNewtons = eval.EvalValue(L"5kg * 2m / s^2");
+    const MathValue derivedSpeed = eval.EvalValue(L"4m / s");
+    run(Check(newtons.displayUnit == derivedNewtons.displayUnit, L"display units share interned ids"));
+    run(Check(derivedSpeed.displayUnit == InternUnitSymbol(L"m/s"), L"derived display units intern once"));
+    run(Check(UnitSymbolText(derivedSpeed.displayUnit) == L"m/s", L"interned ids map back to their text"));
+    run(Check(UnitSymbolText(kNoUnitSymbol).empty(), L"no-unit id has empty text"));
+
+    static_assert(UnitDimension::Make(1, 1, -2).Exponent(UnitDimension::Time) == -2, "packed exponents are constexpr");
+    UnitDimension quotient;
+    UnitDimension overflow;
+    run(Check(UnitDimension::TryDivide(UnitDimension::Make(1, -2, 3), UnitDimension::Make(-1, 2, 5), quotient) &&
+              quotient == UnitDimension::Make(2, -4, -2),
+              L"packed dimensions divide lane by lane"));
+    run(Check(UnitDimension::TryMultiply(quotient, UnitDimension::Make(-2, 4, 2), quotient) && quotient.IsDimensionless(),
+              L"packed dimensions multiply lane by lane"));
+    run(Check(!UnitDimension::TryMultiply(UnitDimension::Make(100), UnitDimension::Make(100), overflow),
+              L"packed multiply rejects exponent overflow"));
+    run(Check(!UnitDimension::TryDivide(UnitDimension::Make(0, -100), UnitDimension::Make(0, 100), overflow),
+              L"packed divide rejects exponent overflow"));
+    run(CheckValueError(eval, L"m^100 * m^100", L"invalid unit exponent", L"unit exponent overflow is rejected"));
     run(CheckValueError(eval, L"log(10m)", L"log requires abstract number", L"logarithm rejects dimensional quantities"));
+    run(CheckValue(eval, L"5kPa + 1hPa", 5.1, L"kPa", L"prefixed registry units evaluate"));
+    run(CheckValue(eval, L"250mA * 4 + 1A", 2000.0, L"mA", L"milli prefix scales base units"));
+
+    UnitRegistry customUnits;
+    std::vector<std::wstring> unitProblems;
+    const size_t kilogram = customUnits.Find(L"kg");
+    const size_t customAdded = customUnits.LoadDefinitions(L"ft 0.3048 m\n"
+                                                           L"bar 100000 Pa prefixes  # pressure\n"
+                                                           L"psi 1 lbf/in^2\n"
+                                                           L"m 2\n"
+                                                           L"9x 1\n",
+                                                           &unitProblems);
+    const size_t millibar = customUnits.Find(L"mbar");
+    run(Check(kilogram != UnitRegistry::kNotFound && customUnits.At(kilogram).scale == 1.0, L"unit registry seeds the SI base units"));
+    run(Check(customAdded == 2 + 25, L"unit registry adds definitions and their prefixed forms"));
+    run(Check(unitProblems.size() == 3, L"unit registry reports bad lines"));
+    run(Check(millibar != UnitRegistry::kNotFound && NearlyEqual(customUnits.At(millibar).scale, 100.0, 1e-9),
+              L"unit registry scales prefixed definitions"));
+    run(Check(millibar != UnitRegistry::kNotFound &&
+              customUnits.At(millibar).dimension == customUnits.At(customUnits.Find(L"Pa")).dimension,
+              L"prefixed definitions keep their dimension"));
+
+    UnitSymbolIndex customIndex(customUnits);
+    UnitSymbolMatcher typing(customIndex);
+    const std::vector<std::wstring> afterM = typing.Match(L"M");
+    const std::vector<std::wstring> afterMi = typing.Match(L"mi");
+    const std::vector<std::wstring> afterMiz = typing.Match(L"miz");
+    const std::vector<std::wstring> backToM = typing.Match(L"m");
+    run(Check(afterM.size() == backToM.size(), L"unit suggestions match case-insensitively"));
+    run(Check(!afterM.empty() && afterM[0] == L"Mm", L"unit suggestions list same-case matches first"));
+    run(Check(backToM.size() >= 3 && backToM[0] == L"m" && backToM[1] == L"min" && backToM[2] == L"mol",
+              L"unit suggestions rank plain units before prefixed ones"));
+    run(Check(afterMi == std::vector<std::wstring>{ L"min" }, L"unit suggestions narrow as the prefix grows"));
+    run(Check(afterMiz.empty(), L"unknown unit prefix has no suggestions"));
+    run(Check(FindMatchingUnitSymbols(L"KPA") == std::vector<std::wstring>{ L"kPa" }, L"unit lookup folds case"));
+
+    const wchar_t* compiledCorpus[] = {
+        L"i^2", L"3i+1", L"2^i", L"1/i", L"i m + 2cm", L"sqrt(i m^2)", L"log_{2}(i)", L"ln(i)",
+        L"-i^2", L"sin(i)/i", L"(i+1", L"log_i(8)", L"foo(i)", L"i + 2s", L"{i}(i-1)", L"i)", L"exp(i m)",
+    };
+    for (const wchar_t* expr : compiledCorpus)
+    {
+        run(CheckCompiledMatchesEvalValue(eval, expr, L"i", 0.0));
+        run(CheckCompiledMatchesEvalValue(eval, expr, L"i", 4.0));
+    }
+
+    const wchar_t* batchCorpus[] = {
+        L"x^2 + 3x - 1", L"sin(x)*cos(x) + tan(x/4)", L"sqrt(x) + abs(x-2) + exp(-x)", L"log_{2}(x) + ln(x)",
+        L"asin(x/10) + acos(x/10) + atan(x)", L"1/(x+1)", L"-x^3 / 2", L"x m + 2cm", L"x kg * 2m / s^2",
+    };
+    for (const wchar_t* expr : batchCorpus)
+        run(CheckBatchMatchesEvalValue(eval, expr, L"x"));
+    run(CheckBatchFallsBack(eval, L"1/x", L"x", 0.0));
+    run(CheckBatchFallsBack(eval, L"sqrt(x)", L"x", -1.0));
+    run(CheckBatchFallsBack(eval, L"(1/(x-2))^0", L"x", 2.0));
+    run(CheckBatchFallsBack(eval, L"m^x", L"x", 2.0));
+
+    run(Check(CompiledExpression::Compile(L"2*.").Evaluate().error == MathError::InvalidExpression,
+              L"compiled lone '.' stops the parse"));
+
+    run(CheckMatrix(eval, L"[1, 2; 3, 4] * [5, 6; 7, 8]", { { 19, 22 }, { 43, 50 } }, L"matrix product"));
+    run(CheckMatrix(eval, L"2[1, 2; 3, 4] - [1, 1; 1, 1]/2", { { 1.5, 3.5 }, { 5.5, 7.5 } }, L"matrix scaling and difference"));
+    run(CheckMatrix(eval, L"[1, 2, 3]^T", { { 1 }, { 2 }, { 3 } }, L"matrix transpose"));
+    run(CheckMatrix(eval, L"[1, 1; 1, 0]^10", { { 89, 55 }, { 55, 34 } }, L"matrix integer power"));
+    run(CheckMatrix(eval, L"[2, 1; 1, 1]^-1", { { 1, -1 }, { -1, 2 } }, L"matrix inverse power"));
+    run(CheckMatrix(eval, L"[1, 2; 3, 4] / [1, 2; 3, 4]", { { 1, 0 }, { 0, 1 } }, L"matrix division inverts the divisor"));
+    run(CheckMatrixError(eval, L"[1, 2] * [3, 4]", L"incompatible matrix sizes", L"matrix product checks shapes"));
+    run(CheckMatrixError(eval, L"[1, 2; 2, 4]^-1", L"singular matrix", L"singular matrix has no inverse"));
+    run(CheckMatrixError(eval, L"[1, 2; 3]", L"invalid matrix", L"ragged matrix literal is rejected"));
+
+    run(CheckDual(eval, L"x^3 - 2x", 2.0, 4.0, 10.0, L"dual polynomial derivative"));
+    run(CheckDual(eval, L"sin(x)*exp(x)", 0.0, 0.0, 1.0, L"dual product and chain rule"));
+    run(CheckDual(eval, L"x^x", 2.0, 4.0, 4.0 * (std::log(2.0) + 1.0), L"dual variable exponent"));
+    run(CheckDual(eval, L"sqrt(x)/(1+x)", 4.0, 0.4, 0.25 / 5.0 - 2.0 / 25.0, L"dual quotient"));
+    const DualNumber dualUnit = eval.EvalDual(L"x m", L"x", 1.0);
+    run(Check(dualUnit.IsError() && dualUnit.error == MathError::DerivativeRequiresAbstractNumbers,
+              L"dual evaluation rejects units"));
+
+    const IntervalValue decimalBounds = eval.EvalInterval(L"0.1 + 0.2");
+    run(Check(!decimalBounds.IsError(), L"interval of inexact decimals evaluates"));
+    run(Check(decimalBounds.lower < 0.3 && decimalBounds.upper > 0.3, L"interval encloses inexact decimals"));
+    const IntervalValue sineBounds = eval.EvalInterval(L"sin(x)", L"x", 0.0, 3.0);
+    run(Check(!sineBounds.IsError(), L"interval sine evaluates"));
+    run(Check(sineBounds.upper == 1.0, L"interval sine includes the interior peak"));
+    run(Check(sineBounds.lower <= 0.0 && sineBounds.lower > -1e-9, L"interval sine lower bound stays tight at zero"));
+    const IntervalValue squareBounds = eval.EvalInterval(L"(x m)^2", L"x", -1.0, 2.0);
+    run(Check(!squareBounds.IsError(), L"interval even power evaluates"));
+    run(Check(squareBounds.lower == 0.0, L"interval even power folds at zero"));
+    run(Check(squareBounds.Contains(4.0) && squareBounds.upper < 4.0 + 1e-12, L"interval even power upper bound is tight"));
+    run(Check(squareBounds.dimension.Exponent(UnitDimension::Length) == 2, L"interval even power keeps units"));
+    const IntervalValue unitMismatch = eval.EvalInterval(L"2 m + 3 s");
+    run(Check(unitMismatch.IsError() && unitMismatch.error == MathError::IncompatibleUnits, L"interval addition checks units"));
+
+    EvaluationContext context;
+    context.Set(context.Bind(L"x"), 2.0);
+    context.Set(context.Bind(L"y"), 3.0);
+    context.Set(context.Bind(L"m"), 4.0);
+    const MathValue contextValue = eval.EvalValue(L"x*y + 2m", context);
+    run(Check(!contextValue.IsError() && contextValue.IsDimensionless(), L"context bindings shadow unit symbols"));
+    run(Check(NearlyEqual(contextValue.baseValue, 14.0, 1e-12), L"context bindings supply their values"));
+    const CompiledExpression nestedBody = CompiledExpression::Compile(L"x*y", context);
+    double nestedSum = 0.0;
+    for (int i = 1; i <= 3; ++i)
+    {
+        context.Set(0, i);
+        for (int j = 1; j <= 4; ++j)
+        {
+            context.Set(1, j);
+            nestedSum += nestedBody.Evaluate(context).baseValue;
+        }
+    }
+    run(Check(nestedSum == 60.0, L"one program serves a nested iteration"));
+    run(Check(nestedBody.Evaluate().IsError(), L"context program without its context reports an error"));
 
     run(CheckZero(eval, L"unknown(5)", L"unknown function -> 0"));
     run(CheckZero(eval, L")", L"bad token -> 0"));
@@ -1,10 +1,16 @@
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "src/math_manager.h"
 #include "src/math_types.h"
 #include "src/math_evaluator.h"
+#include "src/linear_algebra.h"
+#include "src/task_pool.h"
+#include "src/evaluation_service.h"
 
 namespace {
     constexpr double kEps = 1e-6;
@@ -239,6 +245,615 @@ int main()
     run(Check(MathManager::Get().CalculateFormattedResult(unitLogObj) == L" \uFF1D log requires abstract number",
               L"logarithm rejects dimensional arguments with explicit result text"));
 
+    run(Check(MathManager::Get().CalculateFormattedResult(sqrtObj) == L" \uFF1D 3.605551",
+              L"square root object evaluates nested fraction from nodes"));
+    run(Check(MathManager::Get().CalculateFormattedResult(absObj) == L" \uFF1D 11",
+              L"absolute value object evaluates nested power from nodes"));
+    const MathValue nestedRadicand = CompiledExpression::CompileSlot(sqrtObj.slots[0]).Evaluate();
+    run(CheckNear(nestedRadicand.baseValue, eval.EvalValue(sqrtObj.SlotText(1)).baseValue,
+                  L"structured slot matches flattened text"));
+
+    MathObject structuredSumObj;
+    structuredSumObj.type = MathType::Summation;
+    structuredSumObj.SetParts(L"4", L"i=1", L"");
+    structuredSumObj.EnsureStructuredEditLeaf(3);
+    structuredSumObj.EditableLeafText(3) = L"i\\frac";
+    std::vector<size_t> sumFractionPath;
+    run(Check(structuredSumObj.InsertNestedNode(3, {}, L"\\frac", MathNodeKind::Fraction, sumFractionPath, 0),
+              L"insert nested fraction into summation body"));
+    structuredSumObj.EditableLeafText(3, &sumFractionPath) = L"i";
+    std::vector<size_t> sumDenominatorPath = sumFractionPath;
+    run(Check(structuredSumObj.MoveToSiblingSlot(3, sumDenominatorPath, 1), L"move summation fraction to denominator"));
+    structuredSumObj.EditableLeafText(3, &sumDenominatorPath) = L"2";
+    structuredSumObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(structuredSumObj) == L" \uFF1D 15",
+              L"summation binds its variable inside nested nodes"));
+
+    MathObject functionOfNodeObj;
+    functionOfNodeObj.type = MathType::Sum;
+    functionOfNodeObj.SetParts();
+    functionOfNodeObj.EnsureStructuredEditLeaf(1);
+    functionOfNodeObj.EditableLeafText(1) = L"cos\\frac";
+    std::vector<size_t> cosFractionPath;
+    run(Check(functionOfNodeObj.InsertNestedNode(1, {}, L"\\frac", MathNodeKind::Fraction, cosFractionPath, 0),
+              L"insert fraction after function name"));
+    functionOfNodeObj.EditableLeafText(1, &cosFractionPath) = L"0";
+    std::vector<size_t> cosDenominatorPath = cosFractionPath;
+    run(Check(functionOfNodeObj.MoveToSiblingSlot(1, cosDenominatorPath, 1), L"move cos fraction to denominator"));
+    functionOfNodeObj.EditableLeafText(1, &cosDenominatorPath) = L"3";
+    functionOfNodeObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(functionOfNodeObj) == L" \uFF1D 1",
+              L"nested node is a function argument"));
+
+    MathObject nestedSumObj;
+    nestedSumObj.type = MathType::Summation;
+    nestedSumObj.SetParts(L"3", L"i=1", L"");
+    nestedSumObj.EnsureStructuredEditLeaf(3);
+    nestedSumObj.EditableLeafText(3) = L"\\sum";
+    std::vector<size_t> innerLowerPath;
+    run(Check(nestedSumObj.InsertNestedNode(3, {}, L"\\sum", MathNodeKind::Summation, innerLowerPath, 0),
+              L"insert nested summation into summation body"));
+    nestedSumObj.EditableLeafText(3, &innerLowerPath) = L"j=1";
+    std::vector<size_t> innerUpperPath = innerLowerPath;
+    run(Check(nestedSumObj.MoveToSiblingSlot(3, innerUpperPath, 1), L"move nested summation to upper limit"));
+    nestedSumObj.EditableLeafText(3, &innerUpperPath) = L"i";
+    std::vector<size_t> innerBodyPath = innerUpperPath;
+    run(Check(nestedSumObj.MoveToSiblingSlot(3, innerBodyPath, 1), L"move nested summation to body"));
+    nestedSumObj.EditableLeafText(3, &innerBodyPath) = L"j";
+    nestedSumObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(nestedSumObj) == L" \uFF1D 10",
+              L"nested summation reads the outer index as its upper limit"));
+
+    const std::wstring serializedNestedSum = nestedSumObj.SerializeTransferPayload();
+    MathObject deserializedNestedSum;
+    run(Check(MathObject::TryDeserializeTransferPayload(serializedNestedSum, deserializedNestedSum),
+              L"deserialize nested summation payload"));
+    run(Check(MathManager::Get().CalculateFormattedResult(deserializedNestedSum) == L" \uFF1D 10",
+              L"nested summation survives a transfer round trip"));
+
+    MathObject shadowedSumObj = nestedSumObj;
+    shadowedSumObj.EditableLeafText(3, &innerLowerPath) = L"i=1";
+    shadowedSumObj.EditableLeafText(3, &innerUpperPath) = L"3";
+    shadowedSumObj.EditableLeafText(3, &innerBodyPath) = L"i";
+    shadowedSumObj.SetPartText(1, L"2");
+    shadowedSumObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(shadowedSumObj) == L" \uFF1D 12",
+              L"nested summation index shadows the outer one"));
+
+    MathObject badLimitSumObj = nestedSumObj;
+    badLimitSumObj.EditableLeafText(3, &innerLowerPath) = L"j";
+    badLimitSumObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(badLimitSumObj) == L" \uFF1D invalid limits",
+              L"nested summation without an index is rejected"));
+
+    MathObject nestedProductObj;
+    nestedProductObj.type = MathType::Sum;
+    nestedProductObj.SetParts();
+    nestedProductObj.EnsureStructuredEditLeaf(1);
+    nestedProductObj.EditableLeafText(1) = L"2\\prod";
+    std::vector<size_t> productLowerPath;
+    run(Check(nestedProductObj.InsertNestedNode(1, {}, L"\\prod", MathNodeKind::Product, productLowerPath, 0),
+              L"insert nested product into expression"));
+    nestedProductObj.EditableLeafText(1, &productLowerPath) = L"k=1";
+    std::vector<size_t> productUpperPath = productLowerPath;
+    run(Check(nestedProductObj.MoveToSiblingSlot(1, productUpperPath, 1), L"move nested product to upper limit"));
+    nestedProductObj.EditableLeafText(1, &productUpperPath) = L"4";
+    std::vector<size_t> productBodyPath = productUpperPath;
+    run(Check(nestedProductObj.MoveToSiblingSlot(1, productBodyPath, 1), L"move nested product to body"));
+    nestedProductObj.EditableLeafText(1, &productBodyPath) = L"k";
+    nestedProductObj.SyncLegacyFromSlots();
+    run(Check(MathManager::Get().CalculateFormattedResult(nestedProductObj) == L" \uFF1D 48",
+              L"nested product multiplies its terms"));
+    run(Check(MathManager::RunsInBackground(nestedProductObj) && !MathManager::RunsInBackground(fallbackFractionObj),
+              L"objects with a nested loop calculate in the background"));
+
+    MathObject closedInnerSumObj = nestedSumObj;
+    closedInnerSumObj.EditableLeafText(3, &innerUpperPath) = L"1000000000";
+    closedInnerSumObj.SyncLegacyFromSlots();
+    const MathValue closedInnerSum = MathManager::Get().CalculateValueResult(closedInnerSumObj);
+    run(Check(!closedInnerSum.IsError() && std::fabs(closedInnerSum.baseValue / 1.5000000015e18 - 1.0) < 1e-15,
+              L"nested summation takes the closed form"));
+
+    MathObject harmonicInnerSumObj = nestedSumObj;
+    harmonicInnerSumObj.SetPartText(1, L"1");
+    harmonicInnerSumObj.EditableLeafText(3, &innerUpperPath) = L"1000000";
+    harmonicInnerSumObj.EditableLeafText(3, &innerBodyPath) = L"1/j";
+    harmonicInnerSumObj.SyncLegacyFromSlots();
+    run(Check(std::fabs(MathManager::Get().CalculateValueResult(harmonicInnerSumObj).baseValue - 14.392726722865723) < 1e-12,
+              L"nested summation compensates rounding"));
+
+    MathObject cancelledInnerSumObj = nestedSumObj;
+    cancelledInnerSumObj.EditableLeafText(3, &innerUpperPath) = L"1000000000";
+    cancelledInnerSumObj.EditableLeafText(3, &innerBodyPath) = L"sin(j)";
+    cancelledInnerSumObj.SyncLegacyFromSlots();
+    EvaluationControl cancelledInnerControl;
+    cancelledInnerControl.token.Cancel();
+    run(Check(MathManager::Get().CalculateValueResult(cancelledInnerSumObj, &cancelledInnerControl).error == MathError::Cancelled,
+              L"nested summation stops when cancelled"));
+
+    MathObject sumIntegralObj;
+    sumIntegralObj.type = MathType::Integral;
+    sumIntegralObj.SetParts(L"1", L"0", L"");
+    sumIntegralObj.EnsureStructuredEditLeaf(3);
+    sumIntegralObj.EditableLeafText(3) = L"\\sum";
+    std::vector<size_t> integrandLowerPath;
+    run(Check(sumIntegralObj.InsertNestedNode(3, {}, L"\\sum", MathNodeKind::Summation, integrandLowerPath, 0),
+              L"insert nested summation into integrand"));
+    sumIntegralObj.EditableLeafText(3, &integrandLowerPath) = L"j=1";
+    std::vector<size_t> integrandUpperPath = integrandLowerPath;
+    run(Check(sumIntegralObj.MoveToSiblingSlot(3, integrandUpperPath, 1), L"move integrand summation to upper limit"));
+    sumIntegralObj.EditableLeafText(3, &integrandUpperPath) = L"2";
+    std::vector<size_t> integrandBodyPath = integrandUpperPath;
+    run(Check(sumIntegralObj.MoveToSiblingSlot(3, integrandBodyPath, 1), L"move integrand summation to body"));
+    sumIntegralObj.EditableLeafText(3, &integrandBodyPath) = L"x^j";
+    const std::vector<size_t> integrandTailPath = { integrandLowerPath[0] + 1 };
+    sumIntegralObj.EditableLeafText(3, &integrandTailPath) = L" dx";
+    sumIntegralObj.SyncLegacyFromSlots();
+    const MathValue sumIntegral = MathManager::Get().CalculateIntegralResult(sumIntegralObj);
+    run(CheckNear(sumIntegral.baseValue, 5.0 / 6.0, L"integral of nested summation in the variable"));
+
+    MathObject polynomialIntegralObj;
+    polynomialIntegralObj.type = MathType::Integral;
+    polynomialIntegralObj.SetParts(L"1", L"0", L"x^2 dx");
+    QuadratureReport polynomialReport;
+    const MathValue polynomialIntegral = MathManager::Get().CalculateIntegralResult(polynomialIntegralObj, QuadratureOptions(), &polynomialReport);
+    run(CheckNear(polynomialIntegral.baseValue, 1.0 / 3.0, L"adaptive integral of polynomial"));
+    run(Check(polynomialReport.converged && polynomialReport.evaluations == 15 && polynomialReport.errorEstimate < 1e-10,
+              L"smooth integrand converges on a single Kronrod panel"));
+
+    MathObject unitIntegralObj;
+    unitIntegralObj.type = MathType::Integral;
+    unitIntegralObj.SetParts(L"2", L"0", L"t m dt");
+    run(Check(MathManager::Get().CalculateFormattedResult(unitIntegralObj) == L" \uFF1D 2 m",
+              L"integral keeps the integrand unit"));
+
+    MathObject oscillatingIntegralObj;
+    oscillatingIntegralObj.type = MathType::Integral;
+    oscillatingIntegralObj.SetParts(L"10", L"0", L"sin(x^2) dx");
+    QuadratureReport oscillatingReport;
+    const MathValue oscillatingIntegral = MathManager::Get().CalculateIntegralResult(oscillatingIntegralObj, QuadratureOptions(), &oscillatingReport);
+    run(CheckNear(oscillatingIntegral.baseValue, 0.5836708999, L"adaptive integral of oscillating integrand"));
+    QuadratureOptions tightBudget;
+    tightBudget.maxEvaluations = 45;
+    QuadratureReport budgetReport;
+    MathManager::Get().CalculateIntegralResult(oscillatingIntegralObj, tightBudget, &budgetReport);
+    run(Check(!budgetReport.converged && budgetReport.evaluations <= 45 && budgetReport.errorEstimate > 1e-6,
+              L"exhausted budget reports its error estimate"));
+
+    ExpressionTokenCache tokenCache;
+    const std::vector<ExpressionToken>& firstTokens = tokenCache.Lookup(L"2x + sin(1)");
+    const std::vector<ExpressionToken>& secondTokens = tokenCache.Lookup(L"2x + sin(1)");
+    run(Check(&firstTokens == &secondTokens && firstTokens.size() == 7 && tokenCache.Size() == 1,
+              L"token cache lexes a leaf run once"));
+
+    std::vector<int> visits(100003, 0);
+    TaskPool::Shared().ParallelFor(visits.size(), 1000, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index)
+            ++visits[index];
+    });
+    run(Check(std::count(visits.begin(), visits.end(), 1) == static_cast<long>(visits.size()),
+              L"task pool visits every index once"));
+
+    MathObject largeSumObj;
+    largeSumObj.type = MathType::Summation;
+    largeSumObj.SetParts(L"2000000", L"i=1", L"abs(i)");
+    run(Check(MathManager::Get().CalculateFormattedResult(largeSumObj) == L" \uFF1D 2000001000000",
+              L"parallel summation over two million terms"));
+
+    MathObject compensatedSumObj;
+    compensatedSumObj.type = MathType::Summation;
+    compensatedSumObj.SetParts(L"1000000", L"i=1", L"1/i");
+    run(Check(std::fabs(MathManager::Get().CalculateValueResult(compensatedSumObj).baseValue - 14.392726722865723) < 1e-13,
+              L"compensated summation keeps low-order bits"));
+
+    MathObject repeatedUnitSumObj;
+    repeatedUnitSumObj.type = MathType::Summation;
+    repeatedUnitSumObj.SetParts(L"10000", L"i=1", L"sin(i) cm");
+    const MathValue repeatedUnitSum = MathManager::Get().CalculateValueResult(repeatedUnitSumObj);
+    const double sineSum = std::sin(5000.0) * std::sin(5000.5) / std::sin(0.5);
+    run(Check(std::fabs(repeatedUnitSum.baseValue - 0.01 * sineSum) < 1e-13 && repeatedUnitSum.DisplayUnitText() == L"cm",
+              L"parallel summation keeps the term unit"));
+
+    MathObject faulhaberSumObj;
+    faulhaberSumObj.type = MathType::Summation;
+    faulhaberSumObj.SetParts(L"1000000000000", L"i=1", L"i^2");
+    run(Check(MathManager::Get().CalculateFormattedResult(faulhaberSumObj) == L" \uFF1D 3.33333333333833e+35",
+              L"polynomial summation uses the closed form"));
+
+    MathObject exactSumObj;
+    exactSumObj.type = MathType::Summation;
+    exactSumObj.SetParts(L"1000000", L"i=1", L"0.1 i");
+    run(Check(MathManager::Get().CalculateValueResult(exactSumObj).baseValue == 50000050000.0,
+              L"closed-form summation is exact for rational coefficients"));
+
+    MathObject geometricSumObj;
+    geometricSumObj.type = MathType::Summation;
+    geometricSumObj.SetParts(L"10", L"i=0", L"3*2^i + 1/2^i");
+    run(CheckNear(MathManager::Get().CalculateValueResult(geometricSumObj).baseValue, 6141.0 + 2047.0 / 1024.0,
+                  L"geometric summation uses the closed form"));
+
+    MathObject wideSystemObj;
+    wideSystemObj.type = MathType::SystemOfEquations;
+    wideSystemObj.SetParts(L"12345679x+98765431y+55555557z=1", L"76543211x+24681357y+13579247z=2",
+                           L"97531357x+86419753y+11111117z=3");
+    run(Check(MathManager::Get().CalculateSystemResult(wideSystemObj) ==
+                  L" \uFF1D x=3209024861600295/134731317289044342939526, y=1082859873423061/134731317289044342939526, "
+                  L"z=-106518558229255/67365658644522171469763",
+              L"exact system results outgrow 64-bit fractions"));
+
+    MathObject parametricSystemObj;
+    parametricSystemObj.type = MathType::SystemOfEquations;
+    parametricSystemObj.SetParts(L"x+y+z=6", L"x-y=2", L"");
+    run(Check(MathManager::Get().CalculateSystemResult(parametricSystemObj) ==
+                  L" \uFF1D x=4-(1/2)z, y=2-(1/2)z, z free",
+              L"rank-deficient systems report a parametric solution"));
+
+    std::vector<std::wstring> namedEquations;
+    const size_t namedCount = 12;
+    for (size_t row = 0; row < namedCount; ++row)
+    {
+        std::wstring equation;
+        long long rightSide = 0;
+        for (size_t col = 0; col < namedCount; ++col)
+        {
+            const long long coefficient = static_cast<long long>((row * 7 + col * 3) % 11) + (row == col ? 20 : 0);
+            rightSide += coefficient * static_cast<long long>(col + 1);
+            equation += (col == 0 ? L"" : L"+") + std::to_wstring(coefficient) + L"rate_" + std::to_wstring(col);
+        }
+        namedEquations.push_back(equation + L"=" + std::to_wstring(rightSide));
+    }
+    const LinearSystemSolution namedSolution = MathEvaluator().SolveLinearSystemRational(namedEquations);
+    bool namedSolved = namedSolution.status == 0 && namedSolution.variables.size() == namedCount;
+    for (size_t col = 0; namedSolved && col < namedCount; ++col)
+    {
+        const std::wstring& name = namedSolution.variables[col];
+        namedSolved = namedSolution.constants[col] == Rational(std::stoll(name.substr(5)) + 1);
+    }
+    run(Check(namedSolved, L"linear systems accept any number of named variables"));
+
+    const LinearSystemSolution bothSidesSolution = MathEvaluator().SolveLinearSystemRational({L"2x = x + 3"});
+    run(Check(bothSidesSolution.status == 0 && bothSidesSolution.constants[0] == Rational(3),
+              L"linear equations collect unknowns from both sides"));
+
+    const LinearSystemSolution movedSolution = MathEvaluator().SolveLinearSystemRational({L"x = y + 1", L"x + y = 5"});
+    run(Check(movedSolution.status == 0 && movedSolution.variables == std::vector<std::wstring>{L"x", L"y"} &&
+                  movedSolution.constants[0] == Rational(3) && movedSolution.constants[1] == Rational(2),
+              L"unknowns on the right-hand side move to the left"));
+
+    const LinearSystemSolution groupedSolution = MathEvaluator().SolveLinearSystemRational({L"(x+1)*2 = 6"});
+    run(Check(groupedSolution.status == 0 && groupedSolution.constants[0] == Rational(2),
+              L"parentheses group linear terms"));
+
+    const LinearSystemSolution constantSolution = MathEvaluator().SolveLinearSystemRational({L"pi x + 2e = 4"});
+    run(Check(constantSolution.status == 0 && constantSolution.variables == std::vector<std::wstring>{L"x"},
+              L"constants are never taken for unknowns"));
+
+    bool nonlinearRejected = true;
+    for (const wchar_t* equation : {L"3/x = 1", L"1/(x-1) = 2", L"x*y = 2", L"2^x = 4", L"sin(x) = 0", L"2 cm = x", L"x + = 1"})
+        nonlinearRejected = nonlinearRejected && MathEvaluator().SolveLinearSystemRational({equation}).status == -4;
+    run(Check(nonlinearRejected, L"non-linear equations are parse errors, not wrong answers"));
+
+    const std::map<std::wstring, Rational> statusSolution =
+        MathEvaluator().SolveSystemOfEquationsRational({L"x + status = 3", L"x - status = 1"});
+    run(Check(statusSolution.size() == 1 && statusSolution.at(L"status") == Rational(-4),
+              L"a variable named status cannot shadow the solver status"));
+
+    Rational powerOfTwo;
+    run(Check(Rational(2).TryPow(100, powerOfTwo) && powerOfTwo.toString() == L"1267650600228229401496703205376" &&
+                  (powerOfTwo / Rational(2)).toDouble() == std::ldexp(1.0, 99),
+              L"rational powers promote past 64 bits"));
+
+    MathObject rowDeterminantObj;
+    rowDeterminantObj.type = MathType::Determinant;
+    rowDeterminantObj.SetParts(L"1,2,0,0; 3,4,0,0", L"0,0,2,1; 0,0,1,3", L"");
+    run(Check(MathManager::Get().CalculateFormattedResult(rowDeterminantObj) == L" \uFF1D -10",
+              L"determinant accepts any square size as row text"));
+
+    const size_t tridiagonalSize = 100;
+    std::vector<std::vector<double>> tridiagonal(tridiagonalSize, std::vector<double>(tridiagonalSize, 0.0));
+    for (size_t row = 0; row < tridiagonalSize; ++row)
+    {
+        tridiagonal[row][row] = 2.0;
+        if (row > 0) tridiagonal[row][row - 1] = -1.0;
+        if (row + 1 < tridiagonalSize) tridiagonal[row][row + 1] = -1.0;
+    }
+    LUFactorization tridiagonalLU;
+    run(Check(tridiagonalLU.Factor(tridiagonal) && std::fabs(tridiagonalLU.Determinant() - 101.0) < 1e-9,
+              L"blocked LU determinant spans several panels"));
+
+    const size_t denseSize = 70;
+    std::vector<std::vector<double>> dense(denseSize, std::vector<double>(denseSize));
+    std::vector<double> denseRhs(denseSize, 0.0);
+    for (size_t row = 0; row < denseSize; ++row)
+    {
+        for (size_t col = 0; col < denseSize; ++col)
+        {
+            dense[row][col] = static_cast<double>((row * 7 + col * 3) % 11) - 5.0 + (row == col ? 20.0 : 0.0);
+            denseRhs[row] += dense[row][col] * static_cast<double>(col + 1);
+        }
+    }
+    LUFactorization denseLU;
+    std::vector<double> denseSolution;
+    std::vector<std::vector<double>> denseInverse;
+    bool denseSolved = denseLU.Factor(dense) && denseLU.Solve(denseRhs, denseSolution) && denseLU.Inverse(denseInverse);
+    for (size_t row = 0; denseSolved && row < denseSize; ++row)
+    {
+        double identity = 0.0;
+        for (size_t k = 0; k < denseSize; ++k)
+            identity += denseInverse[row][k] * dense[k][row];
+        denseSolved = std::fabs(denseSolution[row] - static_cast<double>(row + 1)) < 1e-9 && std::fabs(identity - 1.0) < 1e-9;
+    }
+    run(Check(denseSolved, L"LU solve and inverse reuse one factorization"));
+
+    MathObject matrixExpressionObj;
+    matrixExpressionObj.type = MathType::Sum;
+    matrixExpressionObj.SetParts(L"[1, 2; 3, 4]^2 + [0.5, 0; 0, 0.5]", L"", L"");
+    run(Check(MathManager::Get().CanCalculateResult(matrixExpressionObj) &&
+                  MathManager::Get().CalculateFormattedResult(matrixExpressionObj) == L" \uFF1D [7.5, 10; 15, 22.5]",
+              L"matrix expressions evaluate to matrices"));
+
+    const size_t productRows = 150;
+    const size_t productDepth = 300;
+    const size_t productColumns = 90;
+    Matrix productLeft(productRows, productDepth);
+    Matrix productRight(productDepth, productColumns);
+    for (size_t row = 0; row < productRows; ++row)
+        for (size_t k = 0; k < productDepth; ++k)
+            productLeft(row, k) = static_cast<double>((row * 5 + k * 3) % 17) - 8.0;
+    for (size_t k = 0; k < productDepth; ++k)
+        for (size_t column = 0; column < productColumns; ++column)
+            productRight(k, column) = static_cast<double>((k * 7 + column) % 13) - 6.0;
+    const Matrix product = Matrix::Multiply(productLeft, productRight);
+    bool productMatches = product.Rows() == productRows && product.Columns() == productColumns;
+    for (size_t row = 0; productMatches && row < productRows; ++row)
+    {
+        for (size_t column = 0; productMatches && column < productColumns; ++column)
+        {
+            double expected = 0.0;
+            for (size_t k = 0; k < productDepth; ++k)
+                expected += productLeft(row, k) * productRight(k, column);
+            productMatches = product(row, column) == expected;
+        }
+    }
+    run(Check(productMatches, L"blocked matrix product matches the naive sum"));
+
+    MathObject scaledProductObj;
+    scaledProductObj.type = MathType::Product;
+    scaledProductObj.SetParts(L"399", L"i=1", L"10^(200-i)");
+    run(CheckNear(MathManager::Get().CalculateValueResult(scaledProductObj).baseValue, 1.0,
+                  L"product survives intermediate overflow"));
+
+    MathObject signedProductObj;
+    signedProductObj.type = MathType::Product;
+    signedProductObj.SetParts(L"5", L"i=1", L"-i");
+    run(Check(MathManager::Get().CalculateFormattedResult(signedProductObj) == L" \uFF1D -120",
+              L"product tracks the sign"));
+
+    MathObject fractionDeterminantObj;
+    fractionDeterminantObj.type = MathType::Determinant;
+    fractionDeterminantObj.SetParts(L"1/3, 2; 3, 4/5", L"", L"");
+    run(Check(MathManager::Get().CalculateFormattedResult(fractionDeterminantObj) == L" \uFF1D -86/15",
+              L"determinant of fractions is exact"));
+
+    std::wstring hilbertText;
+    for (int row = 0; row < 8; ++row)
+    {
+        for (int col = 0; col < 8; ++col)
+            hilbertText += (col == 0 ? L"" : L", ") + std::wstring(L"1/") + std::to_wstring(row + col + 1);
+        hilbertText += row == 7 ? L"" : L"; ";
+    }
+    MathObject hilbertObj;
+    hilbertObj.type = MathType::Determinant;
+    hilbertObj.SetParts(hilbertText, L"", L"");
+    run(Check(MathManager::Get().CalculateFormattedResult(hilbertObj) == L" \uFF1D 1/365356847125734485878112256000000",
+              L"ill-conditioned determinant recombines exactly across primes"));
+
+    std::vector<std::wstring> largeEquations;
+    const size_t largeCount = 40;
+    for (size_t row = 0; row < largeCount; ++row)
+    {
+        std::wstring equation;
+        long long rightSide = 0;
+        for (size_t col = 0; col < largeCount; ++col)
+        {
+            const long long coefficient = static_cast<long long>((row * 13 + col * 7 + row * col) % 19) - 9 + (row == col ? 40 : 0);
+            rightSide += coefficient * static_cast<long long>(col + 1);
+            equation += (coefficient < 0 ? L"-" : L"+") + std::to_wstring(coefficient < 0 ? -coefficient : coefficient) +
+                        L"x_" + std::to_wstring(col);
+        }
+        largeEquations.push_back(equation + L"=" + std::to_wstring(rightSide) + L"/7");
+    }
+    const LinearSystemSolution largeSolution = MathEvaluator().SolveLinearSystemRational(largeEquations);
+    bool largeSolved = largeSolution.status == 0 && largeSolution.variables.size() == largeCount;
+    for (size_t col = 0; largeSolved && col < largeCount; ++col)
+    {
+        const std::wstring& name = largeSolution.variables[col];
+        largeSolved = largeSolution.constants[col] == Rational(std::stoll(name.substr(2)) + 1, 7);
+    }
+    run(Check(largeSolved, L"large square systems solve exactly by modular elimination"));
+
+    const CompiledExpression curve = CompiledExpression::Compile(L"x^3*sin(x)+exp(2x)/x", L"x");
+    const double at = 1.3;
+    const double expectedSlope = 3 * at * at * std::sin(at) + at * at * at * std::cos(at) +
+                                 std::exp(2 * at) * (2 * at - 1) / (at * at);
+    run(CheckNear(curve.Derivative().Evaluate(MathValue::Scalar(at)).baseValue, expectedSlope,
+                  L"symbolic derivative applies product, quotient and chain rules"));
+
+    MathObject nonlinearSystemObj;
+    nonlinearSystemObj.type = MathType::SystemOfEquations;
+    nonlinearSystemObj.SetParts(L"x^2=2", L"", L"");
+    run(Check(MathManager::Get().CalculateSystemResult(nonlinearSystemObj) == L" \uFF1D x=1.414214",
+              L"single nonlinear equation is solved numerically"));
+
+    MathObject reciprocalSystemObj;
+    reciprocalSystemObj.type = MathType::SystemOfEquations;
+    reciprocalSystemObj.SetParts(L"3/x = 1", L"", L"");
+    run(Check(MathManager::Get().CalculateSystemResult(reciprocalSystemObj) == L" \uFF1D x=3",
+              L"a pole between samples does not hide the root"));
+
+    MathObject shiftedPoleSystemObj;
+    shiftedPoleSystemObj.type = MathType::SystemOfEquations;
+    shiftedPoleSystemObj.SetParts(L"1/(x-1) = 2", L"", L"");
+    run(Check(MathManager::Get().CalculateSystemResult(shiftedPoleSystemObj) == L" \uFF1D x=1.5",
+              L"a root next to a pole is found past it"));
+
+    RootFindingReport rootReport;
+    const MathValue transcendentalRoot = MathManager::Get().CalculateEquationRoot(L"cos(t)=t", RootFindingOptions(), &rootReport);
+    run(Check(rootReport.converged && rootReport.bracketed && rootReport.iterations <= 8 &&
+                  std::fabs(transcendentalRoot.baseValue - 0.7390851332151607) < 1e-14,
+              L"bracketed Newton converges in a few iterations"));
+    run(Check(MathManager::Get().CalculateEquationRoot(L"x^2=-1").IsError(),
+              L"equations without a real root report failure"));
+
+    const IntervalValue integralBounds = MathManager::Get().CalculateIntervalResult(oscillatingIntegralObj);
+    run(Check(!integralBounds.IsError() && integralBounds.Contains(oscillatingIntegral.baseValue) &&
+                  integralBounds.upper - integralBounds.lower < 1e-2,
+              L"interval bounds enclose the integral"));
+
+    MathObject reciprocalSumObj;
+    reciprocalSumObj.type = MathType::Summation;
+    reciprocalSumObj.SetParts(L"10", L"n=1", L"1/n");
+    const IntervalValue harmonicBounds = MathManager::Get().CalculateIntervalResult(reciprocalSumObj);
+    run(Check(!harmonicBounds.IsError() && harmonicBounds.Contains(7381.0 / 2520.0) &&
+                  harmonicBounds.lower < harmonicBounds.upper && harmonicBounds.upper - harmonicBounds.lower < 1e-12,
+              L"interval bounds enclose a sum of inexact terms"));
+
+    RootFindingReport tangentReport;
+    const MathValue tangentRoot = MathManager::Get().CalculateEquationRoot(L"(x-0.3)^2=0", RootFindingOptions(), &tangentReport);
+    run(Check(!tangentReport.bracketed && std::fabs(tangentRoot.baseValue - 0.3) < 1e-7,
+              L"interval search finds a root without a sign change"));
+
+    // One compiled program and the const manager calculations serve many
+    // threads at once.
+    const CompiledExpression sharedProgram = CompiledExpression::Compile(L"sin(x)^2 + cos(x)^2 + x", L"x");
+    std::vector<double> sharedValues(2048);
+    std::atomic<bool> sharedResultsMatch{ true };
+    TaskPool::Shared().ParallelFor(sharedValues.size(), 64, [&](size_t begin, size_t end) {
+        const MathEvaluator localEval;
+        for (size_t index = begin; index < end; ++index)
+            sharedValues[index] = sharedProgram.Evaluate(MathValue::Scalar((double)index)).baseValue;
+        if (MathManager::Get().CalculateFormattedResult(unitSumObj) != L" \uFF1D 3.4 m" ||
+            localEval.EvalValue(L"2 km / 4 s").baseValue != 500.0)
+            sharedResultsMatch = false;
+    });
+    bool sharedValuesMatch = sharedResultsMatch;
+    for (size_t index = 0; index < sharedValues.size(); ++index)
+        sharedValuesMatch = sharedValuesMatch && std::fabs(sharedValues[index] - (1.0 + (double)index)) < 1e-9;
+    run(Check(sharedValuesMatch, L"evaluation is reentrant across threads"));
+
+    // Evaluation service: resubmitting a key cancels the job before it, only
+    // the newest job of a key publishes, and budgets bound a job's run.
+    {
+        EvaluationService service(2);
+        std::atomic<bool> staleStarted{ false };
+        service.Submit(7, [&](const CancellationToken& token, EvaluationService::Clock::time_point, const EvaluationService::Publish& publish) {
+            staleStarted = true;
+            while (!token.IsCancelled())
+                std::this_thread::yield();
+            publish(L"stale");
+            return std::wstring(L"stale");
+        }, std::chrono::milliseconds(5000));
+        while (!staleStarted)
+            std::this_thread::yield();
+        service.Submit(7, [](const CancellationToken&, EvaluationService::Clock::time_point, const EvaluationService::Publish& publish) {
+            publish(L"half");
+            return std::wstring(L"done");
+        }, std::chrono::milliseconds(5000));
+        service.Submit(8, [](const CancellationToken& token, EvaluationService::Clock::time_point deadline, const EvaluationService::Publish&) {
+            while (!token.IsCancelled() && EvaluationService::Clock::now() < deadline)
+                std::this_thread::yield();
+            return std::wstring(L"out of time");
+        }, std::chrono::milliseconds(20));
+        const bool idle = service.WaitIdle(std::chrono::milliseconds(5000));
+
+        std::wstring published[9];
+        for (const EvaluationService::Update& update : service.Poll())
+            published[update.key] += update.text + (update.final ? L"!" : L" ");
+        run(Check(idle && published[7] == L"half done!" && published[8] == L"out of time!",
+                  L"evaluation service publishes only the newest job per key"));
+
+        // A finished job's text that was never polled goes with it.
+        service.Submit(7, [](const CancellationToken&, EvaluationService::Clock::time_point, const EvaluationService::Publish&) {
+            return std::wstring(L"old");
+        }, std::chrono::milliseconds(5000));
+        service.WaitIdle(std::chrono::milliseconds(5000));
+        service.Submit(7, [](const CancellationToken&, EvaluationService::Clock::time_point, const EvaluationService::Publish&) {
+            return std::wstring(L"new");
+        }, std::chrono::milliseconds(5000));
+        service.WaitIdle(std::chrono::milliseconds(5000));
+        const std::vector<EvaluationService::Update> resubmitted = service.Poll();
+        run(Check(resubmitted.size() == 1 && resubmitted[0].text == L"new",
+                  L"resubmitting a key discards the old job's unpolled text"));
+    }
+
+    MathObject longSumObj;
+    longSumObj.type = MathType::Summation;
+    longSumObj.SetParts(L"10000000", L"i=1", L"sin(i)");
+    const std::wstring longSum = MathManager::Get().CalculateFormattedResult(longSumObj);
+    std::vector<double> progressFractions;
+    std::wstring progressText;
+    EvaluationControl watchedControl;
+    watchedControl.progress = [&](double fraction, const MathValue& partial) {
+        progressFractions.push_back(fraction);
+        progressText = MathManager::Get().FormatProgressResult(partial, fraction);
+    };
+    const std::wstring watchedSum = MathManager::Get().CalculateFormattedResult(longSumObj, &watchedControl);
+    run(Check(watchedSum == longSum && !progressFractions.empty() &&
+                  std::is_sorted(progressFractions.begin(), progressFractions.end()) && progressFractions.back() < 1.0 &&
+                  progressText.find(L"\u2248 ") == 1 && progressText.back() == L')',
+              L"long sums report progress without changing the result"));
+
+    EvaluationControl cancelledControl;
+    cancelledControl.progress = [&](double, const MathValue&) { cancelledControl.token.Cancel(); };
+    run(Check(MathManager::Get().CalculateFormattedResult(longSumObj, &cancelledControl) == L" \uFF1D cancelled",
+              L"cancelled sums stop early"));
+
+    // Worksheet: a := 2, b := 3a, c := b + 1, b/4 and an unrelated 5+5,
+    // every result shown.
+    MathManager& worksheet = MathManager::Get();
+    worksheet.Clear();
+    const wchar_t* worksheetTexts[] = { L"a := 2", L"b := 3a", L"c := b + 1", L"", L"5+5" };
+    for (const wchar_t* text : worksheetTexts)
+    {
+        MathObject cell;
+        cell.type = MathType::Sum;
+        cell.SetParts(text, L"", L"");
+        cell.resultText = L" \uFF1D";
+        worksheet.GetObjects().push_back(cell);
+    }
+    worksheet.GetObjects()[3].type = MathType::Fraction;
+    worksheet.GetObjects()[3].SetParts(L"b", L"4", L"");
+    worksheet.RecalculateDependents(0);
+    run(Check(worksheet.GetObjects()[2].resultText == L" \uFF1D 7" && worksheet.GetObjects()[3].resultText == L" \uFF1D 1.5",
+              L"objects read document variables"));
+
+    worksheet.GetObjects()[0].SetParts(L"a := 5", L"", L"");
+    const std::vector<size_t> recalculated = worksheet.RecalculateDependents(0);
+    run(Check(recalculated.size() == 4 && recalculated[0] == 0 && recalculated[1] == 1 &&
+                  std::find(recalculated.begin(), recalculated.end(), 4) == recalculated.end() &&
+                  worksheet.GetObjects()[2].resultText == L" \uFF1D 16" && worksheet.GetObjects()[3].resultText == L" \uFF1D 3.75",
+              L"only downstream objects recalculate, in dependency order"));
+
+    MathObject dependentSum;
+    dependentSum.type = MathType::Summation;
+    dependentSum.SetParts(L"b", L"i=1", L"i");
+    dependentSum.resultText = L" \uFF1D 120";
+    worksheet.GetObjects().push_back(dependentSum);
+    worksheet.GetObjects()[0].SetParts(L"a := 1", L"", L"");
+    std::vector<size_t> background;
+    const std::vector<size_t> foreground = worksheet.RecalculateDependents(0, &background);
+    run(Check(background == std::vector<size_t>{ 5 }, L"dependent sums are handed back for background calculation"));
+    run(Check(std::find(foreground.begin(), foreground.end(), 5) == foreground.end() &&
+                  worksheet.GetObjects()[5].resultText == L" \uFF1D 120",
+              L"dependent sums are not calculated on the calling thread"));
+
+    worksheet.GetObjects()[0].SetParts(L"a := c", L"", L"");
+    worksheet.RecalculateDependents(0);
+    run(Check(worksheet.GetObjects()[0].resultText == L" \uFF1D circular definition" &&
+                  worksheet.GetObjects()[3].resultText == L" \uFF1D circular definition",
+              L"cyclic definitions are reported"));
+    worksheet.Clear();
+
     std::wcout << L"\n=== Summary ===" << std::endl;
     std::wcout << L"Passed: " << passed << std::endl;
     std::wcout << L"Failed: " << failed << std::endl;